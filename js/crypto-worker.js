@@ -17,102 +17,416 @@ try {
 let wasmApi = null;
 
 /**
- * 使用 WASM (stb_image) 解码图像数据。
+ * 用 decode_image 解码: stb_image 用 malloc 分配输出，像素同样留在 WASM 内存中，返回值与 decodeImageIntoWasm 相同。
  * @param {object} wasmApi - 已初始化的 WASM API 对象。
- * @param {ArrayBuffer} fileBuffer - 包含原始图像文件（PNG, JPG, BMP等）的 ArrayBuffer。
- * @returns {{width: number, height: number, data: Uint8Array}} 解码后的 RGBA 像素数据。
+ * @param {ArrayBuffer} fileBuffer - 原始图像文件。
+ * @returns {{width: number, height: number, ptr: number, size: number, originalWidth: number, originalHeight: number}}
+ *     调用方负责 _free(ptr)。
  */
 function decodeImageWasm(wasmApi, fileBuffer) {
     console.log("使用 WASM 解码图像...");
     const {Module, decode_image, _free} = wasmApi;
-    let imagePtr = 0, widthPtr = 0, heightPtr = 0, decodedPtr = 0;
+    let imagePtr = 0, widthPtr = 0, heightPtr = 0;
 
     try {
-        // 1. 在 WASM 内存中为输入图像数据分配空间
         const imageSize = fileBuffer.byteLength;
         imagePtr = Module._malloc(imageSize);
-        if (!imagePtr) throw new Error("WASM _malloc 失败：无法为输入图像分配内存。");
-
-        // 2. 将 JS 的 ArrayBuffer 数据复制到 WASM 内存中
-        Module.HEAPU8.set(new Uint8Array(fileBuffer), imagePtr);
-
-        // 3. 为输出参数（宽度和高度）分配内存
         widthPtr = Module._malloc(4); // int
         heightPtr = Module._malloc(4); // int
-        if (!widthPtr || !heightPtr) throw new Error("WASM _malloc 失败：无法为维度指针分配内存。");
+        if (!imagePtr || !widthPtr || !heightPtr) throw new Error("WASM _malloc 失败：无法为输入图像分配内存。");
+        Module.HEAPU8.set(new Uint8Array(fileBuffer), imagePtr);
 
-        // 4. 调用 C 函数进行解码
-        decodedPtr = decode_image(imagePtr, imageSize, widthPtr, heightPtr);
-        if (!decodedPtr) {
+        const pixelsPtr = decode_image(imagePtr, imageSize, widthPtr, heightPtr);
+        if (!pixelsPtr) {
             throw new Error("图像解码失败。WASM 函数返回空指针，可能是不支持的格式或文件已损坏。");
         }
-
-        // 5. 从 WASM 内存中读回解码后的宽度和高度
         const width = Module.getValue(widthPtr, 'i32');
         const height = Module.getValue(heightPtr, 'i32');
-        if (width === 0 || height === 0) throw new Error("WASM 解码返回无效的尺寸。");
 
-        // 6. 将解码后的像素数据从 WASM 内存复制到 JS 内存
-        // 至关重要：使用 .slice() 创建一个副本，因为我们马上要释放 WASM 内存。
-        const decodedSize = width * height * 4; // RGBA
-        const pixels = new Uint8Array(Module.HEAPU8.buffer, decodedPtr, decodedSize).slice();
+        console.log(`WASM 解码成功: ${width}x${height}`);
+        return {width, height, ptr: pixelsPtr, size: width * height * CHANNELS, originalWidth: width, originalHeight: height};
+
+    } finally {
+        if (imagePtr) _free(imagePtr);
+        if (widthPtr) _free(widthPtr);
+        if (heightPtr) _free(heightPtr);
+    }
+}
+
+/**
+ * 解码图像到 WASM 内存中由我们持有的缓冲区: 先用 probe_image 读文件头得到尺寸，
+ * 分配 width * height * 4 字节，再让 decode_image_into 把像素解码进去。
+ * 像素不再复制到 JS 再复制回 WASM，加密/解密内核和编码器直接使用这块内存。
+ * 模块没有这两个导出时改用 decode_image (由它分配输出，总是按原尺寸解码)。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {ArrayBuffer} fileBuffer - 原始图像文件。
+ * @param {number|function(number, number): number} [scaleDenom=1] - JPEG 缩小解码倍数
+ *     (2、4、8 时在 DCT 域直接解出缩小的图像，其他格式不受影响)；也可以是按原图宽高选择倍数的函数。
+ * @returns {{width: number, height: number, ptr: number, size: number, originalWidth: number, originalHeight: number}}
+ *     调用方负责 _free(ptr)。缩小解码时 width/height 是解出的尺寸，originalWidth/originalHeight 是原图尺寸。
+ */
+function decodeImageIntoWasm(wasmApi, fileBuffer, scaleDenom = 1) {
+    if (!wasmApi.probe_image || !wasmApi.decode_image_into) return decodeImageWasm(wasmApi, fileBuffer);
+    console.log("使用 WASM 解码图像 (直接写入 WASM 缓冲区)...");
+    const {Module, probe_image, decode_image_into, _free} = wasmApi;
+    let imagePtr = 0, widthPtr = 0, heightPtr = 0, pixelsPtr = 0;
+
+    try {
+        const imageSize = fileBuffer.byteLength;
+        imagePtr = Module._malloc(imageSize);
+        widthPtr = Module._malloc(4); // int
+        heightPtr = Module._malloc(4); // int
+        if (!imagePtr || !widthPtr || !heightPtr) throw new Error("WASM _malloc 失败：无法为输入图像分配内存。");
+        Module.HEAPU8.set(new Uint8Array(fileBuffer), imagePtr);
+
+        if (!probe_image(imagePtr, imageSize, widthPtr, heightPtr, 1)) {
+            throw new Error("无法识别图像文件头，可能是不支持的格式或文件已损坏。");
+        }
+        const originalWidth = Module.getValue(widthPtr, 'i32');
+        const originalHeight = Module.getValue(heightPtr, 'i32');
+        if (typeof scaleDenom === 'function') scaleDenom = scaleDenom(originalWidth, originalHeight);
+        let width = originalWidth, height = originalHeight;
+        if (scaleDenom > 1 && probe_image(imagePtr, imageSize, widthPtr, heightPtr, scaleDenom)) {
+            width = Module.getValue(widthPtr, 'i32');
+            height = Module.getValue(heightPtr, 'i32');
+        }
+        const size = width * height * CHANNELS;
+
+        pixelsPtr = Module._malloc(size);
+        if (!pixelsPtr) throw new Error(`WASM _malloc 失败：无法为 ${width}x${height} 的图像分配内存。`);
+        if (!decode_image_into(imagePtr, imageSize, pixelsPtr, width, height, scaleDenom)) {
+            throw new Error("图像解码失败，文件可能已损坏。");
+        }
 
         console.log(`WASM 解码成功: ${width}x${height}`);
-        return {width, height, data: pixels};
+        const image = {width, height, ptr: pixelsPtr, size, originalWidth, originalHeight};
+        pixelsPtr = 0; // 所有权交给调用方
+        return image;
 
     } finally {
-        // 7. 释放所有在 WASM 中分配的内存，防止内存泄漏
         if (imagePtr) _free(imagePtr);
         if (widthPtr) _free(widthPtr);
         if (heightPtr) _free(heightPtr);
-        if (decodedPtr) _free(decodedPtr); // stb_image 使用 malloc，所以必须释放
+        if (pixelsPtr) _free(pixelsPtr);
     }
 }
 
+// 探测文件头时读取的字节数: 足够越过 JPEG 常见的 EXIF/ICC 段找到 SOF
+const PROBE_HEADER_BYTES = 256 * 1024;
+// probe_image_header_wasm 给出的格式代码 (与 image_codecs_wasm.c 的 IMAGE_FORMAT_* 顺序一致)
+const IMAGE_FORMATS = ['unknown', 'png', 'jpeg', 'qoi', 'bmp', 'pnm', 'tiles'];
+
 /**
- * 使用 WASM (stb_image_write) 将 RGBA 像素数据编码为 PNG 文件。
+ * 只读文件开头的一段，解析出尺寸、通道数和格式，不解码像素。
+ * 主线程据此在派发前估算任务的内存和耗时。
  * @param {object} wasmApi - 已初始化的 WASM API 对象。
- * @param {Uint8Array} pixels - 原始 RGBA 像素数据。
+ * @param {File} file - 待探测的文件。
+ * @returns {Promise<{width: number, height: number, channels: number, format: string}|null>}
+ *     探测不认识的格式 (GIF、TGA 等只在解码时由 stb 识别)、读取失败或模块没有探测导出时为 null。
+ */
+async function probeFileHeader(wasmApi, file) {
+    const {Module, probe_image_header, _free} = wasmApi;
+    // 旧模块不能只解析文件头，主线程按文件大小估算
+    if (!probe_image_header) return null;
+    let header;
+    try {
+        header = new Uint8Array(await file.slice(0, PROBE_HEADER_BYTES).arrayBuffer());
+    } catch (e) {
+        return null;
+    }
+    const headerPtr = Module._malloc(header.length);
+    const outPtr = Module._malloc(4 * 4);
+    try {
+        if (!headerPtr || !outPtr) return null;
+        Module.HEAPU8.set(header, headerPtr);
+        if (!probe_image_header(headerPtr, header.length, outPtr)) return null;
+        const [width, height, channels, format] = Module.HEAPU32.subarray(outPtr / 4, outPtr / 4 + 4);
+        return {width, height, channels, format: IMAGE_FORMATS[format]};
+    } finally {
+        if (headerPtr) _free(headerPtr);
+        if (outPtr) _free(outPtr);
+    }
+}
+
+// png_stream_feed_wasm 的返回值 (见 png_stream.h)
+const PNG_STREAM = {NEED_MORE: 0, HEADER: 1, DONE: 2};
+
+// 按文件头的 8 字节签名判断是否为 PNG
+function isPngHeader(header) {
+    const signature = [0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A];
+    return header.length >= 8 && signature.every((byte, i) => header[i] === byte);
+}
+
+/**
+ * 边读文件边解码 PNG: 从 Blob 的流中每读到一段就喂给 WASM 里的流式解码器，
+ * 读到 IHDR 后分配像素缓冲区，之后每凑齐一行就去滤波写入。文件读取与解码重叠，
+ * WASM 内存中只保留当前这一段输入和尚未解压的数据，不需要整个文件大小的缓冲区。
+ * 解码与解密合并: 第一行是带种子的元数据行时，内容行解出一行就按置换表写到原图中的位置
+ * (见 image_codecs_wasm.c 的 StreamDecrypt)，核对 magic 行后直接得到解密结果。
+ * 模块没有流式解密导出时只解码，加密容器由调用方照常解密。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {Blob} file - PNG 文件。
+ * @returns {Promise<{width: number, height: number, ptr: number, size: number, decrypted: boolean}|null>}
+ *          decrypted 为 true 时像素已是解密后的原图。
+ *          隔行扫描等不支持的文件或解码失败时返回 null，由调用方改用整体解码 (并给出相应的错误)。
+ */
+async function decodePngStreamIntoWasm(wasmApi, file) {
+    const {
+        Module, png_stream_create, png_stream_feed, png_stream_info, png_stream_set_output, png_stream_free, _free,
+        png_stream_decrypt_begin, png_stream_decrypt_result, png_stream_decrypt_free
+    } = wasmApi;
+    const stream = png_stream_create();
+    if (!stream) throw new Error("WASM _malloc 失败：无法创建 PNG 流式解码器。");
+
+    const reader = file.stream().getReader();
+    let inputPtr = 0, inputCapacity = 0, infoPtr = 0, pixelsPtr = 0, headerRowsPtr = 0, decrypt = 0;
+    let width = 0, height = 0, status = PNG_STREAM.NEED_MORE;
+
+    try {
+        infoPtr = Module._malloc(8); // int width, int height
+        if (!infoPtr) throw new Error("WASM _malloc 失败：无法为图像尺寸分配内存。");
+
+        while (status === PNG_STREAM.NEED_MORE) {
+            const {done, value} = await reader.read();
+            if (done) break;
+
+            // 输入缓冲区按最大的一段分配，各段复用
+            if (value.length > inputCapacity) {
+                if (inputPtr) _free(inputPtr);
+                inputPtr = Module._malloc(value.length);
+                inputCapacity = inputPtr ? value.length : 0;
+                if (!inputPtr) throw new Error("WASM _malloc 失败：无法为输入数据分配内存。");
+            }
+            Module.HEAPU8.set(value, inputPtr);
+            status = png_stream_feed(stream, inputPtr, value.length);
+
+            if (status === PNG_STREAM.HEADER) {
+                png_stream_info(stream, infoPtr, infoPtr + 4);
+                width = Module.getValue(infoPtr, 'i32');
+                height = Module.getValue(infoPtr + 4, 'i32');
+                pixelsPtr = Module._malloc(width * height * CHANNELS);
+                if (!pixelsPtr) throw new Error(`WASM _malloc 失败：无法为 ${width}x${height} 的图像分配内存。`);
+                if (png_stream_decrypt_begin) {
+                    headerRowsPtr = Module._malloc(width * CHANNELS * 2);
+                    decrypt = headerRowsPtr ? png_stream_decrypt_begin(stream, pixelsPtr, headerRowsPtr) : 0;
+                    if (!decrypt) throw new Error("WASM _malloc 失败：无法为流式解密分配内存。");
+                } else {
+                    png_stream_set_output(stream, pixelsPtr);
+                }
+                // 这一段里 IHDR 之后的数据已经缓冲在解码器中，先处理掉
+                status = png_stream_feed(stream, 0, 0);
+            }
+        }
+
+        if (status !== PNG_STREAM.DONE) {
+            console.log(`PNG 流式解码未完成 (状态 ${status})，改用整体解码。`);
+            return null;
+        }
+        let decrypted = false;
+        if (decrypt && png_stream_decrypt_result(decrypt)) {
+            // 第一行像元数据行，还要确认最后一行是 magic 行
+            const headerRows = Module.HEAPU8.subarray(headerRowsPtr, headerRowsPtr + width * CHANNELS * 2);
+            if (!isEncrypted(headerRows, width, 2)) {
+                console.log("首行类似元数据行但没有 magic 行，改用整体解码。");
+                return null;
+            }
+            decrypted = true;
+            height -= 2;
+            console.log(`WASM 流式解码并解密成功: ${width}x${height}`);
+        } else {
+            console.log(`WASM 流式解码成功: ${width}x${height}`);
+        }
+        const image = {width, height, ptr: pixelsPtr, size: width * height * CHANNELS, decrypted};
+        pixelsPtr = 0; // 所有权交给调用方
+        return image;
+
+    } finally {
+        // 提前结束 (IEND 之后的数据、出错) 时取消读取
+        reader.cancel().catch(() => {});
+        png_stream_free(stream);
+        if (decrypt) png_stream_decrypt_free(decrypt);
+        if (inputPtr) _free(inputPtr);
+        if (infoPtr) _free(infoPtr);
+        if (pixelsPtr) _free(pixelsPtr);
+        if (headerRowsPtr) _free(headerRowsPtr);
+    }
+}
+
+/**
+ * 取 WASM 内存中像素的视图。WASM 内存增长后旧视图会失效，
+ * 所以每次 _malloc 之后都要重新调用，不能长期持有。
+ */
+function heapPixels(wasmApi, image) {
+    return new Uint8Array(wasmApi.Module.HEAPU8.buffer, image.ptr, image.size);
+}
+
+/**
+ * 使用 WASM 将 WASM 内存中的 RGBA 像素编码为无损容器文件 (PNG 或 QOI)。
+ * QOI 编码快一个数量级但浏览器无法显示，只用于两端都是本工具的场景。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {number} pixelsPtr - WASM 内存中的 RGBA 像素。
  * @param {number} width - 图像宽度。
  * @param {number} height - 图像高度。
- * @returns {ArrayBuffer} 包含最终 PNG 文件数据的 ArrayBuffer。
+ * @param {string} [format='png'] - 容器格式 ('png' 或 'qoi')。
+ * @returns {Blob} 编码后的文件。
  */
-function encodePngWasm(wasmApi, pixels, width, height) {
-    console.log("使用 WASM 编码 PNG...");
-    const {Module, encode_png, _free} = wasmApi;
-    let pixelsPtr = 0, sizePtr = 0, resultPtr = 0;
+function encodeLosslessWasm(wasmApi, pixelsPtr, width, height, format = 'png') {
+    const formatName = format.toUpperCase();
+    console.log(`使用 WASM 编码 ${formatName}...`);
+    const {Module, _free} = wasmApi;
+    const encode = format === 'qoi' ? wasmApi.encode_qoi : wasmApi.encode_png;
+    if (!encode) throw new Error(`当前的 WASM 模块不支持 ${formatName} 编码，请重新构建 (wasm/build.sh)。`);
+    let sizePtr = 0;
+
+    if (format === 'png' && wasmApi.choose_png_level) {
+        applyEncodeBudget(wasmApi, (timeMs, bytes) => wasmApi.choose_png_level(pixelsPtr, width, height, timeMs, bytes));
+    }
 
     try {
-        // 1. 在 WASM 内存中为输入像素数据分配空间并复制
-        pixelsPtr = Module._malloc(pixels.length);
-        if (!pixelsPtr) throw new Error("WASM _malloc 失败：无法为像素缓冲区分配内存。");
-        Module.HEAPU8.set(pixels, pixelsPtr);
+        // 1. 为输出参数（编码后文件大小）分配内存
+        sizePtr = Module._malloc(4); // size_t
+        if (!sizePtr) throw new Error("WASM _malloc 失败：无法为大小指针分配内存。");
 
-        // 2. 为输出参数（PNG 文件大小）分配内存
+        // 2. 调用 C 函数进行编码，结果是 WASM 内存中的分块输出
+        const outputPtr = encode(pixelsPtr, width, height, sizePtr);
+        if (!outputPtr) {
+            throw new Error(`${formatName} 编码失败。WASM 函数返回空指针。`);
+        }
+
+        // 3. 逐块读出并释放 (旧模块的 encode_png 返回整个文件，大小写在 sizePtr 中)
+        const blob = wasmApi.output_read
+            ? readChunkedOutput(wasmApi, outputPtr, LOSSLESS_MIME_TYPES[format])
+            : readWholeOutput(wasmApi, outputPtr, Module.getValue(sizePtr, 'i32'), LOSSLESS_MIME_TYPES[format]);
+        console.log(`WASM 编码成功，大小: ${blob.size} 字节`);
+        return blob;
+
+    } finally {
+        // 4. 释放所有在 WASM 中分配的内存
+        if (sizePtr) _free(sizePtr);
+    }
+}
+
+/**
+ * 把编码器返回的分块输出读成 Blob，然后释放 WASM 中的块。
+ * 每次只复制一个块 (256KB)，不需要整个文件大小的连续缓冲区。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {number} outputPtr - encode_* 返回的 ChunkedOutput 指针。
+ * @param {string} mimeType - Blob 的 MIME 类型。
+ * @returns {Blob} 编码后的文件。
+ */
+function readChunkedOutput(wasmApi, outputPtr, mimeType) {
+    const {Module, output_read, output_free, _free} = wasmApi;
+    const sizePtr = Module._malloc(4);
+    try {
+        if (!sizePtr) throw new Error("WASM _malloc 失败：无法为大小指针分配内存。");
+        const parts = [];
+        for (let dataPtr; (dataPtr = output_read(outputPtr, sizePtr));) {
+            // Blob 不接受 SharedArrayBuffer 上的视图 (多线程构建)，所以先复制出块
+            parts.push(Module.HEAPU8.slice(dataPtr, dataPtr + Module.getValue(sizePtr, 'i32')));
+        }
+        return new Blob(parts, {type: mimeType});
+    } finally {
+        if (sizePtr) _free(sizePtr);
+        output_free(outputPtr);
+    }
+}
+
+/**
+ * 把编码器一次分配的整个输出读成 Blob，然后释放 (没有分块输出导出的旧模块)。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {number} outputPtr - 编码结果。
+ * @param {number} size - 编码结果的字节数。
+ * @param {string} mimeType - Blob 的 MIME 类型。
+ * @returns {Blob} 编码后的文件。
+ */
+function readWholeOutput(wasmApi, outputPtr, size, mimeType) {
+    try {
+        return new Blob([wasmApi.Module.HEAPU8.slice(outputPtr, outputPtr + size)], {type: mimeType});
+    } finally {
+        wasmApi._free(outputPtr);
+    }
+}
+
+/**
+ * 使用 WASM (stb_image_write) 将 WASM 内存中的 RGBA 像素编码为 JPEG 文件。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {number} pixelsPtr - WASM 内存中的 RGBA 像素 (alpha 被忽略)。
+ * @param {number} width - 图像宽度。
+ * @param {number} height - 图像高度。
+ * @param {number} quality - JPEG 质量 (1-100)。
+ * @returns {Blob} JPEG 文件。
+ */
+function encodeJpegWasm(wasmApi, pixelsPtr, width, height, quality) {
+    console.log(`使用 WASM 编码 JPEG (质量 ${quality})...`);
+    const {Module, encode_jpeg, _free} = wasmApi;
+    if (!encode_jpeg) throw new Error("当前的 WASM 模块不支持 JPEG 编码，请重新构建 (wasm/build.sh)。");
+    let sizePtr = 0;
+
+    try {
         sizePtr = Module._malloc(4); // size_t
         if (!sizePtr) throw new Error("WASM _malloc 失败：无法为大小指针分配内存。");
 
-        // 3. 调用 C 函数进行编码
-        resultPtr = encode_png(pixelsPtr, width, height, sizePtr);
-        if (!resultPtr) {
-            throw new Error("PNG 编码失败。WASM 函数返回空指针。");
+        const outputPtr = encode_jpeg(pixelsPtr, width, height, quality, sizePtr);
+        if (!outputPtr) {
+            throw new Error("JPEG 编码失败。WASM 函数返回空指针。");
         }
 
-        // 4. 从 WASM 内存中读回编码后的文件大小
-        const resultSize = Module.getValue(sizePtr, 'i32');
+        const blob = readChunkedOutput(wasmApi, outputPtr, 'image/jpeg');
+        console.log(`WASM 编码成功，大小: ${blob.size} 字节`);
+        return blob;
+
+    } finally {
+        if (sizePtr) _free(sizePtr);
+    }
+}
+
+/**
+ * JPEG 压缩域打乱/还原: 重排量化 DCT 系数并重新熵编码，不经过像素，输出仍是 JPEG。
+ * 带 JSHUF 标记的 JPEG 总是在压缩域还原；普通 JPEG 只在 outputFormat 为 'jpeg' 时打乱。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {ArrayBuffer} fileBuffer - 原始文件数据。
+ * @param {string} outputFormat - 加密输出格式 ('png' 或 'jpeg')。
+ * @returns {{buffer: ArrayBuffer, decrypted: boolean}|null} 不适用时 (非 JPEG、图片太小、模块没有压缩域导出等)
+ *     返回 null，改走像素路径。
+ */
+function shuffleJpegWasm(wasmApi, fileBuffer, outputFormat) {
+    const bytes = new Uint8Array(fileBuffer);
+    if (bytes.length < 4 || bytes[0] !== 0xFF || bytes[1] !== 0xD8) return null;
 
-        // 5. 将编码后的 PNG 数据从 WASM 内存复制到 JS 的 ArrayBuffer
-        // 同样，使用 .slice().buffer 创建一个独立的副本。
-        const resultBuffer = new Uint8Array(Module.HEAPU8.buffer, resultPtr, resultSize).slice().buffer;
+    const {Module, jpeg_is_tile_shuffled, jpeg_tile_shuffle, jpeg_tile_unshuffle, _free} = wasmApi;
+    if (!jpeg_is_tile_shuffled) return null;
+    let inputPtr = 0, sizePtr = 0, resultPtr = 0;
 
-        console.log(`WASM 编码成功，大小: ${resultSize} 字节`);
-        return resultBuffer;
+    try {
+        inputPtr = Module._malloc(bytes.length);
+        sizePtr = Module._malloc(4); // size_t
+        if (!inputPtr || !sizePtr) throw new Error("WASM _malloc 失败：无法为 JPEG 数据分配内存。");
+        Module.HEAPU8.set(bytes, inputPtr);
+
+        const decrypted = jpeg_is_tile_shuffled(inputPtr, bytes.length) !== 0;
+        if (decrypted) {
+            console.log("JPEG 压缩域还原...");
+            resultPtr = jpeg_tile_unshuffle(inputPtr, bytes.length, sizePtr);
+            if (!resultPtr) throw new Error("JPEG 压缩域还原失败，文件可能已损坏。");
+        } else {
+            // 有损 JPEG 容器要在像素路径上解密，不能当作普通 JPEG 再打乱一次
+            if (outputFormat !== 'jpeg' || isLossyJpegContainer(wasmApi, fileBuffer)) return null;
+            console.log("JPEG 压缩域打乱...");
+            const seed = crypto.getRandomValues(new Uint32Array(2));
+            resultPtr = jpeg_tile_shuffle(inputPtr, bytes.length, seed[0], seed[1], sizePtr);
+            // 尺寸不足一个分块或采样因子不支持时，交给像素路径处理 (并给出相应的错误提示)
+            if (!resultPtr) return null;
+        }
+
+        const resultSize = Module.getValue(sizePtr, 'i32');
+        const buffer = new Uint8Array(Module.HEAPU8.buffer, resultPtr, resultSize).slice().buffer;
+        console.log(`JPEG 压缩域处理完成，大小: ${bytes.length} -> ${resultSize} 字节`);
+        return {buffer, decrypted};
 
     } finally {
-        // 6. 释放所有在 WASM 中分配的内存
-        if (pixelsPtr) _free(pixelsPtr);
+        if (inputPtr) _free(inputPtr);
         if (sizePtr) _free(sizePtr);
-        if (resultPtr) _free(resultPtr); // 我们的 C 代码分配了此内存，必须释放
+        if (resultPtr) _free(resultPtr);
     }
 }
 
@@ -124,7 +438,34 @@ const MAGIC_PIXEL_PATTERN = [
 ];
 const CHANNELS = 4;
 
-function generateMagicRow(width) {
+// 容器头部 (元数据行和 magic 行) 的每个字节写成一个不透明灰度像素 (v, v, v, 255)。
+// 这样头部不会妨碍 PNG 编码器把整张图缩减为 RGB 或灰度: 不透明的照片仍可写成 RGB，
+// 灰度图仍可写成单通道，解码回 RGBA 后头部逐字节不变。
+// 旧容器的头部直接把字节写进 RGBA 四个通道，magic 行的 alpha 不是 255，据此区分。
+
+// 把 bytes 写成一行灰度像素，超出 bytes 长度的像素写成不透明黑色
+function writeGrayBytes(row, bytes) {
+    for (let j = 0; j * CHANNELS < row.length; j++) {
+        const v = j < bytes.length ? bytes[j] : 0;
+        const offset = j * CHANNELS;
+        row[offset] = row[offset + 1] = row[offset + 2] = v;
+        row[offset + 3] = 255;
+    }
+}
+
+// 从灰度像素行读回前 length 个字节
+function readGrayBytes(row, length) {
+    const bytes = new Uint8Array(length);
+    for (let j = 0; j < length; j++) bytes[j] = row[j * CHANNELS];
+    return bytes;
+}
+
+// 判断容器头部是否为灰度布局 (看 magic 行第一个像素的 alpha)
+function hasGrayHeader(pixelData, width, height) {
+    return pixelData[(height - 1) * width * CHANNELS + 3] === 255;
+}
+
+function generateMagicRow(width, grayHeader = true) {
     const magicRow = new Uint8Array(width * CHANNELS);
     for (let j = 0; j < width; j++) {
         const patternPixel = MAGIC_PIXEL_PATTERN[j % MAGIC_PIXEL_PATTERN.length];
@@ -134,6 +475,8 @@ function generateMagicRow(width) {
         magicRow[offset + 2] = patternPixel.b;
         magicRow[offset + 3] = patternPixel.a;
     }
+    // 灰度布局: 把同一串字节逐个写成灰度像素
+    if (grayHeader) writeGrayBytes(magicRow, magicRow.slice());
     return magicRow;
 }
 
@@ -162,18 +505,64 @@ function areBuffersEqual(view1, view2) {
 
 function isEncrypted(pixelData, width, height) {
     if (height < 2) return false;
-    const expectedMagicRow = generateMagicRow(width);
+    const expectedMagicRow = generateMagicRow(width, hasGrayHeader(pixelData, width, height));
     const lastRowOffset = (height - 1) * width * CHANNELS;
     const lastRow = pixelData.subarray(lastRowOffset, lastRowOffset + width * CHANNELS);
     return areBuffersEqual(lastRow, expectedMagicRow);
 }
 
+// stb_image_write 的默认 deflate 级别；'png-stored' 输出用 0 (存储块，不压缩)
+const PNG_DEFAULT_LEVEL = 8;
+// 归档压缩级别 (与 image_codecs_wasm.c 的 PNG_ARCHIVE_LEVEL 一致): 最优解析，慢很多，只在后台使用
+const PNG_ARCHIVE_LEVEL = 10;
+
+// 当前任务分到的编码预算 {timeMs, bytes} (每个任务开始时设置，null 表示使用默认级别)
+let encodeBudget = null;
+
+/**
+ * 当前任务有编码预算时，先抽样估计各级别的体积和耗时，再设置这次 PNG 编码的级别。
+ * 旧模块没有 choose_*_level 导出，调用方此时不调用本函数，编码预算被忽略。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {function(number, number): number} choose - 以 (时间预算 ms, 体积预算字节) 调用对应的 choose_*_level 导出。
+ */
+function applyEncodeBudget(wasmApi, choose) {
+    if (!encodeBudget) return;
+    const level = choose(encodeBudget.timeMs || 0, encodeBudget.bytes || 0);
+    if (level >= 0) {
+        console.log(`按编码预算选择 PNG 级别 ${level}`);
+        wasmApi.set_png_compression_level(level);
+    }
+}
+
+// 无损容器格式对应的 MIME 类型 (QOI 没有注册类型，沿用社区惯用的 image/qoi)
+const LOSSLESS_MIME_TYPES = {png: 'image/png', qoi: 'image/qoi'};
+
+// 按文件头魔数 "qoif" 判断输入是否为 QOI 文件 (header 为文件开头的字节)
+function isQoiFile(header) {
+    return header.length >= 4 && header[0] === 0x71 && header[1] === 0x6F && header[2] === 0x69 && header[3] === 0x66;
+}
+
+// 分块容器没有注册的 MIME 类型，用自定义类型让主线程识别 (只显示占位，不当作图片预览)
+const TILE_CONTAINER_MIME_TYPE = 'application/x-stil';
+// 文件头 + 偏移表的固定部分 (见 wasm/tile_container.h)
+const TILE_CONTAINER_HEADER_BYTES = 32;
+
+// 按文件头魔数 "STIL" 判断输入是否为分块容器
+function isTileContainer(header) {
+    return header.length >= 4 && header[0] === 0x53 && header[1] === 0x54 && header[2] === 0x49 && header[3] === 0x4C;
+}
+
 // Module 是由 image_processor.js 创建的全局对象
 // 等待WASM运行时初始化完成
 createImageProcessorModule()
     .then(Module => {
         console.log("Worker: WASM 模块已加载并初始化。");
 
+        // 预编译的模块不一定包含最新的导出 (重新构建见 wasm/build.sh)。
+        // 模块里没有的函数为 null，调用处改走旧的路径或给出明确的错误，而不是在调用时才失败
+        const optional = (name, returnType, argTypes) =>
+            Module['_' + name] ? Module.cwrap(name, returnType, argTypes) : null;
+
         // 填充 wasmApi 对象，包含所有需要从 JS 调用的 C 函数
         wasmApi = {
             Module: Module,
@@ -186,23 +575,142 @@ createImageProcessorModule()
             perform_decryption: Module.cwrap(
                 'perform_decryption', null, ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']
             ),
+            // 与 perform_decryption 相同，但直接给出原图高度 (第 3 个参数)
+            perform_decryption_rows: optional(
+                'perform_decryption_rows', null, ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']
+            ),
             // 来自 image_codecs_wasm.c
             decode_image: Module.cwrap(
                 'decode_image_wasm', 'number', ['number', 'number', 'number', 'number']
             ),
+            probe_image_header: optional('probe_image_header_wasm', 'number', ['number', 'number', 'number']),
+            // 最后一个参数是 JPEG 缩小解码倍数 (1, 2, 4, 8)
+            probe_image: optional(
+                'probe_image_wasm', 'number', ['number', 'number', 'number', 'number', 'number']
+            ),
+            decode_image_into: optional(
+                'decode_image_into_wasm', 'number', ['number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            // 流式 PNG 解码
+            png_stream_create: optional('png_stream_create_wasm', 'number', []),
+            png_stream_feed: optional('png_stream_feed_wasm', 'number', ['number', 'number', 'number']),
+            png_stream_info: optional('png_stream_info_wasm', 'number', ['number', 'number', 'number']),
+            png_stream_set_output: optional('png_stream_set_output_wasm', null, ['number', 'number']),
+            png_stream_free: optional('png_stream_free_wasm', null, ['number']),
+            // 流式解码与解密合并
+            png_stream_decrypt_begin: optional('png_stream_decrypt_begin_wasm', 'number', ['number', 'number', 'number']),
+            png_stream_decrypt_result: optional('png_stream_decrypt_result_wasm', 'number', ['number']),
+            png_stream_decrypt_free: optional('png_stream_decrypt_free_wasm', null, ['number']),
             encode_png: Module.cwrap(
                 'encode_png_wasm', 'number', ['number', 'number', 'number', 'number']
             ),
+            // 旧模块没有这个导出，始终按内置的默认级别压缩，这里设置级别为空操作
+            set_png_compression_level: optional('set_png_compression_level_wasm', null, ['number']) || (() => {}),
+            // 按编码预算抽样估计并选择 PNG 级别 (返回 -1 表示图太小，不必估计)
+            choose_png_level: optional(
+                'choose_png_level_wasm', 'number', ['number', 'number', 'number', 'number', 'number']
+            ),
+            choose_png_shuffled_level: optional(
+                'choose_png_shuffled_level_wasm', 'number',
+                ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            encode_qoi: optional(
+                'encode_qoi_wasm', 'number', ['number', 'number', 'number', 'number']
+            ),
+            // 无损加密容器: 编码时逐行打乱，不拼装整个容器
+            encode_png_shuffled: optional(
+                'encode_png_shuffled_wasm', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            encode_qoi_shuffled: optional(
+                'encode_qoi_shuffled_wasm', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            // 无损容器的分块去重
+            tile_dedup_build: optional(
+                'tile_dedup_build_wasm', 'number', ['number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            tile_dedup_unique_count: optional('tile_dedup_unique_count_wasm', 'number', ['number']),
+            tile_dedup_free: optional('tile_dedup_free_wasm', null, ['number']),
+            tile_dedup_expand: optional(
+                'tile_dedup_expand_wasm', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            // 分块压缩容器 (逐块 QOI，可只解码局部)
+            encode_tile_container: optional(
+                'encode_tile_container_wasm', 'number', ['number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            tile_container_header_size: optional('tile_container_header_size_wasm', 'number', ['number', 'number']),
+            tile_container_open: optional('tile_container_open_wasm', 'number', ['number', 'number']),
+            tile_container_free: optional('tile_container_free_wasm', null, ['number']),
+            tile_container_region_slots: optional(
+                'tile_container_region_slots_wasm', 'number', ['number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            tile_container_decode_region: optional(
+                'tile_container_decode_region_wasm', 'number',
+                ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']
+            ),
+            encode_jpeg: optional(
+                'encode_jpeg_wasm', 'number', ['number', 'number', 'number', 'number', 'number']
+            ),
+            // 编码器的分块输出 (旧模块没有，它的 encode_png 直接返回整个文件)
+            output_read: optional('output_read_wasm', 'number', ['number', 'number']),
+            output_free: optional('output_free_wasm', null, ['number']),
+            make_shuffle_map: optional(
+                'make_shuffle_map_wasm', null, ['number', 'number', 'number', 'number']
+            ),
+            // JPEG 压缩域打乱/还原
+            jpeg_is_tile_shuffled: optional(
+                'jpeg_is_tile_shuffled_wasm', 'number', ['number', 'number']
+            ),
+            jpeg_tile_shuffle: optional(
+                'jpeg_tile_shuffle_wasm', 'number', ['number', 'number', 'number', 'number', 'number']
+            ),
+            jpeg_tile_unshuffle: optional(
+                'jpeg_tile_unshuffle_wasm', 'number', ['number', 'number', 'number']
+            ),
+            // stb 临时内存 arena
+            arena_stats: optional('arena_stats_wasm', null, ['number']),
+            arena_reset: optional('arena_reset_wasm', null, []),
         };
 
-        // 向主线程发送“准备就绪”的消息
-        self.postMessage({status: 'ready'});
+        // 多线程构建 + 跨源隔离时，让 JPEG 解码按重启区间并行 (线程数与 PTHREAD_POOL_SIZE 一致)。
+        // 默认的单线程构建没有这两个导出；托管方不发送 COOP/COEP 头时也不会跨源隔离 (见 wasm/build.sh)
+        if (self.crossOriginIsolated && Module._set_jpeg_decode_threads) {
+            Module._set_jpeg_decode_threads(Math.min(4, navigator.hardwareConcurrency || 1));
+        }
+        if (self.crossOriginIsolated && Module._set_tile_container_threads) {
+            Module._set_tile_container_threads(Math.min(4, navigator.hardwareConcurrency || 1));
+        }
+
+        // 向主线程发送“准备就绪”的消息，附带模块支持的功能
+        self.postMessage({status: 'ready', features: moduleFeatures(Module)});
     })
     .catch(err => {
         console.error("Worker: WASM 模块加载失败:", err);
         self.postMessage({status: 'error', error: `WASM 模块加载失败: ${err.message}`});
     });
 
+/**
+ * 页面上各个可选功能是否有模块导出支持。预编译的模块不一定包含较新的导出 (重新构建见 wasm/build.sh)，
+ * 主线程据此禁用不支持的选项，而不是等到处理时才报错或悄悄退回普通的处理方式。
+ * @param {object} Module - 已初始化的 Emscripten 模块。
+ * @returns {object} 各功能是否可用。
+ */
+function moduleFeatures(Module) {
+    const has = (...names) => names.every(name => !!Module['_' + name]);
+    return {
+        // QOI 的编码器和解码器在同一次构建中加入，有编码器就能打开 .qoi 文件
+        qoi: has('encode_qoi_wasm'),
+        jpegShuffle: has('jpeg_is_tile_shuffled_wasm', 'jpeg_tile_shuffle_wasm', 'jpeg_tile_unshuffle_wasm'),
+        jpegLossy: has('encode_jpeg_wasm'),
+        // 不压缩 PNG 和归档压缩都要能设置 PNG 级别
+        pngLevel: has('set_png_compression_level_wasm'),
+        budget: has('choose_png_level_wasm', 'choose_png_shuffled_level_wasm'),
+        // 图集按文件头探测的尺寸分组，没有探测时不会合并任何图片
+        atlas: has('probe_image_header_wasm'),
+        tiles: has('encode_tile_container_wasm', 'tile_container_header_size_wasm', 'tile_container_open_wasm',
+            'tile_container_free_wasm', 'tile_container_region_slots_wasm', 'tile_container_decode_region_wasm')
+    };
+}
+
 // 监听主线程发来的任务
 self.onmessage = async (event) => {
     if (!wasmApi) {
@@ -210,40 +718,154 @@ self.onmessage = async (event) => {
         return;
     }
 
-    const {fileBuffer, fileName} = event.data;
+    // file 是主线程传来的 File (Blob)，按需读取，不预先读成 ArrayBuffer
+    const {file, fileName, outputFormat = 'png', jpegQuality = 90, mode, budget = null} = event.data;
+
+    // 派发前的文件头探测: 一次处理一组文件，无法识别的返回 null
+    if (mode === 'probe') {
+        const infos = [];
+        for (const probeFile of event.data.files) {
+            infos.push(await probeFileHeader(wasmApi, probeFile));
+        }
+        self.postMessage({status: 'probed', infos});
+        return;
+    }
+    // 每个任务 (任何模式) 都先重新设置 PNG 级别，不沿用上一个任务按预算选择的级别。
+    // 不压缩的 PNG 只用于交给别处重新压缩的流水线
+    wasmApi.set_png_compression_level(outputFormat === 'png-stored' ? 0 : PNG_DEFAULT_LEVEL);
+    // 不压缩的 PNG 和归档压缩都有固定的级别，不按预算调整
+    encodeBudget = mode === 'archive' || outputFormat === 'png-stored' ? null : budget;
+
+    // 一批小图拼成一个图集容器。解码失败或本身就是加密容器的图片不合并，交还主线程逐个处理
+    if (mode === 'atlas') {
+        try {
+            const container = outputFormat === 'qoi' ? 'qoi' : 'png';
+            const {blob, skipped} = await encryptAtlas(wasmApi, event.data.files, container);
+            self.postMessage({
+                status: 'done',
+                originalFileName: fileName,
+                result: {blob, newFileName: `encrypted-${fileName}.${container}`},
+                skipped
+            });
+        } catch (e) {
+            self.postMessage({status: 'error', originalFileName: fileName, error: e.message});
+        } finally {
+            resetScratchArena(wasmApi);
+        }
+        return;
+    }
+
+    // 后台归档压缩任务: 失败只意味着保留原来的结果，不当作处理失败
+    if (mode === 'archive') {
+        let result = null;
+        try {
+            result = {blob: recompressForArchive(wasmApi, await file.arrayBuffer())};
+        } catch (e) {
+            console.warn(`归档压缩 ${fileName} 失败，保留原结果:`, e);
+        } finally {
+            resetScratchArena(wasmApi);
+        }
+        self.postMessage({status: 'archived', originalFileName: fileName, result});
+        return;
+    }
 
     try {
         // -----------------------------------------------------------------
         // Worker 的核心逻辑：与您原来的单线程 processImageFile 几乎一样
         // 只是它现在在 Worker 内部运行
         // -----------------------------------------------------------------
+        const header = new Uint8Array(await file.slice(0, 8).arrayBuffer());
+
+        // 分块容器不是图片，按偏移表读出块解码后输出 PNG。
+        // 页面填写了区域时只读出和解码与区域相交的块
+        if (isTileContainer(header)) {
+            const region = event.data.region || null;
+            const blob = await encodeTileContainerRegion(wasmApi, file, region);
+            const suffix = region ? `-${region.x}_${region.y}_${region.width}x${region.height}` : '';
+            self.postMessage({
+                status: 'done',
+                originalFileName: fileName,
+                result: {blob, newFileName: `decrypted-${fileName.replace(/\.stil$/i, '')}${suffix}.png`}
+            });
+            return;
+        }
 
-        // 1. 解码图片
-        const {width, height, data: pixels} = decodeImageWasm(wasmApi, fileBuffer);
+        // 1. 解码图片 (像素留在 WASM 内存中，处理完毕后释放)
+        // PNG 边读边解码；其他格式、流式解码不支持的 PNG 以及没有流式解码器的模块读入整个文件后解码
+        let image = isPngHeader(header) && wasmApi.png_stream_create ? await decodePngStreamIntoWasm(wasmApi, file) : null;
+        if (!image) {
+            const fileBuffer = await file.arrayBuffer();
+
+            // JPEG 压缩域路径: 不解码像素，输出保持 JPEG 大小
+            const jpegResult = shuffleJpegWasm(wasmApi, fileBuffer, outputFormat);
+            if (jpegResult) {
+                self.postMessage({
+                    status: 'done',
+                    originalFileName: fileName,
+                    result: {
+                        blob: new Blob([jpegResult.buffer], {type: 'image/jpeg'}),
+                        newFileName: jpegResult.decrypted ? `decrypted-${fileName}` : `encrypted-${fileName}`,
+                        thumbnail: jpegThumbnail(wasmApi, jpegResult.buffer)
+                    }
+                });
+                return;
+            }
 
-        if (!width || !height) {
-            throw new Error("解码失败，无法获取图片数据。");
+            image = decodeImageIntoWasm(wasmApi, fileBuffer);
+        }
+        const {width, height} = image;
+
+        // 2. 加密或解密 (无损 PNG/QOI 容器靠最后的 magic 行识别，有损 JPEG 容器靠头部色块识别)
+        // 编码结果是带 MIME 类型的 Blob
+        let result;
+        try {
+            const pixels = heapPixels(wasmApi, image);
+            const encrypted = !image.decrypted && isEncrypted(pixels, width, height);
+            const lossyHeader = encrypted || image.decrypted ? null : readLossyHeader(pixels, width, height);
+            if (image.decrypted) {
+                // 流式解码时已经按置换表还原，只需编码 (图集拆回各个文件)
+                const files = unpackAtlas(wasmApi, image.ptr, width, height, 'png');
+                result = files ? {files} : {
+                    blob: encodeLosslessWasm(wasmApi, image.ptr, width, height, 'png'),
+                    newFileName: `decrypted-${fileName}`
+                };
+            } else if (encrypted) {
+                // QOI 容器解密后仍输出 QOI，让内部流水线两端都不经过 PNG 编码
+                const container = isQoiFile(header) ? 'qoi' : 'png';
+                const decrypted = await decryptWithShuffle(wasmApi, image, container);
+                result = Array.isArray(decrypted)
+                    ? {files: decrypted}
+                    : {blob: decrypted, newFileName: `decrypted-${fileName}`};
+            } else if (lossyHeader) {
+                const blob = decryptLossyJpeg(wasmApi, image, lossyHeader, jpegQuality);
+                result = {blob, newFileName: `decrypted-${fileName}`};
+            } else if (outputFormat === 'tiles') {
+                const blob = encryptToTileContainer(wasmApi, image);
+                result = {blob, newFileName: `encrypted-${fileName}.stil`};
+            } else if (outputFormat === 'jpeg-lossy') {
+                const blob = encryptToLossyJpeg(wasmApi, image, jpegQuality);
+                result = {blob, newFileName: `encrypted-${fileName}.jpg`};
+            } else {
+                const container = outputFormat === 'qoi' ? 'qoi' : 'png';
+                const blob = await encryptWithShuffle(wasmApi, image, container);
+                result = {blob, newFileName: `encrypted-${fileName}.${container}`};
+            }
+        } finally {
+            wasmApi._free(image.ptr);
         }
 
-        // 2. 加密或解密
-        const encrypted = isEncrypted(pixels, width, height);
-        let outputPngBuffer;
-        if (encrypted) {
-            outputPngBuffer = await decryptWithShuffle(wasmApi, pixels, width, height);
-        } else {
-            outputPngBuffer = await encryptWithShuffle(wasmApi, pixels, width, height);
+        // JPEG 结果 (有损容器的加密和解密) 附带缩小解码的缩略图
+        if (result.blob && result.blob.type === 'image/jpeg') {
+            result.thumbnail = jpegThumbnail(wasmApi, await result.blob.arrayBuffer());
         }
 
         // 3. 将结果发送回主线程
-        // 注意：ArrayBuffer需要作为可转移对象发送，以避免复制
+        // Blob 在线程间按引用传递，不会复制数据
         self.postMessage({
             status: 'done',
             originalFileName: fileName,
-            result: {
-                buffer: outputPngBuffer,
-                newFileName: encrypted ? `decrypted-${fileName}` : `encrypted-${fileName}.png`
-            }
-        }, [outputPngBuffer]);
+            result
+        });
 
     } catch (e) {
         // 如果处理失败，将错误信息发回主线程
@@ -252,19 +874,106 @@ self.onmessage = async (event) => {
             originalFileName: fileName,
             error: e.message
         });
+    } finally {
+        // 任务之间重置 stb 的临时内存 arena (成功或失败都要做)
+        resetScratchArena(wasmApi);
     }
 };
 
+/**
+ * 用归档级别重新编码一个已经生成的 PNG (最优解析 + 逐段滤波搜索)，像素不变。
+ * 直接整体解码而不走流式解码，否则加密容器会在解码时被顺带解密。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {ArrayBuffer} fileBuffer - 快速模式输出的 PNG 文件。
+ * @returns {Blob} 重新编码的 PNG。
+ */
+function recompressForArchive(wasmApi, fileBuffer) {
+    const image = decodeImageIntoWasm(wasmApi, fileBuffer);
+    try {
+        wasmApi.set_png_compression_level(PNG_ARCHIVE_LEVEL);
+        return encodeLosslessWasm(wasmApi, image.ptr, image.width, image.height, 'png');
+    } finally {
+        // 归档级别只用于这一次编码
+        wasmApi.set_png_compression_level(PNG_DEFAULT_LEVEL);
+        wasmApi._free(image.ptr);
+    }
+}
+
+/**
+ * 输出本次任务的 arena 统计并重置 arena。
+ * 复用率高说明 stb 的临时缓冲区基本不再向 malloc 申请新内存。模块没有 arena 时什么也不做。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ */
+function resetScratchArena(wasmApi) {
+    const {Module, arena_stats, arena_reset} = wasmApi;
+    if (!arena_stats || !arena_reset) return;
+    const statsPtr = Module._malloc(6 * 4);
+    if (statsPtr) {
+        arena_stats(statsPtr);
+        const [allocs, requested, reused, chunkMallocs, capacity, peak] = Module.HEAPU32.subarray(statsPtr / 4, statsPtr / 4 + 6);
+        Module._free(statsPtr);
+        if (allocs > 0) {
+            const mb = bytes => (bytes / 1048576).toFixed(1);
+            console.log(`arena: ${allocs} 次分配，请求 ${mb(requested)} MB，复用 ${mb(reused)} MB ` +
+                `(${(reused / requested * 100).toFixed(0)}%)，新 chunk ${chunkMallocs} 个，` +
+                `容量 ${mb(capacity)} MB，峰值 ${mb(peak)} MB`);
+        }
+    }
+    arena_reset();
+}
+
+/**
+ * 由 64 位种子生成置换表，写入 WASM 内存 (map[d] = 输出第 d 块取自原图的第几块)。
+ * 模块没有 make_shuffle_map 导出时用 JS 实现同样的 PCG32 + Fisher-Yates (见 wasm/jpeg_shuffle.h)，
+ * 两者生成的置换表逐项相同。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {number} mapPtr - WASM 内存中 count 个 uint32 的空间。
+ */
+function makeShuffleMap(wasmApi, mapPtr, count, seedLo, seedHi) {
+    if (wasmApi.make_shuffle_map) {
+        wasmApi.make_shuffle_map(mapPtr, count, seedLo, seedHi);
+        return;
+    }
+    const MASK = (1n << 64n) - 1n;
+    let state = (((BigInt(seedHi) << 32n) | BigInt(seedLo)) + 0x853c49e6748fea9bn) & MASK;
+    const next = () => {
+        const old = state;
+        state = (old * 6364136223846793005n + 1442695040888963407n) & MASK;
+        const xorshifted = Number((((old >> 18n) ^ old) >> 27n) & 0xFFFFFFFFn);
+        const rot = Number(old >> 59n);
+        return ((xorshifted >>> rot) | (xorshifted << ((32 - rot) & 31))) >>> 0;
+    };
+    next();
+    const map = wasmApi.Module.HEAPU32.subarray(mapPtr / 4, mapPtr / 4 + count);
+    for (let i = 0; i < count; i++) map[i] = i;
+    for (let i = count - 1; i > 0; i--) {
+        // (r * (i + 1)) >> 32: 块数远小于 2^21，乘积不超过 2^53，用浮点数计算是精确的
+        const j = Math.floor(next() * (i + 1) / 4294967296);
+        const t = map[i];
+        map[i] = map[j];
+        map[j] = t;
+    }
+}
+
 // 在您的 script.js 中，完整替换这个函数
-async function encryptWithShuffle(wasmApi, pixels, width, height) {
+/**
+ * 无损加密: 元数据行 + 打乱后的原图 + magic 行。编码器逐行从原图收集打乱后的内容，
+ * 不在内存中拼装整个容器。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {{width: number, height: number, ptr: number, size: number}} image - WASM 内存中的原图。
+ * @param {string} [container='png'] - 容器格式 ('png' 或 'qoi')。
+ * @returns {Promise<Blob>} 加密后的文件。
+ */
+async function encryptWithShuffle(wasmApi, image, container = 'png') {
     console.log("执行加密 (WASM 优化方案)...");
 
-    const {Module, perform_encryption} = wasmApi;
+    const {Module, tile_dedup_build, tile_dedup_unique_count, tile_dedup_free} = wasmApi;
+    const {width, height} = image;
 
     // --- 步骤 1: 尺寸和参数校验 (核心修复点) ---
-    // 检查最小宽度要求：元数据行需要至少20字节，即宽度至少为5像素。
-    if (width < 5) {
-        throw new Error(`图片宽度太小 (${width}px)，无法写入元数据。最小宽度要求为 5px。`);
+    // 检查最小宽度要求：元数据行 (含种子) 有 32 字节，每个字节占一个像素，即宽度至少为32像素。
+    if (width < METADATA_BYTES) {
+        throw new Error(`图片宽度太小 (${width}px)，无法写入元数据。最小宽度要求为 ${METADATA_BYTES}px。`);
     }
 
     // 计算可用的内容区域
@@ -281,118 +990,136 @@ async function encryptWithShuffle(wasmApi, pixels, width, height) {
     const totalBlocks = blocksX * blocksY;
 
     // --- 步骤 2: 计算元数据和参数 ---
+    // 置换表由 64 位随机种子在 WASM 里生成，只把种子写进元数据行。
+    // 旧格式逐项把置换表写成像素 (每个分块一种颜色)，会让截图超出 256 色而无法写成索引色 PNG。
+    const seed = crypto.getRandomValues(new Uint32Array(2));
     const metadata = {
         originalWidth: width,
         originalHeight: height,
         contentWidth,
         contentHeight,
-        totalBlocks
+        totalBlocks,
+        seedLo: seed[0],
+        seedHi: seed[1]
     };
 
-    const shuffleMap = Array.from({length: totalBlocks}, (_, i) => i);
-    shuffleArray(shuffleMap);
-
-    const mapRows = Math.ceil(totalBlocks / width);
-    const newHeight = 1 + mapRows + height + 1;
+    const rowBytes = width * CHANNELS;
 
-    // --- 步骤 3: 在 JavaScript 中创建并填充最终的输出缓冲区 ---
-    const outputPixels = new Uint8Array(width * newHeight * CHANNELS);
-
-    // 3a. 写入元数据行 (现在可以安全地写入了)
-    const metadataRow = outputPixels.subarray(0, width * CHANNELS);
-    encodeMetadataToRow(metadataRow, metadata);
-
-    // 3b. 写入 Shuffle Map
-    const mapStartOffset = width * CHANNELS;
-    for (let i = 0; i < totalBlocks; i++) {
-        encodeNumberToPixel(shuffleMap[i], outputPixels, mapStartOffset + i * CHANNELS);
-    }
-
-    // --- 步骤 4: 调用 WASM 执行核心的像素打乱操作 ---
-    let originalPixelsPtr = 0, shuffleMapPtr = 0, outputImagePtr = 0;
+    // --- 步骤 3: 生成置换表，在 WASM 内存中准备元数据行和 Magic Row ---
+    // 打乱后的原图不再拼装成整块容器: 编码器逐行请求时才按置换表从原图收集
+    // (旧模块没有逐行打乱的编码器时，退回到先拼装整个容器再编码)
+    const encode = container === 'qoi' ? wasmApi.encode_qoi_shuffled : wasmApi.encode_png_shuffled;
+    let shuffleMapPtr = 0, headerRowsPtr = 0, sizePtr = 0, dedupPtr = 0, containerPtr = 0;
 
     try {
-        originalPixelsPtr = Module._malloc(pixels.length);
-        shuffleMapPtr = Module._malloc(shuffleMap.length * 4);
-        outputImagePtr = Module._malloc(pixels.length);
+        shuffleMapPtr = Module._malloc(totalBlocks * 4);
+        headerRowsPtr = Module._malloc(rowBytes * 2);
+        sizePtr = Module._malloc(4); // size_t
 
-        if (!originalPixelsPtr || !shuffleMapPtr || !outputImagePtr) {
+        if (!shuffleMapPtr || !headerRowsPtr || !sizePtr) {
             throw new Error("在 WASM 中分配内存失败。");
         }
 
-        Module.HEAPU8.set(pixels, originalPixelsPtr);
-        Module.HEAPU32.set(new Uint32Array(shuffleMap), shuffleMapPtr / 4);
+        makeShuffleMap(wasmApi, shuffleMapPtr, totalBlocks, metadata.seedLo, metadata.seedHi);
 
-        perform_encryption(
-            originalPixelsPtr, width, height, contentWidth, contentHeight,
-            shuffleMapPtr, outputImagePtr, 0
+        // 重复的块 (空白边距、界面截图的纯色区域) 只存一次，另存引用表；没有足够多的重复块时为 0
+        // 去重的引用表由逐行打乱的编码器写入，拼装整个容器或模块没有去重导出时不去重
+        dedupPtr = encode && tile_dedup_build ? tile_dedup_build(image.ptr, width, height, contentWidth, contentHeight, shuffleMapPtr) : 0;
+        metadata.dedup = dedupPtr !== 0;
+        if (dedupPtr) {
+            console.log(`分块去重: ${totalBlocks} 个块中有 ${tile_dedup_unique_count(dedupPtr)} 个不重复`);
+        }
+
+        const headerView = Module.HEAPU8.subarray(headerRowsPtr, headerRowsPtr + rowBytes * 2);
+        encodeMetadataToRow(headerView.subarray(0, rowBytes), metadata);
+        headerView.set(generateMagicRow(width), rowBytes);
+
+        if (!encode) {
+            // 元数据行 + 打乱后的图像 + Magic Row，拼成完整容器后整体编码
+            containerPtr = Module._malloc(rowBytes * (height + 2));
+            if (!containerPtr) throw new Error("在 WASM 中分配内存失败。");
+            Module.HEAPU8.copyWithin(containerPtr, headerRowsPtr, headerRowsPtr + rowBytes);
+            wasmApi.perform_encryption(image.ptr, width, height, contentWidth, contentHeight, shuffleMapPtr, containerPtr, 1);
+            Module.HEAPU8.copyWithin(containerPtr + rowBytes * (height + 1), headerRowsPtr + rowBytes, headerRowsPtr + rowBytes * 2);
+            const blob = encodeLosslessWasm(wasmApi, containerPtr, width, height + 2, container);
+            console.log(`WASM 无损加密完成，大小: ${blob.size} 字节`);
+            return blob;
+        }
+
+        // --- 步骤 4: 边打乱边编码 ---
+        const formatName = container.toUpperCase();
+        console.log(`使用 WASM 编码 ${formatName} (编码时逐行打乱)...`);
+        if (container === 'png' && wasmApi.choose_png_shuffled_level) {
+            applyEncodeBudget(wasmApi, (timeMs, bytes) => wasmApi.choose_png_shuffled_level(
+                image.ptr, width, height, contentWidth, contentHeight, shuffleMapPtr, headerRowsPtr, dedupPtr, timeMs, bytes
+            ));
+        }
+        const outputPtr = encode(
+            image.ptr, width, height, contentWidth, contentHeight,
+            shuffleMapPtr, headerRowsPtr, dedupPtr, sizePtr
         );
+        if (!outputPtr) {
+            throw new Error(`${formatName} 编码失败。WASM 函数返回空指针。`);
+        }
 
-        const imageContentStartOffset = (1 + mapRows) * width * CHANNELS;
-        const resultView = new Uint8Array(Module.HEAPU8.buffer, outputImagePtr, pixels.length);
-        outputPixels.set(resultView, imageContentStartOffset);
+        const blob = readChunkedOutput(wasmApi, outputPtr, LOSSLESS_MIME_TYPES[container]);
+        console.log(`WASM 无损加密完成，大小: ${blob.size} 字节`);
+        return blob;
 
     } finally {
-        if (originalPixelsPtr) Module._free(originalPixelsPtr);
         if (shuffleMapPtr) Module._free(shuffleMapPtr);
-        if (outputImagePtr) Module._free(outputImagePtr);
+        if (headerRowsPtr) Module._free(headerRowsPtr);
+        if (sizePtr) Module._free(sizePtr);
+        if (containerPtr) Module._free(containerPtr);
+        if (dedupPtr) tile_dedup_free(dedupPtr);
     }
-
-    // --- 步骤 5: 写入最后的 Magic Row ---
-    const magicRow = generateMagicRow(width);
-    outputPixels.set(magicRow, (newHeight - 1) * width * CHANNELS);
-
-    console.log(`WASM 无损加密完成。`);
-
-    // --- 步骤 6: 将填充完毕的、完整的缓冲区进行 PNG 编码 ---
-    return encodePngWasm(wasmApi, outputPixels, width, newHeight);
 }
 
 const BLOCK_SIZE = 32;
 
-/**
- * 将一个 32 位整数（块索引）编码到一个 RGBA 像素中。
- * @param {number} num - 要编码的数字.
- * @param {Uint8Array} pixelData - 目标像素数据 (长度为 4).
- * @param {number} offset - 在像素数据中的偏移量.
- */
-function encodeNumberToPixel(num, pixelData, offset) {
-    pixelData[offset] = (num >> 24) & 0xFF; // Red
-    pixelData[offset + 1] = (num >> 16) & 0xFF; // Green
-    pixelData[offset + 2] = (num >> 8) & 0xFF; // Blue
-    pixelData[offset + 3] = num & 0xFF;         // Alpha
-}
+// 元数据行第 20 字节起的标记: 置换表由其后的 64 位种子生成，文件中没有置换表行。
+// 旧版容器在这里全为 0，解密时仍按逐项写入的置换表行读取。
+const SEEDED_MAP_TAG = 0x53454544; // 'SEED'
+// 同样由种子生成置换表，内容区只存不重复的块，后跟引用表 (布局见 wasm/tile_dedup.h)
+const DEDUP_MAP_TAG = 0x44454455; // 'DEDU'
+const METADATA_BYTES = 32;
 
 /**
- * 将所有必要的元数据编码到一行像素中。 (修正版)
- * @param {Uint8Array} metadataRow - 目标行 (这是一个 subarray 视图).
+ * 将所有必要的元数据编码到一行像素中 (每个字节一个灰度像素)。
+ * @param {Uint8Array} metadataRow - 目标行 (这是一个 subarray 视图，宽度至少 32 像素).
  * @param {object} metadata - 包含所有元数据的对象.
  */
 function encodeMetadataToRow(metadataRow, metadata) {
-    // --- 核心修正 ---
-    // 当从一个 TypedArray 的 subarray 创建 DataView 时，
-    // 必须使用包含 byteOffset 和 byteLength 的构造函数，
-    // 以确保 DataView 精确地覆盖 subarray 的范围，而不是整个底层 buffer。
-    const view = new DataView(metadataRow.buffer, metadataRow.byteOffset, metadataRow.byteLength);
+    const bytes = new Uint8Array(METADATA_BYTES);
+    const view = new DataView(bytes.buffer);
 
-    // 现在 view 的范围是正确的，写入操作将是安全的。
     view.setUint32(0, metadata.originalWidth, false);
     view.setUint32(4, metadata.originalHeight, false);
     view.setUint32(8, metadata.contentWidth, false);
     view.setUint32(12, metadata.contentHeight, false);
     view.setUint32(16, metadata.totalBlocks, false);
+    view.setUint32(20, metadata.dedup ? DEDUP_MAP_TAG : SEEDED_MAP_TAG, false);
+    view.setUint32(24, metadata.seedHi, false);
+    view.setUint32(28, metadata.seedLo, false);
+    writeGrayBytes(metadataRow, bytes);
 }
 
 /**
  * 从一行像素中解码出所有元数据。 (修正版)
  * @param {Uint8Array} metadataRow - 包含元数据的行 (这是一个 subarray 视图).
+ * @param {boolean} grayHeader - 是否为灰度头部布局 (旧容器的字节直接写在 RGBA 四个通道里).
  * @returns {object} - 解码出的元数据对象.
  */
-function decodeMetadataFromRow(metadataRow) {
-    // --- 核心修正 ---
-    // 同样，为解密函数也应用相同的、正确的 DataView 创建方式，
-    // 以保证代码的健壮性。
-    const view = new DataView(metadataRow.buffer, metadataRow.byteOffset, metadataRow.byteLength);
+function decodeMetadataFromRow(metadataRow, grayHeader) {
+    // 旧布局: 从一个 TypedArray 的 subarray 创建 DataView 时，
+    // 必须使用包含 byteOffset 和 byteLength 的构造函数，
+    // 以确保 DataView 精确地覆盖 subarray 的范围，而不是整个底层 buffer。
+    const view = grayHeader
+        ? new DataView(readGrayBytes(metadataRow, METADATA_BYTES).buffer)
+        : new DataView(metadataRow.buffer, metadataRow.byteOffset, metadataRow.byteLength);
+    const tag = view.byteLength >= METADATA_BYTES ? view.getUint32(20, false) : 0;
+    const dedup = tag === DEDUP_MAP_TAG;
+    const seeded = tag === SEEDED_MAP_TAG || dedup;
 
     return {
         originalWidth: view.getUint32(0, false),
@@ -400,6 +1127,10 @@ function decodeMetadataFromRow(metadataRow) {
         contentWidth: view.getUint32(8, false),
         contentHeight: view.getUint32(12, false),
         totalBlocks: view.getUint32(16, false),
+        seeded,
+        dedup,
+        seedHi: seeded ? view.getUint32(24, false) : 0,
+        seedLo: seeded ? view.getUint32(28, false) : 0,
     };
 }
 
@@ -417,28 +1148,17 @@ function decodeNumberFromPixel(pixelData, offset) {
     return (r << 24) | (g << 16) | (b << 8) | a;
 }
 
-/**
- * Fisher-Yates (aka Knuth) Shuffle 算法，用于随机打乱数组。
- * @param {Array} array - 需要打乱的数组.
- */
-function shuffleArray(array) {
-    for (let i = array.length - 1; i > 0; i--) {
-        const j = Math.floor(Math.random() * (i + 1));
-        [array[i], array[j]] = [array[j], array[i]];
-    }
-}
-
 /**
  * 使用 WASM 模块执行高效的无损解密。
  * 这个函数负责准备数据，调用C语言编译的WASM函数，并处理返回结果。
  * 核心的、计算密集的像素重排工作完全在WASM中完成。
  *
- * @param {Uint8Array} pixels 加密图像的完整像素数据。
- * @param {number} width 加密图像的宽度。
- * @param {number} height 加密图像的高度。
- * @returns {Promise<ArrayBuffer>} 一个包含解密后 PNG 文件数据的 ArrayBuffer。
+ * @param {{width: number, height: number, ptr: number, size: number}} image WASM 内存中的加密图像。
+ * @param {string} [container='png'] 解密结果的容器格式 ('png' 或 'qoi')。
+ * @returns {Promise<Blob|Array<{blob: Blob, newFileName: string}>>} 解密后的 PNG/QOI 文件；
+ *     图集容器拆回各个文件。
  */
-async function decryptWithShuffle(wasmApi, pixels, width, height) {
+async function decryptWithShuffle(wasmApi, image, container = 'png') {
     // 步骤 1: 检查 WASM 模块是否已加载并准备就绪
     if (!wasmApi) {
         // 如果 wasmApi 为 null，说明模块还没加载好，无法继续。
@@ -446,15 +1166,17 @@ async function decryptWithShuffle(wasmApi, pixels, width, height) {
         throw new Error("WASM 模块尚未准备好，请稍后再试。");
     }
 
-    const {Module, perform_decryption} = wasmApi;
+    const {Module, perform_decryption, tile_dedup_expand} = wasmApi;
 
     console.log("执行解密 (WASM 优化方案)...");
 
     // 步骤 2: 从像素数据中解码元数据 (这部分逻辑不变，在JS中完成)
-    // 这不是性能瓶颈，且在JS中操作更灵活。
+    // 这不是性能瓶颈，且在JS中操作更灵活。视图只在下一次 _malloc 之前使用。
+    const {width, height} = image;
+    const pixels = heapPixels(wasmApi, image);
     const metadataRow = pixels.subarray(0, width * CHANNELS);
-    const metadata = decodeMetadataFromRow(metadataRow);
-    const {originalWidth, originalHeight, contentWidth, contentHeight, totalBlocks} = metadata;
+    const metadata = decodeMetadataFromRow(metadataRow, hasGrayHeader(pixels, width, height));
+    const {originalWidth, originalHeight, contentWidth, contentHeight, totalBlocks, seeded} = metadata;
 
     // 验证元数据，确保文件没有损坏
     if (originalWidth !== width) {
@@ -464,12 +1186,15 @@ async function decryptWithShuffle(wasmApi, pixels, width, height) {
         throw new Error(`元数据无效: totalBlocks=${totalBlocks}, contentWidth=${contentWidth}, contentHeight=${contentHeight}`);
     }
 
-    // 步骤 3: 从像素数据中解码 Shuffle Map (同上，在JS中完成)
-    const mapRows = Math.ceil(totalBlocks / originalWidth);
-    const mapStartOffset = originalWidth * CHANNELS;
-    const shuffleMap = new Array(totalBlocks);
-    for (let i = 0; i < totalBlocks; i++) {
-        shuffleMap[i] = decodeNumberFromPixel(pixels, mapStartOffset + i * CHANNELS);
+    // 步骤 3: 得到 Shuffle Map: 新容器由种子在 WASM 中生成，旧容器从置换表行逐项解码
+    const mapRows = seeded ? 0 : Math.ceil(totalBlocks / originalWidth);
+    let shuffleMap = null;
+    if (!seeded) {
+        const mapStartOffset = originalWidth * CHANNELS;
+        shuffleMap = new Uint32Array(totalBlocks);
+        for (let i = 0; i < totalBlocks; i++) {
+            shuffleMap[i] = decodeNumberFromPixel(pixels, mapStartOffset + i * CHANNELS);
+        }
     }
 
     // 计算加密内容在完整像素数据中的起始行号
@@ -478,65 +1203,647 @@ async function decryptWithShuffle(wasmApi, pixels, width, height) {
     // --- 核心：WASM 交互 ---
 
     // 定义一些指针变量，初始化为0（空指针）
-    let encryptedPixelsPtr = 0;
+    // 加密图像已经在 WASM 内存中 (image.ptr)，不需要再复制
     let shuffleMapPtr = 0;
     let decryptedPixelsPtr = 0;
 
     try {
-        // 步骤 4: 在 WASM 的线性内存中为所有数据分配空间
-        // 这是调用C函数前的准备工作，必须为所有输入和输出数据预留内存。
-        const encryptedPixelsSize = pixels.length;
-        const shuffleMapSize = shuffleMap.length * 4; // Uint32Array，每个元素4字节
+        // 步骤 4: 在 WASM 的线性内存中为置换表和输出分配空间
+        const shuffleMapSize = totalBlocks * 4; // Uint32Array，每个元素4字节
         const decryptedPixelsSize = originalWidth * originalHeight * CHANNELS;
 
-        encryptedPixelsPtr = Module._malloc(encryptedPixelsSize);
         shuffleMapPtr = Module._malloc(shuffleMapSize);
         decryptedPixelsPtr = Module._malloc(decryptedPixelsSize);
 
         // 如果内存分配失败 (例如，图片太大导致内存不足)，_malloc 会返回 0
-        if (!encryptedPixelsPtr || !shuffleMapPtr || !decryptedPixelsPtr) {
+        if (!shuffleMapPtr || !decryptedPixelsPtr) {
             throw new Error("在 WASM 中分配内存失败，可能是图片尺寸过大。");
         }
 
-        // 步骤 5: 将 JavaScript 中的数据复制到 WASM 的内存中
-        // 使用 HEAPU8 (Uint8Array 视图) 和 HEAPU32 (Uint32Array 视图) 进行高效复制。
-        Module.HEAPU8.set(pixels, encryptedPixelsPtr);
+        // 步骤 5: 准备置换表
         // 注意: HEAPU32 的偏移量需要除以4，因为它操作的是4字节整数。
-        Module.HEAPU32.set(new Uint32Array(shuffleMap), shuffleMapPtr / 4);
+        if (seeded) {
+            makeShuffleMap(wasmApi, shuffleMapPtr, totalBlocks, metadata.seedLo, metadata.seedHi);
+        } else {
+            Module.HEAPU32.set(shuffleMap, shuffleMapPtr / 4);
+        }
 
         // 步骤 6: 调用导出的 C 函数 `perform_decryption`
         // 所有参数都以数字形式传递（包括指针，它本质上是内存地址的数字表示）。
-        perform_decryption(
-            encryptedPixelsPtr,           // const unsigned char* restrict encrypted_pixels
-            width,                        // int width
-            height,                       // int height
-            contentWidth,                 // int content_width
-            contentHeight,                // int content_height
-            shuffleMapPtr,                // const unsigned int* restrict shuffle_map
-            encryptedContentStartRow,     // int encrypted_content_start_row
-            decryptedPixelsPtr            // unsigned char* restrict decrypted_pixels
-        );
-
-        // 步骤 7: 从 WASM 内存中将解密结果复制回 JavaScript
-        // 创建一个指向 WASM 内存中结果区域的视图
-        const wasmResultView = new Uint8Array(Module.HEAPU8.buffer, decryptedPixelsPtr, decryptedPixelsSize);
-
-        // **至关重要**: 创建一个数据的 JavaScript 副本。
-        // 因为 WASM 内存很快就会被释放，我们不能持有对它的引用。
-        const finalDecryptedPixels = new Uint8Array(wasmResultView);
+        // 去重容器按引用表把块展开回原位
+        if (metadata.dedup) {
+            if (!tile_dedup_expand) {
+                throw new Error("当前的 WASM 模块不支持去重容器的解密，请重新构建 (wasm/build.sh)。");
+            }
+            if (!tile_dedup_expand(image.ptr, width, height, originalHeight, contentWidth, contentHeight,
+                                   shuffleMapPtr, decryptedPixelsPtr)) {
+                throw new Error("去重容器的引用表与元数据不符，文件可能已损坏。");
+            }
+        } else {
+            perform_decryption(
+                image.ptr,                    // const unsigned char* restrict encrypted_pixels
+                width,                        // int width
+                height,                       // int height
+                contentWidth,                 // int content_width
+                contentHeight,                // int content_height
+                shuffleMapPtr,                // const unsigned int* restrict shuffle_map
+                encryptedContentStartRow,     // int encrypted_content_start_row
+                decryptedPixelsPtr            // unsigned char* restrict decrypted_pixels
+            );
+        }
 
         console.log("WASM 无损解密完成。");
 
-        // 步骤 8: 使用解密后的像素数据编码成最终的 PNG 文件
-        // UPNG.encode 期望一个 ArrayBuffer 的数组，所以我们传入 .buffer。
-        return encodePngWasm(wasmApi, finalDecryptedPixels, originalWidth, originalHeight);
+        // 步骤 7: 直接从 WASM 内存把解密结果编码成最终的 PNG/QOI 文件 (图集拆成各个文件分别编码)
+        return unpackAtlas(wasmApi, decryptedPixelsPtr, originalWidth, originalHeight, container) ||
+            encodeLosslessWasm(wasmApi, decryptedPixelsPtr, originalWidth, originalHeight, container);
 
     } finally {
-        // 步骤 9: 无论成功与否，都必须释放 WASM 内存以避免内存泄漏
+        // 步骤 8: 无论成功与否，都必须释放 WASM 内存以避免内存泄漏
         // 使用 try...finally 结构确保即使在发生错误时也能执行清理。
-        if (encryptedPixelsPtr) Module._free(encryptedPixelsPtr);
         if (shuffleMapPtr) Module._free(shuffleMapPtr);
         if (decryptedPixelsPtr) Module._free(decryptedPixelsPtr);
         console.log("WASM 内存已释放。");
     }
-}
\ No newline at end of file
+}
+
+// =======================================================================
+// ==               小图图集                                            ==
+// =======================================================================
+// 压缩包里成千上万的小图标各自成为一个容器时，元数据行、magic 行和 PNG 文件头比图标本身还大。
+// 图集把一批小图拼成一张图，整张图只打乱一次、编码一次，输出一个文件:
+// - 开头是目录区: 字节按灰度像素逐行首尾相接写入 (与容器头部相同)，大端序。
+//   "ATLS"、版本、3 字节保留、图片数、目录总字节数，
+//   然后每张图 x、y、宽、高、文件名长度 (各 16 位) + UTF-8 文件名。
+// - 各图从目录区之后的第一个 32 整数倍行开始按货架 (shelf) 排列，空位为不透明黑色。
+// - 宽高都取 32 的整数倍，整张图都在打乱的内容区内。
+// 图集本身就是普通的无损容器 (encryptWithShuffle)，解密后看到目录区就拆回各个文件。
+const ATLAS_MAGIC = 0x41544C53; // 'ATLS'
+const ATLAS_VERSION = 1;
+const ATLAS_HEADER_BYTES = 16;
+const ATLAS_ENTRY_BYTES = 10;
+// 货架排列的空隙约一成，图集按总面积的 1.1 倍取近似正方形的宽度
+const ATLAS_AREA_SLACK = 1.1;
+
+const alignToBlock = value => Math.ceil(value / BLOCK_SIZE) * BLOCK_SIZE;
+
+/**
+ * 按货架算法排列各图: 从高到低依次放进当前一行，放不下就另起一行。
+ * @param {Array<{width: number, height: number}>} members - 待排列的图，写回 x、y。
+ * @param {number} directoryBytes - 目录区的字节数。
+ * @returns {{width: number, height: number}} 图集尺寸。
+ */
+function layoutAtlas(members, directoryBytes) {
+    const area = members.reduce((sum, m) => sum + m.width * m.height, 0);
+    const widest = members.reduce((max, m) => Math.max(max, m.width), 0);
+    const width = alignToBlock(Math.max(widest, Math.ceil(Math.sqrt(area * ATLAS_AREA_SLACK)), METADATA_BYTES));
+    let x = 0, y = alignToBlock(Math.ceil(directoryBytes / width)), shelfHeight = 0;
+    for (const m of [...members].sort((a, b) => b.height - a.height)) {
+        if (x + m.width > width) {
+            y += shelfHeight;
+            x = 0;
+            shelfHeight = 0;
+        }
+        m.x = x;
+        m.y = y;
+        x += m.width;
+        shelfHeight = Math.max(shelfHeight, m.height);
+    }
+    return {width, height: alignToBlock(y + shelfHeight)};
+}
+
+/**
+ * 判断 JPEG 文件是否为压缩域打乱的输出 (带 JSHUF 标记)。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {ArrayBuffer} fileBuffer - 原始文件数据。
+ * @returns {boolean}
+ */
+function isShuffledJpeg(wasmApi, fileBuffer) {
+    const bytes = new Uint8Array(fileBuffer);
+    if (bytes.length < 4 || bytes[0] !== 0xFF || bytes[1] !== 0xD8) return false;
+    const {Module, jpeg_is_tile_shuffled, _free} = wasmApi;
+    if (!jpeg_is_tile_shuffled) return false;
+    const inputPtr = Module._malloc(bytes.length);
+    if (!inputPtr) throw new Error("WASM _malloc 失败：无法为 JPEG 数据分配内存。");
+    try {
+        Module.HEAPU8.set(bytes, inputPtr);
+        return jpeg_is_tile_shuffled(inputPtr, bytes.length) !== 0;
+    } finally {
+        _free(inputPtr);
+    }
+}
+
+/**
+ * 解码一张待合并的小图。解码失败或是任一种加密容器 (需要解密，不能再合并) 时返回 null。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {File} file - 输入文件。
+ * @returns {Promise<{width: number, height: number, ptr: number, size: number}|null>} 调用方负责 _free(ptr)。
+ */
+async function decodeAtlasMember(wasmApi, file) {
+    const fileBuffer = await file.arrayBuffer();
+    let image = null;
+    try {
+        if (isShuffledJpeg(wasmApi, fileBuffer)) return null;
+        image = decodeImageIntoWasm(wasmApi, fileBuffer);
+    } catch (e) {
+        console.warn(`图集: ${file.name} 解码失败，改为单独处理:`, e);
+        return null;
+    }
+    const pixels = heapPixels(wasmApi, image);
+    if (isEncrypted(pixels, image.width, image.height) || readLossyHeader(pixels, image.width, image.height)) {
+        wasmApi._free(image.ptr);
+        return null;
+    }
+    return image;
+}
+
+/**
+ * 把一批小图拼成图集并加密成一个无损容器。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {File[]} files - 待合并的图片。
+ * @param {string} container - 容器格式 ('png' 或 'qoi')。
+ * @returns {Promise<{blob: Blob, skipped: string[]}>} 图集容器，以及没有合并、需要单独处理的文件名。
+ */
+async function encryptAtlas(wasmApi, files, container) {
+    const {Module, _free} = wasmApi;
+    const members = [], skipped = [];
+    let atlasPtr = 0;
+
+    try {
+        // 1. 解码各图 (像素留在 WASM 内存中，拼好后立即释放)
+        for (const file of files) {
+            const image = await decodeAtlasMember(wasmApi, file);
+            if (image) members.push({name: file.name, ...image});
+            else skipped.push(file.name);
+        }
+        if (members.length === 0) throw new Error("没有可以合并到图集的图片。");
+
+        // 2. 目录和排列
+        const encoder = new TextEncoder();
+        const names = members.map(m => encoder.encode(m.name).subarray(0, 0xFFFF));
+        const directoryBytes = ATLAS_HEADER_BYTES + names.reduce((sum, name) => sum + ATLAS_ENTRY_BYTES + name.length, 0);
+        const {width, height} = layoutAtlas(members, directoryBytes);
+        console.log(`图集: ${members.length} 张图拼成 ${width}x${height}，目录 ${directoryBytes} 字节`);
+
+        const directory = new Uint8Array(directoryBytes);
+        const view = new DataView(directory.buffer);
+        view.setUint32(0, ATLAS_MAGIC, false);
+        view.setUint8(4, ATLAS_VERSION);
+        view.setUint32(8, members.length, false);
+        view.setUint32(12, directoryBytes, false);
+        let offset = ATLAS_HEADER_BYTES;
+        members.forEach((m, i) => {
+            [m.x, m.y, m.width, m.height, names[i].length].forEach((v, k) => view.setUint16(offset + k * 2, v, false));
+            directory.set(names[i], offset + ATLAS_ENTRY_BYTES);
+            offset += ATLAS_ENTRY_BYTES + names[i].length;
+        });
+
+        // 3. 拼图: 底色为不透明黑色，目录区写成灰度像素，各图逐行复制到位
+        const size = width * height * CHANNELS;
+        atlasPtr = Module._malloc(size);
+        if (!atlasPtr) throw new Error(`WASM _malloc 失败：无法为 ${width}x${height} 的图集分配内存。`);
+        new Uint32Array(Module.HEAPU8.buffer, atlasPtr, width * height).fill(0xFF000000); // 小端序: (0, 0, 0, 255)
+        const directoryRows = Math.ceil(directoryBytes / width);
+        writeGrayBytes(Module.HEAPU8.subarray(atlasPtr, atlasPtr + directoryRows * width * CHANNELS), directory);
+        for (const m of members) {
+            const rowBytes = m.width * CHANNELS;
+            for (let row = 0; row < m.height; row++) {
+                const src = m.ptr + row * rowBytes;
+                Module.HEAPU8.copyWithin(atlasPtr + ((m.y + row) * width + m.x) * CHANNELS, src, src + rowBytes);
+            }
+            _free(m.ptr);
+            m.ptr = 0;
+        }
+
+        // 4. 整个图集作为一张图加密: 一次打乱、一次编码
+        const blob = await encryptWithShuffle(wasmApi, {width, height, ptr: atlasPtr, size}, container);
+        return {blob, skipped};
+
+    } finally {
+        for (const m of members) {
+            if (m.ptr) _free(m.ptr);
+        }
+        if (atlasPtr) _free(atlasPtr);
+    }
+}
+
+/**
+ * 解密结果是图集时，按目录把各图拆出来分别编码；不是图集 (或目录无效) 时返回 null。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {number} pixelsPtr - WASM 内存中解密后的 RGBA 像素。
+ * @param {number} width - 图像宽度。
+ * @param {number} height - 图像高度。
+ * @param {string} container - 输出格式 ('png' 或 'qoi')。
+ * @returns {Array<{blob: Blob, newFileName: string}>|null}
+ */
+function unpackAtlas(wasmApi, pixelsPtr, width, height, container) {
+    const {Module, _free} = wasmApi;
+    if (width * height < ATLAS_HEADER_BYTES) return null;
+    const pixels = new Uint8Array(Module.HEAPU8.buffer, pixelsPtr, width * height * CHANNELS);
+    const header = new DataView(readGrayBytes(pixels, ATLAS_HEADER_BYTES).buffer);
+    if (header.getUint32(0, false) !== ATLAS_MAGIC || header.getUint8(4) !== ATLAS_VERSION) return null;
+
+    const count = header.getUint32(8, false);
+    const directoryBytes = header.getUint32(12, false);
+    if (count === 0 || directoryBytes > width * height || directoryBytes < ATLAS_HEADER_BYTES + count * ATLAS_ENTRY_BYTES) {
+        console.warn("图集目录长度无效，按普通图片输出。");
+        return null;
+    }
+
+    // 先完整解析并校验目录，再分配内存 (之后 pixels 视图可能失效)
+    const directory = readGrayBytes(pixels, directoryBytes);
+    const view = new DataView(directory.buffer);
+    const decoder = new TextDecoder();
+    const entries = [];
+    let offset = ATLAS_HEADER_BYTES;
+    for (let i = 0; i < count; i++) {
+        if (offset + ATLAS_ENTRY_BYTES > directoryBytes) return null;
+        const [x, y, w, h, nameLength] = [0, 1, 2, 3, 4].map(k => view.getUint16(offset + k * 2, false));
+        offset += ATLAS_ENTRY_BYTES;
+        if (w === 0 || h === 0 || x + w > width || y + h > height || offset + nameLength > directoryBytes) {
+            console.warn("图集目录项越界，按普通图片输出。");
+            return null;
+        }
+        entries.push({x, y, width: w, height: h, name: decoder.decode(directory.subarray(offset, offset + nameLength))});
+        offset += nameLength;
+    }
+    console.log(`图集: 拆分为 ${entries.length} 个文件`);
+
+    const extension = `.${container}`;
+    return entries.map(entry => {
+        const rowBytes = entry.width * CHANNELS;
+        const ptr = Module._malloc(rowBytes * entry.height);
+        if (!ptr) throw new Error(`WASM _malloc 失败：无法为 ${entry.width}x${entry.height} 的图像分配内存。`);
+        try {
+            for (let row = 0; row < entry.height; row++) {
+                const src = pixelsPtr + ((entry.y + row) * width + entry.x) * CHANNELS;
+                Module.HEAPU8.copyWithin(ptr + row * rowBytes, src, src + rowBytes);
+            }
+            const blob = encodeLosslessWasm(wasmApi, ptr, entry.width, entry.height, container);
+            const suffix = entry.name.toLowerCase().endsWith(extension) ? '' : extension;
+            return {blob, newFileName: `decrypted-${entry.name}${suffix}`};
+        } finally {
+            _free(ptr);
+        }
+    });
+}
+
+// =======================================================================
+// ==               有损 JPEG 容器                                      ==
+// =======================================================================
+// 布局: [头部色带 headerRows 行] + [打乱后的原图 height 行]，宽度不变。
+// - 头部色带的高度取 16 (JPEG MCU) 的整数倍，所以内容区的 32x32 分块都对齐到 MCU 边界，
+//   有损压缩的误差不会在块与块之间串扰。
+// - 元数据和种子按位写成 8x8 的纯黑/纯白色块 (恰好是一个 DCT 块，只有 DC 分量)，
+//   在任何质量下都能可靠读回；整份头部重复写 3 次，读取时逐位多数表决。
+// - 置换表不再逐项写入图像 (每项都要占像素，且无法承受有损压缩)，而是由种子在 WASM 里重新生成。
+const LOSSY_MAGIC = 0x5348;   // 'SH'
+const LOSSY_VERSION = 1;
+const LOSSY_HEADER_BITS = 120;
+const LOSSY_COPIES = 3;
+const LOSSY_CELL = 8;
+const JPEG_MCU_SIZE = 16;
+
+function lossyHeaderRows(width) {
+    const cellsPerStrip = Math.floor(width / LOSSY_CELL);
+    const strips = Math.ceil(LOSSY_HEADER_BITS * LOSSY_COPIES / cellsPerStrip);
+    return Math.ceil(strips * LOSSY_CELL / JPEG_MCU_SIZE) * JPEG_MCU_SIZE;
+}
+
+function lossyHeaderFields(header) {
+    return [
+        [LOSSY_MAGIC, 16], [LOSSY_VERSION, 8],
+        [header.originalWidth, 16], [header.originalHeight, 16],
+        [header.seedLo, 32], [header.seedHi, 32],
+    ];
+}
+
+/**
+ * 把头部写成色块。每一位占一个 8x8 块，1 为白色、0 为黑色。
+ * @param {Uint8Array} pixels - 输出图像 (头部色带已清零)。
+ * @param {number} width - 图像宽度。
+ * @param {object} header - {originalWidth, originalHeight, seedLo, seedHi}。
+ */
+function writeLossyHeader(pixels, width, header) {
+    const bits = [];
+    for (const [value, count] of lossyHeaderFields(header)) {
+        for (let i = count - 1; i >= 0; i--) bits.push(Math.floor(value / 2 ** i) % 2);
+    }
+    const cellsPerStrip = Math.floor(width / LOSSY_CELL);
+    for (let i = 0; i < LOSSY_HEADER_BITS * LOSSY_COPIES; i++) {
+        if (!bits[i % LOSSY_HEADER_BITS]) continue;
+        const x0 = (i % cellsPerStrip) * LOSSY_CELL;
+        const y0 = Math.floor(i / cellsPerStrip) * LOSSY_CELL;
+        for (let y = y0; y < y0 + LOSSY_CELL; y++) {
+            pixels.fill(255, (y * width + x0) * CHANNELS, (y * width + x0 + LOSSY_CELL) * CHANNELS);
+        }
+    }
+    // 黑色块的 alpha 也设为不透明，避免 PNG 预览里出现透明条带
+    for (let i = 3; i < lossyHeaderRows(width) * width * CHANNELS; i += CHANNELS) pixels[i] = 255;
+}
+
+/**
+ * 尝试读取有损 JPEG 容器的头部。
+ * @param {Uint8Array} pixels - 解码后的 RGBA 像素。
+ * @param {number} width - 原图宽度。
+ * @param {number} height - 原图高度。
+ * @param {number} [scale=1] - pixels 是按 1/scale 缩小解码的 (宽高向上取整)；
+ *     scale 为 8 时每个色块正好缩成一个像素 (DC 分量)。
+ * @returns {object|null} 头部信息；不是有损容器时返回 null。
+ */
+function readLossyHeader(pixels, width, height, scale = 1) {
+    if (width < LOSSY_CELL * 2) return null;
+    const headerRows = lossyHeaderRows(width);
+    if (height <= headerRows) return null;
+
+    const cellsPerStrip = Math.floor(width / LOSSY_CELL);
+    const stride = Math.ceil(width / scale);
+    const cell = LOSSY_CELL / scale;
+    const side = Math.min(2, cell);
+    const readCell = (i) => {
+        // 取色块中心 2x2 像素 (缩小解码时是色块剩下的像素) 的平均亮度
+        const cx = (i % cellsPerStrip) * cell + (cell - side) / 2;
+        const cy = Math.floor(i / cellsPerStrip) * cell + (cell - side) / 2;
+        let sum = 0;
+        for (let y = cy; y < cy + side; y++) {
+            for (let x = cx; x < cx + side; x++) {
+                const o = (y * stride + x) * CHANNELS;
+                sum += pixels[o] + pixels[o + 1] + pixels[o + 2];
+            }
+        }
+        return sum > 3 * side * side * 128 ? 1 : 0;
+    };
+
+    const values = [];
+    let bit = 0;
+    for (const [, count] of lossyHeaderFields({})) {
+        let value = 0;
+        for (let i = 0; i < count; i++, bit++) {
+            let votes = 0;
+            for (let c = 0; c < LOSSY_COPIES; c++) votes += readCell(c * LOSSY_HEADER_BITS + bit);
+            value = value * 2 + (votes * 2 > LOSSY_COPIES ? 1 : 0);
+        }
+        values.push(value);
+        // 魔数不对就尽早放弃，普通图片只需读 16 个色块
+        if (values.length === 1 && value !== LOSSY_MAGIC) return null;
+    }
+
+    const [, version, originalWidth, originalHeight, seedLo, seedHi] = values;
+    if (version !== LOSSY_VERSION || originalWidth !== width || headerRows + originalHeight !== height) return null;
+    return {originalWidth, originalHeight, seedLo, seedHi, headerRows};
+}
+
+// 结果卡片缩略图的目标边长 (长边不小于它)
+const THUMBNAIL_SIDE = 256;
+
+/**
+ * 为 JPEG 结果生成卡片缩略图: 在 DCT 域按 1/2、1/4 或 1/8 缩小解码 (选长边仍不小于 THUMBNAIL_SIDE 的最大倍数)，
+ * 编码为 PNG，页面不必为卡片解码整张大图。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {ArrayBuffer} jpegBuffer - JPEG 结果文件。
+ * @returns {Blob|null} 图太小 (缩小一半就不够 THUMBNAIL_SIDE)、模块不支持缩小解码或解码失败时为 null，卡片直接显示结果。
+ */
+function jpegThumbnail(wasmApi, jpegBuffer) {
+    if (!wasmApi.probe_image || !wasmApi.decode_image_into) return null;
+    let image = null;
+    try {
+        image = decodeImageIntoWasm(wasmApi, jpegBuffer, (width, height) => {
+            let denom = LOSSY_CELL;
+            while (denom > 1 && Math.max(width, height) / denom < THUMBNAIL_SIDE) denom /= 2;
+            return denom;
+        });
+        if (image.width === image.originalWidth) return null;
+        return encodeLosslessWasm(wasmApi, image.ptr, image.width, image.height, 'png');
+    } catch (e) {
+        console.warn("生成缩略图失败，卡片直接显示结果:", e);
+        return null;
+    } finally {
+        if (image) wasmApi._free(image.ptr);
+    }
+}
+
+/**
+ * 判断 JPEG 是否为有损容器。只以 1/8 尺寸解码 (只用 DC 系数，头部的每个 8x8 色块剩一个像素)，
+ * 比原尺寸解码便宜得多，供压缩域打乱之前调用。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {ArrayBuffer} fileBuffer - JPEG 文件。
+ * @returns {boolean}
+ */
+function isLossyJpegContainer(wasmApi, fileBuffer) {
+    const image = decodeImageIntoWasm(wasmApi, fileBuffer, LOSSY_CELL);
+    try {
+        const scale = image.width === image.originalWidth ? 1 : LOSSY_CELL;
+        return readLossyHeader(heapPixels(wasmApi, image), image.originalWidth, image.originalHeight, scale) !== null;
+    } finally {
+        wasmApi._free(image.ptr);
+    }
+}
+
+/**
+ * 把图像加密为有损 JPEG 容器。置换、写头部和 JPEG 编码都在同一块 WASM 内存上完成。
+ * @returns {Blob} JPEG 文件。
+ */
+function encryptToLossyJpeg(wasmApi, image, quality) {
+    console.log("执行加密 (有损 JPEG 容器)...");
+    const {Module, perform_encryption} = wasmApi;
+    const {width, height} = image;
+
+    const contentWidth = Math.floor(width / BLOCK_SIZE) * BLOCK_SIZE;
+    const contentHeight = Math.floor(height / BLOCK_SIZE) * BLOCK_SIZE;
+    if (contentWidth < BLOCK_SIZE || contentHeight < BLOCK_SIZE) {
+        throw new Error(`图片尺寸太小 (有效区域 ${contentWidth}x${contentHeight}px)，无法进行分块加密。最小有效区域要求为 ${BLOCK_SIZE}x${BLOCK_SIZE}px。`);
+    }
+    const headerRows = lossyHeaderRows(width);
+    const outputHeight = headerRows + height;
+    if (outputHeight > 65535) {
+        throw new Error(`图片高度太大 (${height}px)，超出 JPEG 的尺寸上限。`);
+    }
+
+    const totalBlocks = (contentWidth / BLOCK_SIZE) * (contentHeight / BLOCK_SIZE);
+    const seed = crypto.getRandomValues(new Uint32Array(2));
+    const header = {originalWidth: width, originalHeight: height, seedLo: seed[0], seedHi: seed[1]};
+
+    let shuffleMapPtr = 0, outputImagePtr = 0;
+    try {
+        const outputSize = width * outputHeight * CHANNELS;
+        shuffleMapPtr = Module._malloc(totalBlocks * 4);
+        outputImagePtr = Module._malloc(outputSize);
+        if (!shuffleMapPtr || !outputImagePtr) {
+            throw new Error("在 WASM 中分配内存失败。");
+        }
+
+        makeShuffleMap(wasmApi, shuffleMapPtr, totalBlocks, header.seedLo, header.seedHi);
+        perform_encryption(
+            image.ptr, width, height, contentWidth, contentHeight,
+            shuffleMapPtr, outputImagePtr, headerRows
+        );
+
+        const headerView = Module.HEAPU8.subarray(outputImagePtr, outputImagePtr + headerRows * width * CHANNELS);
+        headerView.fill(0);
+        writeLossyHeader(headerView, width, header);
+
+        return encodeJpegWasm(wasmApi, outputImagePtr, width, outputHeight, quality);
+    } finally {
+        if (shuffleMapPtr) Module._free(shuffleMapPtr);
+        if (outputImagePtr) Module._free(outputImagePtr);
+    }
+}
+
+/**
+ * 还原有损 JPEG 容器，输出同样编码为 JPEG。
+ * @returns {Blob} JPEG 文件。
+ */
+function decryptLossyJpeg(wasmApi, image, header, quality) {
+    console.log("执行解密 (有损 JPEG 容器)...");
+    const {Module, perform_decryption, perform_decryption_rows} = wasmApi;
+    const {originalWidth, originalHeight, seedLo, seedHi, headerRows} = header;
+
+    const contentWidth = Math.floor(originalWidth / BLOCK_SIZE) * BLOCK_SIZE;
+    const contentHeight = Math.floor(originalHeight / BLOCK_SIZE) * BLOCK_SIZE;
+    const totalBlocks = (contentWidth / BLOCK_SIZE) * (contentHeight / BLOCK_SIZE);
+
+    let shuffleMapPtr = 0, decryptedPixelsPtr = 0;
+    try {
+        shuffleMapPtr = Module._malloc(totalBlocks * 4);
+        decryptedPixelsPtr = Module._malloc(originalWidth * originalHeight * CHANNELS);
+        if (!shuffleMapPtr || !decryptedPixelsPtr) {
+            throw new Error("在 WASM 中分配内存失败，可能是图片尺寸过大。");
+        }
+
+        makeShuffleMap(wasmApi, shuffleMapPtr, totalBlocks, seedLo, seedHi);
+        // 有损容器没有 magic 行，直接告诉内核原图高度
+        if (perform_decryption_rows) {
+            perform_decryption_rows(
+                image.ptr, originalWidth, originalHeight,
+                contentWidth, contentHeight, shuffleMapPtr, headerRows, decryptedPixelsPtr
+            );
+        } else {
+            // 旧模块只有 perform_decryption，它按 "起始行 + 原图高度 + 1 行 magic" 推算原图高度
+            perform_decryption(
+                image.ptr, originalWidth, headerRows + originalHeight + 1,
+                contentWidth, contentHeight, shuffleMapPtr, headerRows, decryptedPixelsPtr
+            );
+        }
+
+        return encodeJpegWasm(wasmApi, decryptedPixelsPtr, originalWidth, originalHeight, quality);
+    } finally {
+        if (shuffleMapPtr) Module._free(shuffleMapPtr);
+        if (decryptedPixelsPtr) Module._free(decryptedPixelsPtr);
+    }
+}
+
+/**
+ * 分块容器加密: 每个 32x32 块单独编码为 QOI，按种子生成的置换表顺序存放，前面是偏移表。
+ * 各块互不依赖，多线程构建中并行编码。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {{width: number, height: number, ptr: number, size: number}} image - WASM 内存中的原图。
+ * @returns {Blob} 分块容器文件。
+ */
+function encryptToTileContainer(wasmApi, image) {
+    console.log("执行分块容器加密...");
+    const {Module, encode_tile_container, _free} = wasmApi;
+    if (!encode_tile_container) throw new Error("当前的 WASM 模块不支持分块容器，请重新构建 (wasm/build.sh)。");
+    const seed = crypto.getRandomValues(new Uint32Array(2));
+    const sizePtr = Module._malloc(4); // size_t
+    try {
+        if (!sizePtr) throw new Error("WASM _malloc 失败：无法为大小指针分配内存。");
+        const outputPtr = encode_tile_container(image.ptr, image.width, image.height, seed[0], seed[1], sizePtr);
+        if (!outputPtr) throw new Error("分块容器编码失败。WASM 函数返回空指针。");
+        const blob = readChunkedOutput(wasmApi, outputPtr, TILE_CONTAINER_MIME_TYPE);
+        console.log(`分块容器加密完成，大小: ${blob.size} 字节`);
+        return blob;
+    } finally {
+        if (sizePtr) _free(sizePtr);
+    }
+}
+
+/**
+ * 把分块容器的一个区域解码并编码为 PNG。只从文件中读出文件头、偏移表和与区域相交的块，
+ * 十亿像素级的归档也只需为这几段数据和区域本身分配内存。
+ * @param {object} wasmApi - 已初始化的 WASM API 对象。
+ * @param {File} file - 分块容器文件。
+ * @param {{x: number, y: number, width: number, height: number}|null} region - 要解码的区域，null 表示整幅图像。
+ * @returns {Promise<Blob>} 区域的 PNG 文件。
+ */
+async function encodeTileContainerRegion(wasmApi, file, region) {
+    const {Module, tile_container_header_size, tile_container_open, tile_container_free,
+        tile_container_region_slots, tile_container_decode_region, _free} = wasmApi;
+    if (!tile_container_open || !tile_container_decode_region) {
+        throw new Error("当前的 WASM 模块不支持打开分块容器，请重新构建 (wasm/build.sh)。");
+    }
+    let headerPtr = 0, containerPtr = 0, slotsPtr = 0, payloadPtr = 0, pixelsPtr = 0;
+
+    try {
+        // 1. 文件头 → 偏移表长度 → 读出文件头和偏移表，打开容器
+        const head = new Uint8Array(await file.slice(0, TILE_CONTAINER_HEADER_BYTES).arrayBuffer());
+        headerPtr = Module._malloc(TILE_CONTAINER_HEADER_BYTES);
+        if (!headerPtr) throw new Error("WASM _malloc 失败：无法为分块容器文件头分配内存。");
+        Module.HEAPU8.set(head, headerPtr);
+        const headerSize = tile_container_header_size(headerPtr, head.length);
+        _free(headerPtr);
+        headerPtr = 0;
+        if (!headerSize) throw new Error("不是有效的分块容器。");
+
+        const header = new Uint8Array(await file.slice(0, headerSize).arrayBuffer());
+        if (header.length < headerSize) throw new Error("分块容器的偏移表不完整，文件可能已损坏。");
+        headerPtr = Module._malloc(headerSize);
+        if (!headerPtr) throw new Error("WASM _malloc 失败：无法为分块容器偏移表分配内存。");
+        Module.HEAPU8.set(header, headerPtr);
+        containerPtr = tile_container_open(headerPtr, headerSize);
+        if (!containerPtr) throw new Error("分块容器的偏移表无效，文件可能已损坏。");
+
+        const view = new DataView(header.buffer);
+        const imageWidth = view.getUint32(8, false);
+        const imageHeight = view.getUint32(12, false);
+        const tileCount = view.getUint32(16, false);
+        const {x, y, width, height} = region || {x: 0, y: 0, width: imageWidth, height: imageHeight};
+
+        // 2. 区域涉及的存储位置 (升序)，相邻的位置合并成一次读取
+        slotsPtr = Module._malloc(tileCount * 4);
+        if (!slotsPtr) throw new Error("WASM _malloc 失败：无法为块列表分配内存。");
+        const slotCount = tile_container_region_slots(containerPtr, x, y, width, height, slotsPtr);
+        if (!slotCount) throw new Error(`区域 (${x}, ${y}, ${width}x${height}) 不在图像 ${imageWidth}x${imageHeight} 内。`);
+        const slots = Module.HEAPU32.subarray(slotsPtr / 4, slotsPtr / 4 + slotCount);
+        const offsetOf = slot => Number(view.getBigUint64(TILE_CONTAINER_HEADER_BYTES + slot * 8, false));
+        const ranges = [];
+        for (const slot of slots) {
+            const last = ranges[ranges.length - 1];
+            if (last && last.slot + 1 === slot) {
+                last.slot = slot;
+                last.end = offsetOf(slot + 1);
+            } else {
+                ranges.push({slot, start: offsetOf(slot), end: offsetOf(slot + 1)});
+            }
+        }
+
+        // 3. 只读出这几段数据，首尾相接放进 WASM 内存
+        const parts = await Promise.all(ranges.map(r =>
+            file.slice(headerSize + r.start, headerSize + r.end).arrayBuffer()));
+        const payloadSize = parts.reduce((sum, part) => sum + part.byteLength, 0);
+        payloadPtr = Module._malloc(payloadSize);
+        pixelsPtr = Module._malloc(width * height * CHANNELS);
+        if (!payloadPtr || !pixelsPtr) throw new Error("WASM _malloc 失败：无法为分块数据分配内存。");
+        let offset = payloadPtr;
+        for (const part of parts) {
+            Module.HEAPU8.set(new Uint8Array(part), offset);
+            offset += part.byteLength;
+        }
+
+        // 4. 解码区域内的块 (多线程构建中并行)，编码为 PNG
+        console.log(`分块容器: 解码 ${slotCount}/${tileCount} 个块，读取 ${payloadSize} 字节`);
+        if (!tile_container_decode_region(containerPtr, payloadPtr, payloadSize, slotsPtr, slotCount,
+            x, y, width, height, pixelsPtr)) {
+            throw new Error("分块容器解码失败，文件可能已损坏。");
+        }
+        _free(payloadPtr);
+        payloadPtr = 0;
+        return encodeLosslessWasm(wasmApi, pixelsPtr, width, height, 'png');
+
+    } finally {
+        if (headerPtr) _free(headerPtr);
+        if (containerPtr) tile_container_free(containerPtr);
+        if (slotsPtr) _free(slotsPtr);
+        if (payloadPtr) _free(payloadPtr);
+        if (pixelsPtr) _free(pixelsPtr);
+    }
+}
@@ -28,6 +28,29 @@ if ('serviceWorker' in navigator) {
     const taskQueue = [];       // 等待被处理的图片任务队列
     let processedFiles = [];    // 存储处理完成的结果
     let isWorking = false;      // 一个标志，用于判断整个处理流程是否在进行中
+    const archiveQueue = [];    // 等待后台归档压缩的 PNG 结果，普通任务全部派发后才处理
+    // 归档压缩很慢，最多占用一半的 Worker，新上传的图片总有空闲的 Worker 可用
+    const MAX_ARCHIVE_WORKERS = Math.max(1, Math.floor(MAX_WORKERS / 2));
+    let batchBytes = 0;         // 本批输入文件的总大小，按文件大小分摊编码预算
+    let batchParallelism = 1;   // 本批同时工作的 Worker 数
+    let isPreparing = false;    // 正在展开压缩包和探测文件头，任务还没有入队
+    let moduleFeatures = null;  // WASM 模块支持的功能 (第一个 Worker 就绪时报告)
+    const probeRequests = [];   // 等待空闲 Worker 的文件头探测 {files, resolve}
+
+    // 一个 Worker 的 WASM 堆上限 (wasm32 开启内存增长时默认最多 2GB)，超过的图片直接拒绝
+    const WORKER_HEAP_LIMIT = 2 * 1024 ** 3;
+    // 所有 Worker 同时占用的内存预算: 设备内存 (navigator.deviceMemory，单位 GB，未知时按 4GB) 的一半
+    const POOL_MEMORY_BUDGET = (navigator.deviceMemory || 4) * 1024 ** 3 / 2;
+    // 每个像素的内存估计: RGBA 像素 4 字节 + 解码器的中间缓冲 + 编码时的索引/通道压缩缓冲
+    const TASK_BYTES_PER_PIXEL = 12;
+    let inFlightBytes = 0;      // 已派发、尚未完成的任务的内存估计之和
+    // 图集模式: 边长都不超过 ATLAS_MAX_SIDE 的小图按批拼成一个图集容器，每个图集最多 ATLAS_MAX_PIXELS 像素
+    const ATLAS_MAX_SIDE = 256;
+    const ATLAS_MAX_PIXELS = 4096 * 4096;
+    // 文件头探测能给出尺寸的格式才合并，分块容器仍逐个处理
+    const ATLAS_FORMATS = ['png', 'jpeg', 'qoi', 'bmp', 'pnm'];
+    // 只有像素无损容器支持图集
+    const ATLAS_OUTPUT_FORMATS = ['png', 'qoi', 'png-stored'];
 
 // --- 2. Worker 池的初始化 ---
 
@@ -45,12 +68,17 @@ if ('serviceWorker' in navigator) {
     }
 
     function scheduleTasks() {
+        // 文件头探测最轻，也决定了后面任务的顺序，优先派发
+        scheduleProbes();
+
         // 使用一个循环来持续派发任务，直到无法再派发为止
         while (true) {
             // 如果没有待处理的任务，或者当前没有在工作，就直接返回
             if (taskQueue.length === 0 || !isWorking) {
                 // 检查是否所有任务都完成了
                 checkIfAllDone();
+                // 普通任务都派发完了，把空闲的 Worker 用于后台归档压缩
+                scheduleArchiveTasks();
                 return; // 退出循环和函数
             }
 
@@ -62,20 +90,57 @@ if ('serviceWorker' in navigator) {
 
             // --- 以下是成功派发一个任务的逻辑 ---
 
+            // 内存准入: 已经有任务在跑，再加上这个任务会超出整个池的内存预算时，等别的任务完成再派发。
+            // 池里没有任务时总是派发 (单个任务已经在入队前按 WORKER_HEAP_LIMIT 检查过)
+            if (inFlightBytes > 0 && inFlightBytes + taskQueue[0].cost.bytes > POOL_MEMORY_BUDGET) {
+                return;
+            }
+
             // 从队列头部取出一个任务
             const task = taskQueue.shift();
 
             // 将工人标记为“忙碌”
             freeWorkerWrapper.isBusy = true;
+            freeWorkerWrapper.taskBytes = task.cost.bytes;
+            inFlightBytes += task.cost.bytes;
 
             // 在UI上更新卡片状态
-            updateCardStatus(task.file.name, 'processing', '正在处理...', null);
+            if (task.members) {
+                for (const member of task.members) {
+                    updateCardStatus(member.file.name, 'processing', '正在合并到图集...', null);
+                }
+            } else {
+                updateCardStatus(task.file.name, 'processing', '正在处理...', null);
+            }
 
             // 将任务发送给工人
+            const outputFormatSelect = document.getElementById('outputFormat');
+            const jpegQualityInput = document.getElementById('jpegQuality');
+            const archiveModeInput = document.getElementById('archiveMode');
+            const outputFormat = outputFormatSelect ? outputFormatSelect.value : 'png';
+            // 不压缩的 PNG 是刻意的选择，不做归档压缩
+            freeWorkerWrapper.archiveResult = !!(archiveModeInput && archiveModeInput.checked) && outputFormat !== 'png-stored';
+            freeWorkerWrapper.atlasTask = task.members ? task : null;
+            if (task.members) {
+                freeWorkerWrapper.worker.postMessage({
+                    mode: 'atlas',
+                    fileName: task.name,
+                    files: task.members.map(member => member.file),
+                    outputFormat,
+                    budget: taskEncodeBudget(task.size)
+                });
+                continue;
+            }
             freeWorkerWrapper.worker.postMessage({
                 fileName: task.file.name,
-                fileBuffer: task.buffer
-            }, [task.buffer]);
+                // 直接传 File (Blob 按引用传递，不复制内容)，由 Worker 按需流式读取
+                file: task.file,
+                outputFormat,
+                jpegQuality: jpegQualityInput ? Number(jpegQualityInput.value) || 90 : 90,
+                budget: taskEncodeBudget(task.file.size),
+                // 只对分块容器 (.stil) 生效: 只解码这个区域
+                region: tileRegion()
+            });
 
             // **核心修正**: 循环将继续，立即尝试为下一个任务寻找下一个空闲的工人。
         }
@@ -96,36 +161,229 @@ if ('serviceWorker' in navigator) {
         if (data.status === 'ready') {
             workerWrapper.isBusy = false; // Worker 准备好了，标记为空闲
             console.log("一个 Worker 已准备就绪。");
+            // 所有 Worker 加载的是同一个模块，按第一个就绪的 Worker 报告的功能调整界面
+            if (!moduleFeatures && data.features) {
+                moduleFeatures = data.features;
+                applyModuleFeatures(moduleFeatures);
+            }
             // 尝试立即调度一个任务
             scheduleTasks();
             return;
         }
 
+        // 派发前的文件头探测完成
+        if (data.status === 'probed') {
+            workerWrapper.probeRequest.resolve(data.infos);
+            workerWrapper.probeRequest = null;
+        }
+
         // B. 如果是 Worker 失败的消息
-        if (data.status === 'error') {
+        else if (data.status === 'error') {
             console.error(`文件 "${data.originalFileName}" 处理失败:`, data.error);
-            updateCardStatus(data.originalFileName, 'error', data.error, null);
+            if (workerWrapper.atlasTask) {
+                // 图集整体失败时各图改为逐个处理，各自给出结果或错误
+                requeueAtlasMembers(workerWrapper.atlasTask.members);
+            } else {
+                updateCardStatus(data.originalFileName, 'error', data.error, null);
+            }
+        }
+
+        // 图集解密: 一个输入拆回多个文件
+        else if (data.status === 'done' && data.result.files) {
+            for (const {blob, newFileName} of data.result.files) {
+                processedFiles.push({name: newFileName, blob});
+            }
+            updateCardStatus(data.originalFileName, 'success', `已拆分为 ${data.result.files.length} 个文件`,
+                data.result.files[0].blob);
         }
 
         // C. 如果是 Worker 成功完成任务的消息
         else if (data.status === 'done') {
-            const {buffer, newFileName} = data.result;
-            const imageBlob = new Blob([buffer], {type: 'image/png'});
+            const {blob: imageBlob, newFileName, thumbnail = null} = data.result;
 
             // 将成功的结果存起来
-            processedFiles.push({name: newFileName, blob: imageBlob});
+            const entry = {name: newFileName, blob: imageBlob};
+            processedFiles.push(entry);
+
+            // 更新UI卡片，显示成功和缩略图 (图集的每张图都指向同一个容器，没有合并的图重新排队)
+            if (workerWrapper.atlasTask) {
+                const skipped = new Set(data.skipped || []);
+                const members = workerWrapper.atlasTask.members;
+                for (const member of members.filter(m => !skipped.has(m.file.name))) {
+                    updateCardStatus(member.file.name, 'success', `已合并到 ${newFileName}`, imageBlob);
+                }
+                requeueAtlasMembers(members.filter(m => skipped.has(m.file.name)));
+            } else {
+                updateCardStatus(data.originalFileName, 'success', '处理成功', imageBlob, thumbnail);
+            }
 
-            // 更新UI卡片，显示成功和缩略图
-            updateCardStatus(data.originalFileName, 'success', '处理成功', imageBlob);
+            // 快速结果已经可用，PNG 结果再排队在后台用归档级别重新压缩
+            if (workerWrapper.archiveResult && imageBlob.type === 'image/png') {
+                archiveQueue.push({fileName: data.originalFileName, entry});
+            }
+        }
+
+        // D. 如果是后台归档压缩完成的消息: 更小才替换 (像素相同)，失败时保留快速结果
+        else if (data.status === 'archived') {
+            const {entry} = workerWrapper.archiveTask;
+            workerWrapper.archiveTask = null;
+            // 期间重新上传过文件的话，这个结果已经不属于当前批次
+            if (data.result && processedFiles.includes(entry) && data.result.blob.size < entry.blob.size) {
+                const saved = (1 - data.result.blob.size / entry.blob.size) * 100;
+                entry.blob = data.result.blob;
+                updateCardMessage(data.originalFileName, `处理成功 (归档压缩 -${saved.toFixed(1)}%)`);
+            }
         }
 
         // 无论成功或失败，这个 worker 的任务都结束了，将它标记为空闲
         workerWrapper.isBusy = false;
+        workerWrapper.atlasTask = null;
+        inFlightBytes -= workerWrapper.taskBytes || 0;
+        workerWrapper.taskBytes = 0;
 
         // 任务完成后，立即尝试调度下一个任务
         scheduleTasks();
     }
 
+    /**
+     * 把文件头探测请求派发给空闲的 Worker。
+     */
+    function scheduleProbes() {
+        while (probeRequests.length > 0) {
+            const freeWorkerWrapper = workerPool.find(w => !w.isBusy);
+            if (!freeWorkerWrapper) return;
+            const request = probeRequests.shift();
+            freeWorkerWrapper.isBusy = true;
+            freeWorkerWrapper.probeRequest = request;
+            freeWorkerWrapper.worker.postMessage({mode: 'probe', files: request.files});
+        }
+    }
+
+    /**
+     * 在 Worker 里探测一批文件的文件头 (只读每个文件开头的一段)，文件分成几组并行探测。
+     * @param {File[]} files - 待探测的文件。
+     * @returns {Promise<Array<{width: number, height: number, channels: number, format: string}|null>>}
+     *     与 files 一一对应，核心模块不认识的格式为 null。
+     */
+    function probeImageHeaders(files) {
+        const groupSize = Math.ceil(files.length / MAX_WORKERS);
+        const pending = [];
+        for (let i = 0; i < files.length; i += groupSize) {
+            const group = files.slice(i, i + groupSize);
+            pending.push(new Promise(resolve => probeRequests.push({files: group, resolve})));
+        }
+        scheduleTasks();
+        return Promise.all(pending).then(results => results.flat());
+    }
+
+    /**
+     * 按文件头估算任务的内存和计算量 (都与像素数成正比)。
+     * 探测不出尺寸的格式只按文件大小计内存。
+     * @param {File} file - 输入文件。
+     * @param {{width: number, height: number}|null} info - probeImageHeaders 的结果。
+     * @returns {{pixels: number, bytes: number}}
+     */
+    function estimateTaskCost(file, info) {
+        const pixels = info ? info.width * info.height : 0;
+        // 文件内容在 JS 和 WASM 里各有一份
+        return {pixels, bytes: file.size * 2 + pixels * TASK_BYTES_PER_PIXEL};
+    }
+
+    /**
+     * 把可以合并的小图分成若干图集任务，其余的图片原样返回。
+     * 只有一张小图时合并没有意义，也原样返回。
+     * @param {Array<{file: File, info: object|null, cost: object}>} tasks - 探测过的任务。
+     * @returns {Array<object>} 普通任务和图集任务 {name, members, size, cost}。
+     */
+    function groupAtlasTasks(tasks) {
+        const small = [], others = [];
+        for (const task of tasks) {
+            const {info} = task;
+            const fits = info && ATLAS_FORMATS.includes(info.format) &&
+                info.width <= ATLAS_MAX_SIDE && info.height <= ATLAS_MAX_SIDE;
+            (fits ? small : others).push(task);
+        }
+        if (small.length < 2) return tasks;
+
+        const groups = [];
+        let group = null;
+        for (const task of small) {
+            const pixels = task.cost.pixels;
+            if (!group || group.cost.pixels + pixels > ATLAS_MAX_PIXELS) {
+                group = {name: `atlas-${groups.length + 1}`, members: [], size: 0, cost: {pixels: 0, bytes: 0}};
+                groups.push(group);
+            }
+            group.members.push(task);
+            group.size += task.file.size;
+            group.cost.pixels += pixels;
+            // 各图解码后的像素和拼好的图集同时在内存中
+            group.cost.bytes += task.cost.bytes + pixels * 4;
+        }
+        console.log(`图集模式: ${small.length} 张小图合并为 ${groups.length} 个图集。`);
+        return others.concat(groups.map(g => g.members.length > 1 ? g : g.members[0]));
+    }
+
+    /**
+     * 图集没有合并的图片 (解码失败、本身是加密容器) 放回队列开头，逐个处理。
+     * @param {Array<{file: File, cost: object}>} members - 图集任务中的图片。
+     */
+    function requeueAtlasMembers(members) {
+        if (members.length === 0) return;
+        console.log(`${members.length} 张图片未合并到图集，改为逐个处理。`);
+        taskQueue.unshift(...members.map(({file, cost}) => ({file, cost})));
+    }
+
+    /**
+     * 读取页面上填写的分块容器区域 "x,y,宽,高"，没有填写或格式不对时返回 null (解码整幅图像)。
+     * @returns {{x: number, y: number, width: number, height: number}|null}
+     */
+    function tileRegion() {
+        const tileRegionInput = document.getElementById('tileRegion');
+        const match = tileRegionInput && /^\s*(\d+)\s*[,，]\s*(\d+)\s*[,，]\s*(\d+)\s*[,，]\s*(\d+)\s*$/.exec(tileRegionInput.value);
+        if (!match) return null;
+        const [x, y, width, height] = match.slice(1).map(Number);
+        return width > 0 && height > 0 ? {x, y, width, height} : null;
+    }
+
+    /**
+     * 按文件大小把整批的编码预算分给一个任务，没有设置预算时返回 null。
+     * 时间预算按并行的 Worker 数放大: 整批耗时约等于各任务耗时之和除以同时工作的 Worker 数。
+     * @param {number} size - 任务输入文件的大小 (图集任务为各图之和)。
+     * @returns {{timeMs: number}|{bytes: number}|null}
+     */
+    function taskEncodeBudget(size) {
+        const budgetModeSelect = document.getElementById('budgetMode');
+        const budgetValueInput = document.getElementById('budgetValue');
+        const value = budgetValueInput ? Number(budgetValueInput.value) : 0;
+        if (!budgetModeSelect || budgetModeSelect.value === 'none' || !(value > 0) || batchBytes === 0) {
+            return null;
+        }
+        const share = size / batchBytes;
+        if (budgetModeSelect.value === 'time') return {timeMs: value * 1000 * share * batchParallelism};
+        return {bytes: value * 1048576 * share};
+    }
+
+    /**
+     * 把排队的归档压缩任务派发给空闲的 Worker。只在普通任务队列为空时调用，
+     * 并且同时进行的归档任务不超过 MAX_ARCHIVE_WORKERS 个。
+     */
+    function scheduleArchiveTasks() {
+        while (archiveQueue.length > 0) {
+            const archiving = workerPool.filter(w => w.archiveTask).length;
+            const freeWorkerWrapper = workerPool.find(w => !w.isBusy);
+            if (archiving >= MAX_ARCHIVE_WORKERS || !freeWorkerWrapper) return;
+
+            const task = archiveQueue.shift();
+            freeWorkerWrapper.isBusy = true;
+            freeWorkerWrapper.archiveTask = task;
+            freeWorkerWrapper.worker.postMessage({
+                mode: 'archive',
+                fileName: task.fileName,
+                file: task.entry.blob
+            });
+        }
+    }
+
 
 // --- 5. 检查是否所有工作都已完成 ---
 
@@ -134,12 +392,13 @@ if ('serviceWorker' in navigator) {
      */
     function checkIfAllDone() {
         // 如果任务队列不为空，说明还有任务在等待分配，不能结束
-        if (taskQueue.length > 0) {
+        // (任务还在准备中时队列暂时为空，也不能结束)
+        if (taskQueue.length > 0 || isPreparing) {
             return;
         }
 
-        // 检查是否所有工人现在都处于空闲状态
-        const allWorkersFree = workerPool.every(w => !w.isBusy);
+        // 检查是否所有工人现在都处于空闲状态 (后台归档压缩不算，快速结果已经可以下载)
+        const allWorkersFree = workerPool.every(w => !w.isBusy || w.archiveTask);
 
         // 只有当任务队列为空，并且所有工人也都空闲时，才意味着全部工作完成
         if (allWorkersFree) {
@@ -155,10 +414,71 @@ if ('serviceWorker' in navigator) {
     }
 
     function isSupportedImage(fileName) {
-        const supportedExtensions = ['.png', '.jpg', '.jpeg', '.bmp'];
+        const supportedExtensions = ['.png', '.jpg', '.jpeg', '.bmp', '.ppm', '.pgm'];
+        // QOI 和分块容器要模块支持才能打开 (Worker 就绪前先接受，处理时由 Worker 报错)
+        if (!moduleFeatures || moduleFeatures.qoi) supportedExtensions.push('.qoi');
+        if (!moduleFeatures || moduleFeatures.tiles) supportedExtensions.push('.stil');
         return supportedExtensions.some(ext => fileName.toLowerCase().endsWith(ext));
     }
 
+    /**
+     * 禁用当前 WASM 模块不支持的输出格式和选项 (预编译的模块可能比页面旧，重新构建见 wasm/build.sh)。
+     * @param {object} features - Worker 就绪时报告的功能 (见 crypto-worker.js 的 moduleFeatures)。
+     */
+    function applyModuleFeatures(features) {
+        const unsupported = '当前的 WASM 模块不支持，需要重新构建';
+        const markUnsupported = (element) => {
+            element.title = element.title ? `${element.title} (${unsupported})` : unsupported;
+        };
+        const disable = (element) => {
+            if (!element) return;
+            element.disabled = true;
+            markUnsupported(element);
+        };
+        const optionFeatures = {
+            'jpeg': features.jpegShuffle,
+            'qoi': features.qoi,
+            'png-stored': features.pngLevel,
+            'jpeg-lossy': features.jpegLossy,
+            'tiles': features.tiles
+        };
+        const outputFormatSelect = document.getElementById('outputFormat');
+        if (outputFormatSelect) {
+            for (const option of outputFormatSelect.options) {
+                if (optionFeatures[option.value] === false) disable(option);
+            }
+            if (outputFormatSelect.selectedOptions[0] && outputFormatSelect.selectedOptions[0].disabled) {
+                outputFormatSelect.value = 'png';
+                outputFormatSelect.dispatchEvent(new Event('change'));
+            }
+        }
+        if (!features.budget) {
+            const budgetModeSelect = document.getElementById('budgetMode');
+            if (budgetModeSelect) {
+                budgetModeSelect.value = 'none';
+                budgetModeSelect.dispatchEvent(new Event('change'));
+                disable(budgetModeSelect);
+            }
+        }
+        const checkboxFeatures = {archiveMode: features.pngLevel, atlasMode: features.atlas};
+        for (const [id, supported] of Object.entries(checkboxFeatures)) {
+            const input = document.getElementById(id);
+            if (supported || !input) continue;
+            input.checked = false;
+            input.disabled = true;
+            // 复选框的说明写在外层的 label 上
+            if (input.closest('label')) markUnsupported(input.closest('label'));
+        }
+        if (!features.tiles) disable(document.getElementById('tileRegion'));
+
+        // 文件选择器里去掉打不开的格式
+        const fileInput = document.getElementById('fileInput');
+        if (fileInput) {
+            const removed = [!features.qoi && '.qoi', !features.tiles && '.stil'].filter(Boolean);
+            fileInput.accept = fileInput.accept.split(',').filter(type => !removed.includes(type.trim())).join(',');
+        }
+    }
+
     /**
      * 使用 fflate 异步解压 ZIP 文件或直接处理支持的图片。
      * 这个函数会返回一个 Promise，以便与 async/await 流程无缝集成。
@@ -234,6 +554,22 @@ if ('serviceWorker' in navigator) {
     const dropZone = document.querySelector('.container');
 
     uploadButton.addEventListener('click', () => fileInput.click());
+    // 质量参数只对有损 JPEG 输出有意义
+    const outputFormatSelect = document.getElementById('outputFormat');
+    const jpegQualityInput = document.getElementById('jpegQuality');
+    if (outputFormatSelect && jpegQualityInput) {
+        outputFormatSelect.addEventListener('change', () => {
+            jpegQualityInput.disabled = outputFormatSelect.value !== 'jpeg-lossy';
+        });
+    }
+    // 选择了预算类型才需要填写预算值
+    const budgetModeSelect = document.getElementById('budgetMode');
+    const budgetValueInput = document.getElementById('budgetValue');
+    if (budgetModeSelect && budgetValueInput) {
+        budgetModeSelect.addEventListener('change', () => {
+            budgetValueInput.disabled = budgetModeSelect.value === 'none';
+        });
+    }
     fileInput.addEventListener('change', (event) => {
         const files = event.target.files;
         if (files.length > 0) {
@@ -288,7 +624,9 @@ if ('serviceWorker' in navigator) {
         resultsGrid.innerHTML = '';
         processedFiles = [];
         taskQueue.length = 0; // 确保清空旧的任务
+        archiveQueue.length = 0; // 上一批还没开始的归档压缩也不再需要
         isWorking = true;     // 开始工作！
+        isPreparing = true;
         uploadButton.disabled = true;
         downloadButton.disabled = true;
 
@@ -303,29 +641,48 @@ if ('serviceWorker' in navigator) {
             if (allImageFiles.length === 0) {
                 resultsGrid.innerHTML = '<p>未在您上传的文件或压缩包中找到支持的图片 (PNG, JPG, BMP)。</p>';
                 isWorking = false; // 没有任务，直接结束
+                isPreparing = false;
                 uploadButton.disabled = false;
                 return;
             }
 
-            // 3. 将所有文件转换为任务，并放入队列
+            batchBytes = allImageFiles.reduce((sum, file) => sum + file.size, 0);
+            batchParallelism = Math.min(MAX_WORKERS, allImageFiles.length);
+
+            // 为每个文件预先创建UI卡片
             for (const file of allImageFiles) {
-                // 为每个文件预先创建UI卡片
                 createResultCard(file.name);
-                try {
-                    // 将文件读取为 ArrayBuffer
-                    const buffer = await file.arrayBuffer();
-                    // 将任务（包含文件和其内容）推入队列
-                    taskQueue.push({file: file, buffer: buffer});
-                } catch (e) {
-                    // 如果单个文件读取失败，直接更新其卡片状态
-                    updateCardStatus(file.name, 'error', '文件读取失败', null);
-                }
             }
 
+            // 3. 派发前先探测文件头，估算每个任务的内存和计算量
+            // 主线程不预先读取文件内容，Worker 只读文件开头的一段，处理时才边读边解码
+            const infos = await probeImageHeaders(allImageFiles);
+            const tasks = [];
+            allImageFiles.forEach((file, index) => {
+                const info = infos[index];
+                const cost = estimateTaskCost(file, info);
+                // 解码到一半才耗尽 Worker 堆的图片直接拒绝
+                if (cost.bytes > WORKER_HEAP_LIMIT) {
+                    const needMb = Math.ceil(cost.bytes / 1048576);
+                    const size = info ? ` (${info.width}x${info.height})` : '';
+                    updateCardStatus(file.name, 'error', `图片过大${size}，约需 ${needMb} MB 内存，超出单个 Worker 的上限`, null);
+                    return;
+                }
+                tasks.push({file, info, cost});
+            });
+            // 图集模式下把小图按批合并，每批只打乱、编码一次
+            const atlasModeInput = document.getElementById('atlasMode');
+            const outputFormat = outputFormatSelect ? outputFormatSelect.value : 'png';
+            const atlasMode = !!(atlasModeInput && atlasModeInput.checked) && ATLAS_OUTPUT_FORMATS.includes(outputFormat);
+            taskQueue.push(...(atlasMode ? groupAtlasTasks(tasks) : tasks));
+            // 大任务先做: 队列末尾剩下的都是小任务，各 Worker 更可能同时完成
+            taskQueue.sort((a, b) => b.cost.pixels - a.cost.pixels);
+
             console.log(`已将 ${taskQueue.length} 个任务加入队列。`);
 
             // 4. 启动调度器
             // 此时，如果已经有 worker 准备好了，它们会立即开始处理任务
+            isPreparing = false;
             scheduleTasks();
 
         } catch (error) {
@@ -333,6 +690,7 @@ if ('serviceWorker' in navigator) {
             console.error("处理上传文件时发生严重错误:", error);
             resultsGrid.innerHTML = `<p class="status error">处理失败: ${error.message}</p>`;
             isWorking = false; // 发生严重错误，结束工作
+            isPreparing = false;
             uploadButton.disabled = false;
         }
     }
@@ -351,7 +709,15 @@ if ('serviceWorker' in navigator) {
         resultsGrid.appendChild(card);
     }
 
-    function updateCardStatus(fileName, status, message, blob) {
+    /**
+     * 更新结果卡片的状态。
+     * @param {string} fileName - 卡片对应的文件名。
+     * @param {string} status - 'processing'、'success' 或 'error'。
+     * @param {string} message - 状态文字。
+     * @param {Blob|null} blob - 成功时的结果文件，点击卡片时打开。
+     * @param {Blob|null} [thumbnail=null] - Worker 生成的缩小缩略图 (大 JPEG 结果)，没有时直接显示结果。
+     */
+    function updateCardStatus(fileName, status, message, blob, thumbnail = null) {
         const cardId = `card-${fileName.replace(/[^a-zA-Z0-9]/g, '-')}`;
         const card = document.getElementById(cardId);
         if (!card) return;
@@ -366,9 +732,16 @@ if ('serviceWorker' in navigator) {
             // 为 blob 创建一个可访问的 URL
             const imageUrl = URL.createObjectURL(blob);
 
-            const img = document.createElement('img');
-            img.src = imageUrl;
-            thumbnailContainer.appendChild(img);
+            // 浏览器无法显示 QOI 和分块容器，只显示格式名作为占位
+            if (blob.type === 'image/qoi') {
+                thumbnailContainer.textContent = 'QOI';
+            } else if (blob.type === 'application/x-stil') {
+                thumbnailContainer.textContent = 'STIL';
+            } else {
+                const img = document.createElement('img');
+                img.src = thumbnail ? URL.createObjectURL(thumbnail) : imageUrl;
+                thumbnailContainer.appendChild(img);
+            }
 
             const statusBadge = document.createElement('span');
             statusBadge.className = 'status success';
@@ -398,6 +771,16 @@ if ('serviceWorker' in navigator) {
         }
     }
 
+    /**
+     * 只替换成功卡片上的状态文字，缩略图和点击事件保持不变。
+     */
+    function updateCardMessage(fileName, message) {
+        const cardId = `card-${fileName.replace(/[^a-zA-Z0-9]/g, '-')}`;
+        const card = document.getElementById(cardId);
+        const statusBadge = card && card.querySelector('.status.success');
+        if (statusBadge) statusBadge.textContent = message;
+    }
+
     // [新函数] 智能下载处理器
     async function handleDownload() {
         if (processedFiles.length === 0) return;
@@ -1,6 +1,6 @@
 // sw.js
 
-const CACHE_NAME = 'image-encryptor-v3';
+const CACHE_NAME = 'image-encryptor-v4';
 
 // 需要缓存的完整文件列表，包括所有 HTML、CSS、JS 和第三方库
 const URLS_TO_CACHE = [
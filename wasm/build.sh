@@ -0,0 +1,56 @@
+#!/bin/sh
+# =======================================================================
+# ==     用 Emscripten 重新生成 js/image_processor.js 和 .wasm           ==
+# =======================================================================
+# 用法 (需要 emcc 在 PATH 中):
+#   ./build.sh              单线程构建
+#   THREADS=1 ./build.sh    多线程构建: JPEG 按重启区间并行解码、分块容器并行编码。
+#                           页面需跨源隔离才能使用 SharedArrayBuffer，即服务器要对页面和脚本发送
+#                             Cross-Origin-Opener-Policy: same-origin
+#                             Cross-Origin-Embedder-Policy: require-corp
+#                           GitHub Pages 等不能设置响应头的静态托管做不到，所以仓库里提交的是
+#                           单线程构建，上述并行解码/编码在这样部署的页面上不会启用。
+#                           多线程构建同样输出到 js/image_processor.js，只部署到能发送这两个头的服务器。
+#
+# 新增 EMSCRIPTEN_KEEPALIVE 导出时，同时加到下面的 EXPORTED_FUNCTIONS。
+# crypto-worker.js 对旧模块里没有的导出做了判断 (缺少时为 null)，
+# 所以没有重新构建时页面仍按旧的功能运行，只是新功能不可用:
+# Worker 就绪时报告模块支持的功能，页面禁用没有导出支持的输出格式和选项。
+set -e
+cd "$(dirname "$0")"
+
+EXPORTS="
+    malloc free
+    perform_encryption perform_decryption perform_decryption_rows
+    decode_image_wasm probe_image_wasm probe_image_header_wasm decode_image_into_wasm
+    set_jpeg_decode_threads
+    png_stream_create_wasm png_stream_feed_wasm png_stream_info_wasm
+    png_stream_set_output_wasm png_stream_free_wasm
+    png_stream_decrypt_begin_wasm png_stream_decrypt_result_wasm png_stream_decrypt_free_wasm
+    output_read_wasm output_free_wasm
+    set_png_compression_level_wasm choose_png_level_wasm choose_png_shuffled_level_wasm
+    encode_png_wasm encode_jpeg_wasm encode_qoi_wasm
+    encode_png_shuffled_wasm encode_qoi_shuffled_wasm
+    tile_dedup_build_wasm tile_dedup_unique_count_wasm tile_dedup_free_wasm tile_dedup_expand_wasm
+    jpeg_is_tile_shuffled_wasm jpeg_tile_shuffle_wasm jpeg_tile_unshuffle_wasm make_shuffle_map_wasm
+    set_tile_container_threads encode_tile_container_wasm tile_container_header_size_wasm
+    tile_container_open_wasm tile_container_free_wasm tile_container_info_wasm
+    tile_container_region_slots_wasm tile_container_decode_region_wasm
+    arena_stats_wasm arena_reset_wasm
+"
+EXPORTED_FUNCTIONS=$(printf '_%s,' $EXPORTS)
+EXPORTED_FUNCTIONS=${EXPORTED_FUNCTIONS%,}
+
+THREAD_FLAGS=""
+if [ "${THREADS:-0}" = "1" ]; then
+    # 线程数与 crypto-worker.js 中 set_*_threads 的上限 (4) 一致
+    THREAD_FLAGS="-pthread -sPTHREAD_POOL_SIZE=4"
+fi
+
+emcc -O3 -msimd128 $THREAD_FLAGS \
+    image_process.c image_codecs_wasm.c \
+    -sMODULARIZE=1 -sEXPORT_NAME=createImageProcessorModule \
+    -sALLOW_MEMORY_GROWTH=1 -sMAXIMUM_MEMORY=2gb \
+    -sEXPORTED_FUNCTIONS="$EXPORTED_FUNCTIONS" \
+    -sEXPORTED_RUNTIME_METHODS=cwrap,getValue,setValue,HEAPU8,HEAPU32 \
+    -o ../js/image_processor.js
@@ -0,0 +1,720 @@
+#ifndef DEFLATE_OPTIMAL_H
+#define DEFLATE_OPTIMAL_H
+
+// =======================================================================
+// ==          归档模式的 deflate: 迭代最优解析 (zopfli 式)               ==
+// =======================================================================
+// stb 内置的压缩器只用固定 Huffman 表和贪心/惰性匹配，速度优先。长期存档时体积比耗时重要，
+// 这里按 zopfli 的思路换取更小的输出:
+//   - 哈希链为每个位置找出所有有用的 (长度, 距离) 组合: 每个长度取最近的距离
+//   - 给定每个符号的比特代价，用动态规划求整段数据代价最小的字面量/匹配序列
+//   - 用这一次解析的符号统计重新估计代价 (熵)，再解析一遍，迭代若干次取总比特数最少的结果
+//   - 输入按 DOPT_CHUNK 分段解析，相邻分段合在一起更省时共用一张动态 Huffman 表，
+//     否则各自成块；每块在动态表、固定表和存储块中选最小的一种
+// 输出是完整的 zlib 流 (头部 + deflate 块 + Adler-32)，签名与 STBIW_ZLIB_COMPRESS 兼容的包装见
+// image_codecs_wasm.c。临时内存和返回的缓冲区都用 DEFLATE_OPT_MALLOC 分配 (默认 malloc)，
+// 调用方用对应的 DEFLATE_OPT_FREE 释放。
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef DEFLATE_OPT_MALLOC
+#define DEFLATE_OPT_MALLOC(sz)                    malloc(sz)
+#define DEFLATE_OPT_REALLOC_SIZED(p, oldsz, newsz) realloc(p, newsz)
+#define DEFLATE_OPT_FREE(p)                       free(p)
+#endif
+
+#define DOPT_WINDOW 32768
+#define DOPT_MIN_MATCH 3
+#define DOPT_MAX_MATCH 258
+#define DOPT_HASH_BITS 15
+// 每个位置沿哈希链最多比较的候选数 (zopfli 为 8192，这里取一个更省时的值)
+#define DOPT_CHAIN_MAX 1024
+// 每次最优解析的输入长度。分段越短 Huffman 表越贴近局部统计，合并判断会把统计相近的分段连起来
+#define DOPT_CHUNK 32768
+// 一个合并块最多累积的符号数，限制待写出符号占用的内存
+#define DOPT_BLOCK_SYMBOLS_MAX (1 << 20)
+#define DOPT_INFINITY 1e300
+
+static const unsigned short dopt_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char dopt_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short dopt_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const unsigned char dopt_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// 码长码的写出顺序 (RFC 1951 3.2.7)
+static const unsigned char dopt_clen_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// 一个解析结果符号: dist 为 0 时 litlen 是字面量，否则是长度为 litlen、距离为 dist 的匹配
+typedef struct {
+    unsigned short litlen;
+    unsigned short dist;
+} DoptSymbol;
+
+// 一段符号的统计: 字面量/长度 288 个，距离 30 个 (第 256 个是块结束符)
+typedef struct {
+    unsigned int ll[288];
+    unsigned int d[30];
+} DoptFreqs;
+
+typedef struct {
+    unsigned char* out;
+    size_t pos;
+    unsigned long long bits;
+    int count;
+} DoptWriter;
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    int iterations;
+    unsigned char len_symbol[DOPT_MAX_MATCH + 1]; // 长度 -> 长度码下标 (0..28)
+
+    int* head;                 // 哈希 -> 最近的位置
+    int* prev;                 // 位置 (按窗口取模) -> 同一哈希的上一个位置
+    // 当前分段的匹配: 位置 i 的 (长度, 距离) 组合在 pairs[match_start[i] .. match_start[i + 1])，
+    // 长度和距离都递增，长度在 (上一个组合的长度, 本组合的长度] 内时最近的距离是本组合的距离
+    unsigned int* match_start;
+    unsigned short* pairs;
+    size_t pairs_capacity;     // 以组合为单位
+    unsigned short* same;      // 从每个位置起相同字节的个数，用于跳过长游程
+    double* cost;              // 动态规划: 到达每个位置的最小代价
+    unsigned short* step_len;  // 到达该位置的最后一步: 1 为字面量，否则为匹配长度
+    unsigned short* step_dist;
+    DoptSymbol* parse;         // 本次迭代的解析结果
+    DoptSymbol* best;          // 总比特数最少的解析结果
+
+    DoptSymbol* block;         // 等待写出的合并块
+    size_t block_count, block_capacity;
+    size_t block_start;        // 合并块对应的输入起点
+    DoptFreqs block_freqs;
+} DoptState;
+
+static inline int dopt_dist_symbol(int dist) {
+    if (dist <= 4) return dist - 1;
+    // 距离码 2k 和 2k + 1 覆盖 (2^k, 2^(k + 1)]，再由次高位区分
+    const unsigned int v = (unsigned int)dist - 1;
+    const int msb = 31 - __builtin_clz(v);
+    return 2 * msb + (int)((v >> (msb - 1)) & 1);
+}
+
+static inline unsigned int dopt_hash(const unsigned char* p) {
+    const unsigned int v = (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16);
+    return (v * 2654435761u) >> (32 - DOPT_HASH_BITS);
+}
+
+// =======================================================================
+// ==          Huffman 码长与码表                                       ==
+// =======================================================================
+
+// 按频率构造码长不超过 max_bits 的 Huffman 码。只有 0 或 1 个符号出现时补足两个 1 比特的码，
+// 得到完整的码表 (有些解码器不接受不完整的码表，zopfli 也这样处理)
+static void dopt_huffman_lengths(const unsigned int* freq, int count, int max_bits, unsigned char* lengths) {
+    int symbols[288];
+    unsigned int weight[2 * 288];
+    int parent[2 * 288];
+    int depth_count[2 * 288 + 1];
+    int m = 0;
+
+    memset(lengths, 0, (size_t)count);
+    for (int s = 0; s < count; ++s) {
+        if (freq[s]) symbols[m++] = s;
+    }
+    if (m < 2) {
+        const int used = m == 1 ? symbols[0] : 0;
+        lengths[used] = 1;
+        lengths[used == 0 ? 1 : 0] = 1;
+        return;
+    }
+
+    // 按频率升序 (同频率按符号) 插入排序，符号数最多 288
+    for (int i = 1; i < m; ++i) {
+        const int s = symbols[i];
+        int j = i - 1;
+        while (j >= 0 && freq[symbols[j]] > freq[s]) {
+            symbols[j + 1] = symbols[j];
+            --j;
+        }
+        symbols[j + 1] = s;
+    }
+
+    // 两个队列建树: 叶子 0..m-1 已按权重排好，内部结点按创建顺序权重也不减
+    for (int i = 0; i < m; ++i) weight[i] = freq[symbols[i]];
+    int leaf = 0, inner = m;
+    for (int node = m; node < 2 * m - 1; ++node) {
+        int pick[2];
+        for (int k = 0; k < 2; ++k) {
+            if (leaf < m && (inner >= node || weight[leaf] <= weight[inner])) pick[k] = leaf++;
+            else pick[k] = inner++;
+        }
+        weight[node] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = parent[pick[1]] = node;
+    }
+    // 父结点的下标总比子结点大，倒序一遍即可得到深度 (weight 复用为深度)
+    weight[2 * m - 2] = 0;
+    for (int node = 2 * m - 3; node >= 0; --node) weight[node] = weight[parent[node]] + 1;
+
+    // 超过 max_bits 的码长先截到 max_bits，再把较短的码逐个加长直到满足 Kraft 等式
+    memset(depth_count, 0, sizeof(depth_count));
+    for (int i = 0; i < m; ++i) depth_count[weight[i] > (unsigned int)max_bits ? max_bits : (int)weight[i]]++;
+    unsigned int total = 0;
+    for (int l = max_bits; l > 0; --l) total += (unsigned int)depth_count[l] << (max_bits - l);
+    while (total != (1u << max_bits)) {
+        depth_count[max_bits]--;
+        for (int l = max_bits - 1; l > 0; --l) {
+            if (depth_count[l]) {
+                depth_count[l]--;
+                depth_count[l + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // 频率最低的符号拿最长的码
+    int i = 0;
+    for (int l = max_bits; l > 0; --l) {
+        for (int k = 0; k < depth_count[l]; ++k) lengths[symbols[i++]] = (unsigned char)l;
+    }
+}
+
+// 规范 Huffman 码 (RFC 1951 3.2.2)，按 deflate 的比特顺序反转后存入 codes
+static void dopt_huffman_codes(const unsigned char* lengths, int count, unsigned short* codes) {
+    unsigned short bl_count[16] = {0}, next_code[16];
+    for (int s = 0; s < count; ++s) bl_count[lengths[s]]++;
+    bl_count[0] = 0;
+    unsigned int code = 0;
+    for (int l = 1; l < 16; ++l) {
+        code = (code + bl_count[l - 1]) << 1;
+        next_code[l] = (unsigned short)code;
+    }
+    for (int s = 0; s < count; ++s) {
+        const int l = lengths[s];
+        if (!l) continue;
+        unsigned int c = next_code[l]++, r = 0;
+        for (int b = 0; b < l; ++b, c >>= 1) r = (r << 1) | (c & 1);
+        codes[s] = (unsigned short)r;
+    }
+}
+
+// =======================================================================
+// ==          块的比特数与写出                                          ==
+// =======================================================================
+
+static inline void dopt_put(DoptWriter* w, unsigned int value, int bits) {
+    if (!w) return;
+    w->bits |= (unsigned long long)value << w->count;
+    w->count += bits;
+    while (w->count >= 8) {
+        w->out[w->pos++] = (unsigned char)w->bits;
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+static void dopt_align(DoptWriter* w) {
+    if (w->count > 0) {
+        w->out[w->pos++] = (unsigned char)w->bits;
+        w->bits = 0;
+        w->count = 0;
+    }
+}
+
+// 两张表的码长按 RFC 1951 的游程码 (16/17/18) 写出，返回动态块头部的比特数 (不含 BFINAL/BTYPE)。
+// w 为 NULL 时只计算比特数
+static size_t dopt_write_tree(DoptWriter* w, const unsigned char* ll_lengths, const unsigned char* d_lengths) {
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && ll_lengths[hlit - 1] == 0) --hlit;
+    while (hdist > 1 && d_lengths[hdist - 1] == 0) --hdist;
+
+    unsigned char all[286 + 30];
+    memcpy(all, ll_lengths, (size_t)hlit);
+    memcpy(all + hlit, d_lengths, (size_t)hdist);
+    const int total = hlit + hdist;
+
+    // 游程编码，同一游程可以跨过两张表的分界 (RFC 允许)
+    unsigned char items[286 + 30], extras[286 + 30];
+    int item_count = 0;
+    unsigned int clen_freq[19] = {0};
+    for (int i = 0; i < total;) {
+        const unsigned char v = all[i];
+        int run = 1;
+        while (i + run < total && all[i + run] == v) ++run;
+        i += run;
+        if (v == 0) {
+            while (run >= 11) {
+                const int r = run < 138 ? run : 138;
+                items[item_count] = 18;
+                extras[item_count++] = (unsigned char)(r - 11);
+                run -= r;
+            }
+            if (run >= 3) {
+                items[item_count] = 17;
+                extras[item_count++] = (unsigned char)(run - 3);
+                run = 0;
+            }
+        } else {
+            items[item_count] = v;
+            extras[item_count++] = 0;
+            --run;
+            while (run >= 3) {
+                const int r = run < 6 ? run : 6;
+                items[item_count] = 16;
+                extras[item_count++] = (unsigned char)(r - 3);
+                run -= r;
+            }
+        }
+        while (run-- > 0) {
+            items[item_count] = v;
+            extras[item_count++] = 0;
+        }
+    }
+    for (int k = 0; k < item_count; ++k) clen_freq[items[k]]++;
+
+    unsigned char clen_lengths[19];
+    unsigned short clen_codes[19];
+    dopt_huffman_lengths(clen_freq, 19, 7, clen_lengths);
+    dopt_huffman_codes(clen_lengths, 19, clen_codes);
+    int hclen = 19;
+    while (hclen > 4 && clen_lengths[dopt_clen_order[hclen - 1]] == 0) --hclen;
+
+    static const unsigned char repeat_bits[3] = {2, 3, 7};
+    size_t bits = 5 + 5 + 4 + 3 * (size_t)hclen;
+    dopt_put(w, (unsigned int)(hlit - 257), 5);
+    dopt_put(w, (unsigned int)(hdist - 1), 5);
+    dopt_put(w, (unsigned int)(hclen - 4), 4);
+    for (int k = 0; k < hclen; ++k) dopt_put(w, clen_lengths[dopt_clen_order[k]], 3);
+    for (int k = 0; k < item_count; ++k) {
+        const int s = items[k];
+        bits += clen_lengths[s];
+        dopt_put(w, clen_codes[s], clen_lengths[s]);
+        if (s >= 16) {
+            bits += repeat_bits[s - 16];
+            dopt_put(w, extras[k], repeat_bits[s - 16]);
+        }
+    }
+    return bits;
+}
+
+// 按统计和码长计算符号数据的比特数 (含额外比特和块结束符)
+static size_t dopt_data_bits(const DoptFreqs* f, const unsigned char* ll_lengths, const unsigned char* d_lengths) {
+    size_t bits = 0;
+    for (int s = 0; s < 286; ++s) {
+        bits += (size_t)f->ll[s] * ll_lengths[s];
+        if (s >= 257) bits += (size_t)f->ll[s] * dopt_len_extra[s - 257];
+    }
+    for (int s = 0; s < 30; ++s) bits += (size_t)f->d[s] * (d_lengths[s] + dopt_dist_extra[s]);
+    return bits;
+}
+
+static void dopt_fixed_lengths(unsigned char* ll_lengths, unsigned char* d_lengths) {
+    for (int s = 0; s < 288; ++s) ll_lengths[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+    for (int s = 0; s < 30; ++s) d_lengths[s] = 5;
+}
+
+// 动态块 (头部 + 数据) 的比特数，码长写入 ll_lengths / d_lengths
+static size_t dopt_dynamic_bits(const DoptFreqs* f, unsigned char* ll_lengths, unsigned char* d_lengths) {
+    dopt_huffman_lengths(f->ll, 286, 15, ll_lengths);
+    ll_lengths[286] = ll_lengths[287] = 0; // 286、287 不会出现
+    dopt_huffman_lengths(f->d, 30, 15, d_lengths);
+    return dopt_write_tree(NULL, ll_lengths, d_lengths) + dopt_data_bits(f, ll_lengths, d_lengths);
+}
+
+static void dopt_count(const DoptState* st, const DoptSymbol* symbols, size_t count, DoptFreqs* f) {
+    memset(f, 0, sizeof(*f));
+    for (size_t k = 0; k < count; ++k) {
+        if (symbols[k].dist == 0) {
+            f->ll[symbols[k].litlen]++;
+        } else {
+            f->ll[257 + st->len_symbol[symbols[k].litlen]]++;
+            f->d[dopt_dist_symbol(symbols[k].dist)]++;
+        }
+    }
+    f->ll[256] = 1;
+}
+
+static void dopt_write_symbols(DoptWriter* w, const DoptState* st, const DoptSymbol* symbols, size_t count,
+                               const unsigned char* ll_lengths, const unsigned char* d_lengths) {
+    unsigned short ll_codes[288], d_codes[30];
+    dopt_huffman_codes(ll_lengths, 288, ll_codes);
+    dopt_huffman_codes(d_lengths, 30, d_codes);
+    for (size_t k = 0; k < count; ++k) {
+        const DoptSymbol s = symbols[k];
+        if (s.dist == 0) {
+            dopt_put(w, ll_codes[s.litlen], ll_lengths[s.litlen]);
+            continue;
+        }
+        const int ls = st->len_symbol[s.litlen], ds = dopt_dist_symbol(s.dist);
+        dopt_put(w, ll_codes[257 + ls], ll_lengths[257 + ls]);
+        dopt_put(w, (unsigned int)(s.litlen - dopt_len_base[ls]), dopt_len_extra[ls]);
+        dopt_put(w, d_codes[ds], d_lengths[ds]);
+        dopt_put(w, (unsigned int)(s.dist - dopt_dist_base[ds]), dopt_dist_extra[ds]);
+    }
+    dopt_put(w, ll_codes[256], ll_lengths[256]);
+}
+
+// 存储块的比特数上限 (对齐按最坏的 7 比特算)，每 65535 字节一块
+static size_t dopt_stored_bits(size_t length) {
+    const size_t pieces = length == 0 ? 1 : (length + 65534) / 65535;
+    return pieces * (3 + 7 + 32) + length * 8;
+}
+
+// 写出输入 [start, start + length) 对应的一个块: 在动态表、固定表和存储块中选比特数最少的
+static void dopt_write_block(DoptWriter* w, const DoptState* st, const DoptSymbol* symbols, size_t count,
+                             const DoptFreqs* f, size_t start, size_t length, int final) {
+    unsigned char ll_lengths[288], d_lengths[30], fixed_ll[288], fixed_d[30];
+    const size_t dynamic_bits = dopt_dynamic_bits(f, ll_lengths, d_lengths);
+    dopt_fixed_lengths(fixed_ll, fixed_d);
+    const size_t fixed_bits = dopt_data_bits(f, fixed_ll, fixed_d);
+    const size_t stored_bits = dopt_stored_bits(length);
+
+    if (stored_bits < dynamic_bits && stored_bits < fixed_bits) {
+        size_t pos = 0;
+        do {
+            const size_t piece = length - pos < 65535 ? length - pos : 65535;
+            dopt_put(w, (final && pos + piece == length) ? 1 : 0, 1);
+            dopt_put(w, 0, 2);
+            dopt_align(w);
+            dopt_put(w, (unsigned int)piece, 16);
+            dopt_put(w, (unsigned int)(~piece & 0xffff), 16);
+            memcpy(w->out + w->pos, st->data + start + pos, piece);
+            w->pos += piece;
+            pos += piece;
+        } while (pos < length);
+    } else if (fixed_bits <= dynamic_bits) {
+        dopt_put(w, (unsigned int)final, 1);
+        dopt_put(w, 1, 2);
+        dopt_write_symbols(w, st, symbols, count, fixed_ll, fixed_d);
+    } else {
+        dopt_put(w, (unsigned int)final, 1);
+        dopt_put(w, 2, 2);
+        dopt_write_tree(w, ll_lengths, d_lengths);
+        dopt_write_symbols(w, st, symbols, count, ll_lengths, d_lengths);
+    }
+}
+
+// =======================================================================
+// ==          匹配查找与最优解析                                        ==
+// =======================================================================
+
+// 找出分段 [start, end) 内每个位置的 (长度, 距离) 组合，同时把这些位置加入哈希链
+static int dopt_find_matches(DoptState* st, size_t start, size_t end) {
+    const unsigned char* data = st->data;
+    size_t count = 0;
+    for (size_t i = start; i < end; ++i) {
+        st->match_start[i - start] = (unsigned int)count;
+        if (i + DOPT_MIN_MATCH > st->size) continue;
+
+        const size_t remaining = st->size - i;
+        const int limit = remaining < DOPT_MAX_MATCH ? (int)remaining : DOPT_MAX_MATCH;
+        const unsigned int h = dopt_hash(data + i);
+        int best = DOPT_MIN_MATCH - 1;
+        int chain = DOPT_CHAIN_MAX;
+        for (int p = st->head[h]; p >= 0 && i - (size_t)p <= DOPT_WINDOW && chain-- > 0;
+             p = st->prev[p & (DOPT_WINDOW - 1)]) {
+            const unsigned char* a = data + p;
+            const unsigned char* b = data + i;
+            if (a[best] != b[best]) continue;
+            int len = 0;
+            while (len < limit && a[len] == b[len]) ++len;
+            if (len <= best) continue;
+
+            if (count == st->pairs_capacity) {
+                const size_t grown = st->pairs_capacity * 2;
+                unsigned short* pairs = (unsigned short*)DEFLATE_OPT_REALLOC_SIZED(
+                    st->pairs, st->pairs_capacity * 2 * sizeof(unsigned short), grown * 2 * sizeof(unsigned short));
+                if (!pairs) return 0;
+                st->pairs = pairs;
+                st->pairs_capacity = grown;
+            }
+            st->pairs[2 * count] = (unsigned short)len;
+            st->pairs[2 * count + 1] = (unsigned short)(i - (size_t)p);
+            ++count;
+            best = len;
+            if (len == limit) break;
+        }
+        st->prev[i & (DOPT_WINDOW - 1)] = st->head[h];
+        st->head[h] = (int)i;
+    }
+    st->match_start[end - start] = (unsigned int)count;
+
+    // 从每个位置起相同字节的个数 (最多 65535)
+    const size_t n = end - start;
+    size_t run = 1;
+    while (end - 1 + run < st->size && run < 65535 && data[end - 1 + run] == data[end - 1]) ++run;
+    st->same[n - 1] = (unsigned short)run;
+    for (size_t k = n - 1; k-- > 0;) {
+        const size_t s = data[start + k] == data[start + k + 1] ? st->same[k + 1] + 1u : 1u;
+        st->same[k] = (unsigned short)(s < 65535 ? s : 65535);
+    }
+    return 1;
+}
+
+// 代价模型: 字面量/长度码、距离码的比特数 (不含额外比特)
+typedef struct {
+    double ll[288];
+    double d[30];
+} DoptCosts;
+
+static void dopt_fixed_costs(DoptCosts* c) {
+    unsigned char ll_lengths[288], d_lengths[30];
+    dopt_fixed_lengths(ll_lengths, d_lengths);
+    for (int s = 0; s < 288; ++s) c->ll[s] = ll_lengths[s];
+    for (int s = 0; s < 30; ++s) c->d[s] = d_lengths[s];
+}
+
+// 按统计的熵估计代价；没出现过的符号按出现一次计
+static void dopt_entropy_costs(const DoptFreqs* f, DoptCosts* c) {
+    unsigned int ll_total = 0, d_total = 0;
+    for (int s = 0; s < 288; ++s) ll_total += f->ll[s];
+    for (int s = 0; s < 30; ++s) d_total += f->d[s];
+    const double ll_log = log2(ll_total ? ll_total : 1);
+    const double d_log = log2(d_total ? d_total : 1);
+    for (int s = 0; s < 288; ++s) c->ll[s] = ll_log - (f->ll[s] ? log2(f->ll[s]) : 0.0);
+    for (int s = 0; s < 30; ++s) c->d[s] = d_log - (f->d[s] ? log2(f->d[s]) : 0.0);
+}
+
+// 按代价模型对分段 [start, end) 做一次最短路径解析，结果写入 st->parse，返回符号数
+static size_t dopt_parse(DoptState* st, size_t start, size_t end, const DoptCosts* c) {
+    const unsigned char* data = st->data;
+    const size_t n = end - start;
+    double len_cost[DOPT_MAX_MATCH + 1];
+    for (int l = DOPT_MIN_MATCH; l <= DOPT_MAX_MATCH; ++l) {
+        const int ls = st->len_symbol[l];
+        len_cost[l] = c->ll[257 + ls] + dopt_len_extra[ls];
+    }
+    const double run_cost = len_cost[DOPT_MAX_MATCH] + c->d[0];
+
+    st->cost[0] = 0;
+    for (size_t k = 1; k <= n; ++k) st->cost[k] = DOPT_INFINITY;
+
+    for (size_t k = 0; k < n; ++k) {
+        // 长游程中间的位置: 直接以距离 1、最大长度前进，不再逐个长度比较 (zopfli 的同名优化)
+        if (st->same[k] > DOPT_MAX_MATCH * 2 && k > DOPT_MAX_MATCH + 1 && k + DOPT_MAX_MATCH * 2 + 1 < n &&
+            st->same[k - DOPT_MAX_MATCH] > DOPT_MAX_MATCH) {
+            for (int r = 0; r < DOPT_MAX_MATCH; ++r, ++k) {
+                st->cost[k + DOPT_MAX_MATCH] = st->cost[k] + run_cost;
+                st->step_len[k + DOPT_MAX_MATCH] = DOPT_MAX_MATCH;
+                st->step_dist[k + DOPT_MAX_MATCH] = 1;
+            }
+        }
+
+        const double base = st->cost[k];
+        const double lit = base + c->ll[data[start + k]];
+        if (lit < st->cost[k + 1]) {
+            st->cost[k + 1] = lit;
+            st->step_len[k + 1] = 1;
+            st->step_dist[k + 1] = 0;
+        }
+
+        // 匹配不越过分段末尾
+        const int max_len = n - k < DOPT_MAX_MATCH ? (int)(n - k) : DOPT_MAX_MATCH;
+        int from = DOPT_MIN_MATCH;
+        for (unsigned int m = st->match_start[k]; m < st->match_start[k + 1] && from <= max_len; ++m) {
+            const int pair_len = st->pairs[2 * m] < max_len ? st->pairs[2 * m] : max_len;
+            const int dist = st->pairs[2 * m + 1];
+            const int ds = dopt_dist_symbol(dist);
+            const double dist_cost = base + c->d[ds] + dopt_dist_extra[ds];
+            for (int l = from; l <= pair_len; ++l) {
+                const double total = dist_cost + len_cost[l];
+                if (total < st->cost[k + l]) {
+                    st->cost[k + l] = total;
+                    st->step_len[k + l] = (unsigned short)l;
+                    st->step_dist[k + l] = (unsigned short)dist;
+                }
+            }
+            from = pair_len + 1;
+        }
+    }
+
+    // 从末尾沿最后一步回溯，符号先倒序写在 parse 的尾部再移到开头
+    size_t count = 0;
+    for (size_t k = n; k > 0; k -= st->step_len[k]) {
+        DoptSymbol* s = &st->parse[n - 1 - count++];
+        if (st->step_dist[k] == 0) {
+            s->litlen = data[start + k - 1];
+            s->dist = 0;
+        } else {
+            s->litlen = st->step_len[k];
+            s->dist = st->step_dist[k];
+        }
+    }
+    memmove(st->parse, st->parse + n - count, count * sizeof(DoptSymbol));
+    return count;
+}
+
+// 分段 [start, end) 迭代解析，最好的结果留在 st->best，返回符号数并写出统计
+static size_t dopt_optimize_chunk(DoptState* st, size_t start, size_t end, DoptFreqs* best_freqs) {
+    DoptCosts costs;
+    DoptFreqs freqs;
+    unsigned char ll_lengths[288], d_lengths[30];
+    size_t best_count = 0, best_bits = (size_t)-1;
+
+    dopt_fixed_costs(&costs);
+    for (int it = 0; it < st->iterations; ++it) {
+        const size_t count = dopt_parse(st, start, end, &costs);
+        dopt_count(st, st->parse, count, &freqs);
+        const size_t bits = dopt_dynamic_bits(&freqs, ll_lengths, d_lengths);
+        if (bits < best_bits) {
+            best_bits = bits;
+            best_count = count;
+            *best_freqs = freqs;
+            memcpy(st->best, st->parse, count * sizeof(DoptSymbol));
+        }
+        dopt_entropy_costs(&freqs, &costs);
+    }
+    return best_count;
+}
+
+// =======================================================================
+// ==          zlib 流                                                  ==
+// =======================================================================
+
+static unsigned int dopt_adler32(const unsigned char* data, size_t size) {
+    unsigned int s1 = 1, s2 = 0;
+    while (size > 0) {
+        const size_t block = size < 5552 ? size : 5552;
+        for (size_t i = 0; i < block; ++i) {
+            s1 += data[i];
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+        data += block;
+        size -= block;
+    }
+    return (s2 << 16) | s1;
+}
+
+// 已解析分段 [chunk_start, chunk_end) 的最优结果 (st->best) 并入等待写出的块；
+// 合在一起比分开写更省时才合并，否则先写出之前的块
+static int dopt_add_chunk(DoptState* st, DoptWriter* w, size_t count, const DoptFreqs* f, size_t chunk_start) {
+    if (st->block_count > 0) {
+        DoptFreqs merged;
+        unsigned char ll_lengths[288], d_lengths[30];
+        for (int s = 0; s < 288; ++s) merged.ll[s] = st->block_freqs.ll[s] + f->ll[s];
+        for (int s = 0; s < 30; ++s) merged.d[s] = st->block_freqs.d[s] + f->d[s];
+        merged.ll[256] = 1;
+        const size_t separate = dopt_dynamic_bits(&st->block_freqs, ll_lengths, d_lengths) +
+                                dopt_dynamic_bits(f, ll_lengths, d_lengths);
+        if (dopt_dynamic_bits(&merged, ll_lengths, d_lengths) > separate ||
+            st->block_count + count > DOPT_BLOCK_SYMBOLS_MAX) {
+            dopt_write_block(w, st, st->block, st->block_count, &st->block_freqs, st->block_start,
+                             chunk_start - st->block_start, 0);
+            st->block_count = 0;
+        } else {
+            st->block_freqs = merged;
+        }
+    }
+    if (st->block_count == 0) {
+        st->block_start = chunk_start;
+        st->block_freqs = *f;
+    }
+
+    if (st->block_count + count > st->block_capacity) {
+        size_t grown = st->block_capacity * 2;
+        while (grown < st->block_count + count) grown *= 2;
+        DoptSymbol* block = (DoptSymbol*)DEFLATE_OPT_REALLOC_SIZED(
+            st->block, st->block_capacity * sizeof(DoptSymbol), grown * sizeof(DoptSymbol));
+        if (!block) return 0;
+        st->block = block;
+        st->block_capacity = grown;
+    }
+    memcpy(st->block + st->block_count, st->best, count * sizeof(DoptSymbol));
+    st->block_count += count;
+    return 1;
+}
+
+// 压缩为 zlib 流。iterations 为每个分段的解析次数 (至少 1)。失败返回 NULL
+static unsigned char* deflate_optimal_zlib(const unsigned char* data, size_t size, size_t* out_size, int iterations) {
+    DoptState st;
+    memset(&st, 0, sizeof(st));
+    st.data = data;
+    st.size = size;
+    st.iterations = iterations < 1 ? 1 : iterations;
+    for (int ls = 0, l = DOPT_MIN_MATCH; l <= DOPT_MAX_MATCH; ++l) {
+        while (ls < 28 && l >= dopt_len_base[ls + 1]) ++ls;
+        st.len_symbol[l] = (unsigned char)ls;
+    }
+
+    // 每个块都不会比存储块大，按存储块的上限一次分配输出
+    const size_t chunks = size / DOPT_CHUNK + 1;
+    const size_t capacity = size + 6 * (size / 65535 + chunks + 1) + 16;
+    unsigned char* out = (unsigned char*)DEFLATE_OPT_MALLOC(capacity);
+    if (!out) return NULL;
+
+    // 分配顺序与释放顺序相反，arena 可以逐个回收
+    const size_t n = size < DOPT_CHUNK ? size : DOPT_CHUNK;
+    st.pairs_capacity = n + 1024;
+    st.block_capacity = n + 1;
+    st.head = (int*)DEFLATE_OPT_MALLOC(sizeof(int) << DOPT_HASH_BITS);
+    st.prev = (int*)DEFLATE_OPT_MALLOC(sizeof(int) * DOPT_WINDOW);
+    st.match_start = (unsigned int*)DEFLATE_OPT_MALLOC(sizeof(unsigned int) * (n + 1));
+    st.same = (unsigned short*)DEFLATE_OPT_MALLOC(sizeof(unsigned short) * (n + 1));
+    st.cost = (double*)DEFLATE_OPT_MALLOC(sizeof(double) * (n + 1));
+    st.step_len = (unsigned short*)DEFLATE_OPT_MALLOC(sizeof(unsigned short) * (n + 1));
+    st.step_dist = (unsigned short*)DEFLATE_OPT_MALLOC(sizeof(unsigned short) * (n + 1));
+    st.parse = (DoptSymbol*)DEFLATE_OPT_MALLOC(sizeof(DoptSymbol) * (n + 1));
+    st.best = (DoptSymbol*)DEFLATE_OPT_MALLOC(sizeof(DoptSymbol) * (n + 1));
+    st.block = (DoptSymbol*)DEFLATE_OPT_MALLOC(sizeof(DoptSymbol) * st.block_capacity);
+    st.pairs = (unsigned short*)DEFLATE_OPT_MALLOC(sizeof(unsigned short) * 2 * st.pairs_capacity);
+
+    int ok = st.head && st.prev && st.match_start && st.same && st.cost && st.step_len && st.step_dist &&
+             st.parse && st.best && st.block && st.pairs;
+    DoptWriter w = {out, 0, 0, 0};
+    if (ok) {
+        for (int h = 0; h < (1 << DOPT_HASH_BITS); ++h) st.head[h] = -1;
+        // 32K 窗口，FLEVEL = 3 (最大压缩)
+        dopt_put(&w, 0x78, 8);
+        dopt_put(&w, 0xda, 8);
+
+        DoptFreqs freqs;
+        for (size_t start = 0; ok && start < size; start += DOPT_CHUNK) {
+            const size_t end = size - start < DOPT_CHUNK ? size : start + DOPT_CHUNK;
+            ok = dopt_find_matches(&st, start, end);
+            if (ok) ok = dopt_add_chunk(&st, &w, dopt_optimize_chunk(&st, start, end, &freqs), &freqs, start);
+        }
+        if (ok) {
+            if (st.block_count > 0 || size > 0) {
+                dopt_write_block(&w, &st, st.block, st.block_count, &st.block_freqs, st.block_start,
+                                 size - st.block_start, 1);
+            } else {
+                // 空输入: 只有块结束符的固定表块
+                dopt_put(&w, 1, 1);
+                dopt_put(&w, 1, 2);
+                dopt_put(&w, 0, 7);
+            }
+            dopt_align(&w);
+            const unsigned int adler = dopt_adler32(data, size);
+            dopt_put(&w, adler >> 24, 8);
+            dopt_put(&w, (adler >> 16) & 0xff, 8);
+            dopt_put(&w, (adler >> 8) & 0xff, 8);
+            dopt_put(&w, adler & 0xff, 8);
+        }
+    }
+
+    DEFLATE_OPT_FREE(st.pairs);
+    DEFLATE_OPT_FREE(st.block);
+    DEFLATE_OPT_FREE(st.best);
+    DEFLATE_OPT_FREE(st.parse);
+    DEFLATE_OPT_FREE(st.step_dist);
+    DEFLATE_OPT_FREE(st.step_len);
+    DEFLATE_OPT_FREE(st.cost);
+    DEFLATE_OPT_FREE(st.same);
+    DEFLATE_OPT_FREE(st.match_start);
+    DEFLATE_OPT_FREE(st.prev);
+    DEFLATE_OPT_FREE(st.head);
+    if (!ok) {
+        DEFLATE_OPT_FREE(out);
+        return NULL;
+    }
+    *out_size = w.pos;
+    return out;
+}
+
+#endif // DEFLATE_OPTIMAL_H
@@ -0,0 +1,175 @@
+#ifndef FAST_CHECKSUM_H
+#define FAST_CHECKSUM_H
+
+// =======================================================================
+// ==          PNG/zlib 校验和的加速实现 (CRC-32 与 Adler-32)             ==
+// =======================================================================
+// stb_image_write 原本逐字节查表计算 CRC-32，并用标量循环计算 Adler-32，
+// 两者都要扫过每一个 IDAT 字节。这里提供:
+//   - crc32_slice16:  slice-by-16 查表法，每次处理 16 字节
+//   - adler32_simd:   wasm SIMD128 / SSE2 向量化实现，无 SIMD 时退回标量
+// 通过 STBIW_CRC32 / STBIW_ADLER32 宏接入 stb_image_write.h。
+// 假定目标平台为小端序 (wasm, x86, ARM)。
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// --- CRC-32 (slice-by-16) ---
+
+static unsigned int crc32_tables[16][256];
+
+// 表在模块加载时由构造函数一次性生成，之后只读。
+// 不能在首次调用时惰性生成: pthread 构建下多个线程可能同时进入。
+__attribute__((constructor))
+static void crc32_init_tables(void) {
+    for (unsigned int i = 0; i < 256; ++i) {
+        unsigned int c = i;
+        for (int k = 0; k < 8; ++k)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc32_tables[0][i] = c;
+    }
+    // 第 k 张表 = 在第 k-1 张表的结果后再多推进一个零字节
+    for (int t = 1; t < 16; ++t) {
+        for (int i = 0; i < 256; ++i) {
+            unsigned int c = crc32_tables[t - 1][i];
+            crc32_tables[t][i] = (c >> 8) ^ crc32_tables[0][c & 0xff];
+        }
+    }
+}
+
+static inline unsigned int checksum_load32(const unsigned char* p) {
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// 在已有的 crc 基础上继续累积 (初始值传 0)，便于分块计算
+static unsigned int crc32_slice16_update(unsigned int crc, const unsigned char* buffer, size_t len) {
+    const unsigned int (*t)[256] = (const unsigned int (*)[256]) crc32_tables;
+
+    crc = ~crc;
+    while (len >= 16) {
+        unsigned int a = crc ^ checksum_load32(buffer);
+        unsigned int b = checksum_load32(buffer + 4);
+        unsigned int c = checksum_load32(buffer + 8);
+        unsigned int d = checksum_load32(buffer + 12);
+        crc = t[15][a & 0xff] ^ t[14][(a >> 8) & 0xff] ^ t[13][(a >> 16) & 0xff] ^ t[12][a >> 24] ^
+              t[11][b & 0xff] ^ t[10][(b >> 8) & 0xff] ^ t[9][(b >> 16) & 0xff]  ^ t[8][b >> 24] ^
+              t[7][c & 0xff]  ^ t[6][(c >> 8) & 0xff]  ^ t[5][(c >> 16) & 0xff]  ^ t[4][c >> 24] ^
+              t[3][d & 0xff]  ^ t[2][(d >> 8) & 0xff]  ^ t[1][(d >> 16) & 0xff]  ^ t[0][d >> 24];
+        buffer += 16;
+        len -= 16;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *buffer++) & 0xff];
+    }
+    return ~crc;
+}
+
+// 与 stbiw__crc32 的签名一致，供 STBIW_CRC32 使用
+static unsigned int crc32_slice16(unsigned char* buffer, int len) {
+    return crc32_slice16_update(0, buffer, (size_t)len);
+}
+
+// --- Adler-32 ---
+
+#define ADLER32_BASE 65521u
+// 保证 s2 在 32 位内不溢出的最大块长 (zlib 的 NMAX)，恰好是 16 的倍数
+#define ADLER32_NMAX 5552
+
+// 在已有的 adler 基础上继续累积 (初始值传 1)，便于分块计算
+static unsigned int adler32_simd_update(unsigned int adler, const unsigned char* data, size_t len) {
+    unsigned int s1 = adler & 0xffff;
+    unsigned int s2 = adler >> 16;
+
+    while (len >= 16) {
+        size_t block = len < ADLER32_NMAX ? (len & ~(size_t)15) : ADLER32_NMAX;
+        size_t chunks = block / 16;
+        unsigned int sum_bytes, sum_prefix, sum_weighted;
+        len -= block;
+
+        // 对每个 16 字节块: s2 += 16*s1 + Σ(16-i)*x[i]; s1 += Σx[i]
+        // 块内 s1 的增量累积在 v_s1，逐块的前缀和累积在 v_ps
+#if defined(__wasm_simd128__)
+        {
+            const v128_t w_lo = wasm_i16x8_make(16, 15, 14, 13, 12, 11, 10, 9);
+            const v128_t w_hi = wasm_i16x8_make(8, 7, 6, 5, 4, 3, 2, 1);
+            v128_t v_s1 = wasm_i32x4_splat(0), v_ps = v_s1, v_s2 = v_s1;
+            for (size_t c = 0; c < chunks; ++c) {
+                v128_t x = wasm_v128_load(data);
+                v_ps = wasm_i32x4_add(v_ps, v_s1);
+                v_s1 = wasm_i32x4_add(v_s1, wasm_u32x4_extadd_pairwise_u16x8(wasm_u16x8_extadd_pairwise_u8x16(x)));
+                v_s2 = wasm_i32x4_add(v_s2, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(x), w_lo));
+                v_s2 = wasm_i32x4_add(v_s2, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(x), w_hi));
+                data += 16;
+            }
+            sum_bytes = wasm_u32x4_extract_lane(v_s1, 0) + wasm_u32x4_extract_lane(v_s1, 1) +
+                        wasm_u32x4_extract_lane(v_s1, 2) + wasm_u32x4_extract_lane(v_s1, 3);
+            sum_prefix = wasm_u32x4_extract_lane(v_ps, 0) + wasm_u32x4_extract_lane(v_ps, 1) +
+                         wasm_u32x4_extract_lane(v_ps, 2) + wasm_u32x4_extract_lane(v_ps, 3);
+            sum_weighted = wasm_u32x4_extract_lane(v_s2, 0) + wasm_u32x4_extract_lane(v_s2, 1) +
+                           wasm_u32x4_extract_lane(v_s2, 2) + wasm_u32x4_extract_lane(v_s2, 3);
+        }
+#elif defined(__SSE2__)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i w_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+            const __m128i w_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+            __m128i v_s1 = zero, v_ps = zero, v_s2 = zero;
+            unsigned int lanes[4];
+            for (size_t c = 0; c < chunks; ++c) {
+                __m128i x = _mm_loadu_si128((const __m128i*)data);
+                v_ps = _mm_add_epi32(v_ps, v_s1);
+                v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(x, zero));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), w_lo));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), w_hi));
+                data += 16;
+            }
+            _mm_storeu_si128((__m128i*)lanes, v_s1);
+            sum_bytes = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            _mm_storeu_si128((__m128i*)lanes, v_ps);
+            sum_prefix = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            _mm_storeu_si128((__m128i*)lanes, v_s2);
+            sum_weighted = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+#else
+        {
+            sum_bytes = sum_prefix = sum_weighted = 0;
+            for (size_t c = 0; c < chunks; ++c) {
+                sum_prefix += sum_bytes;
+                for (int i = 0; i < 16; ++i) {
+                    sum_bytes += data[i];
+                    sum_weighted += (16 - i) * data[i];
+                }
+                data += 16;
+            }
+        }
+#endif
+        // NMAX 保证整块对 s2 的增量不超过 32 位，因此各分量也不会溢出
+        s2 += (unsigned int)chunks * 16 * s1 + 16 * sum_prefix + sum_weighted;
+        s1 += sum_bytes;
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+
+    while (len--) {
+        s1 += *data++;
+        s2 += s1;
+    }
+    s1 %= ADLER32_BASE;
+    s2 %= ADLER32_BASE;
+    return (s2 << 16) | s1;
+}
+
+// 供 STBIW_ADLER32 使用
+static unsigned int adler32_simd(unsigned char* data, int len) {
+    return adler32_simd_update(1, data, (size_t)len);
+}
+
+#endif // FAST_CHECKSUM_H
@@ -6,12 +6,70 @@
 // =======================================================================
 // 定义这些宏告诉 stb.h 文件在此处生成它们的函数实现。
 // 只需要在一个 C/C++ 文件中这样做。
+
+// 两个 stb 库的临时内存都走 arena (见 scratch_arena.h)，导出函数用 arena_begin/arena_end 包住调用
+#include "scratch_arena.h"
+#define STBI_MALLOC(sz)                     arena_malloc(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) arena_realloc_sized(p, oldsz, newsz)
+#define STBI_FREE(p)                        arena_free(p)
+#define STBIW_MALLOC(sz)                     arena_malloc(sz)
+#define STBIW_REALLOC_SIZED(p, oldsz, newsz) arena_realloc_sized(p, oldsz, newsz)
+#define STBIW_FREE(p)                        arena_free(p)
+#define DEFLATE_OPT_MALLOC(sz)                     arena_malloc(sz)
+#define DEFLATE_OPT_REALLOC_SIZED(p, oldsz, newsz) arena_realloc_sized(p, oldsz, newsz)
+#define DEFLATE_OPT_FREE(p)                        arena_free(p)
+
 #define STB_IMAGE_IMPLEMENTATION
+// 使用 64 位位缓冲 + 查表多符号解码的 inflate 快速路径 (解码大 PNG 的主要开销)
+#define STBI_ZLIB_FAST64
+// 以 -pthread 构建时 (emcc 会定义 __EMSCRIPTEN_PTHREADS__) 启用 JPEG 并行解码:
+// 含重启标记 (RSTn) 的基线 JPEG 按重启区间并行熵解码，上采样和色彩转换按行带并行。
+// 需配合 -sPTHREAD_POOL_SIZE=4 预先创建线程，页面需跨源隔离 (COOP/COEP) 才能启用 SharedArrayBuffer。
+#ifdef __EMSCRIPTEN_PTHREADS__
+#define STBI_JPEG_THREADS
+// 分块容器的逐块编码和区域解码同样按线程并行 (见 tile_container.h)
+#define TILE_CONTAINER_THREADS
+#endif
 #include "stb_image.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
+// 用 slice-by-16 CRC 和 SIMD Adler-32 替换 stb 内置的逐字节校验和循环
+#include "fast_checksum.h"
+#define STBIW_CRC32 crc32_slice16
+#define STBIW_ADLER32 adler32_simd
+#define STBIW_ADLER32_UPDATE(adler, data, len) adler32_simd_update(adler, data, (size_t)(len))
+// 归档级别的 PNG 用迭代最优解析压缩 (deflate_optimal.h)，其他级别仍交给 stb 内置的压缩器
+static unsigned char* png_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+#define STBIW_ZLIB_COMPRESS png_zlib_compress
 #include "stb_image_write.h"
 
+// 归档模式的 deflate (zopfli 式迭代最优解析)
+#include "deflate_optimal.h"
+
+// JPEG → JPEG 压缩域打乱，复用上面两个库的 JPEG 解析器和 Huffman 表
+#include "jpeg_shuffle.h"
+
+// QOI 快速无损容器
+#include "qoi_codec.h"
+
+// PNG 颜色精简 (索引色)
+#include "png_reduce.h"
+
+// 无损加密容器的逐行生成
+#include "shuffle_rows.h"
+
+// 流式 PNG 解码，复用 stb_image 的 Huffman 表构建
+#include "png_stream.h"
+
+// 32 位 BMP、二进制 PPM/PGM 直接转换为 RGBA
+#include "raw_image.h"
+
+// 抽样估计各压缩级别的体积和耗时
+#include "png_estimate.h"
+
+// 逐块压缩、可随机读取的分块容器
+#include "tile_container.h"
+
 EMSCRIPTEN_KEEPALIVE
 extern void memcpy_simd(unsigned char* restrict dest, const unsigned char* restrict src, size_t n);
 
@@ -25,10 +83,15 @@ unsigned char* decode_image_wasm(
     const unsigned char* image_data, // [输入] 原始图片文件的二进制数据
     int image_data_size,             // [输入] 数据的大小
     int* out_width,                  // [输出] 用于返回图片宽度的指针
-    int* out_height                 // [输出] 用于返回图片高度的指针
+    int* out_height                  // [输出] 用于返回图片高度的指针
 ) {
     int channels_in_file; // 我们不关心这个，但stbi_load_from_memory需要它
 
+    // stb_image 不认识 QOI，按魔数 "qoif" 识别后交给 qoi_codec.h 解码 (同样输出 RGBA)
+    if (qoi_is_qoi(image_data, (size_t)image_data_size)) {
+        return qoi_decode_rgba(image_data, (size_t)image_data_size, out_width, out_height);
+    }
+
     // 调用stb_image的核心函数来从内存中解码图片
     // stbi_load_from_memory 会自动识别PNG, JPEG, BMP等多种格式
     // 最后一个参数 4 表示我们强制要求输出为 RGBA (4通道) 格式
@@ -41,107 +104,994 @@ unsigned char* decode_image_wasm(
         4 // 强制输出为 RGBA
     );
 
-    // stbi_load_from_memory 内部使用了 malloc，所以返回的指针
-    // 需要在JavaScript中通过调用 C 的 free 来释放。
+    // 这里没有进入 arena 作用域，stbi_load_from_memory 直接使用 malloc，
+    // 返回的指针需要在JavaScript中通过调用 C 的 free 来释放。
 
     return decoded_data;
 }
 
+// JPEG 缩小解码倍数 (1, 2, 4, 8)。只解码缩略图的场景 (例如从 DC 系数读出有损容器头部的色块)
+// 直接在 DCT 域以 1/2、1/4、1/8 尺寸解码 (4x4、2x2 或只用 DC 的缩减 IDCT)，
+// 解码时间和内存最多降低 64 倍。其他格式不受影响，始终按原尺寸解码。
+static int jpeg_scale_denom(const unsigned char* image_data, int image_data_size, int scale_denom) {
+    if (image_data_size < 2 || image_data[0] != 0xFF || image_data[1] != 0xD8) return 1;
+    return scale_denom >= 8 ? 8 : scale_denom >= 4 ? 4 : scale_denom >= 2 ? 2 : 1;
+}
+
+// 只解析文件头，得到按 scale_denom 解码后的宽高 (JPEG 缩小解码时向上取整)，不解码像素。
+// 可识别返回 1，否则返回 0。
+// 与 decode_image_into_wasm 配合: JS 先按尺寸分配缓冲区，再以同样的 scale_denom 把像素解码进去。
+EMSCRIPTEN_KEEPALIVE
+int probe_image_wasm(
+    const unsigned char* image_data,
+    int image_data_size,
+    int* out_width,
+    int* out_height,
+    int scale_denom
+) {
+    int channels_in_file;
+    if (qoi_is_qoi(image_data, (size_t)image_data_size)) {
+        return qoi_read_header(image_data, (size_t)image_data_size, out_width, out_height);
+    }
+    arena_begin();
+    int ok = stbi_info_from_memory(image_data, image_data_size, out_width, out_height, &channels_in_file);
+    arena_end();
+    const int denom = jpeg_scale_denom(image_data, image_data_size, scale_denom);
+    if (ok && denom > 1) {
+        *out_width = (*out_width + denom - 1) / denom;
+        *out_height = (*out_height + denom - 1) / denom;
+    }
+    return ok;
+}
+
+// probe_image_header_wasm 给出的格式 (与 crypto-worker.js 的 IMAGE_FORMATS 顺序一致)
+enum {
+    IMAGE_FORMAT_UNKNOWN,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_JPEG,
+    IMAGE_FORMAT_QOI,
+    IMAGE_FORMAT_BMP,
+    IMAGE_FORMAT_PNM,
+    IMAGE_FORMAT_TILES
+};
+
+// 派发任务前的廉价探测: 只需要文件开头的一段 (JPEG 要包含 SOF 段)，不分配像素缓冲区。
+// 写出 out[0..3] = 宽、高、文件里的通道数、格式，供调度器估算内存和耗时。
+// 其他格式 (GIF、TGA 等只在解码时由 stb 识别) 和文件头不完整时返回 0
+EMSCRIPTEN_KEEPALIVE
+int probe_image_header_wasm(const unsigned char* image_data, int image_data_size, int* out) {
+    const size_t size = image_data_size > 0 ? (size_t)image_data_size : 0;
+    int width, height, channels, format;
+    if (size >= 14 && memcmp(image_data, "qoif", 4) == 0) {
+        width = (int)qoi_read32(image_data + 4);
+        height = (int)qoi_read32(image_data + 8);
+        channels = image_data[12];
+        format = IMAGE_FORMAT_QOI;
+        if (width <= 0 || height <= 0 || channels < 3 || channels > 4) return 0;
+    } else if (raw_image_probe(image_data, size, &width, &height, &channels)) {
+        format = image_data[0] == 'B' ? IMAGE_FORMAT_BMP : IMAGE_FORMAT_PNM;
+    } else if (tile_container_read_header(image_data, size, &width, &height)) {
+        channels = 4;
+        format = IMAGE_FORMAT_TILES;
+    } else {
+        if (size >= 8 && memcmp(image_data, "\x89PNG\r\n\x1a\n", 8) == 0) format = IMAGE_FORMAT_PNG;
+        else if (size >= 2 && image_data[0] == 0xFF && image_data[1] == 0xD8) format = IMAGE_FORMAT_JPEG;
+        else return 0;
+        arena_begin();
+        int ok = stbi_info_from_memory(image_data, image_data_size, &width, &height, &channels);
+        arena_end();
+        if (!ok) return 0;
+    }
+    out[0] = width;
+    out[1] = height;
+    out[2] = channels;
+    out[3] = format;
+    return 1;
+}
+
+// 解码为 RGBA，写入调用方提供的缓冲区 (width * height * 4 字节)，
+// width/height 与 scale_denom 来自 probe_image_wasm。
+// 像素留在 WASM 内存里，可以直接交给 perform_encryption 等内核，JS 侧不再拷贝整幅图像。
+// 解码结果与 width/height 不符 (文件与 probe 时不一致) 或解码失败时返回 0。
+EMSCRIPTEN_KEEPALIVE
+int decode_image_into_wasm(
+    const unsigned char* image_data,
+    int image_data_size,
+    unsigned char* out_pixels,
+    int width,
+    int height,
+    int scale_denom
+) {
+    int decoded_width, decoded_height, channels_in_file;
+
+    // QOI 由我们自己的解码器直接写入目标缓冲区
+    if (qoi_is_qoi(image_data, (size_t)image_data_size)) {
+        if (!qoi_read_header(image_data, (size_t)image_data_size, &decoded_width, &decoded_height) ||
+            decoded_width != width || decoded_height != height) {
+            return 0;
+        }
+        qoi_decode_pixels(image_data, (size_t)image_data_size, out_pixels, (size_t)width * height);
+        return 1;
+    }
+
+    // 未压缩的 BMP/PPM 一遍写进目标缓冲区，不经过 stb 的逐字节读取、格式转换和行翻转
+    RawImageInfo raw;
+    if (raw_image_read_header(image_data, (size_t)image_data_size, &raw)) {
+        if (raw.width != width || raw.height != height) return 0;
+        raw_image_decode(image_data, &raw, out_pixels);
+        return 1;
+    }
+
+    // 其余格式交给 stb_image: 最终的 RGBA 输出 (JPEG、BMP、TGA、PSD、HDR 以及通道/位深转换)
+    // 经 stbi_set_decode_into 直接写进目标缓冲区；彩色 PNG (stb 在解码中直接展开成 RGBA)、GIF 等仍由 stb 分配，
+    // 在 WASM 内部拷贝一次后立即释放 (连同解码的临时内存都在 arena 里)
+    arena_begin();
+    stbi_set_jpeg_scale_denom(jpeg_scale_denom(image_data, image_data_size, scale_denom));
+    stbi_set_decode_into(out_pixels, (size_t)width * height * 4);
+    unsigned char* decoded = stbi_load_from_memory(
+        image_data, image_data_size, &decoded_width, &decoded_height, &channels_in_file, 4);
+    stbi_set_decode_into(NULL, 0);
+    stbi_set_jpeg_scale_denom(1);
+    int ok = decoded != NULL && decoded_width == width && decoded_height == height;
+    if (decoded != out_pixels) {
+        if (ok) memcpy(out_pixels, decoded, (size_t)width * height * 4);
+        stbi_image_free(decoded);
+    }
+    arena_end();
+    return ok;
+}
+
+// 设置 JPEG 解码使用的线程数 (1 表示串行)，在未启用 pthread 的构建中没有效果
+EMSCRIPTEN_KEEPALIVE
+void set_jpeg_decode_threads(int thread_count) {
+    stbi_set_jpeg_threads(thread_count);
+}
+
+// --- 流式 PNG 解码 (见 png_stream.h) ---
+// JS 从 Blob 流中每读到一段就调用 png_stream_feed_wasm，返回 PNG_STREAM_HEADER 后
+// 用 png_stream_info_wasm 取尺寸、分配像素缓冲区并调用 png_stream_set_output_wasm，
+// 继续喂数据直到返回 PNG_STREAM_DONE (2)。返回负数时改用 decode_image_into_wasm 整体解码。
+// 解码器的缓冲区在多次调用之间保留，直接用 malloc，不走 arena。
+
+EMSCRIPTEN_KEEPALIVE
+PngStream* png_stream_create_wasm(void) {
+    return png_stream_create();
+}
+
+EMSCRIPTEN_KEEPALIVE
+int png_stream_feed_wasm(PngStream* stream, const unsigned char* data, int size) {
+    return png_stream_feed(stream, data, size > 0 ? (size_t)size : 0);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int png_stream_info_wasm(PngStream* stream, int* out_width, int* out_height) {
+    return png_stream_info(stream, out_width, out_height);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void png_stream_set_output_wasm(PngStream* stream, unsigned char* out_pixels) {
+    png_stream_set_output(stream, out_pixels);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void png_stream_free_wasm(PngStream* stream) {
+    png_stream_free(stream);
+}
+
+// --- 流式解密 (解码与解密合并) ---
+// 不调用 png_stream_set_output_wasm，而是用 png_stream_decrypt_begin_wasm 逐行接收解码结果:
+// 第 0 行如果是带种子的元数据行 (灰度布局，见 crypto-worker.js 的 encodeMetadataToRow)，
+// 就在这里生成置换表，之后每解出一个内容行就按表写到原图中的位置 (shuffle_rows_put)，
+// 省掉整个容器大小的加密像素缓冲区和单独的 perform_decryption。否则逐行原样写入。
+// 容器的第一行和最后一行另存到 header_rows，JS 核对 magic 行之后才采用解密结果，
+// 核对失败 (恰好像元数据行的普通图像) 时改用整体解码。
+// 旧版容器 (逐项写入的置换表行) 和去重容器 (标记不是 'SEED') 按普通图像输出，仍由 decryptWithShuffle 解密。
+
+#define STREAM_DECRYPT_PENDING 0
+#define STREAM_DECRYPT_PLAIN 1
+#define STREAM_DECRYPT_SCATTER 2
+// 与 crypto-worker.js 的 METADATA_BYTES 和 SEEDED_MAP_TAG ('SEED') 相同
+#define STREAM_DECRYPT_METADATA_BYTES 32
+#define STREAM_DECRYPT_SEED_TAG 0x53454544u
+
+typedef struct {
+    unsigned char* pixels;      // 输出，width * height * 4 字节 (解密时只用前 height - 2 行)
+    unsigned char* header_rows; // 容器的第一行和最后一行，2 * width * 4 字节
+    int width, height;          // 文件 (容器) 的尺寸
+    int mode;
+    unsigned int* shuffle_map;
+    ShuffleRows rows;
+} StreamDecrypt;
+
+// 元数据行每个字节是一个灰度像素，按大端读 4 个字节
+static unsigned int stream_decrypt_read32(const unsigned char* row, int offset) {
+    const unsigned char* p = row + (size_t)offset * 4;
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[4] << 16) | ((unsigned int)p[8] << 8) | p[12];
+}
+
+// 第 0 行是带种子的元数据行且与文件尺寸一致时生成置换表，返回 1
+static int stream_decrypt_parse_metadata(StreamDecrypt* d, const unsigned char* row) {
+    if (d->width < STREAM_DECRYPT_METADATA_BYTES || d->height < 3) return 0;
+    for (int i = 0; i < STREAM_DECRYPT_METADATA_BYTES; ++i) {
+        const unsigned char* px = row + i * 4;
+        if (px[1] != px[0] || px[2] != px[0] || px[3] != 255) return 0;
+    }
+
+    const unsigned int original_width = stream_decrypt_read32(row, 0);
+    const unsigned int original_height = stream_decrypt_read32(row, 4);
+    const unsigned int content_width = stream_decrypt_read32(row, 8);
+    const unsigned int content_height = stream_decrypt_read32(row, 12);
+    const unsigned int total_blocks = stream_decrypt_read32(row, 16);
+    if (stream_decrypt_read32(row, 20) != STREAM_DECRYPT_SEED_TAG ||
+        original_width != (unsigned int)d->width || original_height != (unsigned int)d->height - 2 ||
+        content_width > original_width || content_height > original_height ||
+        content_width % SHUFFLE_BLOCK_SIZE != 0 || content_height % SHUFFLE_BLOCK_SIZE != 0 ||
+        total_blocks == 0 ||
+        total_blocks != (content_width / SHUFFLE_BLOCK_SIZE) * (content_height / SHUFFLE_BLOCK_SIZE)) {
+        return 0;
+    }
+
+    d->shuffle_map = (unsigned int*)malloc(sizeof(unsigned int) * total_blocks);
+    if (!d->shuffle_map) return 0;
+    const unsigned long long seed = ((unsigned long long)stream_decrypt_read32(row, 24) << 32) | stream_decrypt_read32(row, 28);
+    jpeg_shuffle_make_map(d->shuffle_map, (int)total_blocks, seed);
+    return shuffle_rows_init(&d->rows, NULL, d->width, (int)original_height, 4,
+                             (int)content_width, (int)content_height, d->shuffle_map, NULL, NULL);
+}
+
+static void stream_decrypt_row(void* context, int y, const unsigned char* rgba) {
+    StreamDecrypt* d = (StreamDecrypt*)context;
+    const size_t row_bytes = (size_t)d->width * 4;
+    if (y == 0) {
+        d->mode = stream_decrypt_parse_metadata(d, rgba) ? STREAM_DECRYPT_SCATTER : STREAM_DECRYPT_PLAIN;
+    }
+
+    if (d->mode == STREAM_DECRYPT_PLAIN) {
+        memcpy(d->pixels + (size_t)y * row_bytes, rgba, row_bytes);
+    } else if (y == 0) {
+        memcpy(d->header_rows, rgba, row_bytes);
+    } else if (y == d->height - 1) {
+        memcpy(d->header_rows + row_bytes, rgba, row_bytes);
+    } else {
+        shuffle_rows_put(&d->rows, y, rgba, d->pixels);
+    }
+}
+
+// 在 png_stream_feed_wasm 返回 PNG_STREAM_HEADER 之后调用，代替 png_stream_set_output_wasm
+EMSCRIPTEN_KEEPALIVE
+StreamDecrypt* png_stream_decrypt_begin_wasm(PngStream* stream, unsigned char* out_pixels, unsigned char* header_rows) {
+    StreamDecrypt* d = (StreamDecrypt*)calloc(1, sizeof(StreamDecrypt));
+    if (!d) return NULL;
+    d->pixels = out_pixels;
+    d->header_rows = header_rows;
+    if (!png_stream_info(stream, &d->width, &d->height) ||
+        !png_stream_set_row_func(stream, stream_decrypt_row, d)) {
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+// 解码完成后调用: 1 表示输出已是解密后的原图 (width x (height - 2))，0 表示原样输出
+EMSCRIPTEN_KEEPALIVE
+int png_stream_decrypt_result_wasm(const StreamDecrypt* d) {
+    return d->mode == STREAM_DECRYPT_SCATTER;
+}
+
+// 在 png_stream_free_wasm 之后调用
+EMSCRIPTEN_KEEPALIVE
+void png_stream_decrypt_free_wasm(StreamDecrypt* d) {
+    if (!d) return;
+    free(d->shuffle_map);
+    free(d);
+}
+
 
 // =======================================================================
 // ==               图像编码 (替换 UPNG.encode)                         ==
 // =======================================================================
 
-// 用于 stbi_write_png_to_func 的辅助结构体
-// C语言没有闭包，所以我们用一个 struct 来在回调函数间传递状态
-typedef struct {
-    unsigned char* buffer;
+// 编码器通过 write_func_callback 把数据追加到固定大小的块链表里，不按最坏情况
+// 预分配整幅图像大小的输出缓冲区，输出占用的内存只和压缩后的大小相关。
+// JS 用 output_read_wasm 逐块读出 (拼成 Blob)，最后调用 output_free_wasm 释放。
+#define OUTPUT_CHUNK_SIZE (256 * 1024)
+
+typedef struct OutputChunk {
+    struct OutputChunk* next;
     size_t size;
-    size_t capacity; // 记录已分配内存的总大小
-} WriteContext;
+    unsigned char data[OUTPUT_CHUNK_SIZE];
+} OutputChunk;
+
+typedef struct {
+    OutputChunk* head;
+    OutputChunk* tail;
+    OutputChunk* cursor; // output_read_wasm 下一次返回的块
+    size_t total;
+    int failed;          // 分配新块失败，输出不完整
+} ChunkedOutput;
+
+EMSCRIPTEN_KEEPALIVE
+void output_free_wasm(ChunkedOutput* out) {
+    if (out == NULL) return;
+    OutputChunk* c = out->head;
+    while (c) {
+        OutputChunk* next = c->next;
+        free(c);
+        c = next;
+    }
+    free(out);
+}
+
+// 依次返回每个块的数据和大小，读完后返回 NULL
+EMSCRIPTEN_KEEPALIVE
+const unsigned char* output_read_wasm(ChunkedOutput* out, int* size) {
+    OutputChunk* c = out->cursor;
+    if (c == NULL) {
+        *size = 0;
+        return NULL;
+    }
+    out->cursor = c->next;
+    *size = (int)c->size;
+    return c->data;
+}
 
-// 这是传递给 stbi_write_png_to_func 的回调函数
-// stb 会一块一块地调用这个函数，把编码好的PNG数据传给我们
+// 这是传递给 stbi_write_*_to_func / qoi_encode_to_func 的回调函数
+// 编码器会一块一块地调用这个函数，把编码好的数据传给我们
 static void write_func_callback(void* context, void* data, int size) {
-    WriteContext* ctx = (WriteContext*)context;
+    ChunkedOutput* out = (ChunkedOutput*)context;
+    const unsigned char* src = (const unsigned char*)data;
+
+    while (size > 0 && !out->failed) {
+        OutputChunk* c = out->tail;
+        if (c == NULL || c->size == OUTPUT_CHUNK_SIZE) {
+            c = (OutputChunk*)malloc(sizeof(OutputChunk));
+            if (c == NULL) {
+                out->failed = 1;
+                return;
+            }
+            c->next = NULL;
+            c->size = 0;
+            if (out->tail) out->tail->next = c;
+            else out->head = out->cursor = c;
+            out->tail = c;
+        }
 
-    // 检查是否有足够容量，理论上预分配后不应该需要realloc
-    if (ctx->size + size > ctx->capacity) {
-        // 这是一个备用方案，以防预分配的内存不足。
-        // 在实践中，如果预分配大小合理，这里几乎不会被执行。
-        size_t new_capacity = (ctx->size + size) * 1.5; // 指数增长
-        ctx->buffer = (unsigned char*)realloc(ctx->buffer, new_capacity);
-        ctx->capacity = new_capacity;
+        size_t n = OUTPUT_CHUNK_SIZE - c->size;
+        if (n > (size_t)size) n = (size_t)size;
+        memcpy(c->data + c->size, src, n);
+        c->size += n;
+        out->total += n;
+        src += n;
+        size -= (int)n;
     }
+}
 
-    // 断言，确保我们不会写入越界
-    assert(ctx->buffer != NULL && "Memory allocation failed");
-    assert(ctx->size + size <= ctx->capacity && "Write exceeds allocated capacity");
+// 编码结束: 失败或输出不完整时释放并返回 NULL，否则写回总大小
+static ChunkedOutput* output_finish(ChunkedOutput* out, int success, size_t* out_size) {
+    if (!success || out->failed) {
+        output_free_wasm(out);
+        *out_size = 0;
+        return NULL;
+    }
+    *out_size = out->total;
+    return out;
+}
 
-    // 将新的数据块拷贝到我们缓冲区的末尾
-    memcpy(ctx->buffer + ctx->size, data, size);
-    ctx->size += size;
+// 不低于这个级别时按归档模式压缩: 每 16 行试遍所有滤波策略，deflate 用迭代最优解析。
+// 输出通常比默认级别小 5%-10%，耗时是它的几十倍，只用于结果已经交给用户之后的后台重压缩
+#define PNG_ARCHIVE_LEVEL 10
+// 归档模式下每段输入的最优解析迭代次数 (zopfli 默认 15 次，之后的收益已经很小)
+#define PNG_ARCHIVE_ITERATIONS 10
+
+static unsigned char* png_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality) {
+    if (quality < PNG_ARCHIVE_LEVEL) return stbi_zlib_compress_builtin(data, data_len, out_len, quality);
+    size_t size;
+    unsigned char* zlib = deflate_optimal_zlib(data, (size_t)data_len, &size, PNG_ARCHIVE_ITERATIONS);
+    if (zlib) *out_len = (int)size;
+    return zlib;
+}
+
+// 设置之后所有 PNG 编码的 deflate 级别 (默认 8)。0 表示不压缩: 不滤波、不做颜色缩减，
+// 行数据直接写成 deflate 存储块，给在别处重新压缩的流水线使用。
+// PNG_ARCHIVE_LEVEL 及以上为归档模式 (逐带试滤波策略 + 最优解析)
+EMSCRIPTEN_KEEPALIVE
+void set_png_compression_level_wasm(int level) {
+    stbi_write_png_compression_level = level;
+    stbi_write_png_filter_search = level >= PNG_ARCHIVE_LEVEL;
 }
 
 // 这个函数将从JavaScript中被调用，用来编码PNG图片
 EMSCRIPTEN_KEEPALIVE
-unsigned char* encode_png_wasm(
+ChunkedOutput* encode_png_wasm(
     const unsigned char* image_data,
     int width,
     int height,
     size_t* out_size
 ) {
-    // 优化1: 预分配一个足够大的缓冲区。
-    // 最坏情况是无压缩，RGBA大小为 width * height * 4。我们分配这个大小。
-    // PNG通常会压缩得更小，所以这个大小绰绰有余。
-    size_t initial_capacity = (size_t)width * height * 4 * 2;
-    unsigned char* initial_buffer = (unsigned char*)malloc(initial_capacity);
-
-    if (initial_buffer == NULL) {
+    size_t pixel_count = (size_t)width * height;
+    ChunkedOutput* out = (ChunkedOutput*)calloc(1, sizeof(ChunkedOutput));
+    if (out == NULL) {
         *out_size = 0;
         return NULL;
     }
 
-    // 1. 初始化我们的写入上下文
-    WriteContext ctx = {
-        .buffer = initial_buffer,
-        .size = 0,
-        .capacity = initial_capacity
-    };
+    // 不压缩模式: 输出交给别处重新压缩，颜色缩减和行滤波都没有意义，RGBA 行直接写成存储块
+    if (stbi_write_png_compression_level == 0) {
+        arena_begin();
+        int success = stbi_write_png_to_func(write_func_callback, out, width, height, 4, image_data, width * 4);
+        arena_end();
+        return output_finish(out, success, out_size);
+    }
+
+    // 优化0: 颜色类型缩减。alpha 全为 255 时去掉 alpha 通道，R == G == B 时只写一个灰度通道，
+    // 送进 deflate 的数据减少 25%-75%；解码成 RGBA 后与输入完全一致。
+    int opaque, gray;
+    png_analyze_channels(image_data, pixel_count, &opaque, &gray);
+
+    // 优化1: 颜色不超过 256 种 (截图、示意图) 时写索引色 PNG，每像素只有 1 字节。
+    // 不透明灰度图本身就是每像素 1 字节，且可以使用行滤波，不走调色板。
+    // 照片通常在扫描最前面几百个像素内就超过 256 色，检测几乎没有额外开销。
+    if (!(gray && opaque)) {
+        unsigned char* indices = (unsigned char*)malloc(pixel_count);
+        if (indices) {
+            unsigned char palette[PNG_PALETTE_MAX * 4];
+            int palette_size = png_build_palette(image_data, pixel_count, palette, indices);
+            // 像素数和颜色数相当的小图，PLTE/tRNS 的开销抵消了收益
+            if (palette_size > 0 && pixel_count >= (size_t)palette_size * 4) {
+                arena_begin();
+                int success = stbi_write_png_indexed_to_func(
+                    write_func_callback, out, width, height, palette, palette_size, indices, width);
+                arena_end();
+                free(indices);
+                return output_finish(out, success, out_size);
+            }
+            free(indices);
+        }
+    }
+
+    int channels = gray ? (opaque ? 1 : 2) : (opaque ? 3 : 4);
+    const unsigned char* pixels = image_data;
+    unsigned char* packed = NULL;
+    if (channels < 4) {
+        packed = (unsigned char*)malloc(pixel_count * channels);
+        if (packed) {
+            png_pack_channels(image_data, pixel_count, channels, packed);
+            pixels = packed;
+        } else {
+            channels = 4; // 内存不足时退回 RGBA
+        }
+    }
 
-    // 2. 调用stb_image_write的核心函数
+    // 调用stb_image_write的核心函数 (zlib 哈希表、滤波缓冲区等临时内存都在 arena 里)，
+    // 压缩后的数据分段写入 out
+    arena_begin();
     int success = stbi_write_png_to_func(
         write_func_callback,
-        &ctx,
+        out,
         width,
         height,
-        4,
-        image_data,
-        width * 4
+        channels,
+        pixels,
+        width * channels
     );
+    arena_end();
+    free(packed);
+
+    return output_finish(out, success, out_size);
+}
+
+
+// =======================================================================
+// ==               有损 JPEG 容器编码                                  ==
+// =======================================================================
 
-    if (!success) {
-        if (ctx.buffer) free(ctx.buffer);
+// 用 stb 自带的 JPEG 编码器输出有损容器。对可以接受有损结果的场景，
+// 编码耗时和输出体积都远小于 PNG (不需要 zlib 匹配查找，也没有逐行滤波)。
+// quality 取 1-100，<= 90 时色度按 4:2:0 采样 (MCU 为 16x16)。
+EMSCRIPTEN_KEEPALIVE
+ChunkedOutput* encode_jpeg_wasm(
+    const unsigned char* image_data, // [输入] RGBA 像素，alpha 通道被忽略
+    int width,
+    int height,
+    int quality,
+    size_t* out_size
+) {
+    ChunkedOutput* out = (ChunkedOutput*)calloc(1, sizeof(ChunkedOutput));
+    if (out == NULL) {
         *out_size = 0;
         return NULL;
     }
 
-    // 优化2: 单次收缩内存。
-    // 编码完成后，我们知道确切的大小 (ctx.size)。
-    // 调用一次 realloc 将缓冲区收缩到正好大小，避免浪费内存。
-    // 这比在循环中多次调用realloc快得多。
-    unsigned char* final_buffer = (unsigned char*)realloc(ctx.buffer, ctx.size);
-    if (final_buffer == NULL && ctx.size > 0) {
-        // realloc失败，但旧缓冲区仍然有效
-        // 这种情况非常罕见，但为了代码健壮性我们返回旧缓冲区
-        *out_size = ctx.capacity; // JS侧需要知道这是未收缩的缓冲区
-        return ctx.buffer;
+    arena_begin();
+    int success = stbi_write_jpg_to_func(write_func_callback, out, width, height, 4, image_data, quality);
+    arena_end();
+    return output_finish(out, success, out_size);
+}
+
+
+// =======================================================================
+// ==               QOI 容器编码                                        ==
+// =======================================================================
+
+// 无损但比 PNG 编码快得多 (单趟逐像素编码，没有 zlib)，体积通常比 PNG 大 10-30%。
+// 浏览器不能直接显示 QOI，只适合两端都是本工具的场景。
+EMSCRIPTEN_KEEPALIVE
+ChunkedOutput* encode_qoi_wasm(
+    const unsigned char* image_data, // [输入] RGBA 像素
+    int width,
+    int height,
+    size_t* out_size
+) {
+    ChunkedOutput* out = (ChunkedOutput*)calloc(1, sizeof(ChunkedOutput));
+    if (out == NULL) {
+        *out_size = 0;
+        return NULL;
     }
+    return output_finish(out, qoi_encode_to_func(write_func_callback, out, image_data, width, height), out_size);
+}
 
 
-    // 3. 将最终大小写回输出参数
-    *out_size = ctx.size;
+// =======================================================================
+// ==               无损加密容器编码 (不拼装打乱后的图像)               ==
+// =======================================================================
+// 容器 (元数据行 + 打乱后的原图 + magic 行) 不再先由 perform_encryption 写进一整块
+// (height + 2) 行的缓冲区，而是由 shuffle_rows.h 在编码器需要时逐行从原图收集，
+// 滤波、deflate 和 QOI 编码直接作用在这些行上。
+// header_rows 是 JS 准备好的 2 行 RGBA: 第一行为元数据行，第二行为 magic 行。
 
-    // 4. 返回指向我们自己分配和填充的内存的指针
-    return final_buffer;
-}
\ No newline at end of file
+// 把 RGBA 行压成 channels 个通道的行来源 (颜色类型缩减)
+typedef struct {
+    stbi_write_row_func* rows;
+    void* context;
+    int width, channels;
+    unsigned char* rgba; // 一行 RGBA 的暂存区
+} PackedRows;
+
+static const unsigned char* packed_rows_get(void* context, int y, unsigned char* buffer) {
+    PackedRows* p = (PackedRows*)context;
+    png_pack_channels(p->rows(p->context, y, p->rgba), (size_t)p->width, p->channels, buffer);
+    return buffer;
+}
+
+EMSCRIPTEN_KEEPALIVE
+ChunkedOutput* encode_png_shuffled_wasm(
+    const unsigned char* image_data,   // [输入] 原图 RGBA
+    int width,
+    int height,                        // 原图高度，输出高度为 height + 2
+    int content_width,
+    int content_height,
+    const unsigned int* shuffle_map,
+    const unsigned char* header_rows,  // [输入] 元数据行和 magic 行 (2 * width 个 RGBA 像素)
+    const TileDedup* dedup,            // [输入] tile_dedup_build_wasm 的结果，NULL 表示不去重
+    size_t* out_size
+) {
+    const size_t pixel_count = (size_t)width * height;
+    const size_t header_count = (size_t)width * 2;
+    const size_t table_count = dedup ? (size_t)width * dedup->table_rows : 0;
+    ChunkedOutput* out = (ChunkedOutput*)calloc(1, sizeof(ChunkedOutput));
+    if (out == NULL) {
+        *out_size = 0;
+        return NULL;
+    }
+
+    ShuffleRows rows;
+    if (!shuffle_rows_init(&rows, image_data, width, height, 4, content_width, content_height,
+                           shuffle_map, header_rows, header_rows + (size_t)width * 4)) {
+        return output_finish(out, 0, out_size);
+    }
+    if (dedup) shuffle_rows_set_dedup(&rows, dedup, dedup->table);
+    const int container_height = shuffle_rows_height(&rows);
+
+    if (stbi_write_png_compression_level == 0) {
+        arena_begin();
+        int success = stbi_write_png_rows_to_func(write_func_callback, out, width, container_height, 4,
+                                                  shuffle_rows_get, &rows, NULL, 0);
+        arena_end();
+        return output_finish(out, success, out_size);
+    }
+
+    // 与 encode_png_wasm 相同的颜色缩减。打乱不改变颜色集合，只需分析原图、两行头部和引用表
+    // (去重容器的空位用引用表的像素填充，不引入新颜色)
+    int opaque, gray, header_opaque, header_gray;
+    png_analyze_channels(image_data, pixel_count, &opaque, &gray);
+    png_analyze_channels(header_rows, header_count, &header_opaque, &header_gray);
+    opaque = opaque && header_opaque;
+    gray = gray && header_gray;
+    if (dedup) {
+        png_analyze_channels(dedup->table, table_count, &header_opaque, &header_gray);
+        opaque = opaque && header_opaque;
+        gray = gray && header_gray;
+    }
+
+    // 索引色: 对原图、头部行和引用表分别生成索引 (共用一个调色板)，再按同样的方式逐行收集索引
+    if (!(gray && opaque)) {
+        unsigned char* indices = (unsigned char*)malloc(pixel_count + header_count + table_count);
+        if (indices) {
+            unsigned char palette[PNG_PALETTE_MAX * 4];
+            unsigned char* header_indices = indices + pixel_count;
+            unsigned char* table_indices = header_indices + header_count;
+            PngPalette builder;
+            png_palette_init(&builder, palette);
+            if (png_palette_add(&builder, header_rows, header_count, header_indices) &&
+                (!dedup || png_palette_add(&builder, dedup->table, table_count, table_indices)) &&
+                png_palette_add(&builder, image_data, pixel_count, indices) &&
+                pixel_count + header_count >= (size_t)builder.size * 4) {
+                ShuffleRows index_rows = rows;
+                index_rows.pixels = indices;
+                index_rows.bpp = 1;
+                index_rows.header_row = header_indices;
+                index_rows.footer_row = header_indices + width;
+                if (dedup) index_rows.table_rows = table_indices;
+
+                arena_begin();
+                int success = stbi_write_png_rows_to_func(write_func_callback, out, width, container_height, 1,
+                                                          shuffle_rows_get, &index_rows, palette, builder.size);
+                arena_end();
+                free(indices);
+                return output_finish(out, success, out_size);
+            }
+            free(indices);
+        }
+    }
+
+    int channels = gray ? (opaque ? 1 : 2) : (opaque ? 3 : 4);
+    PackedRows packed = {shuffle_rows_get, &rows, width, channels, NULL};
+    stbi_write_row_func* source = shuffle_rows_get;
+    void* source_context = &rows;
+    if (channels < 4) {
+        packed.rgba = (unsigned char*)malloc((size_t)width * 4);
+        if (packed.rgba) {
+            source = packed_rows_get;
+            source_context = &packed;
+        } else {
+            channels = 4; // 内存不足时退回 RGBA
+        }
+    }
+
+    arena_begin();
+    int success = stbi_write_png_rows_to_func(write_func_callback, out, width, container_height, channels,
+                                              source, source_context, NULL, 0);
+    arena_end();
+    free(packed.rgba);
+    return output_finish(out, success, out_size);
+}
+
+EMSCRIPTEN_KEEPALIVE
+ChunkedOutput* encode_qoi_shuffled_wasm(
+    const unsigned char* image_data,
+    int width,
+    int height,
+    int content_width,
+    int content_height,
+    const unsigned int* shuffle_map,
+    const unsigned char* header_rows,
+    const TileDedup* dedup,
+    size_t* out_size
+) {
+    ChunkedOutput* out = (ChunkedOutput*)calloc(1, sizeof(ChunkedOutput));
+    if (out == NULL) {
+        *out_size = 0;
+        return NULL;
+    }
+
+    ShuffleRows rows;
+    if (!shuffle_rows_init(&rows, image_data, width, height, 4, content_width, content_height,
+                           shuffle_map, header_rows, header_rows + (size_t)width * 4)) {
+        return output_finish(out, 0, out_size);
+    }
+    if (dedup) shuffle_rows_set_dedup(&rows, dedup, dedup->table);
+    int success = qoi_encode_rows_to_func(write_func_callback, out, width, shuffle_rows_height(&rows),
+                                          shuffle_rows_get, &rows);
+    return output_finish(out, success, out_size);
+}
+
+
+// =======================================================================
+// ==               无损容器的分块去重 (见 tile_dedup.h)                 ==
+// =======================================================================
+// 加密: JS 生成置换表后调用 tile_dedup_build_wasm，返回非 NULL 时把元数据标记为去重容器，
+// 把句柄交给 encode_*_shuffled_wasm，编码完成后用 tile_dedup_free_wasm 释放。
+// 解密: tile_dedup_expand_wasm 把整个容器展开成原图。
+
+// 没有足够多的重复块 (省下的像素不比引用表多) 时返回 NULL，使用普通容器
+EMSCRIPTEN_KEEPALIVE
+TileDedup* tile_dedup_build_wasm(
+    const unsigned char* image_data,
+    int width,
+    int height,
+    int content_width,
+    int content_height,
+    const unsigned int* shuffle_map
+) {
+    return tile_dedup_build(image_data, width, height, content_width, content_height, shuffle_map);
+}
+
+// 不重复的块数和总块数，供 JS 输出日志
+EMSCRIPTEN_KEEPALIVE
+int tile_dedup_unique_count_wasm(const TileDedup* dedup) {
+    return dedup->unique_count;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void tile_dedup_free_wasm(TileDedup* dedup) {
+    tile_dedup_free(dedup);
+}
+
+// container 是解码后的整个去重容器 (container_height 行)，原图写入 out_pixels
+// (width * height * 4 字节)。容器与元数据不符时返回 0
+EMSCRIPTEN_KEEPALIVE
+int tile_dedup_expand_wasm(
+    const unsigned char* container,
+    int width,
+    int container_height,
+    int height,
+    int content_width,
+    int content_height,
+    const unsigned int* shuffle_map,
+    unsigned char* out_pixels
+) {
+    return tile_dedup_expand(container, width, container_height, height, content_width, content_height,
+                             shuffle_map, out_pixels);
+}
+
+
+// =======================================================================
+// ==               按预算选择 PNG 压缩级别                             ==
+// =======================================================================
+// 运维给整批任务设定时间或体积预算，JS 按文件分摊后在编码前调用。抽样矮图在每个候选级别下
+// 用 encode_png_wasm 真正编码一次，所以颜色缩减、滤波策略和 deflate 都与完整编码一致。
+
+// 候选级别，按耗时从低到高排列。1-4 与 5 完全相同 (stb 的匹配链最短为 5)；
+// PNG_ARCHIVE_LEVEL 在抽样图上也要数秒，只用于后台归档，不参与估计
+static const int png_estimate_levels[] = {0, 5, 7, 9};
+#define PNG_ESTIMATE_LEVEL_COUNT ((int)(sizeof(png_estimate_levels) / sizeof(png_estimate_levels[0])))
+
+// 在各候选级别下编码抽样矮图 (width x sample_rows 的 RGBA)，外推到 total_rows 行。
+// 不改变调用前设置的压缩级别。成功返回 1
+static int png_estimate_levels_run(const unsigned char* sample, int width, int sample_rows, int total_rows,
+                                   PngLevelEstimate* estimates) {
+    const int saved_level = stbi_write_png_compression_level;
+    const int saved_search = stbi_write_png_filter_search;
+    int ok = 1;
+    for (int i = 0; i < PNG_ESTIMATE_LEVEL_COUNT && ok; ++i) {
+        size_t size;
+        set_png_compression_level_wasm(png_estimate_levels[i]);
+        const double start = emscripten_get_now();
+        ChunkedOutput* out = encode_png_wasm(sample, width, sample_rows, &size);
+        const double elapsed = emscripten_get_now() - start;
+        ok = out != NULL;
+        output_free_wasm(out);
+        if (ok) png_estimate_scale(&estimates[i], png_estimate_levels[i], size, elapsed, sample_rows, total_rows);
+    }
+    stbi_write_png_compression_level = saved_level;
+    stbi_write_png_filter_search = saved_search;
+    return ok;
+}
+
+// 抽样行、估计并按预算选择级别。返回选中的级别；图太小或内存不足时返回 -1 (调用方保持原级别)
+static int png_estimate_choose(png_estimate_row_func rows, void* context, int width, int total_rows,
+                               double time_budget_ms, double size_budget_bytes) {
+    const int sample_rows = png_estimate_sample_rows(total_rows);
+    if (sample_rows == 0) return -1;
+
+    const size_t row_bytes = (size_t)width * 4;
+    unsigned char* sample = (unsigned char*)malloc(row_bytes * (sample_rows + 1));
+    if (!sample) return -1;
+    png_estimate_gather(rows, context, total_rows, row_bytes, sample, sample + row_bytes * sample_rows);
+
+    PngLevelEstimate estimates[PNG_ESTIMATE_LEVEL_COUNT];
+    int level = -1;
+    if (png_estimate_levels_run(sample, width, sample_rows, total_rows, estimates)) {
+        level = png_estimate_pick(estimates, PNG_ESTIMATE_LEVEL_COUNT, time_budget_ms, size_budget_bytes);
+    }
+    free(sample);
+    return level;
+}
+
+typedef struct {
+    const unsigned char* pixels;
+    size_t row_bytes;
+} PlainRows;
+
+static const unsigned char* plain_rows_get(void* context, int y, unsigned char* buffer) {
+    const PlainRows* p = (const PlainRows*)context;
+    (void)buffer;
+    return p->pixels + (size_t)y * p->row_bytes;
+}
+
+// 给 encode_png_wasm 选级别。预算为 0 表示不限制该项
+EMSCRIPTEN_KEEPALIVE
+int choose_png_level_wasm(
+    const unsigned char* image_data,
+    int width,
+    int height,
+    double time_budget_ms,
+    double size_budget_bytes
+) {
+    PlainRows rows = {image_data, (size_t)width * 4};
+    return png_estimate_choose(plain_rows_get, &rows, width, height, time_budget_ms, size_budget_bytes);
+}
+
+// 给 encode_png_shuffled_wasm 选级别: 参数与它相同，抽样的是打乱后的容器行
+EMSCRIPTEN_KEEPALIVE
+int choose_png_shuffled_level_wasm(
+    const unsigned char* image_data,
+    int width,
+    int height,
+    int content_width,
+    int content_height,
+    const unsigned int* shuffle_map,
+    const unsigned char* header_rows,
+    const TileDedup* dedup,
+    double time_budget_ms,
+    double size_budget_bytes
+) {
+    ShuffleRows rows;
+    if (!shuffle_rows_init(&rows, image_data, width, height, 4, content_width, content_height,
+                           shuffle_map, header_rows, header_rows + (size_t)width * 4)) {
+        return -1;
+    }
+    if (dedup) shuffle_rows_set_dedup(&rows, dedup, dedup->table);
+    return png_estimate_choose(shuffle_rows_get, &rows, width, shuffle_rows_height(&rows),
+                               time_budget_ms, size_budget_bytes);
+}
+
+
+// =======================================================================
+// ==               JPEG 压缩域打乱 (JPEG → JPEG)                       ==
+// =======================================================================
+// 直接重排量化 DCT 系数并重新熵编码，不经过 IDCT，输出仍是与原图大小相当的 JPEG。
+
+// 检查是否为 jpeg_tile_shuffle_wasm 的输出 (带 JSHUF APP11 段)
+EMSCRIPTEN_KEEPALIVE
+int jpeg_is_tile_shuffled_wasm(const unsigned char* jpeg_data, int jpeg_size) {
+    JpegShuffleInfo info;
+    return jpeg_shuffle_read_info(jpeg_data, (size_t)jpeg_size, &info);
+}
+
+// 按 64 位种子 (由 JS 用 crypto.getRandomValues 生成) 打乱 32x32 像素块
+EMSCRIPTEN_KEEPALIVE
+unsigned char* jpeg_tile_shuffle_wasm(
+    const unsigned char* jpeg_data,
+    int jpeg_size,
+    unsigned int seed_lo,
+    unsigned int seed_hi,
+    size_t* out_size
+) {
+    unsigned long long seed = ((unsigned long long)seed_hi << 32) | seed_lo;
+    // 输出由 jpeg_shuffle.h 用 malloc 分配，只有 stb JPEG 解析器的分量缓冲区在 arena 里
+    arena_begin();
+    unsigned char* out = jpeg_tile_shuffle(jpeg_data, jpeg_size, 0, seed, out_size);
+    arena_end();
+    return out;
+}
+
+// 还原 jpeg_tile_shuffle_wasm 的输出，种子从文件中读取
+EMSCRIPTEN_KEEPALIVE
+unsigned char* jpeg_tile_unshuffle_wasm(
+    const unsigned char* jpeg_data,
+    int jpeg_size,
+    size_t* out_size
+) {
+    arena_begin();
+    unsigned char* out = jpeg_tile_shuffle(jpeg_data, jpeg_size, 1, 0, out_size);
+    arena_end();
+    return out;
+}
+
+// 由 64 位种子生成分块置换表 (与压缩域打乱相同的 PCG32 + Fisher-Yates)，
+// 供有损 JPEG 容器使用: 容器里只需保存种子，不必保存整张置换表
+EMSCRIPTEN_KEEPALIVE
+void make_shuffle_map_wasm(unsigned int* shuffle_map, int count, unsigned int seed_lo, unsigned int seed_hi) {
+    unsigned long long seed = ((unsigned long long)seed_hi << 32) | seed_lo;
+    jpeg_shuffle_make_map(shuffle_map, count, seed);
+}
+
+
+// =======================================================================
+// ==               分块压缩容器 (见 tile_container.h)                 ==
+// =======================================================================
+// 每个 32x32 块单独压缩，按置换表顺序存放并带偏移表，解密或查看局部时只需读出和解码用到的块。
+// JS 先读文件头和偏移表 (tile_container_header_size_wasm 给出长度) 打开容器，
+// 用 tile_container_region_slots_wasm 得到区域涉及的存储位置，从文件中只读出这几段数据，
+// 再交给 tile_container_decode_region_wasm。各块互不依赖，编码和解码都可以按线程并行。
+// 这部分全部用 malloc，不走 (非线程安全的) arena。
+
+// 编码和区域解码使用的线程数 (1 表示串行)，在未启用 pthread 的构建中没有效果
+static int tile_container_threads = 1;
+
+EMSCRIPTEN_KEEPALIVE
+void set_tile_container_threads(int thread_count) {
+    tile_container_threads = thread_count > 0 ? thread_count : 1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+ChunkedOutput* encode_tile_container_wasm(
+    const unsigned char* image_data,
+    int width,
+    int height,
+    unsigned int seed_lo,
+    unsigned int seed_hi,
+    size_t* out_size
+) {
+    ChunkedOutput* out = (ChunkedOutput*)calloc(1, sizeof(ChunkedOutput));
+    if (out == NULL) return NULL;
+    unsigned long long seed = ((unsigned long long)seed_hi << 32) | seed_lo;
+    int success = tile_container_encode(write_func_callback, out, image_data, width, height, seed,
+                                        jpeg_shuffle_make_map, tile_container_threads);
+    return output_finish(out, success, out_size);
+}
+
+// 不是分块容器时返回 0，否则返回打开容器所需的字节数 (文件头 + 偏移表)。只需要文件的前 32 字节
+EMSCRIPTEN_KEEPALIVE
+int tile_container_header_size_wasm(const unsigned char* data, int size) {
+    int width, height;
+    return (int)tile_container_read_header(data, size > 0 ? (size_t)size : 0, &width, &height);
+}
+
+// data 是文件开头的 tile_container_header_size_wasm 个字节。容器无效时返回 NULL
+EMSCRIPTEN_KEEPALIVE
+TileContainer* tile_container_open_wasm(const unsigned char* data, int size) {
+    return tile_container_open(data, size > 0 ? (size_t)size : 0, jpeg_shuffle_make_map);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void tile_container_free_wasm(TileContainer* container) {
+    tile_container_free(container);
+}
+
+// 写出 out[0..1] = 宽、高
+EMSCRIPTEN_KEEPALIVE
+void tile_container_info_wasm(const TileContainer* container, int* out) {
+    out[0] = container->width;
+    out[1] = container->height;
+}
+
+// 区域涉及的存储位置按升序写入 slots (容量为块数)，返回个数
+EMSCRIPTEN_KEEPALIVE
+int tile_container_region_slots_wasm(const TileContainer* container, int x, int y, int width, int height,
+                                     unsigned int* slots) {
+    return tile_container_region_slots(container, x, y, width, height, slots);
+}
+
+// payload 是 slots 中各存储位置的数据按同样顺序首尾相接，区域解码为 RGBA 写入 out_pixels
+EMSCRIPTEN_KEEPALIVE
+int tile_container_decode_region_wasm(
+    const TileContainer* container,
+    const unsigned char* payload,
+    int payload_size,
+    const unsigned int* slots,
+    int slot_count,
+    int x,
+    int y,
+    int width,
+    int height,
+    unsigned char* out_pixels
+) {
+    return tile_container_decode_region(container, payload, payload_size > 0 ? (size_t)payload_size : 0,
+                                        slots, slot_count, x, y, width, height, out_pixels,
+                                        tile_container_threads);
+}
+
+
+// =======================================================================
+// ==               arena 统计与重置                                    ==
+// =======================================================================
+
+// 把自上次重置以来的统计写入 out (6 个 uint32，顺序同 ArenaStats)
+EMSCRIPTEN_KEEPALIVE
+void arena_stats_wasm(unsigned int* out) {
+    const ArenaStats* st = &arena_state.stats;
+    out[0] = (unsigned int)st->alloc_count;
+    out[1] = (unsigned int)st->bytes_requested;
+    out[2] = (unsigned int)st->bytes_reused;
+    out[3] = (unsigned int)st->chunk_mallocs;
+    out[4] = (unsigned int)st->capacity;
+    out[5] = (unsigned int)st->peak;
+}
+
+// 每个任务结束后由 Worker 调用
+EMSCRIPTEN_KEEPALIVE
+void arena_reset_wasm(void) {
+    arena_reset();
+}
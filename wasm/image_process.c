@@ -1,7 +1,9 @@
 #include <string.h> // 用于 memcpy
 #include <stdlib.h>
 #include <emscripten/emscripten.h>
+#if defined(__wasm_simd128__)
 #include <wasm_simd128.h>
+#endif
 
 // --- 常量定义 ---
 const int CHANNELS = 4;
@@ -75,18 +77,16 @@ void perform_encryption(
 }
 
 /**
- * C 版本的解密核心逻辑 (最终修正版 - 无需修改函数签名)
- * 修正点:
- * 1. 在函数内部根据输入参数推导出原始图像的高度(originalHeight)，避免了修改函数签名。
- * 2. 基于推导出的 originalHeight 执行一次安全、大小正确的 memcpy，将加密图像的
- *    内容部分（包括未扰乱的底部行）复制到输出缓冲区，这既避免了内存溢出，
- *    也正确地初始化了输出图像。
- * 3. 保持了之前对 effectiveBlockHeight 的鲁棒性计算，以处理跨越 content_height 边界的图块。
+ * 解密核心逻辑，由调用方直接给出原始图像的高度。
+ * 不依赖容器在内容之后还有几行 (无损容器有 1 行 magic，有损 JPEG 容器没有)。
+ * 1. 执行一次安全、大小正确的 memcpy，将加密图像的内容部分（包括未扰乱的底部行）
+ *    复制到输出缓冲区，这既避免了内存溢出，也正确地初始化了输出图像。
+ * 2. 保持了之前对 effectiveBlockHeight 的鲁棒性计算，以处理跨越 content_height 边界的图块。
  */
 EMSCRIPTEN_KEEPALIVE
-void perform_decryption(
+void perform_decryption_rows(
     const unsigned char* restrict encrypted_pixels,
-    int width, int height,
+    int width, int original_height,
     int content_width, int content_height,
     const unsigned int* restrict shuffle_map,
     int encrypted_content_start_row,
@@ -95,22 +95,17 @@ void perform_decryption(
     const int blocksX = content_width / BLOCK_SIZE;
     const int blocksY = content_height / BLOCK_SIZE;
 
-    // --- 步骤 1: 根据输入参数推导出原始图像的高度 ---
-    // 加密图像总高度(height) = 内容起始行 + 原始高度 + 1个magic行
-    // 因此: originalHeight = height - encrypted_content_start_row - 1
-    const int originalHeight = height - encrypted_content_start_row - 1;
-
-    // --- 步骤 2: 安全地初始化输出缓冲区 ---
+    // --- 步骤 1: 安全地初始化输出缓冲区 ---
     // 定位到加密数据中实际图像内容的起始指针
     const unsigned char* encrypted_content_start = encrypted_pixels + (size_t)encrypted_content_start_row * width * CHANNELS;
     // 计算原始图像内容的总字节大小
-    const size_t original_image_size = (size_t)width * originalHeight * CHANNELS;
+    const size_t original_image_size = (size_t)width * original_height * CHANNELS;
 
     // 将加密图像的内容部分完整复制到输出缓冲区。
     // 这是安全的操作，因为 original_image_size 正好对应 decrypted_pixels 的分配大小。
     memcpy(decrypted_pixels, encrypted_content_start, original_image_size);
 
-    // --- 步骤 3: 执行核心解密循环 ---
+    // --- 步骤 2: 执行核心解密循环 ---
     // 这个循环现在是在一个已正确初始化的、大小正确的缓冲区上进行覆盖操作。
     int shuffle_map_idx = 0;
     for (int srcBlockY = 0; srcBlockY < blocksY; ++srcBlockY) {
@@ -147,4 +142,25 @@ void perform_decryption(
             }
         }
     }
+}
+
+/**
+ * C 版本的解密核心逻辑 (最终修正版 - 无需修改函数签名)
+ * 在函数内部根据输入参数推导出原始图像的高度(originalHeight)，避免了修改函数签名:
+ * 加密图像总高度(height) = 内容起始行 + 原始高度 + 1个magic行
+ * 因此: originalHeight = height - encrypted_content_start_row - 1
+ * 没有 magic 行的容器改用 perform_decryption_rows。
+ */
+EMSCRIPTEN_KEEPALIVE
+void perform_decryption(
+    const unsigned char* restrict encrypted_pixels,
+    int width, int height,
+    int content_width, int content_height,
+    const unsigned int* restrict shuffle_map,
+    int encrypted_content_start_row,
+    unsigned char* restrict decrypted_pixels)
+{
+    const int originalHeight = height - encrypted_content_start_row - 1;
+    perform_decryption_rows(encrypted_pixels, width, originalHeight, content_width, content_height,
+                            shuffle_map, encrypted_content_start_row, decrypted_pixels);
 }
\ No newline at end of file
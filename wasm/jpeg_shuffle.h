@@ -0,0 +1,420 @@
+#ifndef JPEG_SHUFFLE_H
+#define JPEG_SHUFFLE_H
+
+// =======================================================================
+// ==          JPEG 压缩域分块打乱 (不经过 IDCT，不重新量化)             ==
+// =======================================================================
+// 像素路径要把 JPEG 解码成 RGBA、打乱后再写成 PNG，输出往往是原图的 5-10 倍。
+// 这里直接在量化后的 DCT 系数上操作:
+//   1. 用 stb_image 的熵解码器读出各分量的量化系数 (coeff_only 模式，不反量化、不做 IDCT)
+//   2. 以 32x32 像素 (与像素路径的 BLOCK_SIZE 相同，总是 MCU 的整数倍) 为一块，整块搬移系数
+//   3. 按新的块顺序重新计算 DC 差分，用标准 Huffman 表重新熵编码为基线 JPEG
+// 量化表、采样因子和分量 ID 原样保留，解密后的系数与原图完全一致，解码出的像素逐位相同。
+// 置换由写在 APP11 段里的 64 位种子经 PCG32 + Fisher-Yates 生成，解密时据此求逆。
+// 右侧/底部凑不满一整块的边缘保持原位 (与像素路径一致)。
+//
+// 依赖 stb_image.h 与 stb_image_write.h 的实现 (stbi__jpeg 解析器、标准 Huffman 表)，
+// 必须在两者的 IMPLEMENTATION 之后包含。
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JPEG_SHUFFLE_TILE 32
+#define JPEG_SHUFFLE_VERSION 1
+// 单个 8x8 块编码后的最大字节数: 64 个符号 x (16 位码字 + 11 位附加位)，再按全部 0xFF 填充翻倍
+#define JPEG_SHUFFLE_MAX_BLOCK_BYTES 512
+
+static const unsigned char jpeg_shuffle_tag[6] = {'J', 'S', 'H', 'U', 'F', 0};
+
+typedef struct {
+    unsigned long long seed;
+    int tiles_x, tiles_y;
+} JpegShuffleInfo;
+
+// --- 置换生成 (PCG32 + Fisher-Yates) ---
+
+static unsigned int jpeg_shuffle_pcg32(unsigned long long* state) {
+    unsigned long long old = *state;
+    *state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+    unsigned int xorshifted = (unsigned int)(((old >> 18) ^ old) >> 27);
+    unsigned int rot = (unsigned int)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+// map[d] = 输出第 d 块取自原图的第几块
+static void jpeg_shuffle_make_map(unsigned int* map, int count, unsigned long long seed) {
+    unsigned long long state = seed + 0x853c49e6748fea9bULL;
+    jpeg_shuffle_pcg32(&state);
+    for (int i = 0; i < count; ++i) map[i] = (unsigned int)i;
+    for (int i = count - 1; i > 0; --i) {
+        int j = (int)(((unsigned long long)jpeg_shuffle_pcg32(&state) * (unsigned int)(i + 1)) >> 32);
+        unsigned int t = map[i];
+        map[i] = map[j];
+        map[j] = t;
+    }
+}
+
+// --- 读取 APP11 标记 ---
+
+static int jpeg_shuffle_read_info(const unsigned char* data, size_t size, JpegShuffleInfo* info) {
+    size_t pos = 2;
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return 0;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return 0;
+        unsigned char m = data[pos + 1];
+        if (m == 0xFF) { ++pos; continue; } // 填充字节
+        if (m == 0xDA || m == 0xD9) return 0; // 标记只会出现在扫描数据之前
+        if (m == 0x01 || (m >= 0xD0 && m <= 0xD7)) { pos += 2; continue; } // 无长度字段的标记
+        size_t len = ((size_t)data[pos + 2] << 8) | data[pos + 3];
+        if (len < 2 || pos + 2 + len > size) return 0;
+        if (m == 0xEB && len >= 22 && memcmp(data + pos + 4, jpeg_shuffle_tag, 6) == 0) {
+            const unsigned char* p = data + pos + 10;
+            if (p[0] != JPEG_SHUFFLE_VERSION || p[1] != JPEG_SHUFFLE_TILE) return 0;
+            info->tiles_x = (p[2] << 8) | p[3];
+            info->tiles_y = (p[4] << 8) | p[5];
+            info->seed = 0;
+            for (int i = 0; i < 8; ++i) info->seed = (info->seed << 8) | p[6 + i];
+            return 1;
+        }
+        pos += 2 + len;
+    }
+    return 0;
+}
+
+// --- 输出缓冲与比特写入 ---
+
+typedef struct {
+    unsigned char* buffer;
+    size_t size;
+    size_t capacity;
+    unsigned long long bits; // 待写出的比特，低位对齐 (只有低 bit_count 位有效)
+    int bit_count;
+} JpegShuffleWriter;
+
+static int jpeg_shuffle_reserve(JpegShuffleWriter* w, size_t extra) {
+    if (w->size + extra <= w->capacity) return 1;
+    size_t new_capacity = w->capacity * 2;
+    if (new_capacity < w->size + extra) new_capacity = w->size + extra;
+    unsigned char* p = (unsigned char*)realloc(w->buffer, new_capacity);
+    if (!p) return 0;
+    w->buffer = p;
+    w->capacity = new_capacity;
+    return 1;
+}
+
+// 以下写入函数不检查容量，调用前需先 jpeg_shuffle_reserve
+
+static inline void jpeg_shuffle_put16(JpegShuffleWriter* w, int v) {
+    w->buffer[w->size++] = (unsigned char)(v >> 8);
+    w->buffer[w->size++] = (unsigned char)v;
+}
+
+static inline void jpeg_shuffle_put_byte(JpegShuffleWriter* w, unsigned char c) {
+    w->buffer[w->size++] = c;
+    if (c == 0xFF) w->buffer[w->size++] = 0; // 字节填充
+}
+
+// 攒满 32 位再整字写出；只有字里含 0xFF 时才逐字节处理填充
+static inline void jpeg_shuffle_put_bits(JpegShuffleWriter* w, unsigned int code, int len) {
+    w->bits = (w->bits << len) | code;
+    w->bit_count += len;
+    if (w->bit_count >= 32) {
+        w->bit_count -= 32;
+        unsigned int word = (unsigned int)(w->bits >> w->bit_count);
+        unsigned int inv = ~word;
+        if (((inv - 0x01010101u) & ~inv & 0x80808080u) == 0) {
+            unsigned char* p = w->buffer + w->size;
+            p[0] = (unsigned char)(word >> 24);
+            p[1] = (unsigned char)(word >> 16);
+            p[2] = (unsigned char)(word >> 8);
+            p[3] = (unsigned char)word;
+            w->size += 4;
+        } else {
+            jpeg_shuffle_put_byte(w, (unsigned char)(word >> 24));
+            jpeg_shuffle_put_byte(w, (unsigned char)(word >> 16));
+            jpeg_shuffle_put_byte(w, (unsigned char)(word >> 8));
+            jpeg_shuffle_put_byte(w, (unsigned char)word);
+        }
+    }
+}
+
+// 写出剩余比特，最后一个字节用 1 补齐
+static void jpeg_shuffle_flush_bits(JpegShuffleWriter* w) {
+    int pad = (8 - (w->bit_count & 7)) & 7;
+    w->bits = (w->bits << pad) | ((1u << pad) - 1);
+    w->bit_count += pad;
+    while (w->bit_count >= 8) {
+        w->bit_count -= 8;
+        jpeg_shuffle_put_byte(w, (unsigned char)(w->bits >> w->bit_count));
+    }
+}
+
+// 幅值类别 (SSSS) 及其附加位: 负数写 v-1 的低 SSSS 位
+static inline int jpeg_shuffle_category(int v, unsigned int* extra) {
+    int mag = v < 0 ? -v : v;
+    int cat = mag ? 32 - __builtin_clz((unsigned int)mag) : 0;
+    *extra = (unsigned int)(v < 0 ? v - 1 : v) & ((1u << cat) - 1);
+    return cat;
+}
+
+// 按之字形顺序编码一个块，coeff 为自然顺序的量化系数
+static void jpeg_shuffle_encode_block(JpegShuffleWriter* w, const short* coeff, int* dc_pred,
+                                      const unsigned short dc_ht[256][2], const unsigned short ac_ht[256][2]) {
+    unsigned int extra;
+    int dc = coeff[0];
+    // 8 位精度下合法的 DC 不超过 ±1024、AC 不超过 ±1023；损坏的输入截断到标准表能表示的范围
+    if (dc < -1024) dc = -1024;
+    if (dc > 1023) dc = 1023;
+    int cat = jpeg_shuffle_category(dc - *dc_pred, &extra);
+    *dc_pred = dc;
+    jpeg_shuffle_put_bits(w, ((unsigned int)dc_ht[cat][0] << cat) | extra, dc_ht[cat][1] + cat);
+
+    int end = 63;
+    while (end > 0 && coeff[stbi__jpeg_dezigzag[end]] == 0) --end;
+    int run = 0;
+    for (int k = 1; k <= end; ++k) {
+        int v = coeff[stbi__jpeg_dezigzag[k]];
+        if (!v) {
+            ++run;
+            continue;
+        }
+        while (run >= 16) {
+            jpeg_shuffle_put_bits(w, ac_ht[0xF0][0], ac_ht[0xF0][1]); // ZRL
+            run -= 16;
+        }
+        if (v < -1023) v = -1023;
+        if (v > 1023) v = 1023;
+        cat = jpeg_shuffle_category(v, &extra);
+        int symbol = (run << 4) | cat;
+        jpeg_shuffle_put_bits(w, ((unsigned int)ac_ht[symbol][0] << cat) | extra, ac_ht[symbol][1] + cat);
+        run = 0;
+    }
+    if (end != 63) jpeg_shuffle_put_bits(w, ac_ht[0x00][0], ac_ht[0x00][1]); // EOB
+}
+
+// --- 块坐标映射 ---
+
+typedef struct {
+    const short* coeff;
+    int coeff_w;
+    int tile_w, tile_h; // 一个 32x32 像素块在本分量中占多少个 8x8 块
+} JpegShuffleComponent;
+
+typedef struct {
+    JpegShuffleComponent comp[4];
+    const unsigned int* map; // map[d] = 输出第 d 块取自输入的第几块
+    int tiles_x, tiles_y;
+} JpegShuffleLayout;
+
+static inline const short* jpeg_shuffle_src_block(const JpegShuffleLayout* l, int n, int bx, int by) {
+    const JpegShuffleComponent* c = &l->comp[n];
+    int tx = bx / c->tile_w, ty = by / c->tile_h;
+    if (tx < l->tiles_x && ty < l->tiles_y) {
+        unsigned int src = l->map[ty * l->tiles_x + tx];
+        bx = (int)(src % l->tiles_x) * c->tile_w + bx % c->tile_w;
+        by = (int)(src / l->tiles_x) * c->tile_h + by % c->tile_h;
+    }
+    return c->coeff + 64 * (bx + by * c->coeff_w);
+}
+
+// --- 主流程 ---
+
+// decrypt 为 0 时用 seed 打乱并写入 APP11 标记；为 1 时从 APP11 读取种子并还原 (输出不含标记)。
+// 成功返回 malloc 分配的 JPEG 数据 (调用方负责 free)，失败返回 NULL。
+static unsigned char* jpeg_tile_shuffle(const unsigned char* data, int size, int decrypt,
+                                        unsigned long long seed, size_t* out_size) {
+    JpegShuffleInfo info;
+    JpegShuffleLayout layout;
+    JpegShuffleWriter w = {0};
+    stbi__context s;
+    stbi__jpeg* j;
+    unsigned int* map = NULL;
+    unsigned char* result = NULL;
+    int n, k, quant_used = 0, quant16 = 0;
+
+    *out_size = 0;
+    if (decrypt) {
+        if (!jpeg_shuffle_read_info(data, (size_t)size, &info)) return NULL;
+        seed = info.seed;
+    }
+
+    // 1. 熵解码出量化系数 (基线、扩展和渐进式都会归并到 img_comp[].coeff)
+    memset(&s, 0, sizeof(s));
+    stbi__start_mem(&s, data, size);
+    j = (stbi__jpeg*)malloc(sizeof(stbi__jpeg));
+    if (!j) return NULL;
+    memset(j, 0, sizeof(stbi__jpeg));
+    j->s = &s;
+    j->coeff_only = 1;
+    stbi__setup_jpeg(j);
+    if (!stbi__decode_jpeg_image(j) || !j->img_comp[0].coeff) goto done;
+
+    n = s.img_n;
+    int width = (int)s.img_x, height = (int)s.img_y;
+    layout.tiles_x = width / JPEG_SHUFFLE_TILE;
+    layout.tiles_y = height / JPEG_SHUFFLE_TILE;
+    int tile_count = layout.tiles_x * layout.tiles_y;
+    if (decrypt ? (info.tiles_x != layout.tiles_x || info.tiles_y != layout.tiles_y) : tile_count == 0) goto done;
+
+    for (k = 0; k < n; ++k) {
+        // 单分量图像总是按 8x8 非交织编码，采样因子没有意义
+        int h = n == 1 ? 1 : j->img_comp[k].h, v = n == 1 ? 1 : j->img_comp[k].v;
+        int h_max = n == 1 ? 1 : j->img_h_max, v_max = n == 1 ? 1 : j->img_v_max;
+        // 分块必须落在 8x8 块边界上 (采样因子为 3 等少见情况不支持)
+        if ((JPEG_SHUFFLE_TILE / 8 * h) % h_max || (JPEG_SHUFFLE_TILE / 8 * v) % v_max) goto done;
+        layout.comp[k].coeff = j->img_comp[k].coeff;
+        layout.comp[k].coeff_w = j->img_comp[k].coeff_w;
+        layout.comp[k].tile_w = JPEG_SHUFFLE_TILE / 8 * h / h_max;
+        layout.comp[k].tile_h = JPEG_SHUFFLE_TILE / 8 * v / v_max;
+        quant_used |= 1 << j->img_comp[k].tq;
+    }
+    for (k = 0; k < 4; ++k) {
+        if (!(quant_used & (1 << k))) continue;
+        for (int i = 0; i < 64; ++i) quant16 |= j->dequant[k][i] > 255;
+    }
+
+    // 2. 生成置换表；解密时取逆置换
+    map = (unsigned int*)malloc(sizeof(unsigned int) * (tile_count ? tile_count : 1));
+    if (!map) goto done;
+    jpeg_shuffle_make_map(map, tile_count, seed);
+    if (decrypt) {
+        unsigned int* inverse = (unsigned int*)malloc(sizeof(unsigned int) * (tile_count ? tile_count : 1));
+        if (!inverse) goto done;
+        for (k = 0; k < tile_count; ++k) inverse[map[k]] = (unsigned int)k;
+        free(map);
+        map = inverse;
+    }
+    layout.map = map;
+
+    // 3. 写文件头。输出通常与输入大小相当，先按输入大小分配
+    w.capacity = (size_t)size + 1024;
+    w.buffer = (unsigned char*)malloc(w.capacity);
+    if (!w.buffer || !jpeg_shuffle_reserve(&w, 2048)) goto done;
+
+    jpeg_shuffle_put16(&w, 0xFFD8);
+    if (j->jfif) {
+        static const unsigned char app0[] = {0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+        memcpy(w.buffer + w.size, app0, sizeof(app0));
+        w.size += sizeof(app0);
+    }
+    if (j->app14_color_transform >= 0) {
+        // Adobe 标记决定 3/4 分量图像是否做 YCbCr/YCCK 转换，必须保留
+        static const unsigned char app14[] = {0xFF, 0xEE, 0, 14, 'A', 'd', 'o', 'b', 'e', 0, 100, 0, 0, 0, 0};
+        memcpy(w.buffer + w.size, app14, sizeof(app14));
+        w.size += sizeof(app14);
+        w.buffer[w.size++] = (unsigned char)j->app14_color_transform;
+    }
+    if (!decrypt) {
+        jpeg_shuffle_put16(&w, 0xFFEB);
+        jpeg_shuffle_put16(&w, 22);
+        memcpy(w.buffer + w.size, jpeg_shuffle_tag, 6);
+        w.size += 6;
+        w.buffer[w.size++] = JPEG_SHUFFLE_VERSION;
+        w.buffer[w.size++] = JPEG_SHUFFLE_TILE;
+        jpeg_shuffle_put16(&w, layout.tiles_x);
+        jpeg_shuffle_put16(&w, layout.tiles_y);
+        for (k = 7; k >= 0; --k) w.buffer[w.size++] = (unsigned char)(seed >> (k * 8));
+    }
+    for (k = 0; k < 4; ++k) {
+        if (!(quant_used & (1 << k))) continue;
+        jpeg_shuffle_put16(&w, 0xFFDB);
+        jpeg_shuffle_put16(&w, 3 + 64 * (quant16 ? 2 : 1));
+        w.buffer[w.size++] = (unsigned char)((quant16 << 4) | k);
+        for (int i = 0; i < 64; ++i) {
+            int q = j->dequant[k][stbi__jpeg_dezigzag[i]];
+            if (quant16) w.buffer[w.size++] = (unsigned char)(q >> 8);
+            w.buffer[w.size++] = (unsigned char)q;
+        }
+    }
+    // 16 位量化表只允许出现在扩展顺序式 (SOF1) 中
+    jpeg_shuffle_put16(&w, quant16 ? 0xFFC1 : 0xFFC0);
+    jpeg_shuffle_put16(&w, 8 + 3 * n);
+    w.buffer[w.size++] = 8;
+    jpeg_shuffle_put16(&w, height);
+    jpeg_shuffle_put16(&w, width);
+    w.buffer[w.size++] = (unsigned char)n;
+    for (k = 0; k < n; ++k) {
+        w.buffer[w.size++] = (unsigned char)j->img_comp[k].id;
+        w.buffer[w.size++] = n == 1 ? 0x11 : (unsigned char)((j->img_comp[k].h << 4) | j->img_comp[k].v);
+        w.buffer[w.size++] = (unsigned char)j->img_comp[k].tq;
+    }
+    {
+        // 表 0 给亮度 (第一个分量)，表 1 给其余分量
+        static const unsigned char* const bits[4] = {
+            stbiw__jpg_std_dc_luminance_nrcodes, stbiw__jpg_std_ac_luminance_nrcodes,
+            stbiw__jpg_std_dc_chrominance_nrcodes, stbiw__jpg_std_ac_chrominance_nrcodes};
+        static const unsigned char* const vals[4] = {
+            stbiw__jpg_std_dc_luminance_values, stbiw__jpg_std_ac_luminance_values,
+            stbiw__jpg_std_dc_chrominance_values, stbiw__jpg_std_ac_chrominance_values};
+        static const unsigned char ids[4] = {0x00, 0x10, 0x01, 0x11};
+        static const int val_count[4] = {12, 162, 12, 162};
+        jpeg_shuffle_put16(&w, 0xFFC4);
+        jpeg_shuffle_put16(&w, 2 + 4 * 17 + 12 + 162 + 12 + 162);
+        for (k = 0; k < 4; ++k) {
+            w.buffer[w.size++] = ids[k];
+            memcpy(w.buffer + w.size, bits[k] + 1, 16);
+            w.size += 16;
+            memcpy(w.buffer + w.size, vals[k], val_count[k]);
+            w.size += val_count[k];
+        }
+    }
+    jpeg_shuffle_put16(&w, 0xFFDA);
+    jpeg_shuffle_put16(&w, 6 + 2 * n);
+    w.buffer[w.size++] = (unsigned char)n;
+    for (k = 0; k < n; ++k) {
+        w.buffer[w.size++] = (unsigned char)j->img_comp[k].id;
+        w.buffer[w.size++] = k == 0 ? 0x00 : 0x11;
+    }
+    w.buffer[w.size++] = 0;
+    w.buffer[w.size++] = 63;
+    w.buffer[w.size++] = 0;
+
+    // 4. 按置换后的顺序重新熵编码
+    {
+        int dc_pred[4] = {0, 0, 0, 0};
+        if (n == 1) {
+            int blocks_w = (width + 7) >> 3, blocks_h = (height + 7) >> 3;
+            for (int by = 0; by < blocks_h; ++by) {
+                if (!jpeg_shuffle_reserve(&w, (size_t)blocks_w * JPEG_SHUFFLE_MAX_BLOCK_BYTES)) goto done;
+                for (int bx = 0; bx < blocks_w; ++bx)
+                    jpeg_shuffle_encode_block(&w, jpeg_shuffle_src_block(&layout, 0, bx, by), &dc_pred[0],
+                                              stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+            }
+        } else {
+            int blocks_per_mcu = 0;
+            for (k = 0; k < n; ++k) blocks_per_mcu += j->img_comp[k].h * j->img_comp[k].v;
+            for (int my = 0; my < j->img_mcu_y; ++my) {
+                if (!jpeg_shuffle_reserve(&w, (size_t)j->img_mcu_x * blocks_per_mcu * JPEG_SHUFFLE_MAX_BLOCK_BYTES)) goto done;
+                for (int mx = 0; mx < j->img_mcu_x; ++mx) {
+                    for (k = 0; k < n; ++k) {
+                        int h = j->img_comp[k].h, v = j->img_comp[k].v;
+                        for (int y = 0; y < v; ++y)
+                            for (int x = 0; x < h; ++x)
+                                jpeg_shuffle_encode_block(&w, jpeg_shuffle_src_block(&layout, k, mx * h + x, my * v + y), &dc_pred[k],
+                                                          k ? stbiw__jpg_UVDC_HT : stbiw__jpg_YDC_HT,
+                                                          k ? stbiw__jpg_UVAC_HT : stbiw__jpg_YAC_HT);
+                    }
+                }
+            }
+        }
+    }
+
+    // 5. 写出剩余比特和 EOI
+    if (!jpeg_shuffle_reserve(&w, 16)) goto done;
+    jpeg_shuffle_flush_bits(&w);
+    jpeg_shuffle_put16(&w, 0xFFD9);
+
+    result = w.buffer;
+    w.buffer = NULL;
+    *out_size = w.size;
+
+done:
+    free(w.buffer);
+    free(map);
+    stbi__cleanup_jpeg(j);
+    free(j);
+    return result;
+}
+
+#endif // JPEG_SHUFFLE_H
@@ -0,0 +1,82 @@
+#ifndef PNG_ESTIMATE_H
+#define PNG_ESTIMATE_H
+
+// =======================================================================
+// ==          PNG 编码体积/耗时的抽样估计 (按预算选择压缩级别)          ==
+// =======================================================================
+// 完整编码之前，从图像中均匀抽取几段行带，拼成一张矮图，在每个候选级别下真正编码一次
+// (颜色缩减、滤波、deflate 都与完整编码相同)，再按行数比例外推完整编码的体积和耗时。
+// 抽样的行数固定 (PNG_ESTIMATE_BANDS * PNG_ESTIMATE_BAND_ROWS)，估计的开销与图像高度无关。
+//   - png_estimate_gather:  按行源 (与 stbi_write_row_func 签名相同) 收集抽样行
+//   - png_estimate_scale:   把矮图上的测量结果外推到整图
+//   - png_estimate_pick:    按时间或体积预算选择级别
+// 行带之间不连续，带首行的滤波看不到真正的上一行，deflate 也找不到跨带的匹配，
+// 所以估计略偏大；同一张图的各级别偏差方向相同，不影响级别之间的比较。
+
+#include <stddef.h>
+#include <string.h>
+
+#define PNG_ESTIMATE_BANDS 8
+#define PNG_ESTIMATE_BAND_ROWS 16
+// 更慢的级别至少要让输出再小 1% 才值得: 噪声类图像在各级别下体积几乎相同，停在最快的级别
+#define PNG_ESTIMATE_MIN_GAIN 0.01
+
+typedef const unsigned char* (*png_estimate_row_func)(void* context, int y, unsigned char* buffer);
+
+typedef struct {
+    int level;
+    double bytes;   // 外推的输出体积
+    double ms;      // 外推的编码耗时
+} PngLevelEstimate;
+
+// 抽样的总行数。图像不超过抽样行数的两倍时返回 0: 直接编码整图不比估计慢多少
+static int png_estimate_sample_rows(int height) {
+    const int rows = PNG_ESTIMATE_BANDS * PNG_ESTIMATE_BAND_ROWS;
+    return height > rows * 2 ? rows : 0;
+}
+
+// 把 height 行的行源中均匀分布的 PNG_ESTIMATE_BANDS 段行带依次复制到 sample
+// (sample_rows * row_bytes 字节)。row_buffer 是行源需要现场生成行时使用的暂存区
+static void png_estimate_gather(png_estimate_row_func rows, void* context, int height, size_t row_bytes,
+                                unsigned char* sample, unsigned char* row_buffer) {
+    for (int band = 0; band < PNG_ESTIMATE_BANDS; ++band) {
+        const int first = (int)((long long)band * (height - PNG_ESTIMATE_BAND_ROWS) / (PNG_ESTIMATE_BANDS - 1));
+        for (int i = 0; i < PNG_ESTIMATE_BAND_ROWS; ++i) {
+            memcpy(sample, rows(context, first + i, row_buffer), row_bytes);
+            sample += row_bytes;
+        }
+    }
+}
+
+// 矮图上测得 sample_bytes 字节、sample_ms 毫秒，外推到 total_rows 行的整图
+static void png_estimate_scale(PngLevelEstimate* e, int level, size_t sample_bytes, double sample_ms,
+                               int sample_rows, int total_rows) {
+    const double scale = (double)total_rows / sample_rows;
+    e->level = level;
+    e->bytes = (double)sample_bytes * scale;
+    e->ms = sample_ms * scale;
+}
+
+// estimates 按耗时从低到高排列。预算为 0 表示不限制:
+//   - 有体积预算: 选满足体积预算的最快级别；都不满足时选体积最小的
+//   - 有时间预算: 在不超时的级别里选体积最小的；都超时时选最快的
+//   - 都没有:     选体积最小的
+// 选体积最小时，更慢的级别收益不足 PNG_ESTIMATE_MIN_GAIN 就不采用
+static int png_estimate_pick(const PngLevelEstimate* estimates, int count,
+                             double time_budget_ms, double size_budget_bytes) {
+    if (size_budget_bytes > 0) {
+        for (int i = 0; i < count; ++i) {
+            if (estimates[i].bytes <= size_budget_bytes) return estimates[i].level;
+        }
+        time_budget_ms = 0;
+    }
+
+    int best = 0;
+    for (int i = 1; i < count; ++i) {
+        if (time_budget_ms > 0 && estimates[i].ms > time_budget_ms) continue;
+        if (estimates[i].bytes < estimates[best].bytes * (1.0 - PNG_ESTIMATE_MIN_GAIN)) best = i;
+    }
+    return estimates[best].level;
+}
+
+#endif // PNG_ESTIMATE_H
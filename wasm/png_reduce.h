@@ -0,0 +1,198 @@
+#ifndef PNG_REDUCE_H
+#define PNG_REDUCE_H
+
+// =======================================================================
+// ==          PNG 颜色精简 (调色板检测、颜色类型缩减)                   ==
+// =======================================================================
+// 截图、示意图这类图片通常只有不到 256 种颜色，此时写成索引色 PNG (PLTE + 每像素 1 字节)，
+// 送进 deflate 的数据只有 RGBA 的 1/4，压缩更快，文件也更小。
+// 照片几乎都是全不透明的，灰度图的 R == G == B，这些情况可以少写 1-3 个通道。
+//   - png_build_palette:     一趟扫描同时统计颜色并生成索引，超过 256 种颜色时立即放弃
+//                            (png_palette_init/png_palette_add 可以把多段像素加入同一个调色板)
+//   - png_analyze_channels:  向量化检测 alpha 是否全为 255、是否所有像素都是灰色
+//   - png_pack_channels:     把 RGBA 压成灰度、灰度+alpha 或 RGB
+// 打乱分块不改变颜色集合，所以加密后的图片同样可以走这些路径。
+// 以上缩减都能被解码器按 RGBA 原样还原 (灰度展开为 R=G=B，缺失的 alpha 补 255)。
+// 假定目标平台为小端序 (wasm, x86, ARM)。
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define PNG_PALETTE_MAX 256
+// 开放寻址哈希表的槽数，保持装载率不超过 1/2
+#define PNG_PALETTE_HASH_BITS 9
+
+static inline unsigned int png_palette_hash(unsigned int color) {
+    return (color * 0x9E3779B1u) >> (32 - PNG_PALETTE_HASH_BITS);
+}
+
+// 检查从 p 开始的 4 个像素是否都等于 color (大片纯色区域的快速路径)
+static inline int png_reduce_same4(const unsigned char* p, unsigned int color) {
+#if defined(__wasm_simd128__)
+    return wasm_i8x16_all_true(wasm_i32x4_eq(wasm_v128_load(p), wasm_i32x4_splat((int)color)));
+#elif defined(__SSE2__)
+    __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi32((int)color));
+    return _mm_movemask_epi8(eq) == 0xFFFF;
+#else
+    unsigned int v[4];
+    memcpy(v, p, 16);
+    return v[0] == color && v[1] == color && v[2] == color && v[3] == color;
+#endif
+}
+
+// 调色板的构建状态，多段像素可以依次加入同一个调色板
+typedef struct {
+    unsigned int keys[1 << PNG_PALETTE_HASH_BITS];
+    // 0 表示空槽，否则为调色板索引 + 1
+    unsigned short slots[1 << PNG_PALETTE_HASH_BITS];
+    unsigned char* palette; // 最多 256 个颜色 (RGBA 字节序)
+    int size;
+} PngPalette;
+
+static void png_palette_init(PngPalette* p, unsigned char* palette) {
+    memset(p->slots, 0, sizeof(p->slots));
+    p->palette = palette;
+    p->size = 0;
+}
+
+// 统计一段 RGBA 像素的颜色，并把每个像素写成调色板索引 (indices 需要 pixel_count 字节)。
+// 颜色累计超过 256 种时返回 0，此时 indices 的内容无意义。
+static int png_palette_add(PngPalette* p, const unsigned char* rgba, size_t pixel_count, unsigned char* indices) {
+    unsigned int last_color = 0;
+    unsigned char last_index = 0;
+    int have_last = 0;
+    size_t i = 0;
+
+    while (i < pixel_count) {
+        unsigned int color;
+        memcpy(&color, rgba + i * 4, 4);
+
+        if (have_last && color == last_color) {
+            // 与上一个像素相同: 不查哈希表，并尽量 4 个一组跳过
+            indices[i++] = last_index;
+            while (i + 4 <= pixel_count && png_reduce_same4(rgba + i * 4, last_color)) {
+                memset(indices + i, last_index, 4);
+                i += 4;
+            }
+            continue;
+        }
+
+        unsigned int h = png_palette_hash(color);
+        while (p->slots[h] && p->keys[h] != color) {
+            h = (h + 1) & ((1 << PNG_PALETTE_HASH_BITS) - 1);
+        }
+        if (!p->slots[h]) {
+            if (p->size == PNG_PALETTE_MAX) return 0;
+            p->keys[h] = color;
+            p->slots[h] = (unsigned short)(p->size + 1);
+            memcpy(p->palette + p->size * 4, &color, 4);
+            ++p->size;
+        }
+
+        last_color = color;
+        last_index = (unsigned char)(p->slots[h] - 1);
+        have_last = 1;
+        indices[i++] = last_index;
+    }
+    return 1;
+}
+
+// 统计 RGBA 像素的颜色，并把每个像素写成调色板索引。
+// palette 接收最多 256 个颜色 (RGBA 字节序)，indices 需要 pixel_count 字节。
+// 返回调色板大小；颜色超过 256 种时返回 0，此时 indices 的内容无意义。
+static int png_build_palette(const unsigned char* rgba, size_t pixel_count,
+                             unsigned char* palette, unsigned char* indices) {
+    PngPalette p;
+    png_palette_init(&p, palette);
+    return png_palette_add(&p, rgba, pixel_count, indices) ? p.size : 0;
+}
+
+// 小端序下一个 RGBA 像素读成 32 位整数: R | G << 8 | B << 16 | A << 24
+#define PNG_ALPHA_MASK 0xFF000000u
+// (p ^ (p >> 8)) 的低 16 位为 0 当且仅当 R == G 且 G == B
+#define PNG_GRAY_MASK 0x0000FFFFu
+// 每处理这么多像素检查一次是否已经可以提前结束
+#define PNG_ANALYZE_CHUNK 1024
+
+// 检测 alpha 是否全为 255 (*opaque) 以及是否所有像素都满足 R == G == B (*gray)。
+// 两个条件都不成立时立即返回。
+static void png_analyze_channels(const unsigned char* rgba, size_t pixel_count, int* opaque, int* gray) {
+    unsigned int alpha_and = PNG_ALPHA_MASK; // 所有像素 alpha 的按位与
+    unsigned int gray_or = 0;                // 所有像素 (p ^ p >> 8) 低 16 位的按位或
+    size_t i = 0;
+
+    while (i < pixel_count) {
+        size_t end = pixel_count - i > PNG_ANALYZE_CHUNK ? i + PNG_ANALYZE_CHUNK : pixel_count;
+#if defined(__wasm_simd128__)
+        {
+            v128_t v_alpha = wasm_i32x4_splat((int)PNG_ALPHA_MASK), v_gray = wasm_i32x4_splat(0);
+            const v128_t gray_mask = wasm_i32x4_splat((int)PNG_GRAY_MASK);
+            for (; i + 4 <= end; i += 4) {
+                v128_t v = wasm_v128_load(rgba + i * 4);
+                v_alpha = wasm_v128_and(v_alpha, v);
+                v_gray = wasm_v128_or(v_gray, wasm_v128_and(wasm_v128_xor(v, wasm_u32x4_shr(v, 8)), gray_mask));
+            }
+            alpha_and &= wasm_u32x4_extract_lane(v_alpha, 0) & wasm_u32x4_extract_lane(v_alpha, 1) &
+                         wasm_u32x4_extract_lane(v_alpha, 2) & wasm_u32x4_extract_lane(v_alpha, 3);
+            gray_or |= wasm_u32x4_extract_lane(v_gray, 0) | wasm_u32x4_extract_lane(v_gray, 1) |
+                       wasm_u32x4_extract_lane(v_gray, 2) | wasm_u32x4_extract_lane(v_gray, 3);
+        }
+#elif defined(__SSE2__)
+        {
+            __m128i v_alpha = _mm_set1_epi32((int)PNG_ALPHA_MASK), v_gray = _mm_setzero_si128();
+            const __m128i gray_mask = _mm_set1_epi32((int)PNG_GRAY_MASK);
+            unsigned int lanes[4];
+            for (; i + 4 <= end; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+                v_alpha = _mm_and_si128(v_alpha, v);
+                v_gray = _mm_or_si128(v_gray, _mm_and_si128(_mm_xor_si128(v, _mm_srli_epi32(v, 8)), gray_mask));
+            }
+            _mm_storeu_si128((__m128i*)lanes, v_alpha);
+            alpha_and &= lanes[0] & lanes[1] & lanes[2] & lanes[3];
+            _mm_storeu_si128((__m128i*)lanes, v_gray);
+            gray_or |= lanes[0] | lanes[1] | lanes[2] | lanes[3];
+        }
+#endif
+        for (; i < end; ++i) {
+            unsigned int p;
+            memcpy(&p, rgba + i * 4, 4);
+            alpha_and &= p;
+            gray_or |= (p ^ (p >> 8)) & PNG_GRAY_MASK;
+        }
+        if ((alpha_and & PNG_ALPHA_MASK) != PNG_ALPHA_MASK && gray_or != 0) break;
+    }
+
+    *opaque = (alpha_and & PNG_ALPHA_MASK) == PNG_ALPHA_MASK;
+    *gray = gray_or == 0;
+}
+
+// 把 RGBA 压成 channels 个通道: 1 = 灰度, 2 = 灰度 + alpha, 3 = RGB
+static void png_pack_channels(const unsigned char* rgba, size_t pixel_count, int channels, unsigned char* out) {
+    size_t i;
+    switch (channels) {
+        case 1:
+            for (i = 0; i < pixel_count; ++i) out[i] = rgba[i * 4];
+            break;
+        case 2:
+            for (i = 0; i < pixel_count; ++i) {
+                out[i * 2] = rgba[i * 4];
+                out[i * 2 + 1] = rgba[i * 4 + 3];
+            }
+            break;
+        case 3:
+            for (i = 0; i < pixel_count; ++i) {
+                out[i * 3] = rgba[i * 4];
+                out[i * 3 + 1] = rgba[i * 4 + 1];
+                out[i * 3 + 2] = rgba[i * 4 + 2];
+            }
+            break;
+    }
+}
+
+#endif // PNG_REDUCE_H
@@ -0,0 +1,741 @@
+#ifndef PNG_STREAM_H
+#define PNG_STREAM_H
+
+// =======================================================================
+// ==          流式 PNG 解码 (边读文件边解码)                            ==
+// =======================================================================
+// decode_image_into_wasm 要求整个文件先进入 WASM 内存，而 stb 的 PNG 解码器又会把全部 IDAT
+// 拼成一块、整体 inflate 成 (stride + 1) * height 的原始数据后再去滤波。
+// 这里按输入到达的顺序逐块处理，JS 从 Blob 的 ReadableStream 每读到一段就喂进来:
+//   1. 按字节驱动的状态机解析 PNG 块 (签名、块头、数据、CRC)，IDAT 数据追加到压缩输入缓冲区
+//   2. inflate 可以在任意位置暂停: 剩余输入不足 PNG_STREAM_LOOKAHEAD 字节时不开始新的一步，
+//      等下一段数据到达 (IDAT 之后出现其他块时输入已完整，此时把剩下的全部解完)
+//   3. 解压结果写入 64KB 环形窗口，每攒够 32KB 就交给扫描线组装，
+//      一行凑齐后立即去滤波并转换为 RGBA，写到调用方通过 png_stream_set_output 给出的缓冲区
+// 压缩输入只保留尚未解压的部分，原始数据只保留窗口和两行扫描线，都与图像大小无关。
+//
+// 用法: png_stream_feed 返回 PNG_STREAM_HEADER 后用 png_stream_info 取尺寸、分配 width * height * 4
+// 字节并调用 png_stream_set_output，之后继续喂数据直到返回 PNG_STREAM_DONE。
+// 也可以改用 png_stream_set_row_func 逐行接收 RGBA，由调用方决定每一行写到哪里。
+// 隔行扫描 (Adam7) 和未知的关键块 (如 Apple 的 CgBI) 返回 PNG_STREAM_UNSUPPORTED，
+// 调用方改用 stb 的整体解码。与 stb 一样不校验块 CRC 和 Adler-32。
+// 输出与 stbi_load_from_memory(..., 4) 逐字节相同 (16 位取高字节，tRNS 按原始采样值比较)。
+//
+// 依赖 stb_image.h 的实现 (Huffman 表构建、长度/距离表、paeth)，必须在其 IMPLEMENTATION 之后包含。
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PNG_STREAM_NEED_MORE 0    // 需要更多输入
+#define PNG_STREAM_HEADER 1       // 已读到 IHDR，等待 png_stream_set_output
+#define PNG_STREAM_DONE 2         // 所有行都已输出
+#define PNG_STREAM_ERROR (-1)     // 文件损坏
+#define PNG_STREAM_UNSUPPORTED (-2) // 不是 PNG 或不支持的特性，交给整体解码
+
+// 环形窗口大小 (2 的幂)，至少是 deflate 回溯距离 32KB 加上待交付的数据
+#define PNG_STREAM_WINDOW 65536
+// 待交付的解压数据达到这么多字节时先交给扫描线组装
+#define PNG_STREAM_FLUSH 32768
+// inflate 一步最多读取的输入字节数: 动态 Huffman 块头最长约 300 字节，单个长度/距离符号不超过 6 字节
+#define PNG_STREAM_LOOKAHEAD 1024
+// 需要完整保存的块 (IHDR、PLTE、tRNS) 的最大长度
+#define PNG_STREAM_SMALL_CHUNK 768
+
+// 逐行接收解码结果: rgba 为第 y 行的 width * 4 字节，只在回调期间有效
+typedef void png_stream_row_func(void* context, int y, const unsigned char* rgba);
+
+#define PNG_STREAM_TYPE(a, b, c, d) (((unsigned int)(a) << 24) | ((unsigned int)(b) << 16) | ((unsigned int)(c) << 8) | (unsigned int)(d))
+
+enum {
+    PNG_STREAM_SIGNATURE,
+    PNG_STREAM_CHUNK_HEADER,
+    PNG_STREAM_CHUNK_DATA,
+    PNG_STREAM_CHUNK_CRC,
+    PNG_STREAM_END
+};
+
+enum {
+    PNG_STREAM_Z_HEADER,
+    PNG_STREAM_Z_BLOCK,
+    PNG_STREAM_Z_STORED,
+    PNG_STREAM_Z_CODES,
+    PNG_STREAM_Z_DONE
+};
+
+typedef struct {
+    int status;
+
+    // --- 块解析 ---
+    int parse_state;
+    unsigned char header[8];  // 签名或块头 (长度 + 类型)
+    int header_len;
+    unsigned int chunk_type;
+    unsigned int chunk_left;  // 当前块还没读到的数据字节数
+    unsigned char chunk[PNG_STREAM_SMALL_CHUNK];
+    unsigned int chunk_len;
+    int seen_ihdr, seen_idat;
+
+    // --- IHDR / PLTE / tRNS ---
+    int width, height, depth, color;
+    int channels;             // 文件中每像素的通道数
+    int filter_bytes;         // 去滤波时左邻像素的字节距离 (不足 1 字节按 1)
+    size_t stride;            // 每行数据字节数 (不含滤波类型字节)
+    unsigned char palette[256 * 4];
+    int palette_size;
+    int has_trans;
+    unsigned short trans[3];  // 灰度/RGB 的透明色键 (原始采样值)
+
+    // --- 压缩输入 ---
+    unsigned char* zin;
+    size_t zin_pos, zin_len, zin_cap;
+    int zin_final;            // IDAT 已经结束，zin 中就是剩余的全部输入
+    unsigned long long bitbuf;
+    int bitcnt;
+    int zerr;                 // 输入已完整但不够读: 数据被截断
+
+    // --- inflate ---
+    int zstate;
+    int final_block;
+    size_t stored_left;
+    stbi__zhuffman z_length, z_distance;
+    unsigned char window[PNG_STREAM_WINDOW];
+    size_t wpos, rpos;        // 已解压 / 已交付的总字节数
+
+    // --- 扫描线 ---
+    unsigned char* line;      // 正在组装的行 (滤波类型字节 + stride 字节)
+    unsigned char* prev;      // 上一行去滤波后的结果，首行之前为全 0
+    size_t line_fill;
+    unsigned char* out;       // RGBA 输出，由调用方提供
+    png_stream_row_func* row_func; // 或者逐行交给回调
+    void* row_context;
+    unsigned char* row_rgba;  // 需要转换格式时交给回调的一行 RGBA
+    int rows_done;
+} PngStream;
+
+static const unsigned char png_stream_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+static inline unsigned int png_stream_read32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static int png_stream_fail(PngStream* s, int status) {
+    s->status = status;
+    return 0;
+}
+
+static PngStream* png_stream_create(void) {
+    PngStream* s = (PngStream*)calloc(1, sizeof(PngStream));
+    if (!s) return NULL;
+    for (int i = 0; i < 256; ++i) s->palette[i * 4 + 3] = 255;
+    return s;
+}
+
+static void png_stream_free(PngStream* s) {
+    if (!s) return;
+    free(s->zin);
+    free(s->line);
+    free(s->prev);
+    free(s->row_rgba);
+    free(s);
+}
+
+// 输出缓冲区至少 width * height * 4 字节，在解码出第一行之前设置
+static void png_stream_set_output(PngStream* s, unsigned char* rgba) {
+    s->out = rgba;
+}
+
+// 代替 png_stream_set_output: 每解出一行就调用 func。读到 IHDR 之后设置，内存不足时返回 0
+static int png_stream_set_row_func(PngStream* s, png_stream_row_func* func, void* context) {
+    if (!s->seen_ihdr) return 0;
+    // 8 位 RGBA 去滤波后就是输出格式，直接交出扫描线，不需要转换缓冲区
+    if (!(s->depth == 8 && s->color == 6) && !s->row_rgba) {
+        s->row_rgba = (unsigned char*)malloc((size_t)s->width * 4);
+        if (!s->row_rgba) return 0;
+    }
+    s->row_func = func;
+    s->row_context = context;
+    return 1;
+}
+
+static inline int png_stream_has_output(const PngStream* s) {
+    return s->out != NULL || s->row_func != NULL;
+}
+
+// --- 块解析 ---
+
+static int png_stream_parse_ihdr(PngStream* s) {
+    static const int channels_for_color[7] = {1, 0, 3, 1, 2, 0, 4};
+    const unsigned char* p = s->chunk;
+    if (s->chunk_len != 13) return png_stream_fail(s, PNG_STREAM_ERROR);
+
+    const unsigned int width = png_stream_read32(p), height = png_stream_read32(p + 4);
+    const int depth = p[8], color = p[9];
+    if (width == 0 || height == 0 || width > STBI_MAX_DIMENSIONS || height > STBI_MAX_DIMENSIONS) {
+        return png_stream_fail(s, PNG_STREAM_ERROR);
+    }
+    if (color > 6 || channels_for_color[color] == 0 || p[10] != 0 || p[11] != 0 || p[12] > 1) {
+        return png_stream_fail(s, PNG_STREAM_ERROR);
+    }
+    // 合法的位深: 灰度 1/2/4/8/16，索引色 1/2/4/8，其余 8/16
+    const int depth_ok = depth == 8 || (depth == 16 && color != 3) ||
+                         ((depth == 1 || depth == 2 || depth == 4) && (color == 0 || color == 3));
+    if (!depth_ok) return png_stream_fail(s, PNG_STREAM_ERROR);
+    // Adam7 的 7 趟子图像不按行顺序出现，交给 stb 整体解码
+    if (p[12] == 1) return png_stream_fail(s, PNG_STREAM_UNSUPPORTED);
+
+    s->width = (int)width;
+    s->height = (int)height;
+    s->depth = depth;
+    s->color = color;
+    s->channels = channels_for_color[color];
+    const int bits = s->channels * depth;
+    s->filter_bytes = bits >= 8 ? bits / 8 : 1;
+    s->stride = ((size_t)width * bits + 7) / 8;
+
+    s->line = (unsigned char*)malloc(s->stride + 1);
+    s->prev = (unsigned char*)calloc(s->stride + 1, 1);
+    if (!s->line || !s->prev) return png_stream_fail(s, PNG_STREAM_ERROR);
+    s->seen_ihdr = 1;
+    return 1;
+}
+
+static int png_stream_parse_plte(PngStream* s) {
+    if (s->chunk_len % 3 != 0 || s->chunk_len > 256 * 3) return png_stream_fail(s, PNG_STREAM_ERROR);
+    s->palette_size = (int)(s->chunk_len / 3);
+    for (int i = 0; i < s->palette_size; ++i) {
+        s->palette[i * 4] = s->chunk[i * 3];
+        s->palette[i * 4 + 1] = s->chunk[i * 3 + 1];
+        s->palette[i * 4 + 2] = s->chunk[i * 3 + 2];
+    }
+    return 1;
+}
+
+static int png_stream_parse_trns(PngStream* s) {
+    if (s->color == 3) {
+        // 调色板前 n 项的 alpha
+        if (s->palette_size == 0 || s->chunk_len > (unsigned int)s->palette_size) {
+            return png_stream_fail(s, PNG_STREAM_ERROR);
+        }
+        for (unsigned int i = 0; i < s->chunk_len; ++i) s->palette[i * 4 + 3] = s->chunk[i];
+        return 1;
+    }
+    if (s->color & 4) return png_stream_fail(s, PNG_STREAM_ERROR); // 已有 alpha 通道
+    if (s->chunk_len != (unsigned int)s->channels * 2) return png_stream_fail(s, PNG_STREAM_ERROR);
+    for (int k = 0; k < s->channels; ++k) {
+        unsigned int v = ((unsigned int)s->chunk[k * 2] << 8) | s->chunk[k * 2 + 1];
+        // 与 stb 相同: 16 位以下只看低字节
+        s->trans[k] = (unsigned short)(s->depth == 16 ? v : v & 255);
+    }
+    s->has_trans = 1;
+    return 1;
+}
+
+static int png_stream_zin_append(PngStream* s, const unsigned char* data, size_t len) {
+    if (s->zin_len + len > s->zin_cap && s->zin_pos > 0) {
+        // 已解压的输入不再需要，把剩余部分移到开头
+        memmove(s->zin, s->zin + s->zin_pos, s->zin_len - s->zin_pos);
+        s->zin_len -= s->zin_pos;
+        s->zin_pos = 0;
+    }
+    if (s->zin_len + len > s->zin_cap) {
+        size_t cap = s->zin_cap ? s->zin_cap : 65536;
+        while (cap < s->zin_len + len) cap *= 2;
+        unsigned char* zin = (unsigned char*)realloc(s->zin, cap);
+        if (!zin) return png_stream_fail(s, PNG_STREAM_ERROR);
+        s->zin = zin;
+        s->zin_cap = cap;
+    }
+    memcpy(s->zin + s->zin_len, data, len);
+    s->zin_len += len;
+    return 1;
+}
+
+// 块头读完后调用，决定如何处理块数据
+static int png_stream_begin_chunk(PngStream* s) {
+    const unsigned int type = s->chunk_type;
+    if (!s->seen_ihdr && type != PNG_STREAM_TYPE('I', 'H', 'D', 'R')) return png_stream_fail(s, PNG_STREAM_ERROR);
+
+    if (type == PNG_STREAM_TYPE('I', 'D', 'A', 'T')) {
+        if (s->color == 3 && s->palette_size == 0) return png_stream_fail(s, PNG_STREAM_ERROR);
+        s->seen_idat = 1;
+    } else if (s->seen_idat) {
+        // IDAT 之后的任何块都说明压缩数据已经到齐
+        s->zin_final = 1;
+    }
+
+    if (type == PNG_STREAM_TYPE('I', 'E', 'N', 'D')) {
+        if (!s->seen_idat) return png_stream_fail(s, PNG_STREAM_ERROR);
+        s->parse_state = PNG_STREAM_END;
+        return 1;
+    }
+    if (type == PNG_STREAM_TYPE('I', 'H', 'D', 'R') || type == PNG_STREAM_TYPE('P', 'L', 'T', 'E') ||
+        type == PNG_STREAM_TYPE('t', 'R', 'N', 'S')) {
+        if (s->chunk_left > PNG_STREAM_SMALL_CHUNK) return png_stream_fail(s, PNG_STREAM_ERROR);
+        if ((type == PNG_STREAM_TYPE('I', 'H', 'D', 'R')) == (s->seen_ihdr != 0)) return png_stream_fail(s, PNG_STREAM_ERROR);
+    } else if (type != PNG_STREAM_TYPE('I', 'D', 'A', 'T') && !(type & 0x20000000)) {
+        // 不认识的关键块 (类型首字母大写)
+        return png_stream_fail(s, PNG_STREAM_UNSUPPORTED);
+    }
+    s->chunk_len = 0;
+    s->parse_state = PNG_STREAM_CHUNK_DATA;
+    return 1;
+}
+
+static int png_stream_end_chunk(PngStream* s) {
+    int ok = 1;
+    switch (s->chunk_type) {
+        case PNG_STREAM_TYPE('I', 'H', 'D', 'R'): ok = png_stream_parse_ihdr(s); break;
+        case PNG_STREAM_TYPE('P', 'L', 'T', 'E'): ok = png_stream_parse_plte(s); break;
+        case PNG_STREAM_TYPE('t', 'R', 'N', 'S'): ok = png_stream_parse_trns(s); break;
+    }
+    s->parse_state = PNG_STREAM_CHUNK_CRC;
+    s->header_len = 0;
+    return ok;
+}
+
+static int png_stream_parse(PngStream* s, const unsigned char* data, size_t len) {
+    while (len > 0) {
+        switch (s->parse_state) {
+            case PNG_STREAM_SIGNATURE:
+                if (*data != png_stream_signature[s->header_len]) return png_stream_fail(s, PNG_STREAM_UNSUPPORTED);
+                ++data, --len;
+                if (++s->header_len == 8) {
+                    s->header_len = 0;
+                    s->parse_state = PNG_STREAM_CHUNK_HEADER;
+                }
+                break;
+
+            case PNG_STREAM_CHUNK_HEADER:
+                s->header[s->header_len++] = *data++;
+                --len;
+                if (s->header_len == 8) {
+                    s->chunk_left = png_stream_read32(s->header);
+                    s->chunk_type = png_stream_read32(s->header + 4);
+                    if (s->chunk_left > 0x7fffffffu) return png_stream_fail(s, PNG_STREAM_ERROR);
+                    if (!png_stream_begin_chunk(s)) return 0;
+                    if (s->parse_state == PNG_STREAM_CHUNK_DATA && s->chunk_left == 0 && !png_stream_end_chunk(s)) return 0;
+                }
+                break;
+
+            case PNG_STREAM_CHUNK_DATA: {
+                const size_t n = len < s->chunk_left ? len : s->chunk_left;
+                if (s->chunk_type == PNG_STREAM_TYPE('I', 'D', 'A', 'T')) {
+                    if (!png_stream_zin_append(s, data, n)) return 0;
+                } else if (s->chunk_type == PNG_STREAM_TYPE('I', 'H', 'D', 'R') || s->chunk_type == PNG_STREAM_TYPE('P', 'L', 'T', 'E') ||
+                           s->chunk_type == PNG_STREAM_TYPE('t', 'R', 'N', 'S')) {
+                    memcpy(s->chunk + s->chunk_len, data, n);
+                    s->chunk_len += (unsigned int)n;
+                }
+                data += n, len -= n;
+                s->chunk_left -= (unsigned int)n;
+                if (s->chunk_left == 0 && !png_stream_end_chunk(s)) return 0;
+                break;
+            }
+
+            case PNG_STREAM_CHUNK_CRC: {
+                const size_t n = len < (size_t)(4 - s->header_len) ? len : (size_t)(4 - s->header_len);
+                data += n, len -= n;
+                s->header_len += (int)n;
+                if (s->header_len == 4) {
+                    s->header_len = 0;
+                    s->parse_state = PNG_STREAM_CHUNK_HEADER;
+                }
+                break;
+            }
+
+            default: // PNG_STREAM_END: IEND 之后的数据忽略
+                return 1;
+        }
+    }
+    return 1;
+}
+
+// --- 位读取 ---
+
+static inline void png_stream_refill(PngStream* s) {
+    if (s->zin_len - s->zin_pos >= 8) {
+        // 小端序下一次读 8 字节，zin_pos 只前进完整放进位缓冲的字节数。
+        // bitcnt 之上残留的是下一个字节的部分位，下次读入时会在同一位置写入相同的值
+        unsigned long long v;
+        memcpy(&v, s->zin + s->zin_pos, 8);
+        s->bitbuf |= v << s->bitcnt;
+        s->zin_pos += (size_t)((63 - s->bitcnt) >> 3);
+        s->bitcnt |= 56;
+        return;
+    }
+    while (s->bitcnt <= 56 && s->zin_pos < s->zin_len) {
+        s->bitbuf |= (unsigned long long)s->zin[s->zin_pos++] << s->bitcnt;
+        s->bitcnt += 8;
+    }
+}
+
+static inline void png_stream_consume(PngStream* s, int n) {
+    if (n > s->bitcnt) {
+        s->zerr = 1;
+        s->bitbuf = 0;
+        s->bitcnt = 0;
+        return;
+    }
+    s->bitbuf >>= n;
+    s->bitcnt -= n;
+}
+
+static inline unsigned int png_stream_bits(PngStream* s, int n) {
+    if (s->bitcnt < n) png_stream_refill(s);
+    const unsigned int v = (unsigned int)(s->bitbuf & ((1ull << n) - 1));
+    png_stream_consume(s, n);
+    return v;
+}
+
+// 与 stbi__zhuffman_decode 相同，但读自己的位缓冲。输入结束时不足的位按 0 补齐
+// (最后一个符号之后总有 4 字节的 Adler-32，补齐的位不会真的被消耗)
+static int png_stream_decode(PngStream* s, const stbi__zhuffman* z) {
+    if (s->bitcnt < 16) png_stream_refill(s);
+    const unsigned int bits = (unsigned int)s->bitbuf;
+    int b = z->fast[bits & STBI__ZFAST_MASK];
+    if (b) {
+        png_stream_consume(s, b >> 9);
+        return b & 511;
+    }
+    const int k = stbi__bit_reverse((int)(bits & 0xffff), 16);
+    int len;
+    for (len = STBI__ZFAST_BITS + 1;; ++len) {
+        if (k < z->maxcode[len]) break;
+    }
+    if (len >= 16) return -1;
+    b = (k >> (16 - len)) - z->firstcode[len] + z->firstsymbol[len];
+    if (b >= STBI__ZNSYMS || z->size[b] != len) return -1;
+    png_stream_consume(s, len);
+    return z->value[b];
+}
+
+// --- inflate ---
+
+static int png_stream_zlib_header(PngStream* s) {
+    const unsigned int cmf = png_stream_bits(s, 8), flg = png_stream_bits(s, 8);
+    if ((cmf * 256 + flg) % 31 != 0 || (flg & 32) || (cmf & 15) != 8) return 0;
+    s->zstate = PNG_STREAM_Z_BLOCK;
+    return 1;
+}
+
+static int png_stream_dynamic_tables(PngStream* s) {
+    static const unsigned char length_dezigzag[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    stbi__zhuffman z_codelength;
+    unsigned char lencodes[286 + 32 + 137];
+    unsigned char codelength_sizes[19];
+
+    const int hlit = (int)png_stream_bits(s, 5) + 257;
+    const int hdist = (int)png_stream_bits(s, 5) + 1;
+    const int hclen = (int)png_stream_bits(s, 4) + 4;
+    const int ntot = hlit + hdist;
+
+    memset(codelength_sizes, 0, sizeof(codelength_sizes));
+    for (int i = 0; i < hclen; ++i) codelength_sizes[length_dezigzag[i]] = (unsigned char)png_stream_bits(s, 3);
+    if (!stbi__zbuild_huffman(&z_codelength, codelength_sizes, 19)) return 0;
+
+    int n = 0;
+    while (n < ntot) {
+        int c = png_stream_decode(s, &z_codelength);
+        if (c < 0 || c >= 19 || s->zerr) return 0;
+        if (c < 16) {
+            lencodes[n++] = (unsigned char)c;
+            continue;
+        }
+        unsigned char fill = 0;
+        if (c == 16) {
+            if (n == 0) return 0;
+            c = (int)png_stream_bits(s, 2) + 3;
+            fill = lencodes[n - 1];
+        } else if (c == 17) {
+            c = (int)png_stream_bits(s, 3) + 3;
+        } else {
+            c = (int)png_stream_bits(s, 7) + 11;
+        }
+        if (ntot - n < c) return 0;
+        memset(lencodes + n, fill, c);
+        n += c;
+    }
+    return stbi__zbuild_huffman(&s->z_length, lencodes, hlit) &&
+           stbi__zbuild_huffman(&s->z_distance, lencodes + hlit, hdist);
+}
+
+static int png_stream_block_header(PngStream* s) {
+    s->final_block = (int)png_stream_bits(s, 1);
+    const unsigned int type = png_stream_bits(s, 2);
+    if (type == 0) {
+        // 存储块: 丢弃到字节边界，LEN 和 NLEN 各 2 字节
+        png_stream_consume(s, s->bitcnt & 7);
+        const unsigned int len = png_stream_bits(s, 16), nlen = png_stream_bits(s, 16);
+        if (nlen != (len ^ 0xffff)) return 0;
+        s->stored_left = len;
+        s->zstate = PNG_STREAM_Z_STORED;
+    } else if (type == 1) {
+        if (!stbi__zbuild_huffman(&s->z_length, stbi__zdefault_length, STBI__ZNSYMS) ||
+            !stbi__zbuild_huffman(&s->z_distance, stbi__zdefault_distance, 32)) {
+            return 0;
+        }
+        s->zstate = PNG_STREAM_Z_CODES;
+    } else if (type == 2) {
+        if (!png_stream_dynamic_tables(s)) return 0;
+        s->zstate = PNG_STREAM_Z_CODES;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static void png_stream_end_block(PngStream* s) {
+    s->zstate = s->final_block ? PNG_STREAM_Z_DONE : PNG_STREAM_Z_BLOCK;
+}
+
+// 存储块: 先取位缓冲里剩下的整字节，再直接从 zin 拷贝。返回 -1 表示需要更多输入
+static int png_stream_stored(PngStream* s) {
+    while (s->stored_left > 0 && s->wpos - s->rpos < PNG_STREAM_FLUSH) {
+        if (s->bitcnt >= 8) {
+            s->window[s->wpos++ & (PNG_STREAM_WINDOW - 1)] = (unsigned char)s->bitbuf;
+            png_stream_consume(s, 8);
+            --s->stored_left;
+            continue;
+        }
+        if (s->zin_pos == s->zin_len) return s->zin_final ? 0 : -1;
+        // 位缓冲高位可能还留着 8 字节读入时多读的字节，它们马上会被直接拷走
+        s->bitbuf = 0;
+
+        const size_t at = s->wpos & (PNG_STREAM_WINDOW - 1);
+        size_t n = s->zin_len - s->zin_pos;
+        if (n > s->stored_left) n = s->stored_left;
+        if (n > PNG_STREAM_FLUSH - (s->wpos - s->rpos)) n = PNG_STREAM_FLUSH - (s->wpos - s->rpos);
+        if (n > PNG_STREAM_WINDOW - at) n = PNG_STREAM_WINDOW - at;
+        memcpy(s->window + at, s->zin + s->zin_pos, n);
+        s->zin_pos += n;
+        s->wpos += n;
+        s->stored_left -= n;
+    }
+    if (s->stored_left == 0) png_stream_end_block(s);
+    return 1;
+}
+
+// 解码 Huffman 块的符号，直到块结束、待交付数据达到 PNG_STREAM_FLUSH 或输入不够一步
+static int png_stream_codes(PngStream* s) {
+    const size_t mask = PNG_STREAM_WINDOW - 1;
+    while (s->wpos - s->rpos < PNG_STREAM_FLUSH) {
+        if (!s->zin_final && s->zin_len - s->zin_pos < PNG_STREAM_LOOKAHEAD) return 1;
+        // 一个长度/距离符号最多 48 位
+        if (s->bitcnt < 48) png_stream_refill(s);
+
+        int sym = png_stream_decode(s, &s->z_length);
+        if (sym < 256) {
+            if (sym < 0) return 0;
+            s->window[s->wpos++ & mask] = (unsigned char)sym;
+            continue;
+        }
+        if (sym == 256) {
+            png_stream_end_block(s);
+            return 1;
+        }
+        if (sym >= 286) return 0;
+        sym -= 257;
+        int len = stbi__zlength_base[sym];
+        if (stbi__zlength_extra[sym]) len += (int)png_stream_bits(s, stbi__zlength_extra[sym]);
+        sym = png_stream_decode(s, &s->z_distance);
+        if (sym < 0 || sym >= 30) return 0;
+        size_t dist = (size_t)stbi__zdist_base[sym];
+        if (stbi__zdist_extra[sym]) dist += png_stream_bits(s, stbi__zdist_extra[sym]);
+        if (dist > s->wpos || s->zerr) return 0;
+
+        const size_t from = (s->wpos - dist) & mask, to = s->wpos & mask;
+        if (from + len <= PNG_STREAM_WINDOW && to + len <= PNG_STREAM_WINDOW) {
+            // 源和目标都不跨越窗口末尾 (绝大多数情况)，重叠时逐字节复制以重复最近的数据
+            if (dist >= (size_t)len) {
+                memcpy(s->window + to, s->window + from, len);
+            } else {
+                for (int i = 0; i < len; ++i) s->window[to + i] = s->window[from + i];
+            }
+            s->wpos += len;
+        } else {
+            for (int i = 0; i < len; ++i, ++s->wpos) s->window[s->wpos & mask] = s->window[(s->wpos - dist) & mask];
+        }
+    }
+    return 1;
+}
+
+// --- 扫描线 ---
+
+// 16 位以下的灰度按 stb 的规则放大到 0-255
+static const unsigned char png_stream_depth_scale[9] = {0, 0xff, 0x55, 0, 0x11, 0, 0, 0, 0x01};
+
+// 读第 i 个采样 (16 位返回完整的原始值)
+static inline unsigned int png_stream_sample(const unsigned char* row, int depth, size_t i) {
+    switch (depth) {
+        case 16: return ((unsigned int)row[i * 2] << 8) | row[i * 2 + 1];
+        case 8: return row[i];
+        default: {
+            const size_t bit = i * depth;
+            return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+        }
+    }
+}
+
+// 去滤波后的一行转换为 RGBA
+static void png_stream_convert_row(const PngStream* s, const unsigned char* row, unsigned char* dst) {
+    const int depth = s->depth, channels = s->channels;
+    const int shift = depth == 16 ? 8 : 0;
+    const unsigned int scale = depth == 16 ? 1 : png_stream_depth_scale[depth];
+
+    if (depth == 8 && s->color == 6) {
+        memcpy(dst, row, (size_t)s->width * 4);
+        return;
+    }
+    for (int x = 0; x < s->width; ++x, dst += 4) {
+        const size_t i = (size_t)x * channels;
+        if (s->color == 3) {
+            memcpy(dst, s->palette + png_stream_sample(row, depth, i) * 4, 4);
+            continue;
+        }
+        unsigned int v[4];
+        for (int k = 0; k < channels; ++k) v[k] = png_stream_sample(row, depth, i + k);
+        switch (s->color) {
+            case 0: // 灰度
+                dst[0] = dst[1] = dst[2] = (unsigned char)((v[0] >> shift) * scale);
+                dst[3] = s->has_trans && v[0] == s->trans[0] ? 0 : 255;
+                break;
+            case 4: // 灰度 + alpha
+                dst[0] = dst[1] = dst[2] = (unsigned char)(v[0] >> shift);
+                dst[3] = (unsigned char)(v[1] >> shift);
+                break;
+            case 2: // RGB
+                dst[0] = (unsigned char)(v[0] >> shift);
+                dst[1] = (unsigned char)(v[1] >> shift);
+                dst[2] = (unsigned char)(v[2] >> shift);
+                dst[3] = s->has_trans && v[0] == s->trans[0] && v[1] == s->trans[1] && v[2] == s->trans[2] ? 0 : 255;
+                break;
+            default: // RGBA 16 位
+                dst[0] = (unsigned char)(v[0] >> 8);
+                dst[1] = (unsigned char)(v[1] >> 8);
+                dst[2] = (unsigned char)(v[2] >> 8);
+                dst[3] = (unsigned char)(v[3] >> 8);
+                break;
+        }
+    }
+}
+
+// line 已经凑齐: 去滤波、转换、与 prev 交换
+static int png_stream_finish_row(PngStream* s) {
+    unsigned char* cur = s->line + 1;
+    const unsigned char* prior = s->prev + 1;
+    const size_t n = s->stride, fb = (size_t)s->filter_bytes;
+    size_t i;
+
+    switch (s->line[0]) {
+        case 0: break;
+        case 1: // Sub
+            for (i = fb; i < n; ++i) cur[i] = (unsigned char)(cur[i] + cur[i - fb]);
+            break;
+        case 2: // Up
+            for (i = 0; i < n; ++i) cur[i] = (unsigned char)(cur[i] + prior[i]);
+            break;
+        case 3: // Average
+            for (i = 0; i < fb && i < n; ++i) cur[i] = (unsigned char)(cur[i] + (prior[i] >> 1));
+            for (; i < n; ++i) cur[i] = (unsigned char)(cur[i] + ((cur[i - fb] + prior[i]) >> 1));
+            break;
+        case 4: // Paeth
+            for (i = 0; i < fb && i < n; ++i) cur[i] = (unsigned char)(cur[i] + prior[i]);
+            for (; i < n; ++i) cur[i] = (unsigned char)(cur[i] + stbi__paeth(cur[i - fb], prior[i], prior[i - fb]));
+            break;
+        default:
+            return 0;
+    }
+
+    if (s->row_func) {
+        if (s->row_rgba) {
+            png_stream_convert_row(s, cur, s->row_rgba);
+            s->row_func(s->row_context, s->rows_done, s->row_rgba);
+        } else {
+            s->row_func(s->row_context, s->rows_done, cur);
+        }
+    } else {
+        png_stream_convert_row(s, cur, s->out + (size_t)s->rows_done * s->width * 4);
+    }
+    unsigned char* t = s->prev;
+    s->prev = s->line;
+    s->line = t;
+    s->line_fill = 0;
+    ++s->rows_done;
+    return 1;
+}
+
+// 把窗口里待交付的数据组装成行
+static int png_stream_deliver(PngStream* s) {
+    const size_t line_size = s->stride + 1;
+    while (s->rpos < s->wpos) {
+        if (s->rows_done == s->height) {
+            // 最后一行之后多余的数据忽略 (与 stb 相同)
+            s->rpos = s->wpos;
+            break;
+        }
+        const size_t at = s->rpos & (PNG_STREAM_WINDOW - 1);
+        size_t n = s->wpos - s->rpos;
+        if (n > PNG_STREAM_WINDOW - at) n = PNG_STREAM_WINDOW - at;
+        if (n > line_size - s->line_fill) n = line_size - s->line_fill;
+        memcpy(s->line + s->line_fill, s->window + at, n);
+        s->line_fill += n;
+        s->rpos += n;
+        if (s->line_fill == line_size && !png_stream_finish_row(s)) return 0;
+    }
+    return 1;
+}
+
+static int png_stream_inflate(PngStream* s) {
+    while (s->zstate != PNG_STREAM_Z_DONE) {
+        if (s->wpos - s->rpos >= PNG_STREAM_FLUSH && !png_stream_deliver(s)) return 0;
+
+        if (s->zstate == PNG_STREAM_Z_STORED) {
+            const int r = png_stream_stored(s);
+            if (r < 0) break;
+            if (r == 0) return 0;
+            continue;
+        }
+        if (!s->zin_final && s->zin_len - s->zin_pos < PNG_STREAM_LOOKAHEAD) break;
+
+        int ok;
+        switch (s->zstate) {
+            case PNG_STREAM_Z_HEADER: ok = png_stream_zlib_header(s); break;
+            case PNG_STREAM_Z_BLOCK: ok = png_stream_block_header(s); break;
+            default: ok = png_stream_codes(s); break;
+        }
+        if (!ok || s->zerr) return 0;
+    }
+    return png_stream_deliver(s);
+}
+
+// 喂入下一段文件数据 (len 可以为 0，用于设置输出后继续处理已缓冲的数据)
+static int png_stream_feed(PngStream* s, const unsigned char* data, size_t len) {
+    if (s->status != PNG_STREAM_NEED_MORE && s->status != PNG_STREAM_HEADER) return s->status;
+    if (len > 0 && !png_stream_parse(s, data, len)) return s->status;
+
+    if (png_stream_has_output(s) && s->seen_idat && !png_stream_inflate(s)) {
+        png_stream_fail(s, PNG_STREAM_ERROR);
+        return s->status;
+    }
+
+    if (s->zstate == PNG_STREAM_Z_DONE) {
+        s->status = s->rows_done == s->height ? PNG_STREAM_DONE : PNG_STREAM_ERROR;
+    } else if (png_stream_has_output(s) && s->zin_final) {
+        // 输入已经完整，inflate 却没有结束
+        s->status = PNG_STREAM_ERROR;
+    } else {
+        s->status = s->seen_ihdr && !png_stream_has_output(s) ? PNG_STREAM_HEADER : PNG_STREAM_NEED_MORE;
+    }
+    return s->status;
+}
+
+// 读到 IHDR 后返回 1 并给出尺寸
+static int png_stream_info(const PngStream* s, int* out_width, int* out_height) {
+    if (!s->seen_ihdr) return 0;
+    *out_width = s->width;
+    *out_height = s->height;
+    return 1;
+}
+
+#endif // PNG_STREAM_H
@@ -0,0 +1,257 @@
+#ifndef QOI_CODEC_H
+#define QOI_CODEC_H
+
+// =======================================================================
+// ==          QOI 无损编解码 (快速容器格式)                             ==
+// =======================================================================
+// QOI ("Quite OK Image", https://qoiformat.org) 用索引表、游程和小差分对像素逐个编码，
+// 没有 deflate 的匹配查找和 Huffman 编码，编码速度比 PNG 快一个数量级，压缩率略低。
+// 浏览器无法直接显示 QOI，所以只用于两端都是本工具的内部流水线。
+//   - qoi_encode_to_func: RGBA 像素 -> QOI 文件 (头部固定写 4 通道、sRGB)，
+//                         与 stbi_write_*_to_func 一样分段交给回调，不需要整个文件大小的缓冲区
+//   - qoi_encode_rows_to_func: 同上，但像素行由回调按顺序逐行提供 (不需要整幅图像在内存中)
+//   - qoi_decode_rgba:    QOI 文件 -> RGBA 像素 (3 通道文件的 alpha 按规范补 255)
+//   - qoi_read_header / qoi_decode_pixels: 先读尺寸，再解码到调用方提供的缓冲区
+// qoi_decode_rgba 返回的缓冲区用 malloc 分配，由调用方 free。
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00 // 00xxxxxx
+#define QOI_OP_DIFF  0x40 // 01xxxxxx
+#define QOI_OP_LUMA  0x80 // 10xxxxxx
+#define QOI_OP_RUN   0xc0 // 11xxxxxx
+#define QOI_OP_RGB   0xfe // 11111110
+#define QOI_OP_RGBA  0xff // 11111111
+#define QOI_MASK_2   0xc0
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+// 与参考实现相同的像素数上限，防止恶意文件让输出缓冲区的大小计算溢出
+#define QOI_PIXELS_MAX 400000000u
+// 编码时的暂存区大小，写满后交给回调
+#define QOI_STAGE_SIZE 65536
+
+// 与 stb_image_write 的 stbi_write_func 签名相同，两者可以共用一个回调
+typedef void qoi_write_func(void* context, void* data, int size);
+// 与 stbi_write_row_func 签名相同: 返回第 y 行的 RGBA 像素，可以指向自己的内存，
+// 也可以填入 buffer (width * 4 字节) 后返回 buffer
+typedef const unsigned char* qoi_row_func(void* context, int y, unsigned char* buffer);
+
+static const unsigned char qoi_padding[QOI_PADDING_SIZE] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+static inline unsigned int qoi_hash(const unsigned char* px) {
+    return (px[0] * 3u + px[1] * 5u + px[2] * 7u + px[3] * 11u) & 63;
+}
+
+static inline unsigned int qoi_read32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static inline void qoi_write32(unsigned char* p, unsigned int v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+// 检查文件头魔数 "qoif"
+static int qoi_is_qoi(const unsigned char* data, size_t size) {
+    return size >= QOI_HEADER_SIZE + QOI_PADDING_SIZE && memcmp(data, "qoif", 4) == 0;
+}
+
+// 编码成功返回 1。像素写入 QOI_STAGE_SIZE 字节的暂存区，剩余空间不够一个最长操作时先交给回调
+static int qoi_encode_rows_to_func(qoi_write_func* func, void* context, int width, int height,
+                                   qoi_row_func* rows, void* row_context) {
+    if (width <= 0 || height <= 0 || (size_t)width * height > QOI_PIXELS_MAX) return 0;
+
+    unsigned char* out = (unsigned char*)malloc(QOI_STAGE_SIZE + (size_t)width * 4);
+    if (!out) return 0;
+    unsigned char* row_buffer = out + QOI_STAGE_SIZE;
+    // 每次循环最多写 QOI_OP_RUN (1 字节) + QOI_OP_RGBA (5 字节)
+    const size_t flush_at = QOI_STAGE_SIZE - 6;
+
+    memcpy(out, "qoif", 4);
+    qoi_write32(out + 4, (unsigned int)width);
+    qoi_write32(out + 8, (unsigned int)height);
+    out[12] = 4; // channels
+    out[13] = 0; // colorspace: sRGB + 线性 alpha
+    size_t p = QOI_HEADER_SIZE;
+
+    unsigned int index[64] = {0};
+    unsigned int prev = 0;
+    unsigned char prev_px[4] = {0, 0, 0, 255};
+    memcpy(&prev, prev_px, 4);
+    int run = 0;
+
+    // 游程、索引表和前一个像素跨行延续，与整幅图像连续编码的结果相同
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* row = rows(row_context, y, row_buffer);
+        for (int x = 0; x < width; ++x) {
+            const unsigned char* px = row + (size_t)x * 4;
+            unsigned int cur;
+            memcpy(&cur, px, 4);
+
+            if (cur == prev) {
+                // 截图和纯色背景里大段相同像素只需计数
+                if (++run == 62) {
+                    if (p >= flush_at) {
+                        func(context, out, (int)p);
+                        p = 0;
+                    }
+                    out[p++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (p >= flush_at) {
+                func(context, out, (int)p);
+                p = 0;
+            }
+            if (run > 0) {
+                out[p++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            const unsigned int h = qoi_hash(px);
+            if (index[h] == cur) {
+                out[p++] = (unsigned char)(QOI_OP_INDEX | h);
+            } else {
+                index[h] = cur;
+                memcpy(prev_px, &prev, 4);
+                if (px[3] == prev_px[3]) {
+                    const signed char vr = (signed char)(px[0] - prev_px[0]);
+                    const signed char vg = (signed char)(px[1] - prev_px[1]);
+                    const signed char vb = (signed char)(px[2] - prev_px[2]);
+                    const signed char vg_r = (signed char)(vr - vg);
+                    const signed char vg_b = (signed char)(vb - vg);
+
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        out[p++] = (unsigned char)(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                    } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                        out[p++] = (unsigned char)(QOI_OP_LUMA | (vg + 32));
+                        out[p++] = (unsigned char)((vg_r + 8) << 4 | (vg_b + 8));
+                    } else {
+                        out[p++] = QOI_OP_RGB;
+                        out[p++] = px[0];
+                        out[p++] = px[1];
+                        out[p++] = px[2];
+                    }
+                } else {
+                    out[p++] = QOI_OP_RGBA;
+                    memcpy(out + p, px, 4);
+                    p += 4;
+                }
+            }
+            prev = cur;
+        }
+    }
+    if (p + 1 + QOI_PADDING_SIZE > QOI_STAGE_SIZE) {
+        func(context, out, (int)p);
+        p = 0;
+    }
+    if (run > 0) out[p++] = (unsigned char)(QOI_OP_RUN | (run - 1));
+
+    memcpy(out + p, qoi_padding, QOI_PADDING_SIZE);
+    p += QOI_PADDING_SIZE;
+    func(context, out, (int)p);
+    free(out);
+    return 1;
+}
+
+// 整幅图像在内存中时的行来源
+typedef struct {
+    const unsigned char* pixels;
+    size_t stride;
+} QoiMemoryRows;
+
+static const unsigned char* qoi_memory_row(void* context, int y, unsigned char* buffer) {
+    const QoiMemoryRows* m = (const QoiMemoryRows*)context;
+    (void)buffer;
+    return m->pixels + (size_t)y * m->stride;
+}
+
+static int qoi_encode_to_func(qoi_write_func* func, void* context, const unsigned char* pixels, int width, int height) {
+    QoiMemoryRows m = {pixels, (size_t)width * 4};
+    return qoi_encode_rows_to_func(func, context, width, height, qoi_memory_row, &m);
+}
+
+// 只解析文件头，得到尺寸。文件头无效时返回 0
+static int qoi_read_header(const unsigned char* data, size_t size, int* out_width, int* out_height) {
+    if (!qoi_is_qoi(data, size)) return 0;
+    const unsigned int width = qoi_read32(data + 4);
+    const unsigned int height = qoi_read32(data + 8);
+    const unsigned char channels = data[12], colorspace = data[13];
+    if (width == 0 || height == 0 || channels < 3 || channels > 4 || colorspace > 1 ||
+        height >= QOI_PIXELS_MAX / width) {
+        return 0;
+    }
+    *out_width = (int)width;
+    *out_height = (int)height;
+    return 1;
+}
+
+// 解码到调用方提供的 RGBA 缓冲区 (至少 pixel_count * 4 字节)
+static void qoi_decode_pixels(const unsigned char* data, size_t size, unsigned char* pixels, size_t pixel_count) {
+    unsigned char index[64][4];
+    unsigned char px[4] = {0, 0, 0, 255};
+    memset(index, 0, sizeof(index));
+    const size_t chunks_end = size - QOI_PADDING_SIZE;
+    size_t p = QOI_HEADER_SIZE;
+    int run = 0;
+
+    for (size_t i = 0; i < pixel_count; ++i) {
+        if (run > 0) {
+            --run;
+        } else if (p < chunks_end) {
+            const unsigned char b1 = data[p++];
+            const size_t operand_size = b1 == QOI_OP_RGB ? 3 : b1 == QOI_OP_RGBA ? 4 :
+                                        (b1 & QOI_MASK_2) == QOI_OP_LUMA ? 1 : 0;
+            if (p + operand_size > chunks_end) {
+                // 操作数被截断: 不再解析，余下的像素都用最后一个像素补齐
+                p = chunks_end;
+            } else if (b1 == QOI_OP_RGB) {
+                px[0] = data[p++];
+                px[1] = data[p++];
+                px[2] = data[p++];
+            } else if (b1 == QOI_OP_RGBA) {
+                memcpy(px, data + p, 4);
+                p += 4;
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+                memcpy(px, index[b1], 4);
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+                px[0] += ((b1 >> 4) & 0x03) - 2;
+                px[1] += ((b1 >> 2) & 0x03) - 2;
+                px[2] += (b1 & 0x03) - 2;
+            } else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+                const unsigned char b2 = data[p++];
+                const int vg = (b1 & 0x3f) - 32;
+                px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+                px[1] += vg;
+                px[2] += vg - 8 + (b2 & 0x0f);
+            } else { // QOI_OP_RUN
+                run = b1 & 0x3f;
+            }
+            memcpy(index[qoi_hash(px)], px, 4);
+        }
+        // 数据提前结束时按规范用最后一个像素补齐
+        memcpy(pixels + i * 4, px, 4);
+    }
+}
+
+static unsigned char* qoi_decode_rgba(const unsigned char* data, size_t size, int* out_width, int* out_height) {
+    int width, height;
+    if (!qoi_read_header(data, size, &width, &height)) return NULL;
+
+    const size_t pixel_count = (size_t)width * height;
+    unsigned char* pixels = (unsigned char*)malloc(pixel_count * 4);
+    if (!pixels) return NULL;
+
+    qoi_decode_pixels(data, size, pixels, pixel_count);
+    *out_width = width;
+    *out_height = height;
+    return pixels;
+}
+
+#endif // QOI_CODEC_H
@@ -0,0 +1,229 @@
+#ifndef RAW_IMAGE_H
+#define RAW_IMAGE_H
+
+// =======================================================================
+// ==          未压缩格式的快速解码 (32 位 BMP、二进制 PPM/PGM)           ==
+// =======================================================================
+// 这些格式的像素在文件里本来就是逐行排好的，stb 的通用加载器却要逐字节 get8、先解成文件的
+// 通道数、再转换为 RGBA，BMP 还要另做一遍上下翻转。这里直接从文件数据一遍写进调用方的 RGBA 缓冲区:
+//   - 32 位 BMP (BI_RGB，或掩码为标准 BGRA/BGRX 的 BI_BITFIELDS): 交换 R/B，自下而上的行
+//     在复制时直接写到翻转后的位置
+//   - P6 (RGB) / P5 (灰度)，最大值不超过 255: 补 alpha 255
+// 输出与 stbi_load_from_memory(..., 4) 逐字节相同。其他变体 (调色板、16/24 位 BMP、
+// 16 位 PNM、文件被截断等) 由 raw_image_read_header 返回 0，仍交给 stb 处理。
+
+#include <stddef.h>
+#include <string.h>
+
+// 与 stb_image 的 STBI_MAX_DIMENSIONS 相同
+#define RAW_IMAGE_MAX_DIMENSION (1 << 24)
+
+enum {
+    RAW_IMAGE_BMP_BGRA,     // alpha 原样 (BI_BITFIELDS 带 alpha 掩码)
+    RAW_IMAGE_BMP_BGRA_ANY, // BI_RGB: alpha 全为 0 时视为不透明 (与 stb 相同)
+    RAW_IMAGE_BMP_BGRX,     // 没有 alpha 掩码，alpha 写 255
+    RAW_IMAGE_PNM_RGB,
+    RAW_IMAGE_PNM_GRAY
+};
+
+typedef struct {
+    int format;
+    int width, height;
+    size_t offset;   // 像素数据在文件中的起始位置
+    int bottom_up;   // BMP 的行自下而上存放
+} RawImageInfo;
+
+static inline unsigned int raw_image_le32(const unsigned char* p) {
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static int raw_image_read_bmp(const unsigned char* data, size_t size, RawImageInfo* info) {
+    if (size < 54 || data[0] != 'B' || data[1] != 'M') return 0;
+    const unsigned int offset = raw_image_le32(data + 10);
+    const unsigned int hsz = raw_image_le32(data + 14);
+    // 12 和 56 字节的信息头 stb 按特殊规则读取，不走快速路径
+    if (hsz != 40 && hsz != 108 && hsz != 124) return 0;
+    if (size < 14 + (size_t)hsz) return 0;
+
+    const int width = (int)raw_image_le32(data + 18);
+    const int height = (int)raw_image_le32(data + 22);
+    const unsigned int planes = data[26] | (data[27] << 8);
+    const unsigned int bpp = data[28] | (data[29] << 8);
+    const unsigned int compress = raw_image_le32(data + 30);
+    if (planes != 1 || bpp != 32 || (compress != 0 && compress != 3)) return 0;
+
+    size_t header_end = 14 + (size_t)hsz;
+    if (compress == 0) {
+        info->format = RAW_IMAGE_BMP_BGRA_ANY;
+    } else {
+        // 40 字节头的掩码紧跟在头后面 (只有 RGB)，V4/V5 头里还有 alpha 掩码
+        const unsigned char* masks = data + 54;
+        if (hsz == 40) {
+            if (size < 66) return 0;
+            header_end += 12;
+        }
+        if (raw_image_le32(masks) != 0x00ff0000u || raw_image_le32(masks + 4) != 0x0000ff00u ||
+            raw_image_le32(masks + 8) != 0x000000ffu) {
+            return 0;
+        }
+        const unsigned int alpha_mask = hsz == 40 ? 0 : raw_image_le32(masks + 12);
+        if (alpha_mask == 0xff000000u) info->format = RAW_IMAGE_BMP_BGRA;
+        else if (alpha_mask == 0) info->format = RAW_IMAGE_BMP_BGRX;
+        else return 0;
+    }
+
+    // 像素数据紧跟在信息头之后。中间有间隙时 stb 会把间隙多跳过一次，交给它处理以保持输出一致
+    if (offset != header_end || offset > size) return 0;
+    if (width <= 0 || height == 0 || height == (int)0x80000000) return 0;
+    const int abs_height = height < 0 ? -height : height;
+    if (width > RAW_IMAGE_MAX_DIMENSION || abs_height > RAW_IMAGE_MAX_DIMENSION) return 0;
+    if ((size - offset) / 4 / (size_t)width < (size_t)abs_height) return 0; // 文件被截断
+
+    info->width = width;
+    info->height = abs_height;
+    info->offset = offset;
+    info->bottom_up = height > 0;
+    return 1;
+}
+
+static inline int raw_image_pnm_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// 按 stb 的规则跳过空白和注释，读一个十进制整数；*pos 停在整数后面的那个字符上
+static int raw_image_pnm_int(const unsigned char* data, size_t size, size_t* pos, int* value) {
+    size_t p = *pos;
+    for (;;) {
+        while (p < size && raw_image_pnm_space(data[p])) ++p;
+        if (p >= size || data[p] != '#') break;
+        while (p < size && data[p] != '\n' && data[p] != '\r') ++p;
+    }
+    int v = 0, digits = 0;
+    while (p < size && data[p] >= '0' && data[p] <= '9') {
+        if (v > RAW_IMAGE_MAX_DIMENSION) return 0;
+        v = v * 10 + (data[p++] - '0');
+        ++digits;
+    }
+    *pos = p;
+    *value = v;
+    return digits > 0;
+}
+
+static int raw_image_read_pnm(const unsigned char* data, size_t size, RawImageInfo* info) {
+    if (size < 3 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) return 0;
+    size_t pos = 2;
+    int width, height, max_value;
+    if (!raw_image_pnm_int(data, size, &pos, &width) || !raw_image_pnm_int(data, size, &pos, &height) ||
+        !raw_image_pnm_int(data, size, &pos, &max_value)) {
+        return 0;
+    }
+    // 最大值后面恰好一个空白字符，然后是像素数据
+    if (pos >= size || !raw_image_pnm_space(data[pos])) return 0;
+    ++pos;
+    if (width <= 0 || height <= 0 || width > RAW_IMAGE_MAX_DIMENSION || height > RAW_IMAGE_MAX_DIMENSION) return 0;
+    // 16 位采样由 stb 缩放；最大值小于 255 时 stb 也不缩放，原样输出
+    if (max_value > 255) return 0;
+
+    const int channels = data[1] == '6' ? 3 : 1;
+    if ((size - pos) / (size_t)channels / (size_t)width < (size_t)height) return 0; // 文件被截断
+
+    info->format = channels == 3 ? RAW_IMAGE_PNM_RGB : RAW_IMAGE_PNM_GRAY;
+    info->width = width;
+    info->height = height;
+    info->offset = pos;
+    info->bottom_up = 0;
+    return 1;
+}
+
+// 只读文件头得到尺寸和文件里的通道数 (探测用): 任何 BMP/PNM 变体都接受，不要求文件完整
+static int raw_image_probe(const unsigned char* data, size_t size, int* width, int* height, int* channels) {
+    if (size >= 26 && data[0] == 'B' && data[1] == 'M') {
+        const unsigned int hsz = raw_image_le32(data + 14);
+        int w, h, bpp;
+        if (hsz == 12) {
+            // OS/2 1.x 头: 16 位的宽高
+            w = data[18] | (data[19] << 8);
+            h = data[20] | (data[21] << 8);
+            bpp = data[24] | (data[25] << 8);
+        } else {
+            if (size < 30) return 0;
+            w = (int)raw_image_le32(data + 18);
+            h = (int)raw_image_le32(data + 22);
+            bpp = data[28] | (data[29] << 8);
+            if (h == (int)0x80000000) return 0;
+            if (h < 0) h = -h;
+        }
+        if (w <= 0 || h <= 0 || w > RAW_IMAGE_MAX_DIMENSION || h > RAW_IMAGE_MAX_DIMENSION) return 0;
+        *width = w;
+        *height = h;
+        *channels = bpp == 32 ? 4 : 3;
+        return 1;
+    }
+    if (size >= 3 && data[0] == 'P' && (data[1] == '5' || data[1] == '6')) {
+        size_t pos = 2;
+        int w, h;
+        if (!raw_image_pnm_int(data, size, &pos, &w) || !raw_image_pnm_int(data, size, &pos, &h)) return 0;
+        if (w <= 0 || h <= 0) return 0;
+        *width = w;
+        *height = h;
+        *channels = data[1] == '6' ? 3 : 1;
+        return 1;
+    }
+    return 0;
+}
+
+// 可以走快速路径时返回 1 并给出尺寸
+static int raw_image_read_header(const unsigned char* data, size_t size, RawImageInfo* info) {
+    return raw_image_read_bmp(data, size, info) || raw_image_read_pnm(data, size, info);
+}
+
+// BGRA -> RGBA: 小端下读成 32 位整数后交换第 0 和第 2 字节
+static inline unsigned int raw_image_swap_rb(unsigned int v) {
+    return (v & 0xff00ff00u) | ((v >> 16) & 0xffu) | ((v & 0xffu) << 16);
+}
+
+// 解码到调用方提供的 RGBA 缓冲区 (width * height * 4 字节)
+static void raw_image_decode(const unsigned char* data, const RawImageInfo* info, unsigned char* out) {
+    const size_t width = (size_t)info->width;
+    const unsigned char* src = data + info->offset;
+    unsigned int any_alpha = 0;
+
+    for (int y = 0; y < info->height; ++y) {
+        unsigned char* dst = out + (size_t)(info->bottom_up ? info->height - 1 - y : y) * width * 4;
+        switch (info->format) {
+            case RAW_IMAGE_PNM_RGB:
+                for (size_t x = 0; x < width; ++x, src += 3, dst += 4) {
+                    dst[0] = src[0];
+                    dst[1] = src[1];
+                    dst[2] = src[2];
+                    dst[3] = 255;
+                }
+                break;
+            case RAW_IMAGE_PNM_GRAY:
+                for (size_t x = 0; x < width; ++x, ++src, dst += 4) {
+                    dst[0] = dst[1] = dst[2] = src[0];
+                    dst[3] = 255;
+                }
+                break;
+            default: {
+                const unsigned int fill = info->format == RAW_IMAGE_BMP_BGRX ? 0xff000000u : 0;
+                for (size_t x = 0; x < width; ++x, src += 4, dst += 4) {
+                    unsigned int v;
+                    memcpy(&v, src, 4);
+                    v = raw_image_swap_rb(v) | fill;
+                    any_alpha |= v;
+                    memcpy(dst, &v, 4);
+                }
+                break;
+            }
+        }
+    }
+
+    // BI_RGB 的 alpha 全为 0 说明文件其实没有 alpha 通道
+    if (info->format == RAW_IMAGE_BMP_BGRA_ANY && (any_alpha >> 24) == 0) {
+        const size_t count = width * info->height;
+        for (size_t i = 0; i < count; ++i) out[i * 4 + 3] = 255;
+    }
+}
+
+#endif // RAW_IMAGE_H
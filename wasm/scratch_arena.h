@@ -0,0 +1,210 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+// =======================================================================
+// ==          stb 临时内存的 arena 分配器                                ==
+// =======================================================================
+// stb_image / stb_image_write 处理一张图要做大量 malloc/realloc/free:
+// zlib 输出和 16384 个哈希桶都是倍增扩容的 stretchy buffer，PNG/JPEG 解码还有逐行缓冲区。
+// 在 emscripten 的 dlmalloc 上这些大小不一的块会把堆切碎，迫使 WASM 内存不断增长。
+// 这里把它们改为在几个大块 (chunk) 上顺序分配:
+//   - arena_malloc:          在 chunk 内顺序分配，16 字节对齐
+//   - arena_realloc_sized:   最后分配的块原地扩展 (zlib 输出缓冲区的倍增不再拷贝)
+//   - arena_free:            只回收最后分配的块，其余的等作用域结束时统一回收
+//   - arena_begin/arena_end: 导出函数用它们包住对 stb 的调用，最外层 arena_end 时整体回收
+//   - arena_reset:           每个任务结束后调用，把 chunk 合并为一个并清零统计
+// 只有在 arena_begin/arena_end 之间、且在调用 arena_begin 的线程上才从 arena 分配，
+// 其他情况 (包括 JPEG 并行解码的工作线程) 直接使用 malloc。arena_free 按地址判断归属，
+// 所以 malloc 得到的指针也可以交给它释放。作用域内分配的内存不能带出作用域，
+// 返回给 JS 的缓冲区必须用 malloc 分配。
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+// 新 chunk 的最小大小
+#define ARENA_MIN_CHUNK ((size_t)1 << 20)
+// 任务之间最多保留这么多字节，更大的 chunk 归还给 malloc，留给像素缓冲区使用
+#define ARENA_RETAIN_MAX ((size_t)64 << 20)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t capacity; // 可用字节数 (不含头部)
+    size_t top;      // 下一次分配的偏移
+    size_t high;     // 曾经用到的最高偏移，低于它的字节是被重复使用的
+} ArenaChunk;
+
+#define ARENA_HEADER ((sizeof(ArenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+// 自上次 arena_reset 以来的统计，arena_stats_wasm 按此顺序导出
+typedef struct {
+    size_t alloc_count;     // 从 arena 分配 (含 realloc) 的次数
+    size_t bytes_requested; // 请求的总字节数
+    size_t bytes_reused;    // 其中落在已用过的内存上的字节数 (不需要新内存)
+    size_t chunk_mallocs;   // 向 malloc 申请 chunk 的次数
+    size_t capacity;        // 当前持有的 chunk 总容量
+    size_t peak;            // 同一时刻占用的最大字节数
+} ArenaStats;
+
+typedef struct {
+    ArenaChunk* chunks;
+    unsigned char* last;    // 最后分配的块，只有它可以被回收或原地扩展
+    ArenaChunk* last_chunk;
+    int depth;              // arena_begin 的嵌套层数，大于 0 时启用
+    ArenaStats stats;
+} Arena;
+
+// 每个线程一个 arena: 工作线程从不调用 arena_begin，它们的分配直接走 malloc
+static _Thread_local Arena arena_state;
+
+static inline unsigned char* arena_chunk_data(ArenaChunk* c) {
+    return (unsigned char*)c + ARENA_HEADER;
+}
+
+static inline size_t arena_round(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static ArenaChunk* arena_owner(const void* p) {
+    const unsigned char* b = (const unsigned char*)p;
+    for (ArenaChunk* c = arena_state.chunks; c; c = c->next) {
+        if (b >= arena_chunk_data(c) && b < arena_chunk_data(c) + c->capacity) return c;
+    }
+    return NULL;
+}
+
+// 占用 chunk c 中 [c->top, end) 并更新统计
+static void arena_claim(ArenaChunk* c, size_t end) {
+    Arena* a = &arena_state;
+    if (c->top < c->high) a->stats.bytes_reused += (end < c->high ? end : c->high) - c->top;
+    if (end > c->high) c->high = end;
+    c->top = end;
+
+    size_t used = 0;
+    for (ArenaChunk* it = a->chunks; it; it = it->next) used += it->top;
+    if (used > a->stats.peak) a->stats.peak = used;
+}
+
+static ArenaChunk* arena_new_chunk(size_t need) {
+    Arena* a = &arena_state;
+    // 按总容量倍增，大图的几次扩容后就不再需要新 chunk
+    size_t size = a->stats.capacity > ARENA_MIN_CHUNK ? a->stats.capacity : ARENA_MIN_CHUNK;
+    if (size < need) size = need;
+
+    ArenaChunk* c = (ArenaChunk*)malloc(ARENA_HEADER + size);
+    if (!c && size > need) {
+        size = need;
+        c = (ArenaChunk*)malloc(ARENA_HEADER + size);
+    }
+    if (!c) return NULL;
+
+    c->capacity = size;
+    c->top = c->high = 0;
+    c->next = a->chunks;
+    a->chunks = c;
+    a->stats.capacity += size;
+    a->stats.chunk_mallocs++;
+    return c;
+}
+
+static void* arena_malloc(size_t size) {
+    Arena* a = &arena_state;
+    if (a->depth == 0) return malloc(size);
+
+    const size_t n = arena_round(size ? size : 1);
+    ArenaChunk* c = a->chunks;
+    while (c && c->capacity - c->top < n) c = c->next;
+    if (!c && !(c = arena_new_chunk(n))) return NULL;
+
+    unsigned char* p = arena_chunk_data(c) + c->top;
+    arena_claim(c, c->top + n);
+    a->last = p;
+    a->last_chunk = c;
+    a->stats.alloc_count++;
+    a->stats.bytes_requested += size;
+    return p;
+}
+
+static void arena_free(void* p) {
+    Arena* a = &arena_state;
+    if (!p) return;
+    if (p == a->last) {
+        // 后进先出的释放 (stb 常见的临时缓冲区用法) 立即回收
+        a->last_chunk->top = (size_t)((unsigned char*)p - arena_chunk_data(a->last_chunk));
+        a->last = NULL;
+        return;
+    }
+    if (!arena_owner(p)) free(p);
+}
+
+static void* arena_realloc_sized(void* p, size_t old_size, size_t new_size) {
+    Arena* a = &arena_state;
+    if (!p) return arena_malloc(new_size);
+    if (!arena_owner(p)) return realloc(p, new_size);
+
+    if (p == a->last && a->depth > 0) {
+        ArenaChunk* c = a->last_chunk;
+        const size_t offset = (size_t)((unsigned char*)p - arena_chunk_data(c));
+        const size_t n = arena_round(new_size ? new_size : 1);
+        if (c->capacity - offset >= n) {
+            // 最后一个块的末尾就是 top，扩展时只有新增的部分需要占用
+            if (offset + n > c->top) arena_claim(c, offset + n);
+            else c->top = offset + n;
+            a->stats.alloc_count++;
+            a->stats.bytes_requested += new_size > old_size ? new_size - old_size : 0;
+            return p;
+        }
+    }
+
+    void* q = arena_malloc(new_size);
+    if (!q) return NULL; // 与 realloc 一致，原块保持有效
+    memcpy(q, p, old_size < new_size ? old_size : new_size);
+    arena_free(p);
+    return q;
+}
+
+static void arena_begin(void) {
+    arena_state.depth++;
+}
+
+// 最外层作用域结束时回收全部块，chunk 留给下一次使用
+static void arena_end(void) {
+    Arena* a = &arena_state;
+    if (--a->depth > 0) return;
+    for (ArenaChunk* c = a->chunks; c; c = c->next) c->top = 0;
+    a->last = NULL;
+    a->last_chunk = NULL;
+}
+
+// 任务结束: 多个 chunk 合并成一个，大小按本次任务的峰值留 1/4 余量 (不超过 ARENA_RETAIN_MAX)，
+// 下一个相近大小的任务只用一个 chunk 就够了。必须在所有作用域之外调用。
+static void arena_reset(void) {
+    Arena* a = &arena_state;
+    if (a->depth > 0) return;
+
+    const size_t want = arena_round(a->stats.peak + a->stats.peak / 4);
+    const int single = a->chunks && !a->chunks->next;
+    if (a->chunks && !(single && a->stats.capacity <= ARENA_RETAIN_MAX)) {
+        ArenaChunk* c = a->chunks;
+        while (c) {
+            ArenaChunk* next = c->next;
+            free(c);
+            c = next;
+        }
+        a->chunks = NULL;
+        const size_t keep = want < ARENA_RETAIN_MAX ? want : ARENA_RETAIN_MAX;
+        ArenaChunk* merged = keep ? (ArenaChunk*)malloc(ARENA_HEADER + keep) : NULL;
+        if (merged) {
+            merged->capacity = keep;
+            merged->top = merged->high = 0;
+            merged->next = NULL;
+            a->chunks = merged;
+        }
+    }
+
+    memset(&a->stats, 0, sizeof(a->stats));
+    for (ArenaChunk* c = a->chunks; c; c = c->next) a->stats.capacity += c->capacity;
+}
+
+#endif // SCRATCH_ARENA_H
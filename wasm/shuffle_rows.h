@@ -0,0 +1,183 @@
+#ifndef SHUFFLE_ROWS_H
+#define SHUFFLE_ROWS_H
+
+// =======================================================================
+// ==          无损加密容器的逐行生成与还原 (虚拟图像)                  ==
+// =======================================================================
+// 无损容器 = 元数据行 + 按 shuffle_map 打乱 32x32 分块后的原图 + magic 行。
+// perform_encryption 先把整个容器拼在内存里再交给编码器；这里改为编码器要哪一行就现场生成哪一行:
+//   - 第 0 行和最后一行直接返回调用方准备好的头部行
+//   - 内容区 (content_width x content_height) 内的行按置换表逐块从原图收集，
+//     右侧凑不满一块的部分和底部不满一块的行保持原位 (与 perform_encryption 相同)
+// 像素可以是 RGBA (bpp = 4)，也可以是调色板索引 (bpp = 1)，打乱只搬移整块，与像素格式无关。
+// shuffle_rows_get 的签名与 stbi_write_row_func / qoi_row_func 相同，可以直接交给两个编码器。
+// 解密方向的 shuffle_rows_put 把容器的一行按同一张置换表分散写回原图中的位置，
+// 解码器每交出一行就能立即放好，不需要先得到整个容器。
+// 设置了去重 (shuffle_rows_set_dedup) 时按 tile_dedup.h 的布局生成容器的行。
+
+#include <stddef.h>
+#include <string.h>
+
+#include "tile_dedup.h"
+
+// 与 image_process.c 和 JS 中的 BLOCK_SIZE 相同
+#define SHUFFLE_BLOCK_SIZE 32
+
+typedef struct {
+    const unsigned char* pixels;       // 原图，width * height * bpp 字节
+    int width, height, bpp;
+    int blocks_x, blocks_y;            // 内容区的分块数
+    const unsigned int* shuffle_map;   // 目标块 i 取自原图的第 shuffle_map[i] 块
+    const unsigned char* header_row;   // 容器第 0 行 (元数据行)
+    const unsigned char* footer_row;   // 容器最后一行 (magic 行)
+    const TileDedup* dedup;            // 非 NULL 时为去重容器
+    const unsigned char* table_rows;   // 去重容器的引用表行 (与 pixels 相同的像素格式)
+} ShuffleRows;
+
+// 检查置换表的每一项都指向内容区内的块，避免按表收集时越界读取
+static int shuffle_rows_init(ShuffleRows* r, const unsigned char* pixels, int width, int height, int bpp,
+                             int content_width, int content_height, const unsigned int* shuffle_map,
+                             const unsigned char* header_row, const unsigned char* footer_row) {
+    r->pixels = pixels;
+    r->width = width;
+    r->height = height;
+    r->bpp = bpp;
+    r->blocks_x = content_width / SHUFFLE_BLOCK_SIZE;
+    r->blocks_y = content_height / SHUFFLE_BLOCK_SIZE;
+    r->shuffle_map = shuffle_map;
+    r->header_row = header_row;
+    r->footer_row = footer_row;
+    r->dedup = NULL;
+    r->table_rows = NULL;
+    if (content_width > width || content_height > height) return 0;
+
+    const unsigned int total = (unsigned int)(r->blocks_x * r->blocks_y);
+    for (unsigned int i = 0; i < total; ++i) {
+        if (shuffle_map[i] >= total) return 0;
+    }
+    return 1;
+}
+
+// 改为生成去重容器。table_rows 是 dedup->table 换成 pixels 的像素格式后的引用表
+static void shuffle_rows_set_dedup(ShuffleRows* r, const TileDedup* dedup, const unsigned char* table_rows) {
+    r->dedup = dedup;
+    r->table_rows = table_rows;
+}
+
+// 容器的高度 (行数)
+static int shuffle_rows_height(const ShuffleRows* r) {
+    return r->dedup ? r->dedup->container_height : r->height + 2;
+}
+
+// 用引用表的第一个像素填充 count 个像素
+static void shuffle_rows_fill(const ShuffleRows* r, unsigned char* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i) memcpy(dst + i * r->bpp, r->table_rows, (size_t)r->bpp);
+}
+
+// 去重容器的第 y 行 (1 .. container_height - 2)
+static const unsigned char* shuffle_rows_get_dedup(const ShuffleRows* r, int y, unsigned char* buffer) {
+    const TileDedup* d = r->dedup;
+    const size_t row_bytes = (size_t)r->width * r->bpp;
+    int row = y - 1;
+    if (row < d->table_rows) return r->table_rows + (size_t)row * row_bytes;
+    row -= d->table_rows;
+
+    const int content_width = r->blocks_x * SHUFFLE_BLOCK_SIZE;
+    const int content_height = r->blocks_y * SHUFFLE_BLOCK_SIZE;
+    const int tile_rows = (d->unique_count + r->blocks_x - 1) / r->blocks_x;
+    const size_t block_bytes = (size_t)SHUFFLE_BLOCK_SIZE * r->bpp;
+    if (row < tile_rows * SHUFFLE_BLOCK_SIZE) {
+        // 块区: 不重复的块按编号排列
+        const int in_block = row % SHUFFLE_BLOCK_SIZE;
+        const int first = (row / SHUFFLE_BLOCK_SIZE) * r->blocks_x;
+        int bx = 0;
+        for (; bx < r->blocks_x && first + bx < d->unique_count; ++bx) {
+            const unsigned int block = d->unique_src[first + bx];
+            const int src_y = (int)(block / r->blocks_x) * SHUFFLE_BLOCK_SIZE + in_block;
+            const int src_x = (int)(block % r->blocks_x) * SHUFFLE_BLOCK_SIZE;
+            memcpy(buffer + bx * block_bytes, r->pixels + (size_t)src_y * row_bytes + (size_t)src_x * r->bpp, block_bytes);
+        }
+        shuffle_rows_fill(r, buffer + bx * block_bytes, (size_t)r->width - (size_t)bx * SHUFFLE_BLOCK_SIZE);
+        return buffer;
+    }
+    row -= tile_rows * SHUFFLE_BLOCK_SIZE;
+
+    if (row < d->strip_rows) {
+        // 右侧条带: 容器这一行是条带像素序列中的 [row * width, (row + 1) * width)
+        const size_t strip_width = (size_t)(r->width - content_width);
+        const size_t strip_total = (size_t)content_height * strip_width;
+        size_t p = (size_t)row * r->width;
+        const size_t end = p + (size_t)r->width < strip_total ? p + (size_t)r->width : strip_total;
+        unsigned char* dst = buffer;
+        while (p < end) {
+            const size_t src_y = p / strip_width, src_x = p % strip_width;
+            size_t run = strip_width - src_x;
+            if (run > end - p) run = end - p;
+            memcpy(dst, r->pixels + src_y * row_bytes + ((size_t)content_width + src_x) * r->bpp, run * r->bpp);
+            dst += run * r->bpp;
+            p += run;
+        }
+        shuffle_rows_fill(r, dst, (size_t)(buffer + row_bytes - dst) / r->bpp);
+        return buffer;
+    }
+    row -= d->strip_rows;
+
+    // 底部条带原样
+    return r->pixels + (size_t)(content_height + row) * row_bytes;
+}
+
+// 返回容器的第 y 行 (0 .. shuffle_rows_height - 1)。需要收集的行写入 buffer (width * bpp 字节)
+static const unsigned char* shuffle_rows_get(void* context, int y, unsigned char* buffer) {
+    const ShuffleRows* r = (const ShuffleRows*)context;
+    if (y == 0) return r->header_row;
+    if (r->dedup) {
+        if (y == r->dedup->container_height - 1) return r->footer_row;
+        return shuffle_rows_get_dedup(r, y, buffer);
+    }
+    if (y == r->height + 1) return r->footer_row;
+
+    const int row = y - 1;
+    const size_t row_bytes = (size_t)r->width * r->bpp;
+    const unsigned char* src_row = r->pixels + (size_t)row * row_bytes;
+    if (row >= r->blocks_y * SHUFFLE_BLOCK_SIZE) return src_row; // 底部保持原位
+
+    const size_t block_bytes = (size_t)SHUFFLE_BLOCK_SIZE * r->bpp;
+    const int in_block = row % SHUFFLE_BLOCK_SIZE;
+    const unsigned int* map = r->shuffle_map + (size_t)(row / SHUFFLE_BLOCK_SIZE) * r->blocks_x;
+    for (int bx = 0; bx < r->blocks_x; ++bx) {
+        const unsigned int block = map[bx];
+        const int src_y = (int)(block / r->blocks_x) * SHUFFLE_BLOCK_SIZE + in_block;
+        const int src_x = (int)(block % r->blocks_x) * SHUFFLE_BLOCK_SIZE;
+        memcpy(buffer + bx * block_bytes, r->pixels + (size_t)src_y * row_bytes + (size_t)src_x * r->bpp, block_bytes);
+    }
+    // 右侧凑不满一块的像素保持原位
+    const size_t content_bytes = (size_t)r->blocks_x * block_bytes;
+    memcpy(buffer + content_bytes, src_row + content_bytes, row_bytes - content_bytes);
+    return buffer;
+}
+
+// shuffle_rows_get 的逆操作: 把容器的第 y 行 (1 .. height) 写回 pixels (原图，width * height * bpp 字节)。
+// 容器的块 i 来自原图的第 shuffle_map[i] 块，所以直接按表写到目标块，不需要求逆置换
+static void shuffle_rows_put(const ShuffleRows* r, int y, const unsigned char* row, unsigned char* pixels) {
+    const int content_row = y - 1;
+    const size_t row_bytes = (size_t)r->width * r->bpp;
+    unsigned char* dst_row = pixels + (size_t)content_row * row_bytes;
+    if (content_row >= r->blocks_y * SHUFFLE_BLOCK_SIZE) {
+        memcpy(dst_row, row, row_bytes);
+        return;
+    }
+
+    const size_t block_bytes = (size_t)SHUFFLE_BLOCK_SIZE * r->bpp;
+    const int in_block = content_row % SHUFFLE_BLOCK_SIZE;
+    const unsigned int* map = r->shuffle_map + (size_t)(content_row / SHUFFLE_BLOCK_SIZE) * r->blocks_x;
+    for (int bx = 0; bx < r->blocks_x; ++bx) {
+        const unsigned int block = map[bx];
+        const int dst_y = (int)(block / r->blocks_x) * SHUFFLE_BLOCK_SIZE + in_block;
+        const int dst_x = (int)(block % r->blocks_x) * SHUFFLE_BLOCK_SIZE;
+        memcpy(pixels + (size_t)dst_y * row_bytes + (size_t)dst_x * r->bpp, row + bx * block_bytes, block_bytes);
+    }
+    const size_t content_bytes = (size_t)r->blocks_x * block_bytes;
+    memcpy(dst_row + content_bytes, row + content_bytes, row_bytes - content_bytes);
+}
+
+#endif // SHUFFLE_ROWS_H
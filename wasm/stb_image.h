@@ -270,6 +270,13 @@ RECENT REVISION HISTORY:
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
 //
+// WebAssembly SIMD128 is used automatically when compiling with -msimd128
+// (emcc defines __wasm_simd128__); it covers the same JPEG IDCT, YCbCr
+// conversion and upsampling kernels as SSE2/NEON, plus the 2x vertical and
+// horizontal upsamplers. The PNG decoder additionally has
+// vectorized unfilter loops for 4-byte pixels (RGBA8, GA16) that are used
+// with WebAssembly SIMD128 or, on x86, when compiling with -msse4.1.
+//
 // If for some reason you do not want to use any of SIMD code, or if
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
@@ -524,6 +531,26 @@ STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpre
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// decode baseline JPEGs that contain restart markers on up to this many
+// threads, and run their upsampling/color conversion in parallel row bands.
+// only has an effect when compiled with STBI_JPEG_THREADS (uses pthreads);
+// the default of 1 keeps JPEG decoding single-threaded.
+STBIDEF void stbi_set_jpeg_threads(int thread_count);
+
+// decode JPEGs at 1/2, 1/4 or 1/8 size (scale_denom 2, 4 or 8) by running
+// reduced IDCTs (4x4, 2x2, DC only) instead of decoding full size and
+// downsampling; the returned dimensions are rounded up. 1 (the default)
+// decodes at full size. other formats are not affected.
+STBIDEF void stbi_set_jpeg_scale_denom(int scale_denom);
+
+// decode into a caller-provided buffer: while set, the first allocation of a
+// final 8-bit output image that is exactly `size` bytes (JPEG, BMP, TGA, PSD,
+// HDR, and any stbi__convert_format / 16->8 conversion) uses `buffer` instead,
+// and the load returns `buffer` itself -- don't stbi_image_free it. loads that
+// end in a different-sized or otherwise allocated buffer behave as usual, so
+// compare the returned pointer. NULL clears. not thread-safe.
+STBIDEF void stbi_set_decode_into(unsigned char *buffer, size_t size);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -598,6 +625,10 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #include <stdio.h>
 #endif
 
+#ifdef STBI_JPEG_THREADS
+#include <pthread.h>
+#endif
+
 #ifndef STBI_ASSERT
 #include <assert.h>
 #define STBI_ASSERT(x) assert(x)
@@ -788,6 +819,19 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// WebAssembly SIMD128
+#if defined(__wasm_simd128__) && !defined(STBI_NO_SIMD)
+#define STBI_WASM_SIMD
+#include <wasm_simd128.h>
+#define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
+#endif
+
+// SSE4.1 (x86, enabled by compiler flag like SSE2 above)
+#if defined(STBI_SSE2) && defined(__SSE4_1__)
+#define STBI_SSE41
+#include <smmintrin.h>
+#endif
+
 #ifndef STBI_SIMD_ALIGN
 #define STBI_SIMD_ALIGN(type, name) type name
 #endif
@@ -1058,6 +1102,39 @@ static void *stbi__malloc_mad3(int a, int b, int c, int add)
    return stbi__malloc(a*b*c + add);
 }
 
+// stbi_set_decode_into: output buffers go through these two, intermediate
+// buffers keep using stbi__malloc/STBI_FREE
+static unsigned char *stbi__into_buffer = NULL;
+static size_t stbi__into_size = 0;
+static int stbi__into_claimed = 0;
+
+STBIDEF void stbi_set_decode_into(unsigned char *buffer, size_t size)
+{
+   stbi__into_buffer = buffer;
+   stbi__into_size = buffer ? size : 0;
+   stbi__into_claimed = 0;
+}
+
+static void *stbi__malloc_output_mad3(int a, int b, int c)
+{
+   if (!stbi__mad3sizes_valid(a, b, c, 0)) return NULL;
+   if (stbi__into_buffer && !stbi__into_claimed && (size_t) a*b*c == stbi__into_size) {
+      stbi__into_claimed = 1;
+      return stbi__into_buffer;
+   }
+   return stbi__malloc(a*b*c);
+}
+
+static void stbi__free_output(void *p)
+{
+   if (p && p == stbi__into_buffer) {
+      // released on an error path or by a further conversion; a later output may claim it again
+      stbi__into_claimed = 0;
+      return;
+   }
+   STBI_FREE(p);
+}
+
 #if !defined(STBI_NO_LINEAR) || !defined(STBI_NO_HDR) || !defined(STBI_NO_PNM)
 static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
 {
@@ -1134,6 +1211,20 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__jpeg_threads = 1;
+
+STBIDEF void stbi_set_jpeg_threads(int thread_count)
+{
+   stbi__jpeg_threads = thread_count;
+}
+
+static int stbi__jpeg_scale_shift = 0;
+
+STBIDEF void stbi_set_jpeg_scale_denom(int scale_denom)
+{
+   stbi__jpeg_scale_shift = scale_denom >= 8 ? 3 : scale_denom >= 4 ? 2 : scale_denom >= 2 ? 1 : 0;
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1193,7 +1284,7 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
    int img_len = w * h * channels;
    stbi_uc *reduced;
 
-   reduced = (stbi_uc *) stbi__malloc(img_len);
+   reduced = (stbi_uc *) stbi__malloc_output_mad3(w, h, channels);
    if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
 
    for (i = 0; i < img_len; ++i)
@@ -1760,9 +1851,9 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
    if (req_comp == img_n) return data;
    STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
 
-   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
+   good = (unsigned char *) stbi__malloc_output_mad3(req_comp, x, y);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free_output(data);
       return stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1787,12 +1878,12 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free_output(data); stbi__free_output(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free_output(data);
    return good;
 }
 #endif
@@ -1886,7 +1977,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
    int i,k,n;
    stbi_uc *output;
    if (!data) return NULL;
-   output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
+   output = (stbi_uc *) stbi__malloc_output_mad3(x, y, comp);
    if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
@@ -1972,7 +2063,7 @@ typedef struct
       stbi_uc *data;
       void *raw_data, *raw_coeff;
       stbi_uc *linebuf;
-      short   *coeff;   // progressive only
+      short   *coeff;   // progressive or coeff_only
       int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
    } img_comp[4];
 
@@ -1993,6 +2084,8 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale_shift;   // log2 of the downscale factor; blocks decode to (8>>scale_shift)^2 pixels
+   int coeff_only;    // keep quantized coefficients in img_comp[].coeff instead of decoding pixels
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -2523,6 +2616,64 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced-size IDCTs for downscaled decoding (stbi_set_jpeg_scale_denom).
+// the NxN lowest-frequency coefficients go through an N-point IDCT whose
+// basis is scaled by sqrt(N/8) per axis, so each output pixel approximates
+// the average of the (8/N)x(8/N) full-size pixels it stands for. the
+// remaining coefficients are never looked at.
+#define STBI__IDCT_4(s0,s1,s2,s3) \
+   int t0 = ((s0) + (s2)) * stbi__f2f(0.353553391f); \
+   int t1 = ((s0) - (s2)) * stbi__f2f(0.353553391f); \
+   int o0 = (s1) * stbi__f2f(0.461939766f) + (s3) * stbi__f2f( 0.191341716f); \
+   int o1 = (s1) * stbi__f2f(0.191341716f) + (s3) * stbi__f2f(-0.461939766f);
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   int i,val[16],*v=val;
+   short *d = data;
+
+   // columns; constants are scaled up by 1<<12, keep 2 extra bits like stbi__idct_block
+   for (i=0; i < 4; ++i,++d,++v) {
+      STBI__IDCT_4(d[0],d[8],d[16],d[24])
+      t0 += 512; t1 += 512;
+      v[ 0] = (t0+o0) >> 10;
+      v[12] = (t0-o0) >> 10;
+      v[ 4] = (t1+o1) >> 10;
+      v[ 8] = (t1-o1) >> 10;
+   }
+
+   // rows; remove the 1<<14 and re-center on 128, with rounding
+   for (i=0, v=val; i < 4; ++i,v+=4,out+=out_stride) {
+      STBI__IDCT_4(v[0],v[1],v[2],v[3])
+      t0 += 8192 + (128<<14);
+      t1 += 8192 + (128<<14);
+      out[0] = stbi__clamp((t0+o0) >> 14);
+      out[3] = stbi__clamp((t0-o0) >> 14);
+      out[1] = stbi__clamp((t1+o1) >> 14);
+      out[2] = stbi__clamp((t1-o1) >> 14);
+   }
+}
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   // both passes of the 2-point IDCT multiply by 1/(2*sqrt(2)), i.e. 1/8 in total
+   int a = data[0] + data[8], b = data[0] - data[8];
+   int c = data[1] + data[9], e = data[1] - data[9];
+   int bias = 4 + (128 << 3);
+   out[0]            = stbi__clamp((a + c + bias) >> 3);
+   out[1]            = stbi__clamp((a - c + bias) >> 3);
+   out[out_stride]   = stbi__clamp((b + e + bias) >> 3);
+   out[out_stride+1] = stbi__clamp((b - e + bias) >> 3);
+}
+
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   // DC only: the block average
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+#undef STBI__IDCT_4
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2912,6 +3063,186 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_NEON
 
+#ifdef STBI_WASM_SIMD
+
+// WebAssembly SIMD128 integer IDCT. A direct port of the SSE2 version above,
+// so it produces bit-identical results to the generic C version.
+static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
+{
+   v128_t row0, row1, row2, row3, row4, row5, row6, row7;
+   v128_t tmp;
+
+   // dot product constant: even elems=x, odd elems=y
+   #define dct_const(x,y)  wasm_i16x8_make((x),(y),(x),(y),(x),(y),(x),(y))
+
+   // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+   // out(1) = c1[even]*x + c1[odd]*y
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      v128_t c0##lo = wasm_i16x8_shuffle((x),(y), 0,8,1,9,2,10,3,11); \
+      v128_t c0##hi = wasm_i16x8_shuffle((x),(y), 4,12,5,13,6,14,7,15); \
+      v128_t out0##_l = wasm_i32x4_dot_i16x8(c0##lo, c0); \
+      v128_t out0##_h = wasm_i32x4_dot_i16x8(c0##hi, c0); \
+      v128_t out1##_l = wasm_i32x4_dot_i16x8(c0##lo, c1); \
+      v128_t out1##_h = wasm_i32x4_dot_i16x8(c0##hi, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+   #define dct_widen(out, in) \
+      v128_t out##_l = wasm_i32x4_shl(wasm_i32x4_extend_low_i16x8(in), 12); \
+      v128_t out##_h = wasm_i32x4_shl(wasm_i32x4_extend_high_i16x8(in), 12)
+
+   // wide add
+   #define dct_wadd(out, a, b) \
+      v128_t out##_l = wasm_i32x4_add(a##_l, b##_l); \
+      v128_t out##_h = wasm_i32x4_add(a##_h, b##_h)
+
+   // wide sub
+   #define dct_wsub(out, a, b) \
+      v128_t out##_l = wasm_i32x4_sub(a##_l, b##_l); \
+      v128_t out##_h = wasm_i32x4_sub(a##_h, b##_h)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         v128_t abiased_l = wasm_i32x4_add(a##_l, bias); \
+         v128_t abiased_h = wasm_i32x4_add(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = wasm_i16x8_narrow_i32x4(wasm_i32x4_shr(sum_l, s), wasm_i32x4_shr(sum_h, s)); \
+         out1 = wasm_i16x8_narrow_i32x4(wasm_i32x4_shr(dif_l, s), wasm_i32x4_shr(dif_h, s)); \
+      }
+
+   // 8-bit interleave step (for transposes)
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = wasm_i8x16_shuffle(a, b, 0,16,1,17,2,18,3,19,4,20,5,21,6,22,7,23); \
+      b = wasm_i8x16_shuffle(tmp, b, 8,24,9,25,10,26,11,27,12,28,13,29,14,30,15,31)
+
+   // 16-bit interleave step (for transposes)
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = wasm_i16x8_shuffle(a, b, 0,8,1,9,2,10,3,11); \
+      b = wasm_i16x8_shuffle(tmp, b, 4,12,5,13,6,14,7,15)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         v128_t sum04 = wasm_i16x8_add(row0, row4); \
+         v128_t dif04 = wasm_i16x8_sub(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         v128_t sum17 = wasm_i16x8_add(row1, row7); \
+         v128_t sum35 = wasm_i16x8_add(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   v128_t rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   v128_t rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   v128_t rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   v128_t rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   v128_t rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   v128_t rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   v128_t rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   v128_t rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see stbi__idct_block for explanation.
+   v128_t bias_0 = wasm_i32x4_splat(512);
+   v128_t bias_1 = wasm_i32x4_splat(65536 + (128<<17));
+
+   // load
+   row0 = wasm_v128_load(data + 0*8);
+   row1 = wasm_v128_load(data + 1*8);
+   row2 = wasm_v128_load(data + 2*8);
+   row3 = wasm_v128_load(data + 3*8);
+   row4 = wasm_v128_load(data + 4*8);
+   row5 = wasm_v128_load(data + 5*8);
+   row6 = wasm_v128_load(data + 6*8);
+   row7 = wasm_v128_load(data + 7*8);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      v128_t p0 = wasm_u8x16_narrow_i16x8(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+      v128_t p1 = wasm_u8x16_narrow_i16x8(row2, row3);
+      v128_t p2 = wasm_u8x16_narrow_i16x8(row4, row5);
+      v128_t p3 = wasm_u8x16_narrow_i16x8(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2); // a0e0a1e1...
+      dct_interleave8(p1, p3); // c0g0c1g1...
+
+      // transpose pass 2
+      dct_interleave8(p0, p1); // a0c0e0g0...
+      dct_interleave8(p2, p3); // b0d0f0h0...
+
+      // transpose pass 3
+      dct_interleave8(p0, p2); // a0b0c0d0...
+      dct_interleave8(p1, p3); // a4b4c4d4...
+
+      // store
+      wasm_v128_store64_lane(out, p0, 0); out += out_stride;
+      wasm_v128_store64_lane(out, p0, 1); out += out_stride;
+      wasm_v128_store64_lane(out, p2, 0); out += out_stride;
+      wasm_v128_store64_lane(out, p2, 1); out += out_stride;
+      wasm_v128_store64_lane(out, p1, 0); out += out_stride;
+      wasm_v128_store64_lane(out, p1, 1); out += out_stride;
+      wasm_v128_store64_lane(out, p3, 0); out += out_stride;
+      wasm_v128_store64_lane(out, p3, 1);
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+
+#endif // STBI_WASM_SIMD
+
 #define STBI__MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -2927,6 +3258,33 @@ static stbi_uc stbi__get_marker(stbi__jpeg *j)
    return x;
 }
 
+// where block (bx,by) of component n goes in its (possibly downscaled) plane
+stbi_inline static stbi_uc *stbi__jpeg_block_out(stbi__jpeg *z, int n, int bx, int by)
+{
+   int s = 3 - z->scale_shift;
+   return z->img_comp[n].data + z->img_comp[n].w2*(by << s) + (bx << s);
+}
+
+// dequantization table that leaves the coefficients as stored in the file
+static stbi__uint16 stbi__jpeg_unit_dequant[64] = {
+   1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+   1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1
+};
+
+// decode baseline block (bx,by) of component n: IDCT it into its plane, or
+// in coeff_only mode store the quantized coefficients like progressive does
+static int stbi__jpeg_baseline_block(stbi__jpeg *z, short data[64], int n, int bx, int by)
+{
+   int ha = z->img_comp[n].ha;
+   if (z->coeff_only) {
+      short *c = z->img_comp[n].coeff + 64 * (bx + by * z->img_comp[n].coeff_w);
+      return stbi__jpeg_decode_block(z, c, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, stbi__jpeg_unit_dequant);
+   }
+   if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+   z->idct_block_kernel(stbi__jpeg_block_out(z, n, bx, by), z->img_comp[n].w2, data);
+   return 1;
+}
+
 // in each scan, we'll have scan_n components, and the order
 // of the components is specified by order[]
 #define STBI__RESTART(x)     ((x) >= 0xd0 && (x) <= 0xd7)
@@ -2946,10 +3304,210 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+#ifdef STBI_JPEG_THREADS
+// Parallel baseline decoding. Restart markers reset the entropy decoder and
+// the DC predictors, so once the byte range of every restart interval is
+// known the intervals can be entropy-decoded (and IDCT'd, which the baseline
+// decoder does per block) independently. Only memory-backed contexts qualify,
+// since the whole scan has to be visible up front.
+
+#ifndef STBI_JPEG_MAX_THREADS
+#define STBI_JPEG_MAX_THREADS 16
+#endif
+
+typedef void (*stbi__jpeg_task_func)(void *arg);
+
+typedef struct
+{
+   stbi__jpeg_task_func func;
+   void *arg;
+} stbi__jpeg_task;
+
+static void *stbi__jpeg_task_entry(void *arg)
+{
+   stbi__jpeg_task *t = (stbi__jpeg_task *) arg;
+   t->func(t->arg);
+   return NULL;
+}
+
+// run func on each of the count argument structs, the first one on the
+// calling thread. if a thread can't be started its work is done inline.
+static void stbi__jpeg_run_tasks(stbi__jpeg_task_func func, void *args, size_t arg_size, int count)
+{
+   pthread_t tid[STBI_JPEG_MAX_THREADS];
+   stbi__jpeg_task task[STBI_JPEG_MAX_THREADS];
+   int started[STBI_JPEG_MAX_THREADS];
+   int i;
+   for (i=1; i < count; ++i) {
+      task[i].func = func;
+      task[i].arg = (char *) args + i*arg_size;
+      started[i] = pthread_create(&tid[i], NULL, stbi__jpeg_task_entry, &task[i]) == 0;
+      if (!started[i])
+         func(task[i].arg);
+   }
+   func(args);
+   for (i=1; i < count; ++i)
+      if (started[i])
+         pthread_join(tid[i], NULL);
+}
+
+// decode MCU number m of a baseline scan (same block order as the serial loops)
+static int stbi__jpeg_decode_mcu(stbi__jpeg *z, int m, short data[64])
+{
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      int w = (z->img_comp[n].x+7) >> 3;
+      if (!stbi__jpeg_baseline_block(z, data, n, m % w, m / w)) return 0;
+   } else {
+      int i = m % z->img_mcu_x, j = m / z->img_mcu_x;
+      int k,x,y;
+      for (k=0; k < z->scan_n; ++k) {
+         int n = z->order[k];
+         for (y=0; y < z->img_comp[n].v; ++y) {
+            for (x=0; x < z->img_comp[n].h; ++x)
+               if (!stbi__jpeg_baseline_block(z, data, n, i*z->img_comp[n].h + x, j*z->img_comp[n].v + y)) return 0;
+         }
+      }
+   }
+   return 1;
+}
+
+typedef struct
+{
+   stbi__jpeg *z;         // shared decoder state, read only
+   stbi_uc **start;       // first entropy-coded byte of each interval
+   stbi_uc **end;         // one past the last byte of each interval
+   int first, last;       // intervals [first,last) belong to this worker
+   int total;             // MCUs in the scan
+   int result;
+} stbi__jpeg_interval_job;
+
+static void stbi__jpeg_decode_intervals(void *arg)
+{
+   stbi__jpeg_interval_job *job = (stbi__jpeg_interval_job *) arg;
+   stbi__jpeg *d;
+   stbi__context s;
+   int k;
+   STBI_SIMD_ALIGN(short, data[64]);
+
+   job->result = 0;
+   // private copy of the decoder: bit buffer, DC predictors and input
+   // position are per interval, the component planes are shared
+   d = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!d) return;
+   memcpy(d, job->z, sizeof(stbi__jpeg));
+   memset(&s, 0, sizeof(s));
+   d->s = &s;
+
+   for (k=job->first; k < job->last; ++k) {
+      int m = k * d->restart_interval;
+      int m_end = m + d->restart_interval < job->total ? m + d->restart_interval : job->total;
+      // the interval ends right before its restart marker; reading past it
+      // yields zero bits, exactly like the serial decoder after a marker
+      s.img_buffer = job->start[k];
+      s.img_buffer_end = job->end[k];
+      stbi__jpeg_reset(d);
+      for (; m < m_end; ++m)
+         if (!stbi__jpeg_decode_mcu(d, m, data)) { STBI_FREE(d); return; }
+   }
+   STBI_FREE(d);
+   job->result = 1;
+}
+
+// returns 1 or 0 if the scan was decoded in parallel, -1 to use the serial decoder
+static int stbi__jpeg_parallel_scan(stbi__jpeg *z)
+{
+   stbi__context *s = z->s;
+   stbi__jpeg_interval_job job[STBI_JPEG_MAX_THREADS];
+   stbi_uc **start, **end;
+   stbi_uc *p, *q, *scan_end, *last_end = NULL;
+   int threads = stbi__jpeg_threads, total, count, found, t, result;
+   unsigned char marker = STBI__MARKER_none;
+
+   if (threads < 2 || z->restart_interval <= 0 || s->read_from_callbacks)
+      return -1;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      total = ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3);
+   } else
+      total = z->img_mcu_x * z->img_mcu_y;
+   count = (total + z->restart_interval - 1) / z->restart_interval;
+   if (count < 2)
+      return -1;
+
+   start = (stbi_uc **) stbi__malloc_mad2(count, 2 * sizeof(stbi_uc *), 0);
+   if (!start) return -1;
+   end = start + count;
+
+   // locate the restart markers. 0xff 0x00 is a stuffed byte and runs of 0xff
+   // are fill; any other marker ends the scan. A restart after the last interval
+   // is skipped the way the serial decoder resets past it, and the scan still
+   // ends at the next real marker
+   p = s->img_buffer;
+   scan_end = s->img_buffer_end;
+   start[0] = p;
+   found = 0;
+   while (p < s->img_buffer_end) {
+      if (*p++ != 0xff) continue;
+      q = p - 1;
+      while (p < s->img_buffer_end && *p == 0xff) ++p;
+      if (p >= s->img_buffer_end) break;
+      if (*p == 0x00) { ++p; continue; }
+      if (STBI__RESTART(*p)) {
+         if (found+1 >= count) {
+            if (!last_end) last_end = q;
+            ++p;
+            continue;
+         }
+         // RSTn must count up mod 8; otherwise leave it to the serial decoder
+         if ((*p & 7) != (found & 7)) { found = -1; break; }
+         end[found] = q;
+         start[++found] = ++p;
+         continue;
+      }
+      marker = *p++;
+      scan_end = q;
+      break;
+   }
+   if (found != count-1) {
+      STBI_FREE(start);
+      return -1;
+   }
+   end[found] = last_end ? last_end : scan_end;
+
+   if (threads > STBI_JPEG_MAX_THREADS) threads = STBI_JPEG_MAX_THREADS;
+   if (threads > count) threads = count;
+   for (t=0; t < threads; ++t) {
+      job[t].z = z;
+      job[t].start = start;
+      job[t].end = end;
+      job[t].first = count * t / threads;
+      job[t].last = count * (t+1) / threads;
+      job[t].total = total;
+   }
+   stbi__jpeg_run_tasks(stbi__jpeg_decode_intervals, job, sizeof(job[0]), threads);
+
+   result = 1;
+   for (t=0; t < threads; ++t)
+      result &= job[t].result;
+   STBI_FREE(start);
+
+   // leave the stream where the serial decoder would: just past the marker
+   // that ended the scan, with that marker pending
+   s->img_buffer = p;
+   z->marker = marker;
+   return result;
+}
+#endif // STBI_JPEG_THREADS
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
    if (!z->progressive) {
+#ifdef STBI_JPEG_THREADS
+      int parallel = stbi__jpeg_parallel_scan(z);
+      if (parallel >= 0) return parallel;
+#endif
       if (z->scan_n == 1) {
          int i,j;
          STBI_SIMD_ALIGN(short, data[64]);
@@ -2962,9 +3520,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          int h = (z->img_comp[n].y+7) >> 3;
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
-               int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               if (!stbi__jpeg_baseline_block(z, data, n, i, j)) return 0;
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2988,11 +3544,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
-                        int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        if (!stbi__jpeg_baseline_block(z, data, n, i*z->img_comp[n].h + x, j*z->img_comp[n].v + y)) return 0;
                      }
                   }
                }
@@ -3089,7 +3641,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(stbi__jpeg_block_out(z, n, i, j), z->img_comp[n].w2, data);
             }
          }
       }
@@ -3334,12 +3886,15 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
-      if (z->img_comp[i].raw_data == NULL)
-         return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
-      // align blocks for idct using mmx/sse
-      z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
-      if (z->progressive) {
+      if (!z->coeff_only) {
+         // a downscaled decode only needs a plane of the reduced size
+         z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2 >> z->scale_shift, z->img_comp[i].h2 >> z->scale_shift, 15);
+         if (z->img_comp[i].raw_data == NULL)
+            return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
+         // align blocks for idct using mmx/sse
+         z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
+      }
+      if (z->progressive || z->coeff_only) {
          // w2, h2 are multiples of 8 (see above)
          z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
          z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
@@ -3347,7 +3902,13 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
+         // zero them so blocks a truncated stream never reaches come out flat, not as heap garbage
+         if (z->coeff_only)
+            memset(z->img_comp[i].coeff, 0, z->img_comp[i].w2 * z->img_comp[i].h2 * sizeof(short));
       }
+      // from here on w2/h2 describe the output plane
+      z->img_comp[i].w2 >>= z->scale_shift;
+      z->img_comp[i].h2 >>= z->scale_shift;
    }
 
    return 1;
@@ -3441,7 +4002,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
          m = stbi__get_marker(j);
       }
    }
-   if (j->progressive)
+   if (j->progressive && !j->coeff_only)
       stbi__jpeg_finish(j);
    return 1;
 }
@@ -3465,9 +4026,25 @@ static stbi_uc *resample_row_1(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far,
 static stbi_uc* stbi__resample_row_v_2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // need to generate two samples vertically for every one in input
-   int i;
+   int i=0;
    STBI_NOTUSED(hs);
-   for (i=0; i < w; ++i)
+#ifdef STBI_WASM_SIMD
+   {
+      v128_t bias = wasm_i16x8_splat(2);
+      for (; i+15 < w; i += 16) {
+         v128_t nearb = wasm_v128_load(in_near + i);
+         v128_t farb  = wasm_v128_load(in_far + i);
+         v128_t nlo = wasm_u16x8_extend_low_u8x16(nearb);
+         v128_t nhi = wasm_u16x8_extend_high_u8x16(nearb);
+         v128_t lo  = wasm_i16x8_add(wasm_i16x8_add(wasm_i16x8_shl(nlo, 1), nlo), wasm_u16x8_extend_low_u8x16(farb));
+         v128_t hi  = wasm_i16x8_add(wasm_i16x8_add(wasm_i16x8_shl(nhi, 1), nhi), wasm_u16x8_extend_high_u8x16(farb));
+         lo = wasm_u16x8_shr(wasm_i16x8_add(lo, bias), 2);
+         hi = wasm_u16x8_shr(wasm_i16x8_add(hi, bias), 2);
+         wasm_v128_store(out + i, wasm_u8x16_narrow_i16x8(lo, hi));
+      }
+   }
+#endif
+   for (; i < w; ++i)
       out[i] = stbi__div4(3*in_near[i] + in_far[i] + 2);
    return out;
 }
@@ -3486,7 +4063,26 @@ static stbi_uc*  stbi__resample_row_h_2(stbi_uc *out, stbi_uc *in_near, stbi_uc
 
    out[0] = input[0];
    out[1] = stbi__div4(input[0]*3 + input[1] + 2);
-   for (i=1; i < w-1; ++i) {
+   i = 1;
+#ifdef STBI_WASM_SIMD
+   {
+      // even = (3*cur + prev + 2) >> 2, odd = (3*cur + next + 2) >> 2;
+      // needs input[i+8] to be valid, so stop one short of the last pixel
+      v128_t bias = wasm_i16x8_splat(2);
+      for (; i+8 < w; i += 8) {
+         v128_t prev = wasm_u16x8_load8x8(input + i - 1);
+         v128_t curr = wasm_u16x8_load8x8(input + i);
+         v128_t next = wasm_u16x8_load8x8(input + i + 1);
+         v128_t curb = wasm_i16x8_add(wasm_i16x8_add(wasm_i16x8_shl(curr, 1), curr), bias);
+         v128_t even = wasm_u16x8_shr(wasm_i16x8_add(curb, prev), 2);
+         v128_t odd  = wasm_u16x8_shr(wasm_i16x8_add(curb, next), 2);
+         v128_t outv = wasm_u8x16_narrow_i16x8(wasm_i16x8_shuffle(even, odd, 0,8,1,9,2,10,3,11),
+                                               wasm_i16x8_shuffle(even, odd, 4,12,5,13,6,14,7,15));
+         wasm_v128_store(out + i*2, outv);
+      }
+   }
+#endif
+   for (; i < w-1; ++i) {
       int n = 3*input[i]+2;
       out[i*2+0] = stbi__div4(n+input[i-1]);
       out[i*2+1] = stbi__div4(n+input[i+1]);
@@ -3526,7 +4122,7 @@ static stbi_uc *stbi__resample_row_hv_2(stbi_uc *out, stbi_uc *in_near, stbi_uc
    return out;
 }
 
-#if defined(STBI_SSE2) || defined(STBI_NEON)
+#if defined(STBI_SSE2) || defined(STBI_NEON) || defined(STBI_WASM_SIMD)
 static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // need to generate 2x2 samples for every one in input
@@ -3619,6 +4215,38 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
       o.val[0] = vqrshrun_n_s16(even, 4);
       o.val[1] = vqrshrun_n_s16(odd,  4);
       vst2_u8(out + i*2, o);
+#elif defined(STBI_WASM_SIMD)
+      // same structure as the SSE2 version
+      v128_t farw  = wasm_u16x8_load8x8(in_far + i);
+      v128_t nearw = wasm_u16x8_load8x8(in_near + i);
+      v128_t diff  = wasm_i16x8_sub(farw, nearw);
+      v128_t nears = wasm_i16x8_shl(nearw, 2);
+      v128_t curr  = wasm_i16x8_add(nears, diff); // current row
+
+      // "prev" is current row shifted right by 1 pixel with t1 inserted,
+      // "next" is shifted left by 1 pixel with the next block's first pixel.
+      v128_t prev = wasm_i16x8_shuffle(curr, curr, 0,0,1,2,3,4,5,6);
+      v128_t next = wasm_i16x8_shuffle(curr, curr, 1,2,3,4,5,6,7,7);
+      prev = wasm_i16x8_replace_lane(prev, 0, (short) t1);
+      next = wasm_i16x8_replace_lane(next, 7, (short) (3*in_near[i+8] + in_far[i+8]));
+
+      // even pixels = cur*4 + (prev - cur), odd pixels = cur*4 + (next - cur)
+      v128_t bias = wasm_i16x8_splat(8);
+      v128_t curs = wasm_i16x8_shl(curr, 2);
+      v128_t prvd = wasm_i16x8_sub(prev, curr);
+      v128_t nxtd = wasm_i16x8_sub(next, curr);
+      v128_t curb = wasm_i16x8_add(curs, bias);
+      v128_t even = wasm_i16x8_add(prvd, curb);
+      v128_t odd  = wasm_i16x8_add(nxtd, curb);
+
+      // interleave even and odd pixels, then undo scaling.
+      v128_t int0 = wasm_i16x8_shuffle(even, odd, 0,8,1,9,2,10,3,11);
+      v128_t int1 = wasm_i16x8_shuffle(even, odd, 4,12,5,13,6,14,7,15);
+      v128_t de0  = wasm_u16x8_shr(int0, 4);
+      v128_t de1  = wasm_u16x8_shr(int1, 4);
+
+      // pack and write output
+      wasm_v128_store(out + i*2, wasm_u8x16_narrow_i16x8(de0, de1));
 #endif
 
       // "previous" value for next iter
@@ -3682,7 +4310,7 @@ static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc
    }
 }
 
-#if defined(STBI_SSE2) || defined(STBI_NEON)
+#if defined(STBI_SSE2) || defined(STBI_NEON) || defined(STBI_WASM_SIMD)
 static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
 {
    int i = 0;
@@ -3794,6 +4422,69 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
    }
 #endif
 
+#ifdef STBI_WASM_SIMD
+   // port of the SSE2 path; wasm has no 16-bit mulhi, so it is built from
+   // a widening multiply plus a shuffle that keeps the high halves.
+   #define stbi__wasm_mulhi_i16x8(a, b) \
+      wasm_i16x8_shuffle(wasm_i32x4_extmul_low_i16x8(a, b), wasm_i32x4_extmul_high_i16x8(a, b), 1,3,5,7,9,11,13,15)
+   if (step == 4) {
+      v128_t signflip  = wasm_i8x16_splat(-0x80);
+      v128_t cr_const0 = wasm_i16x8_splat(   (short) ( 1.40200f*4096.0f+0.5f));
+      v128_t cr_const1 = wasm_i16x8_splat( - (short) ( 0.71414f*4096.0f+0.5f));
+      v128_t cb_const0 = wasm_i16x8_splat( - (short) ( 0.34414f*4096.0f+0.5f));
+      v128_t cb_const1 = wasm_i16x8_splat(   (short) ( 1.77200f*4096.0f+0.5f));
+      v128_t y_bias = wasm_i8x16_splat((char) (unsigned char) 128);
+      v128_t xw = wasm_i16x8_splat(255); // alpha channel
+      v128_t zero = wasm_i32x4_splat(0);
+
+      for (; i+7 < count; i += 8) {
+         // load
+         v128_t y_bytes  = wasm_v128_load64_zero(y+i);
+         v128_t cr_bytes = wasm_v128_load64_zero(pcr+i);
+         v128_t cb_bytes = wasm_v128_load64_zero(pcb+i);
+         v128_t cr_biased = wasm_v128_xor(cr_bytes, signflip); // -128
+         v128_t cb_biased = wasm_v128_xor(cb_bytes, signflip); // -128
+
+         // unpack to short (and left-shift cr, cb by 8)
+         v128_t yw  = wasm_i8x16_shuffle(y_bias, y_bytes, 0,16,1,17,2,18,3,19,4,20,5,21,6,22,7,23);
+         v128_t crw = wasm_i8x16_shuffle(zero, cr_biased, 0,16,1,17,2,18,3,19,4,20,5,21,6,22,7,23);
+         v128_t cbw = wasm_i8x16_shuffle(zero, cb_biased, 0,16,1,17,2,18,3,19,4,20,5,21,6,22,7,23);
+
+         // color transform
+         v128_t yws = wasm_u16x8_shr(yw, 4);
+         v128_t cr0 = stbi__wasm_mulhi_i16x8(cr_const0, crw);
+         v128_t cb0 = stbi__wasm_mulhi_i16x8(cb_const0, cbw);
+         v128_t cb1 = stbi__wasm_mulhi_i16x8(cbw, cb_const1);
+         v128_t cr1 = stbi__wasm_mulhi_i16x8(crw, cr_const1);
+         v128_t rws = wasm_i16x8_add(cr0, yws);
+         v128_t gwt = wasm_i16x8_add(cb0, yws);
+         v128_t bws = wasm_i16x8_add(yws, cb1);
+         v128_t gws = wasm_i16x8_add(gwt, cr1);
+
+         // descale
+         v128_t rw = wasm_i16x8_shr(rws, 4);
+         v128_t bw = wasm_i16x8_shr(bws, 4);
+         v128_t gw = wasm_i16x8_shr(gws, 4);
+
+         // back to byte, set up for transpose
+         v128_t brb = wasm_u8x16_narrow_i16x8(rw, bw);
+         v128_t gxb = wasm_u8x16_narrow_i16x8(gw, xw);
+
+         // transpose to interleave channels
+         v128_t t0 = wasm_i8x16_shuffle(brb, gxb, 0,16,1,17,2,18,3,19,4,20,5,21,6,22,7,23);
+         v128_t t1 = wasm_i8x16_shuffle(brb, gxb, 8,24,9,25,10,26,11,27,12,28,13,29,14,30,15,31);
+         v128_t o0 = wasm_i16x8_shuffle(t0, t1, 0,8,1,9,2,10,3,11);
+         v128_t o1 = wasm_i16x8_shuffle(t0, t1, 4,12,5,13,6,14,7,15);
+
+         // store
+         wasm_v128_store(out + 0, o0);
+         wasm_v128_store(out + 16, o1);
+         out += 32;
+      }
+   }
+   #undef stbi__wasm_mulhi_i16x8
+#endif
+
    for (; i < count; ++i) {
       int y_fixed = (y[i] << 20) + (1<<19); // rounding
       int r,g,b;
@@ -3832,11 +4523,15 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    }
 #endif
 
-#ifdef STBI_NEON
+#if defined(STBI_NEON) || defined(STBI_WASM_SIMD)
    j->idct_block_kernel = stbi__idct_simd;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
 #endif
+
+   if (j->scale_shift == 1) j->idct_block_kernel = stbi__idct_block_4x4;
+   if (j->scale_shift == 2) j->idct_block_kernel = stbi__idct_block_2x2;
+   if (j->scale_shift == 3) j->idct_block_kernel = stbi__idct_block_1x1;
 }
 
 // clean up the temporary component buffers
@@ -3862,6 +4557,183 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+// step a component's resampler to the next output row
+static void stbi__resample_advance(stbi__jpeg *z, stbi__resample *r, int k)
+{
+   if (++r->ystep >= r->vs) {
+      r->ystep = 0;
+      r->line0 = r->line1;
+      if (++r->ypos < z->img_comp[k].y)
+         r->line1 += z->img_comp[k].w2;
+   }
+}
+
+// resample and color-convert output rows [y0,y1). res_comp holds the
+// resampler state for row 0 and is advanced in place.
+static void stbi__jpeg_convert_rows(stbi__jpeg *z, stbi_uc *output, int n, int decode_n, int is_rgb,
+                                    stbi__resample *res_comp, stbi_uc **linebuf, unsigned int y0, unsigned int y1)
+{
+   int k;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   for (j=0; j < y0; ++j)
+      for (k=0; k < decode_n; ++k)
+         stbi__resample_advance(z, &res_comp[k], k);
+
+   for (j=y0; j < y1; ++j) {
+      stbi_uc *out = output + n * z->s->img_x * j;
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         stbi__resample_advance(z, r, k);
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += n;
+               }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += n;
+               }
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += n;
+               }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+   }
+}
+
+#ifdef STBI_JPEG_THREADS
+// don't bother splitting the conversion into bands thinner than this
+#define STBI__JPEG_MIN_BAND_ROWS 64
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc *output;
+   int n, decode_n, is_rgb;
+   stbi__resample res_comp[4];
+   stbi_uc *linebuf[4];
+   unsigned int y0, y1;
+} stbi__jpeg_band_job;
+
+static void stbi__jpeg_convert_band(void *arg)
+{
+   stbi__jpeg_band_job *job = (stbi__jpeg_band_job *) arg;
+   stbi__jpeg_convert_rows(job->z, job->output, job->n, job->decode_n, job->is_rgb,
+                           job->res_comp, job->linebuf, job->y0, job->y1);
+}
+
+// split the conversion into row bands, each with its own line buffers and a
+// copy of the resampler state. returns 0 if it couldn't (caller goes serial)
+static int stbi__jpeg_convert_parallel(stbi__jpeg *z, stbi_uc *output, int n, int decode_n, int is_rgb,
+                                       stbi__resample *res_comp)
+{
+   stbi__jpeg_band_job job[STBI_JPEG_MAX_THREADS];
+   stbi_uc *extra;
+   int bands = stbi__jpeg_threads, t, k;
+   unsigned int h = z->s->img_y;
+
+   // with 3 output channels the row converters store a 4th byte past each
+   // pixel, which lands on the first byte of the next row; that only comes
+   // out right if rows are written in order
+   if (n == 3) return 0;
+   if (bands > STBI_JPEG_MAX_THREADS) bands = STBI_JPEG_MAX_THREADS;
+   if (bands > (int) (h / STBI__JPEG_MIN_BAND_ROWS)) bands = (int) (h / STBI__JPEG_MIN_BAND_ROWS);
+   if (bands < 2) return 0;
+
+   // band 0 reuses the component line buffers
+   extra = (stbi_uc *) stbi__malloc_mad3(bands-1, decode_n, z->s->img_x + 3, 0);
+   if (!extra) return 0;
+
+   for (t=0; t < bands; ++t) {
+      job[t].z = z;
+      job[t].output = output;
+      job[t].n = n;
+      job[t].decode_n = decode_n;
+      job[t].is_rgb = is_rgb;
+      job[t].y0 = h * t / bands;
+      job[t].y1 = h * (t+1) / bands;
+      for (k=0; k < decode_n; ++k) {
+         job[t].res_comp[k] = res_comp[k];
+         job[t].linebuf[k] = t == 0 ? z->img_comp[k].linebuf : extra + ((t-1)*decode_n + k) * (z->s->img_x + 3);
+      }
+   }
+   stbi__jpeg_run_tasks(stbi__jpeg_convert_band, job, sizeof(job[0]), bands);
+   STBI_FREE(extra);
+   return 1;
+}
+#endif // STBI_JPEG_THREADS
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3873,6 +4745,17 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // the planes were decoded at reduced size; everything below works in output pixels
+   if (z->scale_shift) {
+      int k, round = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + round) >> z->scale_shift;
+      for (k=0; k < z->s->img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + round) >> z->scale_shift;
+         z->img_comp[k].y = (z->img_comp[k].y + round) >> z->scale_shift;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3890,10 +4773,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // resample and color-convert
    {
       int k;
-      unsigned int i,j;
       stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
       stbi__resample res_comp[4];
 
       for (k=0; k < decode_n; ++k) {
@@ -3918,104 +4798,21 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          else                               r->resample = stbi__resample_row_generic;
       }
 
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+      // can't error after this so, this is safe. the extra byte is slack for
+      // 3-channel output, so only 4-channel output may go to stbi_set_decode_into
+      output = (stbi_uc *) (n == 4 ? stbi__malloc_output_mad3(n, z->s->img_x, z->s->img_y)
+                                   : stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1));
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
-         }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
-         }
+#ifdef STBI_JPEG_THREADS
+      if (!stbi__jpeg_convert_parallel(z, output, n, decode_n, is_rgb, res_comp))
+#endif
+      {
+         stbi_uc *linebuf[4];
+         for (k=0; k < decode_n; ++k)
+            linebuf[k] = z->img_comp[k].linebuf;
+         stbi__jpeg_convert_rows(z, output, n, decode_n, is_rgb, res_comp, linebuf, 0, z->s->img_y);
       }
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
@@ -4033,6 +4830,7 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    memset(j, 0, sizeof(stbi__jpeg));
    STBI_NOTUSED(ri);
    j->s = s;
+   j->scale_shift = stbi__jpeg_scale_shift;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
    STBI_FREE(j);
@@ -4091,6 +4889,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
+#define STBI__Z64_BITS 11 // literal/length table bits for STBI_ZLIB_FAST64
 
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
@@ -4187,6 +4986,9 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+#ifdef STBI_ZLIB_FAST64
+   stbi__uint32 z_fast64[1 << STBI__Z64_BITS];
+#endif
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
@@ -4306,9 +5108,241 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+#ifdef STBI_ZLIB_FAST64
+// Optional replacement for the inner inflate loop, enabled with STBI_ZLIB_FAST64.
+//
+// While at least STBI__Z64_IN_SLACK input bytes and STBI__Z64_OUT_SLACK output
+// bytes remain, symbols are decoded from a 64-bit bit buffer that is refilled
+// with one unaligned load per symbol, so no per-byte eof or output checks are
+// needed. Literal/length codes are resolved through an 11-bit table whose
+// entries can hold two literals at once, and matches are copied in 8-byte
+// chunks. The tail of the stream falls back to the regular loop below.
+// Assumes a little-endian target (wasm, x86, ARM).
+
+typedef unsigned long long stbi__uint64;
+
+// table entry layout:
+//    bits 0-4   total code bits consumed by the entry
+//    bits 5-6   kind (STBI__Z64_SLOW, _LIT, _LEN, _EOB)
+//    bit  7     literal entries: set if the entry holds two literals
+//    bits 8-23  literal entries: first literal, second literal
+//    bits 8-16  length entries: base length; bits 17-20: extra bits
+#define STBI__Z64_SLOW  (0 << 5)  // code longer than the table, or invalid symbol
+#define STBI__Z64_LIT   (1 << 5)
+#define STBI__Z64_LEN   (2 << 5)
+#define STBI__Z64_EOB   (3 << 5)
+#define STBI__Z64_KIND  (3 << 5)
+#define STBI__Z64_PAIR  (1 << 7)
+
+#define STBI__Z64_IN_SLACK   16
+#define STBI__Z64_OUT_SLACK  (258 + 16)
+
+static void stbi__zbuild_fast64(stbi__uint32 *table, const stbi_uc *sizelist, int num)
+{
+   stbi__uint32 single[1 << STBI__Z64_BITS];
+   int i, j, code = 0, next_code[16], sizes[16];
+
+   memset(sizes, 0, sizeof(sizes));
+   memset(single, 0, sizeof(single));
+   for (i=0; i < num; ++i)
+      ++sizes[sizelist[i]];
+   sizes[0] = 0;
+   for (i=1; i < 16; ++i) {
+      next_code[i] = code;
+      code = (code + sizes[i]) << 1;
+   }
+   // stbi__zbuild_huffman has already validated the code lengths
+   for (i=0; i < num; ++i) {
+      int s = sizelist[i];
+      if (s) {
+         if (s <= STBI__Z64_BITS) {
+            stbi__uint32 e;
+            if (i < 256)
+               e = s | STBI__Z64_LIT | (i << 8);
+            else if (i == 256)
+               e = s | STBI__Z64_EOB;
+            else if (i < 286)
+               e = s | STBI__Z64_LEN | (stbi__zlength_base[i-257] << 8) | (stbi__zlength_extra[i-257] << 17);
+            else
+               e = STBI__Z64_SLOW;
+            for (j = stbi__bit_reverse(next_code[s], s); j < (1 << STBI__Z64_BITS); j += (1 << s))
+               single[j] = e;
+         }
+         ++next_code[s];
+      }
+   }
+   // pair up literals whose combined code fits in the table
+   for (j=0; j < (1 << STBI__Z64_BITS); ++j) {
+      stbi__uint32 e = single[j];
+      int s = e & 31;
+      table[j] = e;
+      if ((e & STBI__Z64_KIND) == STBI__Z64_LIT) {
+         stbi__uint32 e2 = single[j >> s];
+         int s2 = e2 & 31;
+         if ((e2 & STBI__Z64_KIND) == STBI__Z64_LIT && s2 && s + s2 <= STBI__Z64_BITS)
+            table[j] = (s + s2) | STBI__Z64_LIT | STBI__Z64_PAIR | (e & 0xff00) | ((e2 & 0xff00) << 8);
+      }
+   }
+}
+
+// same as stbi__zhuffman_decode_slowpath, but on a caller-held bit buffer
+static int stbi__zfast64_slowpath(stbi__zhuffman *z, stbi__uint64 bits, int *len)
+{
+   int b,s,k;
+   k = stbi__bit_reverse((int) (bits & 0xffff), 16);
+   for (s=STBI__ZFAST_BITS+1; ; ++s)
+      if (k < z->maxcode[s])
+         break;
+   if (s >= 16) return -1;
+   b = (k >> (16-s)) - z->firstcode[s] + z->firstsymbol[s];
+   if (b >= STBI__ZNSYMS) return -1;
+   if (z->size[b] != s) return -1;
+   *len = s;
+   return z->value[b];
+}
+
+// returns 1 at end of block, 0 on error, and 2 when the remaining input or
+// output is too short and decoding must continue on the careful path
+static int stbi__parse_huffman_block_fast64(stbi__zbuf *a)
+{
+   stbi_uc *in = a->zbuffer;
+   stbi_uc *in_end, *out_end;
+   stbi_uc *zout = (stbi_uc *) a->zout;
+   stbi_uc *zout_start = (stbi_uc *) a->zout_start;
+   stbi__uint64 bitbuf = a->code_buffer;
+   int nbits = a->num_bits;
+   int result = 2;
+
+   if (a->hit_zeof_once) return 2;
+   if (a->zbuffer_end - in < STBI__Z64_IN_SLACK) return 2;
+   if ((stbi_uc *) a->zout_end - zout < STBI__Z64_OUT_SLACK) return 2;
+   in_end = a->zbuffer_end - STBI__Z64_IN_SLACK;
+   out_end = (stbi_uc *) a->zout_end - STBI__Z64_OUT_SLACK;
+
+   while (in < in_end && zout < out_end) {
+      stbi__uint32 e;
+      int sym, len, dist, s, extra;
+      stbi_uc *p;
+      {
+         // branchless refill to at least 56 bits
+         stbi__uint64 v;
+         memcpy(&v, in, 8);
+         bitbuf |= v << nbits;
+         in += (63 - nbits) >> 3;
+         nbits |= 56;
+      }
+
+      e = a->z_fast64[bitbuf & ((1 << STBI__Z64_BITS) - 1)];
+      if ((e & STBI__Z64_KIND) == STBI__Z64_LIT) {
+         // up to three literal entries (at most 33 bits) per refill
+         int n = 3;
+         do {
+            s = e & 31;
+            bitbuf >>= s;
+            nbits -= s;
+            zout[0] = (stbi_uc) (e >> 8);
+            zout[1] = (stbi_uc) (e >> 16); // may be overwritten, output slack covers it
+            zout += (e & STBI__Z64_PAIR) ? 2 : 1;
+            e = a->z_fast64[bitbuf & ((1 << STBI__Z64_BITS) - 1)];
+         } while (--n && (e & STBI__Z64_KIND) == STBI__Z64_LIT);
+         continue;
+      }
+      if ((e & STBI__Z64_KIND) == STBI__Z64_LEN) {
+         s = e & 31;
+         len = (e >> 8) & 511;
+         extra = (e >> 17) & 15;
+      } else if ((e & STBI__Z64_KIND) == STBI__Z64_EOB) {
+         s = e & 31;
+         bitbuf >>= s;
+         nbits -= s;
+         result = 1;
+         break;
+      } else {
+         sym = stbi__zfast64_slowpath(&a->z_length, bitbuf, &s);
+         if (sym < 0) return stbi__err("bad huffman code","Corrupt PNG");
+         if (sym < 256) {
+            bitbuf >>= s;
+            nbits -= s;
+            *zout++ = (stbi_uc) sym;
+            continue;
+         }
+         if (sym == 256) {
+            bitbuf >>= s;
+            nbits -= s;
+            result = 1;
+            break;
+         }
+         if (sym >= 286) return stbi__err("bad huffman code","Corrupt PNG");
+         len = stbi__zlength_base[sym-257];
+         extra = stbi__zlength_extra[sym-257];
+      }
+      bitbuf >>= s;
+      nbits -= s;
+      len += (int) (bitbuf & ((1 << extra) - 1));
+      bitbuf >>= extra;
+      nbits -= extra;
+
+      sym = a->z_distance.fast[bitbuf & STBI__ZFAST_MASK];
+      if (sym) {
+         s = sym >> 9;
+         sym &= 511;
+      } else {
+         sym = stbi__zfast64_slowpath(&a->z_distance, bitbuf, &s);
+      }
+      if (sym < 0 || sym >= 30) return stbi__err("bad huffman code","Corrupt PNG");
+      bitbuf >>= s;
+      nbits -= s;
+      extra = stbi__zdist_extra[sym];
+      dist = stbi__zdist_base[sym] + (int) (bitbuf & ((1 << extra) - 1));
+      bitbuf >>= extra;
+      nbits -= extra;
+      if (zout - zout_start < dist) return stbi__err("bad dist","Corrupt PNG");
+
+      // copy the match; chunked copies may write up to 15 bytes past the end
+      p = zout - dist;
+      if (dist >= 16) {
+         stbi_uc *end = zout + len;
+         do {
+            memcpy(zout, p, 16);
+            zout += 16;
+            p += 16;
+         } while (zout < end);
+         zout = end;
+      } else if (dist >= 8) {
+         stbi_uc *end = zout + len;
+         do {
+            memcpy(zout, p, 8);
+            zout += 8;
+            p += 8;
+         } while (zout < end);
+         zout = end;
+      } else if (dist == 1) {
+         memset(zout, *p, len);
+         zout += len;
+      } else {
+         do *zout++ = *p++; while (--len);
+      }
+   }
+
+   // give back whole unread bytes so the bit state fits the 32-bit buffer again
+   in -= nbits >> 3;
+   nbits &= 7;
+   a->zbuffer = in;
+   a->code_buffer = (stbi__uint32) (bitbuf & ((1u << nbits) - 1));
+   a->num_bits = nbits;
+   a->zout = (char *) zout;
+   return result;
+}
+#endif // STBI_ZLIB_FAST64
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
-   char *zout = a->zout;
+   char *zout;
+#ifdef STBI_ZLIB_FAST64
+   int r = stbi__parse_huffman_block_fast64(a);
+   if (r != 2) return r;
+#endif
+   zout = a->zout;
    for(;;) {
       int z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
@@ -4403,6 +5437,9 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
    if (n != ntot) return stbi__err("bad codelengths","Corrupt PNG");
    if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!stbi__zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+#ifdef STBI_ZLIB_FAST64
+   stbi__zbuild_fast64(a->z_fast64, lencodes, hlit);
+#endif
    return 1;
 }
 
@@ -4498,6 +5535,9 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
             // use fixed code lengths
             if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , STBI__ZNSYMS)) return 0;
             if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+#ifdef STBI_ZLIB_FAST64
+            stbi__zbuild_fast64(a->z_fast64, stbi__zdefault_length, STBI__ZNSYMS);
+#endif
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
@@ -4692,6 +5732,170 @@ static void stbi__create_png_alpha_expand8(stbi_uc *dest, stbi_uc *src, stbi__ui
    }
 }
 
+#if defined(STBI_SSE41) || defined(STBI_WASM_SIMD)
+#define STBI__PNG_SIMD
+
+// Vectorized unfiltering for 4-byte pixels (RGBA8, GA16). Every routine
+// handles the whole scanline including the first pixel, with the left and
+// upper-left neighbours of the first pixel treated as zero, and nk must be
+// a multiple of 4. The results are bit-identical to the scalar loops.
+
+static stbi__uint32 stbi__png_ld32(const stbi_uc *p) { stbi__uint32 v; memcpy(&v, p, 4); return v; }
+static void stbi__png_st32(stbi_uc *p, stbi__uint32 v) { memcpy(p, &v, 4); }
+
+#ifdef STBI_SSE41
+
+static void stbi__png_unfilter4_up(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk)
+{
+   int k = 0;
+   for (; k + 16 <= nk; k += 16)
+      _mm_storeu_si128((__m128i *) (cur+k), _mm_add_epi8(_mm_loadu_si128((const __m128i *) (raw+k)), _mm_loadu_si128((const __m128i *) (prior+k))));
+   for (; k < nk; ++k)
+      cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+}
+
+static void stbi__png_unfilter4_sub(stbi_uc *cur, const stbi_uc *raw, int nk)
+{
+   __m128i last = _mm_setzero_si128();
+   int k = 0;
+   // prefix sum of 4 pixels at a time, then add the last decoded pixel
+   for (; k + 16 <= nk; k += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *) (raw+k));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi8(x, last);
+      _mm_storeu_si128((__m128i *) (cur+k), x);
+      last = _mm_shuffle_epi32(x, _MM_SHUFFLE(3,3,3,3));
+   }
+   for (; k < nk; k += 4) {
+      last = _mm_add_epi8(_mm_cvtsi32_si128((int) stbi__png_ld32(raw+k)), last);
+      stbi__png_st32(cur+k, (stbi__uint32) _mm_cvtsi128_si32(last));
+   }
+}
+
+static void stbi__png_unfilter4_avg(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk)
+{
+   const __m128i one = _mm_set1_epi8(1);
+   __m128i a = _mm_setzero_si128();
+   int k;
+   for (k = 0; k < nk; k += 4) {
+      __m128i b = _mm_cvtsi32_si128((int) stbi__png_ld32(prior+k));
+      __m128i d = _mm_cvtsi32_si128((int) stbi__png_ld32(raw+k));
+      // pavgb rounds up; subtract the carried low bit to get floor((a+b)/2)
+      __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+      a = _mm_add_epi8(d, avg);
+      stbi__png_st32(cur+k, (stbi__uint32) _mm_cvtsi128_si32(a));
+   }
+}
+
+static void stbi__png_unfilter4_paeth(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i a = zero, c = zero; // left and upper-left pixels, widened to 16 bits
+   int k;
+   for (k = 0; k < nk; k += 4) {
+      __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int) stbi__png_ld32(prior+k)), zero);
+      __m128i d = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int) stbi__png_ld32(raw+k)), zero);
+      // with p = a+b-c: |p-a| = |b-c|, |p-b| = |a-c|, |p-c| = |(b-c)+(a-c)|
+      __m128i pa = _mm_sub_epi16(b, c);
+      __m128i pb = _mm_sub_epi16(a, c);
+      __m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+      __m128i smallest, pred;
+      pa = _mm_abs_epi16(pa);
+      pb = _mm_abs_epi16(pb);
+      smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+      pred = _mm_blendv_epi8(c, b, _mm_cmpeq_epi16(pb, smallest));
+      pred = _mm_blendv_epi8(pred, a, _mm_cmpeq_epi16(pa, smallest));
+      a = _mm_and_si128(_mm_add_epi16(d, pred), _mm_set1_epi16(0xff));
+      c = b;
+      stbi__png_st32(cur+k, (stbi__uint32) _mm_cvtsi128_si32(_mm_packus_epi16(a, a)));
+   }
+}
+
+#else // STBI_WASM_SIMD
+
+static void stbi__png_unfilter4_up(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk)
+{
+   int k = 0;
+   for (; k + 16 <= nk; k += 16)
+      wasm_v128_store(cur+k, wasm_i8x16_add(wasm_v128_load(raw+k), wasm_v128_load(prior+k)));
+   for (; k < nk; ++k)
+      cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+}
+
+static void stbi__png_unfilter4_sub(stbi_uc *cur, const stbi_uc *raw, int nk)
+{
+   const v128_t zero = wasm_i8x16_splat(0);
+   v128_t last = zero;
+   int k = 0;
+   // prefix sum of 4 pixels at a time, then add the last decoded pixel
+   for (; k + 16 <= nk; k += 16) {
+      v128_t x = wasm_v128_load(raw+k);
+      x = wasm_i8x16_add(x, wasm_i8x16_shuffle(x, zero, 16,16,16,16, 0,1,2,3, 4,5,6,7, 8,9,10,11));
+      x = wasm_i8x16_add(x, wasm_i8x16_shuffle(x, zero, 16,16,16,16, 16,16,16,16, 0,1,2,3, 4,5,6,7));
+      x = wasm_i8x16_add(x, last);
+      wasm_v128_store(cur+k, x);
+      last = wasm_i32x4_shuffle(x, x, 3,3,3,3);
+   }
+   for (; k < nk; k += 4) {
+      last = wasm_i8x16_add(wasm_v128_load32_zero(raw+k), last);
+      wasm_v128_store32_lane(cur+k, last, 0);
+   }
+}
+
+static void stbi__png_unfilter4_avg(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk)
+{
+   const v128_t one = wasm_i8x16_splat(1);
+   v128_t a = wasm_i8x16_splat(0);
+   int k;
+   for (k = 0; k < nk; k += 4) {
+      v128_t b = wasm_v128_load32_zero(prior+k);
+      v128_t d = wasm_v128_load32_zero(raw+k);
+      // avgr rounds up; subtract the carried low bit to get floor((a+b)/2)
+      v128_t avg = wasm_i8x16_sub(wasm_u8x16_avgr(a, b), wasm_v128_and(wasm_v128_xor(a, b), one));
+      a = wasm_i8x16_add(d, avg);
+      wasm_v128_store32_lane(cur+k, a, 0);
+   }
+}
+
+static void stbi__png_unfilter4_paeth(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk)
+{
+   const v128_t mask = wasm_i16x8_splat(0xff);
+   v128_t a = wasm_i16x8_splat(0), c = a; // left and upper-left pixels, widened to 16 bits
+   int k;
+   for (k = 0; k < nk; k += 4) {
+      v128_t b = wasm_u16x8_extend_low_u8x16(wasm_v128_load32_zero(prior+k));
+      v128_t d = wasm_u16x8_extend_low_u8x16(wasm_v128_load32_zero(raw+k));
+      // with p = a+b-c: |p-a| = |b-c|, |p-b| = |a-c|, |p-c| = |(b-c)+(a-c)|
+      v128_t pa = wasm_i16x8_sub(b, c);
+      v128_t pb = wasm_i16x8_sub(a, c);
+      v128_t pc = wasm_i16x8_abs(wasm_i16x8_add(pa, pb));
+      v128_t smallest, pred;
+      pa = wasm_i16x8_abs(pa);
+      pb = wasm_i16x8_abs(pb);
+      smallest = wasm_i16x8_min(pc, wasm_i16x8_min(pa, pb));
+      pred = wasm_v128_bitselect(b, c, wasm_i16x8_eq(pb, smallest));
+      pred = wasm_v128_bitselect(a, pred, wasm_i16x8_eq(pa, smallest));
+      a = wasm_v128_and(wasm_i16x8_add(d, pred), mask);
+      c = b;
+      wasm_v128_store32_lane(cur+k, wasm_u8x16_narrow_i16x8(a, a), 0);
+   }
+}
+
+#endif
+
+// filter must be one of sub, up, avg or paeth
+static void stbi__png_unfilter4(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk)
+{
+   switch (filter) {
+      case STBI__F_sub:   stbi__png_unfilter4_sub(cur, raw, nk); break;
+      case STBI__F_up:    stbi__png_unfilter4_up(cur, raw, prior, nk); break;
+      case STBI__F_avg:   stbi__png_unfilter4_avg(cur, raw, prior, nk); break;
+      case STBI__F_paeth: stbi__png_unfilter4_paeth(cur, raw, prior, nk); break;
+   }
+}
+#endif // STBI__PNG_SIMD
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
@@ -4752,6 +5956,11 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       if (j == 0) filter = first_row_filter[filter];
 
       // perform actual filtering
+#ifdef STBI__PNG_SIMD
+      if (filter_bytes == 4 && filter != STBI__F_none && filter != STBI__F_avg_first)
+         stbi__png_unfilter4(filter, cur, raw, prior, nk);
+      else
+#endif
       switch (filter) {
       case STBI__F_none:
          memcpy(cur, raw, nk);
@@ -5594,11 +6803,11 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!stbi__mad3sizes_valid(target, s->img_x, s->img_y, 0))
       return stbi__errpuc("too large", "Corrupt BMP");
 
-   out = (stbi_uc *) stbi__malloc_mad3(target, s->img_x, s->img_y, 0);
+   out = (stbi_uc *) stbi__malloc_output_mad3(target, s->img_x, s->img_y);
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (info.bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { STBI_FREE(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi__free_output(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = stbi__get8(s);
          pal[i][1] = stbi__get8(s);
@@ -5610,7 +6819,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       if (info.bpp == 1) width = (s->img_x + 7) >> 3;
       else if (info.bpp == 4) width = (s->img_x + 1) >> 1;
       else if (info.bpp == 8) width = s->img_x;
-      else { STBI_FREE(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
+      else { stbi__free_output(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       if (info.bpp == 1) {
          for (j=0; j < (int) s->img_y; ++j) {
@@ -5667,13 +6876,13 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { stbi__free_output(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = stbi__high_bit(mr)-7; rcount = stbi__bitcount(mr);
          gshift = stbi__high_bit(mg)-7; gcount = stbi__bitcount(mg);
          bshift = stbi__high_bit(mb)-7; bcount = stbi__bitcount(mb);
          ashift = stbi__high_bit(ma)-7; acount = stbi__bitcount(ma);
-         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { stbi__free_output(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
       }
       for (j=0; j < (int) s->img_y; ++j) {
          if (easy) {
@@ -5924,7 +7133,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!stbi__mad3sizes_valid(tga_width, tga_height, tga_comp, 0))
       return stbi__errpuc("too large", "Corrupt TGA");
 
-   tga_data = (unsigned char*)stbi__malloc_mad3(tga_width, tga_height, tga_comp, 0);
+   tga_data = (unsigned char*)stbi__malloc_output_mad3(tga_width, tga_height, tga_comp);
    if (!tga_data) return stbi__errpuc("outofmem", "Out of memory");
 
    // skip to the data's starting position (offset usually = 0)
@@ -5941,7 +7150,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       if ( tga_indexed)
       {
          if (tga_palette_len == 0) {  /* you have to have at least one entry! */
-            STBI_FREE(tga_data);
+            stbi__free_output(tga_data);
             return stbi__errpuc("bad palette", "Corrupt TGA");
          }
 
@@ -5950,7 +7159,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
          //   load the palette
          tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
          if (!tga_palette) {
-            STBI_FREE(tga_data);
+            stbi__free_output(tga_data);
             return stbi__errpuc("outofmem", "Out of memory");
          }
          if (tga_rgb16) {
@@ -5961,7 +7170,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                pal_entry += tga_comp;
             }
          } else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
-               STBI_FREE(tga_data);
+               stbi__free_output(tga_data);
                STBI_FREE(tga_palette);
                return stbi__errpuc("bad palette", "Corrupt TGA");
          }
@@ -6201,7 +7410,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
       out = (stbi_uc *) stbi__malloc_mad3(8, w, h, 0);
       ri->bits_per_channel = 16;
    } else
-      out = (stbi_uc *) stbi__malloc(4 * w*h);
+      out = (stbi_uc *) stbi__malloc_output_mad3(4, w, h);
 
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    pixelCount = w*h;
@@ -6235,7 +7444,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
          } else {
             // Read the RLE data.
             if (!stbi__psd_decode_rle(s, p, pixelCount)) {
-               STBI_FREE(out);
+               stbi__free_output(out);
                return stbi__errpuc("corrupt", "bad RLE data");
             }
          }
@@ -32,6 +32,18 @@ BUILDING:
    The returned data will be freed with STBIW_FREE() (free() by default),
    so it must be heap allocated with STBIW_MALLOC() (malloc() by default),
 
+   The builtin compressor remains available as stbi_zlib_compress_builtin()
+   (same signature), so a custom function can handle only some quality
+   levels and pass the others on to it.
+
+   You can #define STBIW_CRC32 and STBIW_ADLER32 to replace the builtin PNG chunk
+   CRC and zlib Adler-32 loops; both have the signature
+   unsigned int my_checksum(unsigned char *data, int len);
+   The stored PNG mode (see below) checksums incrementally; #define
+   STBIW_ADLER32_UPDATE with the signature
+   unsigned int my_update(unsigned int adler, unsigned char *data, int len);
+   to replace its loop as well.
+
 UNICODE:
 
    If compiling for Windows and you wish to use Unicode filenames, compile
@@ -68,6 +80,7 @@ USAGE:
       int stbi_write_tga_with_rle;             // defaults to true; set to 0 to disable RLE
       int stbi_write_png_compression_level;    // defaults to 8; set to higher for more compression
       int stbi_write_force_png_filter;         // defaults to -1; set to 0..5 to force a filter mode
+      int stbi_write_png_filter_search;        // defaults to 0; set to 1 to choose filters per band by trial
 
 
    You can define STBI_WRITE_NO_STDIO to disable the file variant of these
@@ -97,7 +110,17 @@ USAGE:
    at the end of the line.)
 
    PNG allows you to set the deflate compression level by setting the global
-   variable 'stbi_write_png_compression_level' (it defaults to 8).
+   variable 'stbi_write_png_compression_level' (it defaults to 8). Level 0
+   makes the PNG _to_func writers emit unfiltered rows in deflate stored
+   blocks, streamed straight from the row source without building a filtered
+   copy of the image; use it when the file is recompressed elsewhere.
+
+   Setting 'stbi_write_png_filter_search' to 1 filters the image in bands of
+   16 rows and, for every band, tries each filter strategy (each of the five
+   filters on all rows, and two per-row heuristics: smallest sum of absolute
+   residuals, smallest byte entropy), keeping the one whose band a quick LZ77
+   + entropy estimate rates smallest. It is meant for slow, size-first
+   encodes together with a stronger STBIW_ZLIB_COMPRESS.
 
    HDR expects linear float data. Since the format is always 32-bit rgb(e)
    data, alpha (if provided) is discarded, and for monochrome data it is
@@ -170,6 +193,7 @@ LICENSE
 STBIWDEF int stbi_write_tga_with_rle;
 STBIWDEF int stbi_write_png_compression_level;
 STBIWDEF int stbi_write_force_png_filter;
+STBIWDEF int stbi_write_png_filter_search;
 #endif
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -192,6 +216,19 @@ STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int w,
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const float *data);
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, int quality);
 
+// indexed-color PNG: 1 byte per pixel into palette_size (1..256) RGBA entries;
+// returns a STBIW_MALLOC'd buffer, or NULL on failure
+STBIWDEF unsigned char *stbi_write_png_indexed_to_mem(const unsigned char *indices, int stride_bytes, int x, int y, const unsigned char *palette, int palette_size, int *out_len);
+STBIWDEF int stbi_write_png_indexed_to_func(stbi_write_func *func, void *context, int x, int y, const unsigned char *palette, int palette_size, const void *indices, int stride_bytes);
+
+// PNG whose rows are produced on demand instead of read from one buffer:
+// rows(row_context, j, buffer) returns row j (x*comp bytes, or x palette
+// indices when palette != NULL). it may return a pointer to its own memory or
+// fill the x*comp byte buffer passed in; the returned row must stay valid
+// until the following row has been requested (it is the filter's prior row)
+typedef const unsigned char *stbi_write_row_func(void *context, int y, unsigned char *buffer);
+STBIWDEF int stbi_write_png_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context, const unsigned char *palette, int palette_size);
+
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #endif//INCLUDE_STB_IMAGE_WRITE_H
@@ -251,10 +288,12 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 static int stbi_write_png_compression_level = 8;
 static int stbi_write_tga_with_rle = 1;
 static int stbi_write_force_png_filter = -1;
+static int stbi_write_png_filter_search = 0;
 #else
 int stbi_write_png_compression_level = 8;
 int stbi_write_tga_with_rle = 1;
 int stbi_write_force_png_filter = -1;
+int stbi_write_png_filter_search = 0;
 #endif
 
 static int stbi__flip_vertically_on_write = 0;
@@ -809,7 +848,6 @@ STBIWDEF int stbi_write_hdr(char const *filename, int x, int y, int comp, const
 // PNG writer
 //
 
-#ifndef STBIW_ZLIB_COMPRESS
 // stretchy buffer; stbiw__sbpush() == vector<>::push_back() -- stbiw__sbcount() == vector<>::size()
 #define stbiw__sbraw(a) ((int *) (void *) (a) - 2)
 #define stbiw__sbm(a)   stbiw__sbraw(a)[0]
@@ -890,14 +928,10 @@ static unsigned int stbiw__zhash(unsigned char *data)
 
 #define stbiw__ZHASH   16384
 
-#endif // STBIW_ZLIB_COMPRESS
-
-STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+// compiled even when STBIW_ZLIB_COMPRESS is defined, so the custom function
+// can fall back to it
+STBIWDEF unsigned char * stbi_zlib_compress_builtin(unsigned char *data, int data_len, int *out_len, int quality)
 {
-#ifdef STBIW_ZLIB_COMPRESS
-   // user provided a zlib compress implementation, use that
-   return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
-#else // use builtin
    static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
    static unsigned char  lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
    static unsigned short distc[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
@@ -1000,6 +1034,10 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
 
    {
       // compute adler32 on input
+#ifdef STBIW_ADLER32
+      unsigned int adler = STBIW_ADLER32(data, data_len);
+      unsigned int s1 = adler & 0xffff, s2 = adler >> 16;
+#else
       unsigned int s1=1, s2=0;
       int blocklen = (int) (data_len % 5552);
       j=0;
@@ -1009,6 +1047,7 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
          j += blocklen;
          blocklen = 5552;
       }
+#endif
       stbiw__sbpush(out, STBIW_UCHAR(s2 >> 8));
       stbiw__sbpush(out, STBIW_UCHAR(s2));
       stbiw__sbpush(out, STBIW_UCHAR(s1 >> 8));
@@ -1018,6 +1057,15 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
    // make returned pointer freeable
    STBIW_MEMMOVE(stbiw__sbraw(out), out, *out_len);
    return (unsigned char *) stbiw__sbraw(out);
+}
+
+STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+{
+#ifdef STBIW_ZLIB_COMPRESS
+   // user provided a zlib compress implementation, use that
+   return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
+#else // use builtin
+   return stbi_zlib_compress_builtin(data, data_len, out_len, quality);
 #endif // STBIW_ZLIB_COMPRESS
 }
 
@@ -1089,15 +1137,14 @@ static unsigned char stbiw__paeth(int a, int b, int c)
 }
 
 // @OPTIMIZE: provide an option that always forces left-predict or paeth predict
-static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int width, int height, int y, int n, int filter_type, signed char *line_buffer)
+// z is the row being encoded, prior the row above it (NULL for the first row)
+static void stbiw__encode_png_line(const unsigned char *z, const unsigned char *prior, int width, int n, int filter_type, signed char *line_buffer)
 {
    static int mapping[] = { 0,1,2,3,4 };
    static int firstmap[] = { 0,1,0,5,6 };
-   int *mymap = (y != 0) ? mapping : firstmap;
+   int *mymap = prior ? mapping : firstmap;
    int i;
    int type = mymap[filter_type];
-   unsigned char *z = pixels + stride_bytes * (stbi__flip_vertically_on_write ? height-1-y : y);
-   int signed_stride = stbi__flip_vertically_on_write ? -stride_bytes : stride_bytes;
 
    if (type==0) {
       memcpy(line_buffer, z, width*n);
@@ -1108,93 +1155,306 @@ static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int
    for (i = 0; i < n; ++i) {
       switch (type) {
          case 1: line_buffer[i] = z[i]; break;
-         case 2: line_buffer[i] = z[i] - z[i-signed_stride]; break;
-         case 3: line_buffer[i] = z[i] - (z[i-signed_stride]>>1); break;
-         case 4: line_buffer[i] = (signed char) (z[i] - stbiw__paeth(0,z[i-signed_stride],0)); break;
+         case 2: line_buffer[i] = z[i] - prior[i]; break;
+         case 3: line_buffer[i] = z[i] - (prior[i]>>1); break;
+         case 4: line_buffer[i] = (signed char) (z[i] - stbiw__paeth(0,prior[i],0)); break;
          case 5: line_buffer[i] = z[i]; break;
          case 6: line_buffer[i] = z[i]; break;
       }
    }
    switch (type) {
       case 1: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - z[i-n]; break;
-      case 2: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - z[i-signed_stride]; break;
-      case 3: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - ((z[i-n] + z[i-signed_stride])>>1); break;
-      case 4: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - stbiw__paeth(z[i-n], z[i-signed_stride], z[i-signed_stride-n]); break;
+      case 2: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - prior[i]; break;
+      case 3: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - ((z[i-n] + prior[i])>>1); break;
+      case 4: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - stbiw__paeth(z[i-n], prior[i], prior[i-n]); break;
       case 5: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - (z[i-n]>>1); break;
       case 6: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - stbiw__paeth(z[i-n], 0,0); break;
    }
 }
 
-STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+// row source for images held in one buffer
+typedef struct
+{
+   const unsigned char *pixels;
+   int stride_bytes, height;
+} stbiw__png_mem_rows;
+
+static const unsigned char *stbiw__png_mem_row(void *context, int y, unsigned char *buffer)
+{
+   stbiw__png_mem_rows *m = (stbiw__png_mem_rows *) context;
+   (void) buffer;
+   return m->pixels + (size_t) m->stride_bytes * (stbi__flip_vertically_on_write ? m->height-1-y : y);
+}
+
+// runs every filter over one row and keeps the one the heuristic prefers:
+// the smallest sum of |residual| (minsum) or the smallest byte entropy.
+// returns the filter type; line_buffer holds the filtered row
+static int stbiw__png_pick_filter(const unsigned char *z, const unsigned char *prior, int x, int n, int minsum, signed char *line_buffer)
+{
+   int filter_type, best_filter = 0, i;
+   double best_filter_val = 0, est;
+   for (filter_type = 0; filter_type < 5; filter_type++) {
+      stbiw__encode_png_line(z, prior, x, n, filter_type, line_buffer);
+
+      // Estimate the entropy of the line using this filter; the less, the better.
+      est = 0;
+      if (minsum) {
+         int sum = 0;
+         for (i = 0; i < x*n; ++i) {
+            sum += abs((signed char) line_buffer[i]);
+         }
+         est = sum;
+      } else {
+         // x*n*entropy = x*n*log(x*n) - sum(c*log(c)); the first term is the same for every filter
+         int hist[256];
+         memset(hist, 0, sizeof(hist));
+         for (i = 0; i < x*n; ++i) hist[(unsigned char) line_buffer[i]]++;
+         for (i = 0; i < 256; ++i)
+            if (hist[i] > 1) est -= hist[i] * log((double) hist[i]);
+      }
+      if (filter_type == 0 || est < best_filter_val) {
+         best_filter_val = est;
+         best_filter = filter_type;
+      }
+   }
+   if (best_filter != 4)  // the last iteration already left filter 4 in line_buffer
+      stbiw__encode_png_line(z, prior, x, n, best_filter, line_buffer);
+   return best_filter;
+}
+
+// stbi_write_png_filter_search: band height and the strategies tried per band.
+// strategies 0..4 use that filter on every row of the band
+#define STBIW__PNG_BAND_ROWS        16
+#define STBIW__PNG_STRATEGY_MINSUM  5
+#define STBIW__PNG_STRATEGY_ENTROPY 6
+#define STBIW__PNG_STRATEGIES       7
+#define STBIW__BAND_HASH            4096
+
+// filters 'count' rows stored one after another at band + x*n (the row before
+// them, if has_prior, at band) into 'count' PNG scanlines at out
+static void stbiw__png_filter_band(const unsigned char *band, int has_prior, int count, int x, int n, int strategy, unsigned char *out, signed char *line_buffer)
+{
+   int r, filter_type;
+   for (r = 0; r < count; ++r) {
+      const unsigned char *z = band + (size_t) (r+1) * x*n;
+      const unsigned char *prior = (r > 0 || has_prior) ? z - x*n : NULL;
+      if (strategy < 5) {
+         filter_type = strategy;
+         stbiw__encode_png_line(z, prior, x, n, filter_type, line_buffer);
+      } else {
+         filter_type = stbiw__png_pick_filter(z, prior, x, n, strategy == STBIW__PNG_STRATEGY_MINSUM, line_buffer);
+      }
+      out[(size_t) r*(x*n+1)] = (unsigned char) filter_type;
+      STBIW_MEMMOVE(out + (size_t) r*(x*n+1) + 1, line_buffer, x*n);
+   }
+}
+
+// estimated deflated size of a band in bits: greedy LZ77 (short hash chains)
+// plus the Shannon size of the literals and matches it emits. it only has to
+// rank the strategies of one band, and needs no allocation per call: head has
+// STBIW__BAND_HASH entries, prev one entry per byte of data
+static double stbiw__png_band_cost(unsigned char *data, int len, int *head, int *prev)
+{
+   int hist[256], matches = 0, i = 0, j;
+   double bits = 0, total;
+   memset(hist, 0, sizeof(hist));
+   for (j = 0; j < STBIW__BAND_HASH; ++j) head[j] = -1;
+   while (i < len) {
+      int best = 0, dist = 0;
+      if (i + 3 <= len) {
+         int h = stbiw__zhash(data+i) & (STBIW__BAND_HASH-1), p = head[h], chain = 8;
+         int limit = len - i < 258 ? len - i : 258;
+         for (; p >= 0 && i - p <= 32768 && chain > 0; p = prev[p], --chain) {
+            int m = stbiw__zlib_countm(data+p, data+i, limit);
+            if (m > best) { best = m; dist = i - p; }
+         }
+         prev[i] = head[h];
+         head[h] = i;
+      }
+      if (best >= 3) {
+         // make the skipped positions reachable for later matches
+         for (j = 1; j < best && i+j+3 <= len; ++j) {
+            int h = stbiw__zhash(data+i+j) & (STBIW__BAND_HASH-1);
+            prev[i+j] = head[h];
+            head[h] = i+j;
+         }
+         // length and distance cost roughly their extra bits plus a short code each
+         bits += log((double) best) * 1.4427 + log((double) dist) * 1.4427 + 4;
+         ++matches;
+         i += best;
+      } else {
+         hist[data[i]]++;
+         ++i;
+      }
+   }
+   total = matches;
+   for (j = 0; j < 256; ++j) total += hist[j];
+   for (j = 0; j < 256; ++j)
+      if (hist[j]) bits += hist[j] * log(total / hist[j]) * 1.4427;
+   if (matches) bits += matches * log(total / matches) * 1.4427;
+   return bits;
+}
+
+// stbi_write_png_filter_search: fills filt band by band with the cheapest strategy
+static int stbiw__png_filter_search(stbi_write_row_func *rows, void *row_context, int x, int y, int n, unsigned char *filt, unsigned char *row_buffer, signed char *line_buffer)
+{
+   int stride = x*n+1, j, r, s;
+   // the row before the band, then the band itself
+   unsigned char *band = (unsigned char *) STBIW_MALLOC((size_t) (STBIW__PNG_BAND_ROWS+1) * x*n);
+   unsigned char *cand = (unsigned char *) STBIW_MALLOC((size_t) STBIW__PNG_BAND_ROWS * stride);
+   int *head = (int *) STBIW_MALLOC(STBIW__BAND_HASH * sizeof(int));
+   int *prev = (int *) STBIW_MALLOC((size_t) STBIW__PNG_BAND_ROWS * stride * sizeof(int));
+   int ok = band && cand && head && prev;
+   for (j = 0; ok && j < y; j += STBIW__PNG_BAND_ROWS) {
+      int count = y - j < STBIW__PNG_BAND_ROWS ? y - j : STBIW__PNG_BAND_ROWS, best_strategy = 0;
+      double best_cost = 0;
+      for (r = 0; r < count; ++r)
+         memcpy(band + (size_t) (r+1) * x*n, rows(row_context, j+r, row_buffer), x*n);
+      for (s = 0; s < STBIW__PNG_STRATEGIES; ++s) {
+         double cost;
+         stbiw__png_filter_band(band, j > 0, count, x, n, s, cand, line_buffer);
+         cost = stbiw__png_band_cost(cand, count * stride, head, prev);
+         if (s == 0 || cost < best_cost) {
+            best_cost = cost;
+            best_strategy = s;
+         }
+      }
+      stbiw__png_filter_band(band, j > 0, count, x, n, best_strategy, filt + (size_t) j * stride, line_buffer);
+      // the band's last row is the prior row of the next band
+      memcpy(band, band + (size_t) count * x*n, x*n);
+   }
+   STBIW_FREE(prev);
+   STBIW_FREE(head);
+   STBIW_FREE(cand);
+   STBIW_FREE(band);
+   return ok;
+}
+
+// filters every row and deflates the result; returns a STBIW_MALLOC'd zlib
+// stream. indexed images (1-byte palette indices) are never filtered unless
+// stbi_write_png_filter_search finds filtering smaller
+static unsigned char *stbiw__png_filter_compress(stbi_write_row_func *rows, void *row_context, int x, int y, int n, int indexed, int *zlen)
 {
    int force_filter = stbi_write_force_png_filter;
-   int ctype[5] = { -1, 0, 4, 2, 6 };
-   unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
-   unsigned char *out,*o, *filt, *zlib;
+   unsigned char *filt, *zlib, *row_buffer;
+   const unsigned char *z, *prior = NULL;
    signed char *line_buffer;
-   int j,zlen;
-
-   if (stride_bytes == 0)
-      stride_bytes = x * n;
+   int j;
 
    if (force_filter >= 5) {
       force_filter = -1;
    }
 
+   // filtering index bytes only scrambles them; the PNG spec recommends filter 0
+   if (indexed && !stbi_write_png_filter_search) force_filter = 0;
+
    filt = (unsigned char *) STBIW_MALLOC((x*n+1) * y); if (!filt) return 0;
    line_buffer = (signed char *) STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
-   for (j=0; j < y; ++j) {
-      int filter_type;
-      if (force_filter > -1) {
-         filter_type = force_filter;
-         stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, force_filter, line_buffer);
-      } else { // Estimate the best filter by running through all of them:
-         int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
-         for (filter_type = 0; filter_type < 5; filter_type++) {
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, filter_type, line_buffer);
-
-            // Estimate the entropy of the line using this filter; the less, the better.
-            est = 0;
-            for (i = 0; i < x*n; ++i) {
-               est += abs((signed char) line_buffer[i]);
-            }
-            if (est < best_filter_val) {
-               best_filter_val = est;
-               best_filter = filter_type;
-            }
-         }
-         if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, best_filter, line_buffer);
-            filter_type = best_filter;
+   // two row buffers, so a row built by the row source survives as the prior row
+   row_buffer = (unsigned char *) STBIW_MALLOC(2 * x * n); if (!row_buffer) { STBIW_FREE(line_buffer); STBIW_FREE(filt); return 0; }
+   if (stbi_write_png_filter_search && force_filter < 0) {
+      if (!stbiw__png_filter_search(rows, row_context, x, y, n, filt, row_buffer, line_buffer)) {
+         STBIW_FREE(row_buffer); STBIW_FREE(line_buffer); STBIW_FREE(filt);
+         return 0;
+      }
+   } else {
+      for (j=0; j < y; ++j) {
+         int filter_type;
+         z = rows(row_context, j, row_buffer + (j & 1) * x * n);
+         if (force_filter > -1) {
+            filter_type = force_filter;
+            stbiw__encode_png_line(z, prior, x, n, force_filter, line_buffer);
+         } else { // Estimate the best filter by running through all of them:
+            filter_type = stbiw__png_pick_filter(z, prior, x, n, 1, line_buffer);
          }
+         // when we get here, filter_type contains the filter type, and line_buffer contains the data
+         filt[j*(x*n+1)] = (unsigned char) filter_type;
+         STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
+         prior = z;
       }
-      // when we get here, filter_type contains the filter type, and line_buffer contains the data
-      filt[j*(x*n+1)] = (unsigned char) filter_type;
-      STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
    }
+   STBIW_FREE(row_buffer);
    STBIW_FREE(line_buffer);
-   zlib = stbi_zlib_compress(filt, y*( x*n+1), &zlen, stbi_write_png_compression_level);
+   zlib = stbi_zlib_compress(filt, y*( x*n+1), zlen, stbi_write_png_compression_level);
    STBIW_FREE(filt);
-   if (!zlib) return 0;
+   return zlib;
+}
 
-   // each tag requires 12 bytes of overhead
-   out = (unsigned char *) STBIW_MALLOC(8 + 12+13 + 12+zlen + 12);
-   if (!out) return 0;
-   *out_len = 8 + 12+13 + 12+zlen + 12;
+// largest signature + IHDR + PLTE + tRNS block written by stbiw__png_header
+#define STBIW__PNG_HEADER_MAX (8 + 12+13 + 12+256*3 + 12+256)
+
+// writes everything that precedes IDAT; returns the byte count. palette !=
+// NULL writes an indexed (color type 3) image: pixels are 1-byte indices into
+// palette_size RGBA entries, emitted as PLTE plus a tRNS chunk that is trimmed
+// after the last non-opaque entry
+static int stbiw__png_header(unsigned char *out, int x, int y, int n, const unsigned char *palette, int palette_size)
+{
+   int ctype[5] = { -1, 0, 4, 2, 6 };
+   unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
+   unsigned char *o = out;
+   int j, plte_len = palette_size * 3, trns_len = 0;
 
-   o=out;
    STBIW_MEMMOVE(o,sig,8); o+= 8;
    stbiw__wp32(o, 13); // header length
    stbiw__wptag(o, "IHDR");
    stbiw__wp32(o, x);
    stbiw__wp32(o, y);
    *o++ = 8;
-   *o++ = STBIW_UCHAR(ctype[n]);
+   *o++ = STBIW_UCHAR(palette ? 3 : ctype[n]);
    *o++ = 0;
    *o++ = 0;
    *o++ = 0;
    stbiw__wpcrc(&o,13);
 
+   if (palette) {
+      for (j=0; j < palette_size; ++j)
+         if (palette[j*4+3] != 255) trns_len = j+1;
+      stbiw__wp32(o, plte_len);
+      stbiw__wptag(o, "PLTE");
+      for (j=0; j < palette_size; ++j) {
+         *o++ = palette[j*4+0];
+         *o++ = palette[j*4+1];
+         *o++ = palette[j*4+2];
+      }
+      stbiw__wpcrc(&o, plte_len);
+      if (trns_len) {
+         stbiw__wp32(o, trns_len);
+         stbiw__wptag(o, "tRNS");
+         for (j=0; j < trns_len; ++j)
+            *o++ = palette[j*4+3];
+         stbiw__wpcrc(&o, trns_len);
+      }
+   }
+   return (int) (o - out);
+}
+
+static unsigned char *stbiw__write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, const unsigned char *palette, int palette_size, int *out_len)
+{
+   unsigned char header[STBIW__PNG_HEADER_MAX];
+   unsigned char *out,*o, *zlib;
+   int zlen, header_len;
+
+   stbiw__png_mem_rows m;
+
+   if (stride_bytes == 0)
+      stride_bytes = x * n;
+   m.pixels = pixels;
+   m.stride_bytes = stride_bytes;
+   m.height = y;
+
+   zlib = stbiw__png_filter_compress(stbiw__png_mem_row, &m, x, y, n, palette != NULL, &zlen);
+   if (!zlib) return 0;
+
+   header_len = stbiw__png_header(header, x, y, n, palette, palette_size);
+
+   // each tag requires 12 bytes of overhead
+   *out_len = header_len + 12+zlen + 12;
+   out = (unsigned char *) STBIW_MALLOC(*out_len);
+   if (!out) { STBIW_FREE(zlib); return 0; }
+
+   o=out;
+   STBIW_MEMMOVE(o, header, header_len); o += header_len;
+
    stbiw__wp32(o, zlen);
    stbiw__wptag(o, "IDAT");
    STBIW_MEMMOVE(o, zlib, zlen);
@@ -1211,6 +1471,179 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
    return out;
 }
 
+// IDAT payload per chunk when streaming to a write func
+#define STBIW__PNG_IDAT_CHUNK 65536
+
+// largest LEN of a deflate stored block
+#define STBIW__STORED_BLOCK 65535
+// chunk length + tag, zlib header, stored block header
+#define STBIW__STORED_DATA (8 + 2 + 5)
+
+static unsigned int stbiw__adler32_update(unsigned int adler, unsigned char *data, int len)
+{
+#ifdef STBIW_ADLER32_UPDATE
+   return STBIW_ADLER32_UPDATE(adler, data, len);
+#else
+   unsigned int s1 = adler & 0xffff, s2 = adler >> 16;
+   while (len > 0) {
+      int i, blocklen = len < 5552 ? len : 5552;
+      for (i=0; i < blocklen; ++i) { s1 += data[i]; s2 += s1; }
+      s1 %= 65521; s2 %= 65521;
+      data += blocklen;
+      len -= blocklen;
+   }
+   return (s2 << 16) | s1;
+#endif
+}
+
+// level 0 output: one IDAT chunk per stored block, the block data is copied
+// into place right behind the chunk and block headers
+typedef struct
+{
+   stbi_write_func *func;
+   void *context;
+   unsigned char *chunk; // STBIW__STORED_DATA + block + adler + crc
+   int fill;             // bytes in the current block
+   size_t left;          // bytes not yet flushed, including the current block
+   unsigned int adler;
+   int first;
+} stbiw__png_stored;
+
+static void stbiw__png_stored_flush(stbiw__png_stored *s)
+{
+   // the first chunk carries the zlib header; later ones start 2 bytes in
+   unsigned char *start = s->first ? s->chunk : s->chunk + 2;
+   unsigned char *o = start;
+   unsigned char *data = s->chunk + STBIW__STORED_DATA;
+   int final = s->left == (size_t) s->fill;
+   int len = (s->first ? 2 : 0) + 5 + s->fill + (final ? 4 : 0);
+
+   stbiw__wp32(o, len);
+   stbiw__wptag(o, "IDAT");
+   if (s->first) {
+      *o++ = 0x78; // DEFLATE 32K window
+      *o++ = 0x01; // FLEVEL = 0
+   }
+   *o++ = STBIW_UCHAR(final); // BFINAL = ?, BTYPE = 0 -- no compression
+   *o++ = STBIW_UCHAR(s->fill); // LEN
+   *o++ = STBIW_UCHAR(s->fill >> 8);
+   *o++ = STBIW_UCHAR(~s->fill); // NLEN
+   *o++ = STBIW_UCHAR(~s->fill >> 8);
+   s->adler = stbiw__adler32_update(s->adler, data, s->fill);
+   o += s->fill;
+   if (final) {
+      *o++ = STBIW_UCHAR(s->adler >> 24);
+      *o++ = STBIW_UCHAR(s->adler >> 16);
+      *o++ = STBIW_UCHAR(s->adler >> 8);
+      *o++ = STBIW_UCHAR(s->adler);
+   }
+   stbiw__wpcrc(&o, len);
+   s->func(s->context, start, (int) (o - start));
+
+   s->left -= s->fill;
+   s->fill = 0;
+   s->first = 0;
+}
+
+static void stbiw__png_stored_put(stbiw__png_stored *s, const unsigned char *data, int len)
+{
+   while (len > 0) {
+      int n = STBIW__STORED_BLOCK - s->fill;
+      if (n > len) n = len;
+      STBIW_MEMMOVE(s->chunk + STBIW__STORED_DATA + s->fill, data, n);
+      s->fill += n;
+      data += n;
+      len -= n;
+      if (s->fill == STBIW__STORED_BLOCK) stbiw__png_stored_flush(s);
+   }
+}
+
+static int stbiw__write_png_stored_to_func(stbi_write_func *func, void *context, stbi_write_row_func *rows, void *row_context, int x, int y, int n, const unsigned char *palette, int palette_size)
+{
+   unsigned char header[STBIW__PNG_HEADER_MAX];
+   unsigned char filter = 0, *row_buffer, *o;
+   stbiw__png_stored s;
+   int j;
+
+   s.chunk = (unsigned char *) STBIW_MALLOC(STBIW__STORED_DATA + STBIW__STORED_BLOCK + 4 + 4);
+   if (!s.chunk) return 0;
+   row_buffer = (unsigned char *) STBIW_MALLOC(x * n);
+   if (!row_buffer) { STBIW_FREE(s.chunk); return 0; }
+   s.func = func;
+   s.context = context;
+   s.fill = 0;
+   s.left = (size_t) y * (x*n+1);
+   s.adler = 1;
+   s.first = 1;
+
+   func(context, header, stbiw__png_header(header, x, y, n, palette, palette_size));
+   for (j=0; j < y; ++j) {
+      stbiw__png_stored_put(&s, &filter, 1);
+      stbiw__png_stored_put(&s, rows(row_context, j, row_buffer), x*n);
+   }
+   if (s.fill > 0) stbiw__png_stored_flush(&s);
+   STBIW_FREE(row_buffer);
+   STBIW_FREE(s.chunk);
+
+   o = header;
+   stbiw__wp32(o,0);
+   stbiw__wptag(o, "IEND");
+   stbiw__wpcrc(&o,0);
+   func(context, header, 12);
+   return 1;
+}
+
+// same bytes as the _to_mem path except that the zlib stream is split across
+// IDAT chunks of at most STBIW__PNG_IDAT_CHUNK bytes, so the complete file is
+// never assembled in memory: peak usage is the zlib stream plus one chunk
+static int stbiw__write_png_to_func(stbi_write_func *func, void *context, stbi_write_row_func *rows, void *row_context, int x, int y, int n, const unsigned char *palette, int palette_size)
+{
+   unsigned char header[STBIW__PNG_HEADER_MAX];
+   unsigned char *zlib, *chunk, *o;
+   int zlen, pos, len;
+
+   if (stbi_write_png_compression_level == 0)
+      return stbiw__write_png_stored_to_func(func, context, rows, row_context, x, y, n, palette, palette_size);
+
+   zlib = stbiw__png_filter_compress(rows, row_context, x, y, n, palette != NULL, &zlen);
+   if (!zlib) return 0;
+   chunk = (unsigned char *) STBIW_MALLOC(12 + STBIW__PNG_IDAT_CHUNK);
+   if (!chunk) { STBIW_FREE(zlib); return 0; }
+
+   func(context, header, stbiw__png_header(header, x, y, n, palette, palette_size));
+
+   for (pos = 0; pos < zlen; pos += len) {
+      len = zlen - pos < STBIW__PNG_IDAT_CHUNK ? zlen - pos : STBIW__PNG_IDAT_CHUNK;
+      o = chunk;
+      stbiw__wp32(o, len);
+      stbiw__wptag(o, "IDAT");
+      STBIW_MEMMOVE(o, zlib + pos, len);
+      o += len;
+      stbiw__wpcrc(&o, len);
+      func(context, chunk, 12 + len);
+   }
+   STBIW_FREE(chunk);
+   STBIW_FREE(zlib);
+
+   o = header;
+   stbiw__wp32(o,0);
+   stbiw__wptag(o, "IEND");
+   stbiw__wpcrc(&o,0);
+   func(context, header, 12);
+   return 1;
+}
+
+STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+{
+   return stbiw__write_png_to_mem(pixels, stride_bytes, x, y, n, NULL, 0, out_len);
+}
+
+STBIWDEF unsigned char *stbi_write_png_indexed_to_mem(const unsigned char *indices, int stride_bytes, int x, int y, const unsigned char *palette, int palette_size, int *out_len)
+{
+   if (!palette || palette_size < 1 || palette_size > 256) return NULL;
+   return stbiw__write_png_to_mem(indices, stride_bytes, x, y, 1, palette, palette_size, out_len);
+}
+
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_png(char const *filename, int x, int y, int comp, const void *data, int stride_bytes)
 {
@@ -1230,12 +1663,27 @@ STBIWDEF int stbi_write_png(char const *filename, int x, int y, int comp, const
 
 STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_bytes)
 {
-   int len;
-   unsigned char *png = stbi_write_png_to_mem((const unsigned char *) data, stride_bytes, x, y, comp, &len);
-   if (png == NULL) return 0;
-   func(context, png, len);
-   STBIW_FREE(png);
-   return 1;
+   stbiw__png_mem_rows m;
+   m.pixels = (const unsigned char *) data;
+   m.stride_bytes = stride_bytes ? stride_bytes : x * comp;
+   m.height = y;
+   return stbiw__write_png_to_func(func, context, stbiw__png_mem_row, &m, x, y, comp, NULL, 0);
+}
+
+STBIWDEF int stbi_write_png_indexed_to_func(stbi_write_func *func, void *context, int x, int y, const unsigned char *palette, int palette_size, const void *indices, int stride_bytes)
+{
+   stbiw__png_mem_rows m;
+   if (!palette || palette_size < 1 || palette_size > 256) return 0;
+   m.pixels = (const unsigned char *) indices;
+   m.stride_bytes = stride_bytes ? stride_bytes : x;
+   m.height = y;
+   return stbiw__write_png_to_func(func, context, stbiw__png_mem_row, &m, x, y, 1, palette, palette_size);
+}
+
+STBIWDEF int stbi_write_png_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context, const unsigned char *palette, int palette_size)
+{
+   if (palette && (palette_size < 1 || palette_size > 256 || comp != 1)) return 0;
+   return stbiw__write_png_to_func(func, context, rows, row_context, x, y, comp, palette, palette_size);
 }
 
 
@@ -1254,11 +1702,13 @@ static void stbiw__jpg_writeBits(stbi__write_context *s, int *bitBufP, int *bitC
    int bitBuf = *bitBufP, bitCnt = *bitCntP;
    bitCnt += bs[1];
    bitBuf |= bs[0] << (24 - bitCnt);
+   // entropy-coded bytes go through the small write buffer instead of one
+   // callback per byte; stbi_write_jpg_core flushes it before the EOI marker
    while(bitCnt >= 8) {
       unsigned char c = (bitBuf >> 16) & 255;
-      stbiw__putc(s, c);
+      stbiw__write1(s, c);
       if(c == 255) {
-         stbiw__putc(s, 0);
+         stbiw__write1(s, 0);
       }
       bitBuf <<= 8;
       bitCnt -= 8;
@@ -1395,71 +1845,74 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
    return DU[0];
 }
 
+// standard Huffman tables (ITU T.81 Annex K.3); nrcodes[0] is padding, the DHT
+// segment takes nrcodes+1
+static const unsigned char stbiw__jpg_std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
+static const unsigned char stbiw__jpg_std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
+static const unsigned char stbiw__jpg_std_ac_luminance_nrcodes[] = {0,0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d};
+static const unsigned char stbiw__jpg_std_ac_luminance_values[] = {
+   0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
+   0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+   0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
+   0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+   0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
+   0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+   0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
+};
+static const unsigned char stbiw__jpg_std_dc_chrominance_nrcodes[] = {0,0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0};
+static const unsigned char stbiw__jpg_std_dc_chrominance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
+static const unsigned char stbiw__jpg_std_ac_chrominance_nrcodes[] = {0,0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77};
+static const unsigned char stbiw__jpg_std_ac_chrominance_values[] = {
+   0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
+   0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+   0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
+   0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+   0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
+   0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+   0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
+};
+// Huffman codes {code, length}, indexed by (run<<4)|size
+static const unsigned short stbiw__jpg_YDC_HT[256][2] = { {0,2},{2,3},{3,3},{4,3},{5,3},{6,3},{14,4},{30,5},{62,6},{126,7},{254,8},{510,9}};
+static const unsigned short stbiw__jpg_UVDC_HT[256][2] = { {0,2},{1,2},{2,2},{6,3},{14,4},{30,5},{62,6},{126,7},{254,8},{510,9},{1022,10},{2046,11}};
+static const unsigned short stbiw__jpg_YAC_HT[256][2] = {
+   {10,4},{0,2},{1,2},{4,3},{11,4},{26,5},{120,7},{248,8},{1014,10},{65410,16},{65411,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {12,4},{27,5},{121,7},{502,9},{2038,11},{65412,16},{65413,16},{65414,16},{65415,16},{65416,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {28,5},{249,8},{1015,10},{4084,12},{65417,16},{65418,16},{65419,16},{65420,16},{65421,16},{65422,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {58,6},{503,9},{4085,12},{65423,16},{65424,16},{65425,16},{65426,16},{65427,16},{65428,16},{65429,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {59,6},{1016,10},{65430,16},{65431,16},{65432,16},{65433,16},{65434,16},{65435,16},{65436,16},{65437,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {122,7},{2039,11},{65438,16},{65439,16},{65440,16},{65441,16},{65442,16},{65443,16},{65444,16},{65445,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {123,7},{4086,12},{65446,16},{65447,16},{65448,16},{65449,16},{65450,16},{65451,16},{65452,16},{65453,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {250,8},{4087,12},{65454,16},{65455,16},{65456,16},{65457,16},{65458,16},{65459,16},{65460,16},{65461,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {504,9},{32704,15},{65462,16},{65463,16},{65464,16},{65465,16},{65466,16},{65467,16},{65468,16},{65469,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {505,9},{65470,16},{65471,16},{65472,16},{65473,16},{65474,16},{65475,16},{65476,16},{65477,16},{65478,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {506,9},{65479,16},{65480,16},{65481,16},{65482,16},{65483,16},{65484,16},{65485,16},{65486,16},{65487,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {1017,10},{65488,16},{65489,16},{65490,16},{65491,16},{65492,16},{65493,16},{65494,16},{65495,16},{65496,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {1018,10},{65497,16},{65498,16},{65499,16},{65500,16},{65501,16},{65502,16},{65503,16},{65504,16},{65505,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {2040,11},{65506,16},{65507,16},{65508,16},{65509,16},{65510,16},{65511,16},{65512,16},{65513,16},{65514,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {65515,16},{65516,16},{65517,16},{65518,16},{65519,16},{65520,16},{65521,16},{65522,16},{65523,16},{65524,16},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {2041,11},{65525,16},{65526,16},{65527,16},{65528,16},{65529,16},{65530,16},{65531,16},{65532,16},{65533,16},{65534,16},{0,0},{0,0},{0,0},{0,0},{0,0}
+};
+static const unsigned short stbiw__jpg_UVAC_HT[256][2] = {
+   {0,2},{1,2},{4,3},{10,4},{24,5},{25,5},{56,6},{120,7},{500,9},{1014,10},{4084,12},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {11,4},{57,6},{246,8},{501,9},{2038,11},{4085,12},{65416,16},{65417,16},{65418,16},{65419,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {26,5},{247,8},{1015,10},{4086,12},{32706,15},{65420,16},{65421,16},{65422,16},{65423,16},{65424,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {27,5},{248,8},{1016,10},{4087,12},{65425,16},{65426,16},{65427,16},{65428,16},{65429,16},{65430,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {58,6},{502,9},{65431,16},{65432,16},{65433,16},{65434,16},{65435,16},{65436,16},{65437,16},{65438,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {59,6},{1017,10},{65439,16},{65440,16},{65441,16},{65442,16},{65443,16},{65444,16},{65445,16},{65446,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {121,7},{2039,11},{65447,16},{65448,16},{65449,16},{65450,16},{65451,16},{65452,16},{65453,16},{65454,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {122,7},{2040,11},{65455,16},{65456,16},{65457,16},{65458,16},{65459,16},{65460,16},{65461,16},{65462,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {249,8},{65463,16},{65464,16},{65465,16},{65466,16},{65467,16},{65468,16},{65469,16},{65470,16},{65471,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {503,9},{65472,16},{65473,16},{65474,16},{65475,16},{65476,16},{65477,16},{65478,16},{65479,16},{65480,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {504,9},{65481,16},{65482,16},{65483,16},{65484,16},{65485,16},{65486,16},{65487,16},{65488,16},{65489,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {505,9},{65490,16},{65491,16},{65492,16},{65493,16},{65494,16},{65495,16},{65496,16},{65497,16},{65498,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {506,9},{65499,16},{65500,16},{65501,16},{65502,16},{65503,16},{65504,16},{65505,16},{65506,16},{65507,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {2041,11},{65508,16},{65509,16},{65510,16},{65511,16},{65512,16},{65513,16},{65514,16},{65515,16},{65516,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {16352,14},{65517,16},{65518,16},{65519,16},{65520,16},{65521,16},{65522,16},{65523,16},{65524,16},{65525,16},{0,0},{0,0},{0,0},{0,0},{0,0},
+   {1018,10},{32707,15},{65526,16},{65527,16},{65528,16},{65529,16},{65530,16},{65531,16},{65532,16},{65533,16},{65534,16},{0,0},{0,0},{0,0},{0,0},{0,0}
+};
+
 static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
    // Constants that don't pollute global namespace
-   static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
-   static const unsigned char std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
-   static const unsigned char std_ac_luminance_nrcodes[] = {0,0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d};
-   static const unsigned char std_ac_luminance_values[] = {
-      0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
-      0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
-      0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
-      0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
-      0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
-      0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
-      0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
-   };
-   static const unsigned char std_dc_chrominance_nrcodes[] = {0,0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0};
-   static const unsigned char std_dc_chrominance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
-   static const unsigned char std_ac_chrominance_nrcodes[] = {0,0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77};
-   static const unsigned char std_ac_chrominance_values[] = {
-      0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
-      0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
-      0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
-      0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
-      0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
-      0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
-      0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa
-   };
-   // Huffman tables
-   static const unsigned short YDC_HT[256][2] = { {0,2},{2,3},{3,3},{4,3},{5,3},{6,3},{14,4},{30,5},{62,6},{126,7},{254,8},{510,9}};
-   static const unsigned short UVDC_HT[256][2] = { {0,2},{1,2},{2,2},{6,3},{14,4},{30,5},{62,6},{126,7},{254,8},{510,9},{1022,10},{2046,11}};
-   static const unsigned short YAC_HT[256][2] = {
-      {10,4},{0,2},{1,2},{4,3},{11,4},{26,5},{120,7},{248,8},{1014,10},{65410,16},{65411,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {12,4},{27,5},{121,7},{502,9},{2038,11},{65412,16},{65413,16},{65414,16},{65415,16},{65416,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {28,5},{249,8},{1015,10},{4084,12},{65417,16},{65418,16},{65419,16},{65420,16},{65421,16},{65422,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {58,6},{503,9},{4085,12},{65423,16},{65424,16},{65425,16},{65426,16},{65427,16},{65428,16},{65429,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {59,6},{1016,10},{65430,16},{65431,16},{65432,16},{65433,16},{65434,16},{65435,16},{65436,16},{65437,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {122,7},{2039,11},{65438,16},{65439,16},{65440,16},{65441,16},{65442,16},{65443,16},{65444,16},{65445,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {123,7},{4086,12},{65446,16},{65447,16},{65448,16},{65449,16},{65450,16},{65451,16},{65452,16},{65453,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {250,8},{4087,12},{65454,16},{65455,16},{65456,16},{65457,16},{65458,16},{65459,16},{65460,16},{65461,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {504,9},{32704,15},{65462,16},{65463,16},{65464,16},{65465,16},{65466,16},{65467,16},{65468,16},{65469,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {505,9},{65470,16},{65471,16},{65472,16},{65473,16},{65474,16},{65475,16},{65476,16},{65477,16},{65478,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {506,9},{65479,16},{65480,16},{65481,16},{65482,16},{65483,16},{65484,16},{65485,16},{65486,16},{65487,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {1017,10},{65488,16},{65489,16},{65490,16},{65491,16},{65492,16},{65493,16},{65494,16},{65495,16},{65496,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {1018,10},{65497,16},{65498,16},{65499,16},{65500,16},{65501,16},{65502,16},{65503,16},{65504,16},{65505,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {2040,11},{65506,16},{65507,16},{65508,16},{65509,16},{65510,16},{65511,16},{65512,16},{65513,16},{65514,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {65515,16},{65516,16},{65517,16},{65518,16},{65519,16},{65520,16},{65521,16},{65522,16},{65523,16},{65524,16},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {2041,11},{65525,16},{65526,16},{65527,16},{65528,16},{65529,16},{65530,16},{65531,16},{65532,16},{65533,16},{65534,16},{0,0},{0,0},{0,0},{0,0},{0,0}
-   };
-   static const unsigned short UVAC_HT[256][2] = {
-      {0,2},{1,2},{4,3},{10,4},{24,5},{25,5},{56,6},{120,7},{500,9},{1014,10},{4084,12},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {11,4},{57,6},{246,8},{501,9},{2038,11},{4085,12},{65416,16},{65417,16},{65418,16},{65419,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {26,5},{247,8},{1015,10},{4086,12},{32706,15},{65420,16},{65421,16},{65422,16},{65423,16},{65424,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {27,5},{248,8},{1016,10},{4087,12},{65425,16},{65426,16},{65427,16},{65428,16},{65429,16},{65430,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {58,6},{502,9},{65431,16},{65432,16},{65433,16},{65434,16},{65435,16},{65436,16},{65437,16},{65438,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {59,6},{1017,10},{65439,16},{65440,16},{65441,16},{65442,16},{65443,16},{65444,16},{65445,16},{65446,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {121,7},{2039,11},{65447,16},{65448,16},{65449,16},{65450,16},{65451,16},{65452,16},{65453,16},{65454,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {122,7},{2040,11},{65455,16},{65456,16},{65457,16},{65458,16},{65459,16},{65460,16},{65461,16},{65462,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {249,8},{65463,16},{65464,16},{65465,16},{65466,16},{65467,16},{65468,16},{65469,16},{65470,16},{65471,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {503,9},{65472,16},{65473,16},{65474,16},{65475,16},{65476,16},{65477,16},{65478,16},{65479,16},{65480,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {504,9},{65481,16},{65482,16},{65483,16},{65484,16},{65485,16},{65486,16},{65487,16},{65488,16},{65489,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {505,9},{65490,16},{65491,16},{65492,16},{65493,16},{65494,16},{65495,16},{65496,16},{65497,16},{65498,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {506,9},{65499,16},{65500,16},{65501,16},{65502,16},{65503,16},{65504,16},{65505,16},{65506,16},{65507,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {2041,11},{65508,16},{65509,16},{65510,16},{65511,16},{65512,16},{65513,16},{65514,16},{65515,16},{65516,16},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {16352,14},{65517,16},{65518,16},{65519,16},{65520,16},{65521,16},{65522,16},{65523,16},{65524,16},{65525,16},{0,0},{0,0},{0,0},{0,0},{0,0},
-      {1018,10},{32707,15},{65526,16},{65527,16},{65528,16},{65529,16},{65530,16},{65531,16},{65532,16},{65533,16},{65534,16},{0,0},{0,0},{0,0},{0,0},{0,0}
-   };
    static const int YQT[] = {16,11,10,16,24,40,51,61,12,12,14,19,26,58,60,55,14,13,16,24,40,57,69,56,14,17,22,29,51,87,80,62,18,22,
                              37,56,68,109,103,77,24,35,55,64,81,104,113,92,49,64,78,87,103,121,120,101,72,92,95,98,112,100,103,99};
    static const int UVQT[] = {17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,
@@ -1505,17 +1958,17 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       stbiw__putc(s, 1);
       s->func(s->context, UVTable, sizeof(UVTable));
       s->func(s->context, (void*)head1, sizeof(head1));
-      s->func(s->context, (void*)(std_dc_luminance_nrcodes+1), sizeof(std_dc_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
+      s->func(s->context, (void*)(stbiw__jpg_std_dc_luminance_nrcodes+1), sizeof(stbiw__jpg_std_dc_luminance_nrcodes)-1);
+      s->func(s->context, (void*)stbiw__jpg_std_dc_luminance_values, sizeof(stbiw__jpg_std_dc_luminance_values));
       stbiw__putc(s, 0x10); // HTYACinfo
-      s->func(s->context, (void*)(std_ac_luminance_nrcodes+1), sizeof(std_ac_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
+      s->func(s->context, (void*)(stbiw__jpg_std_ac_luminance_nrcodes+1), sizeof(stbiw__jpg_std_ac_luminance_nrcodes)-1);
+      s->func(s->context, (void*)stbiw__jpg_std_ac_luminance_values, sizeof(stbiw__jpg_std_ac_luminance_values));
       stbiw__putc(s, 1); // HTUDCinfo
-      s->func(s->context, (void*)(std_dc_chrominance_nrcodes+1), sizeof(std_dc_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
+      s->func(s->context, (void*)(stbiw__jpg_std_dc_chrominance_nrcodes+1), sizeof(stbiw__jpg_std_dc_chrominance_nrcodes)-1);
+      s->func(s->context, (void*)stbiw__jpg_std_dc_chrominance_values, sizeof(stbiw__jpg_std_dc_chrominance_values));
       stbiw__putc(s, 0x11); // HTUACinfo
-      s->func(s->context, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+      s->func(s->context, (void*)(stbiw__jpg_std_ac_chrominance_nrcodes+1), sizeof(stbiw__jpg_std_ac_chrominance_nrcodes)-1);
+      s->func(s->context, (void*)stbiw__jpg_std_ac_chrominance_values, sizeof(stbiw__jpg_std_ac_chrominance_values));
       s->func(s->context, (void*)head2, sizeof(head2));
    }
 
@@ -1547,10 +2000,10 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
                      V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
                   }
                }
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
 
                // subsample U,V
                {
@@ -1563,8 +2016,8 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
                         subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
                      }
                   }
-                  DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-                  DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+                  DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, stbiw__jpg_UVDC_HT, stbiw__jpg_UVAC_HT);
+                  DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, stbiw__jpg_UVDC_HT, stbiw__jpg_UVAC_HT);
                }
             }
          }
@@ -1586,15 +2039,16 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
                   }
                }
 
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT);
-               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, stbiw__jpg_UVDC_HT, stbiw__jpg_UVAC_HT);
+               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, stbiw__jpg_UVDC_HT, stbiw__jpg_UVAC_HT);
             }
          }
       }
 
       // Do the bit alignment of the EOI marker
       stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+      stbiw__write_flush(s);
    }
 
    // EOI
@@ -0,0 +1,15 @@
+#ifndef TEST_EMSCRIPTEN_H
+#define TEST_EMSCRIPTEN_H
+
+// 本机 (gcc/clang) 编译 roundtrip_test.c 时代替 emscripten 的头文件，只提供模块用到的两项
+#include <time.h>
+
+#define EMSCRIPTEN_KEEPALIVE
+
+static inline double emscripten_get_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+#endif // TEST_EMSCRIPTEN_H
@@ -0,0 +1,519 @@
+// =======================================================================
+// ==          容器格式的本机往返测试                                   ==
+// =======================================================================
+// 按 crypto-worker.js 的流程在本机调用导出函数: 加密 → 编码 → 解码 → 解密，与原图逐字节比较。
+//   - 无损容器 (PNG / QOI，种子容器和 'DEDU' 去重容器): encode_*_shuffled_wasm 的输出解码后
+//     与 perform_encryption 拼装的容器一致，decrypt 之后与原图一致
+//   - 流式解密: 按不同的分段大小喂给 png_stream_decrypt_begin_wasm，种子容器直接得到原图，
+//     去重容器原样输出后再由 tile_dedup_expand_wasm 展开
+//   - 分块容器 (.stil): 整幅图和随机区域只读出相关的块解码
+// 尺寸包括不是 32 整数倍的情况 (右侧和底部凑不满一块的条带、分块容器的边缘块)。
+//
+// 在 wasm/ 目录下编译运行 (不需要 emscripten，test/emscripten/emscripten.h 代替其头文件):
+//   gcc -O2 -g -fsanitize=address,undefined -Itest test/roundtrip_test.c image_process.c -lm -pthread -o roundtrip_test
+//   ./roundtrip_test
+// 加 -DTILE_CONTAINER_THREADS 测试分块容器的多线程编码和解码。全部通过时返回 0。
+
+#include <stdio.h>
+
+#include "../image_codecs_wasm.c"
+
+// image_process.c (单独编译)
+void perform_encryption(const unsigned char* original_pixels, int width, int height,
+                        int content_width, int content_height, const unsigned int* shuffle_map,
+                        unsigned char* output_pixels, int output_start_row);
+void perform_decryption(const unsigned char* encrypted_pixels, int width, int height,
+                        int content_width, int content_height, const unsigned int* shuffle_map,
+                        int encrypted_content_start_row, unsigned char* decrypted_pixels);
+
+#define TEST_BLOCK 32
+#define TEST_METADATA_BYTES 32
+#define TEST_SEED_TAG 0x53454544u  // 'SEED'
+#define TEST_DEDUP_TAG 0x44454455u // 'DEDU'
+
+static int failures = 0;
+static int checks = 0;
+static int dedup_containers = 0;
+
+#define CHECK(cond, ...) do { \
+        ++checks; \
+        if (!(cond)) { \
+            ++failures; \
+            printf("失败: "); \
+            printf(__VA_ARGS__); \
+            printf(" (%s:%d)\n", __FILE__, __LINE__); \
+        } \
+    } while (0)
+
+// --- 测试图像 ---
+
+typedef struct {
+    const char* name;
+    int width, height;
+    unsigned char* pixels;
+} Image;
+
+static unsigned int rng_state = 0x12345678u;
+
+static unsigned int rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+enum { PATTERN_NOISE, PATTERN_PHOTO, PATTERN_GRAY, PATTERN_SCREENSHOT, PATTERN_COUNT };
+static const char* pattern_names[PATTERN_COUNT] = {"噪声 (RGBA)", "渐变 (RGB)", "灰度", "截图 (索引色，大片空白)"};
+
+static Image make_image(int pattern, int width, int height) {
+    Image img = {pattern_names[pattern], width, height, (unsigned char*)malloc((size_t)width * height * 4)};
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            unsigned char* p = img.pixels + ((size_t)y * width + x) * 4;
+            const unsigned int r = rng_next();
+            switch (pattern) {
+            case PATTERN_NOISE:
+                p[0] = (unsigned char)r; p[1] = (unsigned char)(r >> 8);
+                p[2] = (unsigned char)(r >> 16); p[3] = (unsigned char)(r >> 24);
+                break;
+            case PATTERN_PHOTO:
+                p[0] = (unsigned char)(x * 3 + y); p[1] = (unsigned char)(y * 5 - x);
+                p[2] = (unsigned char)((x ^ y) + (r & 7)); p[3] = 255;
+                break;
+            case PATTERN_GRAY:
+                p[0] = p[1] = p[2] = (unsigned char)(x + y * 2 + (r & 3)); p[3] = 255;
+                break;
+            default: {
+                // 白底上几个色块和一条文字般的细纹: 大部分 32x32 块完全相同
+                const int in_box = (x >= 40 && x < 90 && y >= 8 && y < 30) || (y >= 64 && y < 70);
+                const int stripe = x >= 8 && x < 24 && y % 9 == 0;
+                const unsigned char v = in_box ? (unsigned char)(40 + (x / 8) * 16) : stripe ? 0 : 255;
+                p[0] = v; p[1] = in_box ? 120 : v; p[2] = v; p[3] = 255;
+                break;
+            }
+            }
+        }
+    }
+    return img;
+}
+
+// --- 与 crypto-worker.js 相同的容器头部 ---
+
+static const unsigned char magic_pattern[16] = {
+    0xDE, 0xAD, 0xBE, 0xEF, 0xCA, 0xFE, 0xBA, 0xBE, 0xFE, 0xED, 0xDE, 0xED, 0xDA, 0x7A, 0xB0, 0x55,
+};
+
+// writeGrayBytes: 每个字节写成一个不透明灰度像素，多出的像素为不透明黑色
+static void write_gray_bytes(unsigned char* row, int width, const unsigned char* bytes, int count) {
+    for (int j = 0; j < width; ++j) {
+        const unsigned char v = j < count ? bytes[j] : 0;
+        row[j * 4] = row[j * 4 + 1] = row[j * 4 + 2] = v;
+        row[j * 4 + 3] = 255;
+    }
+}
+
+static void put32(unsigned char* p, unsigned int v) {
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v;
+}
+
+static unsigned int gray32(const unsigned char* row, int offset) {
+    const unsigned char* p = row + (size_t)offset * 4;
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[4] << 16) | ((unsigned int)p[8] << 8) | p[12];
+}
+
+typedef struct {
+    unsigned int original_width, original_height, content_width, content_height, total_blocks, tag;
+    unsigned long long seed;
+} Metadata;
+
+// encodeMetadataToRow + generateMagicRow，写出 2 行 RGBA
+static void make_header_rows(unsigned char* rows, int width, const Metadata* m) {
+    unsigned char bytes[TEST_METADATA_BYTES];
+    put32(bytes, m->original_width);
+    put32(bytes + 4, m->original_height);
+    put32(bytes + 8, m->content_width);
+    put32(bytes + 12, m->content_height);
+    put32(bytes + 16, m->total_blocks);
+    put32(bytes + 20, m->tag);
+    put32(bytes + 24, (unsigned int)(m->seed >> 32));
+    put32(bytes + 28, (unsigned int)m->seed);
+    write_gray_bytes(rows, width, bytes, TEST_METADATA_BYTES);
+
+    unsigned char* magic = (unsigned char*)malloc((size_t)width);
+    for (int j = 0; j < width; ++j) magic[j] = magic_pattern[j % 16];
+    write_gray_bytes(rows + (size_t)width * 4, width, magic, width);
+    free(magic);
+}
+
+static Metadata read_metadata(const unsigned char* row) {
+    Metadata m;
+    m.original_width = gray32(row, 0);
+    m.original_height = gray32(row, 4);
+    m.content_width = gray32(row, 8);
+    m.content_height = gray32(row, 12);
+    m.total_blocks = gray32(row, 16);
+    m.tag = gray32(row, 20);
+    m.seed = ((unsigned long long)gray32(row, 24) << 32) | gray32(row, 28);
+    return m;
+}
+
+// --- 编码输出 ---
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+} Bytes;
+
+// readChunkedOutput: 把块链表拼成一段连续的字节
+static Bytes take_output(ChunkedOutput* out, size_t expected_size) {
+    Bytes b = {NULL, 0};
+    if (!out) return b;
+    b.data = (unsigned char*)malloc(expected_size ? expected_size : 1);
+    const unsigned char* chunk;
+    int size;
+    while ((chunk = output_read_wasm(out, &size)) != NULL) {
+        CHECK(b.size + (size_t)size <= expected_size, "输出块的总大小超过 out_size");
+        if (b.size + (size_t)size > expected_size) break;
+        memcpy(b.data + b.size, chunk, (size_t)size);
+        b.size += (size_t)size;
+    }
+    output_free_wasm(out);
+    return b;
+}
+
+// --- 无损容器 ---
+
+enum { CONTAINER_PNG, CONTAINER_QOI };
+
+typedef struct {
+    Bytes file;
+    Metadata meta;
+    unsigned int* shuffle_map;
+    unsigned char* header_rows;
+} Encrypted;
+
+// encryptWithShuffle: 由种子生成置换表，尝试去重，写头部行，边打乱边编码
+static Encrypted encrypt_image(const Image* img, int container, int try_dedup, unsigned long long seed) {
+    Encrypted e;
+    memset(&e, 0, sizeof(e));
+    const int width = img->width, height = img->height;
+    const int content_width = width / TEST_BLOCK * TEST_BLOCK;
+    const int content_height = height / TEST_BLOCK * TEST_BLOCK;
+    const int total_blocks = (content_width / TEST_BLOCK) * (content_height / TEST_BLOCK);
+
+    e.shuffle_map = (unsigned int*)malloc(sizeof(unsigned int) * total_blocks);
+    make_shuffle_map_wasm(e.shuffle_map, total_blocks, (unsigned int)seed, (unsigned int)(seed >> 32));
+    TileDedup* dedup = try_dedup
+        ? tile_dedup_build_wasm(img->pixels, width, height, content_width, content_height, e.shuffle_map)
+        : NULL;
+
+    Metadata m = {(unsigned int)width, (unsigned int)height, (unsigned int)content_width,
+                  (unsigned int)content_height, (unsigned int)total_blocks,
+                  dedup ? TEST_DEDUP_TAG : TEST_SEED_TAG, seed};
+    e.meta = m;
+    e.header_rows = (unsigned char*)malloc((size_t)width * 4 * 2);
+    make_header_rows(e.header_rows, width, &m);
+
+    size_t size = 0;
+    ChunkedOutput* out = container == CONTAINER_QOI
+        ? encode_qoi_shuffled_wasm(img->pixels, width, height, content_width, content_height,
+                                   e.shuffle_map, e.header_rows, dedup, &size)
+        : encode_png_shuffled_wasm(img->pixels, width, height, content_width, content_height,
+                                   e.shuffle_map, e.header_rows, dedup, &size);
+    e.file = take_output(out, size);
+    if (dedup) {
+        ++dedup_containers;
+        tile_dedup_free_wasm(dedup);
+    }
+    arena_reset_wasm();
+    return e;
+}
+
+static void free_encrypted(Encrypted* e) {
+    free(e->file.data);
+    free(e->shuffle_map);
+    free(e->header_rows);
+}
+
+// 整体解码 (probe_image_wasm + decode_image_into_wasm)，失败返回 NULL
+static unsigned char* decode_whole(const Bytes* file, int* width, int* height) {
+    if (!probe_image_wasm(file->data, (int)file->size, width, height, 1)) return NULL;
+    unsigned char* pixels = (unsigned char*)malloc((size_t)*width * *height * 4);
+    if (!decode_image_into_wasm(file->data, (int)file->size, pixels, *width, *height, 1)) {
+        free(pixels);
+        pixels = NULL;
+    }
+    arena_reset_wasm();
+    return pixels;
+}
+
+// perform_encryption 拼装的完整容器 (旧模块的路径)，用来核对逐行打乱的编码器
+static unsigned char* assemble_container(const Image* img, const Encrypted* e) {
+    const size_t row_bytes = (size_t)img->width * 4;
+    unsigned char* c = (unsigned char*)malloc(row_bytes * (img->height + 2));
+    memcpy(c, e->header_rows, row_bytes);
+    perform_encryption(img->pixels, img->width, img->height, (int)e->meta.content_width,
+                       (int)e->meta.content_height, e->shuffle_map, c, 1);
+    memcpy(c + row_bytes * (img->height + 1), e->header_rows + row_bytes, row_bytes);
+    return c;
+}
+
+// decryptWithShuffle: 从解码出的容器读元数据、核对 magic 行，展开去重容器或 perform_decryption
+static unsigned char* decrypt_container(const unsigned char* container, int width, int height, const char* label) {
+    const size_t row_bytes = (size_t)width * 4;
+    const Metadata m = read_metadata(container);
+    unsigned char* rows = (unsigned char*)malloc(row_bytes * 2);
+    make_header_rows(rows, width, &m);
+    CHECK(memcmp(container + row_bytes * (height - 1), rows + row_bytes, row_bytes) == 0, "%s: 最后一行不是 magic 行", label);
+    free(rows);
+    CHECK(m.original_width == (unsigned int)width, "%s: 元数据宽度 %u", label, m.original_width);
+    CHECK(m.tag == TEST_SEED_TAG || m.tag == TEST_DEDUP_TAG, "%s: 元数据标记 %08x", label, m.tag);
+    if (m.original_width != (unsigned int)width || (m.tag != TEST_SEED_TAG && m.tag != TEST_DEDUP_TAG)) return NULL;
+
+    unsigned int* map = (unsigned int*)malloc(sizeof(unsigned int) * (m.total_blocks ? m.total_blocks : 1));
+    make_shuffle_map_wasm(map, (int)m.total_blocks, (unsigned int)m.seed, (unsigned int)(m.seed >> 32));
+    unsigned char* out = (unsigned char*)malloc(row_bytes * m.original_height);
+    if (m.tag == TEST_DEDUP_TAG) {
+        const int ok = tile_dedup_expand_wasm(container, width, height, (int)m.original_height, (int)m.content_width,
+                                              (int)m.content_height, map, out);
+        CHECK(ok, "%s: tile_dedup_expand_wasm 失败", label);
+        if (!ok) {
+            free(out);
+            out = NULL;
+        }
+    } else {
+        CHECK(m.original_height == (unsigned int)height - 2, "%s: 元数据高度 %u", label, m.original_height);
+        perform_decryption(container, width, height, (int)m.content_width, (int)m.content_height, map, 1, out);
+    }
+    free(map);
+    return out;
+}
+
+// decodePngStreamIntoWasm: 每段复制进单独的缓冲区喂给解码器，喂完立即涂掉 (解码器不能保留输入指针)。
+// 成功时返回像素，decrypted 为 1 表示已是解密后的原图
+static unsigned char* stream_decrypt(const Bytes* file, size_t piece_size, unsigned char** header_rows,
+                                     int* width, int* height, int* decrypted) {
+    PngStream* stream = png_stream_create_wasm();
+    StreamDecrypt* d = NULL;
+    unsigned char* pixels = NULL;
+    unsigned char* piece = (unsigned char*)malloc(piece_size);
+    int status = PNG_STREAM_NEED_MORE;
+    *header_rows = NULL;
+    *decrypted = 0;
+
+    for (size_t pos = 0; pos < file->size && status == PNG_STREAM_NEED_MORE; pos += piece_size) {
+        const size_t n = file->size - pos < piece_size ? file->size - pos : piece_size;
+        memcpy(piece, file->data + pos, n);
+        status = png_stream_feed_wasm(stream, piece, (int)n);
+        memset(piece, 0xCD, n);
+        if (status == PNG_STREAM_HEADER) {
+            png_stream_info_wasm(stream, width, height);
+            pixels = (unsigned char*)malloc((size_t)*width * *height * 4);
+            *header_rows = (unsigned char*)malloc((size_t)*width * 4 * 2);
+            d = png_stream_decrypt_begin_wasm(stream, pixels, *header_rows);
+            status = d ? png_stream_feed_wasm(stream, NULL, 0) : PNG_STREAM_ERROR;
+        }
+    }
+    if (status == PNG_STREAM_DONE) {
+        *decrypted = png_stream_decrypt_result_wasm(d);
+        if (*decrypted) *height -= 2;
+    } else {
+        free(pixels);
+        pixels = NULL;
+    }
+    png_stream_free_wasm(stream);
+    png_stream_decrypt_free_wasm(d);
+    free(piece);
+    return pixels;
+}
+
+static void check_stream(const Image* img, const Encrypted* e, const unsigned char* container, int container_height,
+                         const char* label) {
+    static const size_t piece_sizes[] = {7, 1021, 65536};
+    const size_t row_bytes = (size_t)img->width * 4;
+    for (size_t i = 0; i < sizeof(piece_sizes) / sizeof(piece_sizes[0]); ++i) {
+        unsigned char* header_rows;
+        int width, height, decrypted;
+        unsigned char* pixels = stream_decrypt(&e->file, piece_sizes[i], &header_rows, &width, &height, &decrypted);
+        CHECK(pixels != NULL, "%s 流式 %zu 字节一段: 解码失败", label, piece_sizes[i]);
+        if (pixels && e->meta.tag == TEST_SEED_TAG) {
+            CHECK(decrypted, "%s 流式 %zu: 种子容器没有直接解密", label, piece_sizes[i]);
+            CHECK(width == img->width && height == img->height, "%s 流式 %zu: 尺寸 %dx%d", label, piece_sizes[i], width, height);
+            CHECK(decrypted && memcmp(header_rows, e->header_rows, row_bytes * 2) == 0,
+                  "%s 流式 %zu: 头部行不一致", label, piece_sizes[i]);
+            CHECK(decrypted && memcmp(pixels, img->pixels, row_bytes * img->height) == 0,
+                  "%s 流式 %zu: 解密结果与原图不一致", label, piece_sizes[i]);
+        } else if (pixels) {
+            // 去重容器: 原样输出，之后与整体解码一样展开
+            CHECK(!decrypted && height == container_height, "%s 流式 %zu: 去重容器应原样输出", label, piece_sizes[i]);
+            if (!decrypted && height == container_height) {
+                CHECK(memcmp(pixels, container, row_bytes * container_height) == 0,
+                      "%s 流式 %zu: 与整体解码不一致", label, piece_sizes[i]);
+                unsigned char* out = decrypt_container(pixels, width, height, label);
+                CHECK(out && memcmp(out, img->pixels, row_bytes * img->height) == 0,
+                      "%s 流式 %zu: 展开结果与原图不一致", label, piece_sizes[i]);
+                free(out);
+            }
+        }
+        free(pixels);
+        free(header_rows);
+    }
+}
+
+static void check_lossless(const Image* img, int container, int png_level, int try_dedup) {
+    char label[160];
+    snprintf(label, sizeof(label), "[%s %dx%d %s 级别 %d%s]", container == CONTAINER_QOI ? "QOI" : "PNG",
+             img->width, img->height, img->name, png_level, try_dedup ? " 去重" : "");
+    set_png_compression_level_wasm(png_level);
+    const unsigned long long seed = ((unsigned long long)rng_next() << 32) | rng_next();
+    Encrypted e = encrypt_image(img, container, try_dedup, seed);
+    CHECK(e.file.data != NULL && e.file.size > 0, "%s: 编码失败", label);
+    if (!e.file.data) {
+        free_encrypted(&e);
+        return;
+    }
+
+    int width, height;
+    unsigned char* decoded = decode_whole(&e.file, &width, &height);
+    CHECK(decoded != NULL, "%s: 解码失败", label);
+    if (decoded) {
+        const size_t row_bytes = (size_t)width * 4;
+        CHECK(width == img->width, "%s: 容器宽度 %d", label, width);
+        CHECK(memcmp(decoded, e.header_rows, row_bytes) == 0, "%s: 元数据行不一致", label);
+        if (e.meta.tag == TEST_SEED_TAG) {
+            CHECK(height == img->height + 2, "%s: 容器高度 %d", label, height);
+            unsigned char* assembled = assemble_container(img, &e);
+            CHECK(height == img->height + 2 && memcmp(decoded, assembled, row_bytes * height) == 0,
+                  "%s: 与 perform_encryption 拼装的容器不一致", label);
+            free(assembled);
+        }
+        unsigned char* out = decrypt_container(decoded, width, height, label);
+        CHECK(out && memcmp(out, img->pixels, row_bytes * img->height) == 0, "%s: 解密结果与原图不一致", label);
+        free(out);
+        if (container == CONTAINER_PNG) check_stream(img, &e, decoded, height, label);
+    }
+    free(decoded);
+    free_encrypted(&e);
+    set_png_compression_level_wasm(8);
+}
+
+// --- 分块容器 ---
+
+static unsigned long long read64(const unsigned char* p) {
+    return ((unsigned long long)qoi_read32(p) << 32) | qoi_read32(p + 4);
+}
+
+// encodeTileContainerRegion: 只取出区域涉及的存储位置的数据，首尾相接后解码
+static void check_tile_region(const Image* img, const Bytes* file, const TileContainer* c, size_t header_size,
+                              int x, int y, int w, int h, const char* label) {
+    int info[2];
+    tile_container_info_wasm(c, info);
+    const int tile_count = tile_container_tiles(info[0]) * tile_container_tiles(info[1]);
+    unsigned int* slots = (unsigned int*)malloc(sizeof(unsigned int) * tile_count);
+    const int slot_count = tile_container_region_slots_wasm(c, x, y, w, h, slots);
+    CHECK(slot_count > 0, "%s 区域 (%d,%d %dx%d): 没有块", label, x, y, w, h);
+
+    size_t payload_size = 0;
+    for (int i = 0; i < slot_count; ++i) {
+        const unsigned char* entry = file->data + TILE_CONTAINER_HEADER_SIZE + (size_t)slots[i] * 8;
+        payload_size += (size_t)(read64(entry + 8) - read64(entry));
+    }
+    unsigned char* payload = (unsigned char*)malloc(payload_size ? payload_size : 1);
+    size_t pos = 0;
+    for (int i = 0; i < slot_count; ++i) {
+        const unsigned char* entry = file->data + TILE_CONTAINER_HEADER_SIZE + (size_t)slots[i] * 8;
+        const size_t start = header_size + (size_t)read64(entry), end = header_size + (size_t)read64(entry + 8);
+        CHECK(end <= file->size, "%s: 偏移表超出文件", label);
+        if (end > file->size) break;
+        memcpy(payload + pos, file->data + start, end - start);
+        pos += end - start;
+    }
+
+    unsigned char* pixels = (unsigned char*)malloc((size_t)w * h * 4);
+    const int ok = tile_container_decode_region_wasm(c, payload, (int)payload_size, slots, slot_count,
+                                                     x, y, w, h, pixels);
+    CHECK(ok, "%s 区域 (%d,%d %dx%d): 解码失败", label, x, y, w, h);
+    int same = ok;
+    for (int row = 0; row < h && same; ++row) {
+        same = memcmp(pixels + (size_t)row * w * 4, img->pixels + ((size_t)(y + row) * img->width + x) * 4,
+                      (size_t)w * 4) == 0;
+    }
+    CHECK(same, "%s 区域 (%d,%d %dx%d): 与原图不一致", label, x, y, w, h);
+    free(pixels);
+    free(payload);
+    free(slots);
+}
+
+static void check_tile_container(const Image* img, int threads) {
+    char label[160];
+    snprintf(label, sizeof(label), "[STIL %dx%d %s 线程 %d]", img->width, img->height, img->name, threads);
+    set_tile_container_threads(threads);
+    const unsigned int seed_lo = rng_next(), seed_hi = rng_next();
+    size_t size = 0;
+    ChunkedOutput* out = encode_tile_container_wasm(img->pixels, img->width, img->height, seed_lo, seed_hi, &size);
+    Bytes file = take_output(out, size);
+    CHECK(file.data != NULL && file.size == size, "%s: 编码失败", label);
+    if (!file.data) return;
+
+    const size_t header_size = (size_t)tile_container_header_size_wasm(file.data, 32);
+    CHECK(header_size > TILE_CONTAINER_HEADER_SIZE && header_size <= file.size, "%s: 文件头 %zu", label, header_size);
+    CHECK(read64(file.data + 20) == (((unsigned long long)seed_hi << 32) | seed_lo), "%s: 种子不一致", label);
+    TileContainer* c = header_size ? tile_container_open_wasm(file.data, (int)header_size) : NULL;
+    CHECK(c != NULL, "%s: 打开失败", label);
+    if (c) {
+        int info[2];
+        tile_container_info_wasm(c, info);
+        CHECK(info[0] == img->width && info[1] == img->height, "%s: 尺寸 %dx%d", label, info[0], info[1]);
+
+        // 存储顺序是置换表给出的打乱顺序
+        int shuffled = 0;
+        for (int s = 0; s < c->tile_count; ++s) shuffled |= c->map[s] != (unsigned int)s;
+        CHECK(shuffled || c->tile_count < 3, "%s: 块没有打乱", label);
+
+        check_tile_region(img, &file, c, header_size, 0, 0, img->width, img->height, label);
+        for (int i = 0; i < 6; ++i) {
+            const int x = (int)(rng_next() % (unsigned int)img->width);
+            const int y = (int)(rng_next() % (unsigned int)img->height);
+            const int w = 1 + (int)(rng_next() % (unsigned int)(img->width - x));
+            const int h = 1 + (int)(rng_next() % (unsigned int)(img->height - y));
+            check_tile_region(img, &file, c, header_size, x, y, w, h, label);
+        }
+        tile_container_free_wasm(c);
+    }
+    free(file.data);
+    set_tile_container_threads(1);
+}
+
+int main(void) {
+    // 宽度至少 32 (元数据行)，内容区至少一块；大多数尺寸带有凑不满一块的右侧或底部条带
+    static const int lossless_sizes[][2] = {{32, 32}, {33, 47}, {64, 64}, {100, 70}, {257, 129}, {45, 200}};
+    static const int tile_sizes[][2] = {{1, 1}, {31, 5}, {32, 32}, {33, 65}, {100, 70}, {257, 129}};
+
+    for (size_t s = 0; s < sizeof(lossless_sizes) / sizeof(lossless_sizes[0]); ++s) {
+        for (int pattern = 0; pattern < PATTERN_COUNT; ++pattern) {
+            Image img = make_image(pattern, lossless_sizes[s][0], lossless_sizes[s][1]);
+            for (int dedup = 0; dedup <= 1; ++dedup) {
+                check_lossless(&img, CONTAINER_PNG, 0, dedup);
+                check_lossless(&img, CONTAINER_PNG, 8, dedup);
+                check_lossless(&img, CONTAINER_QOI, 8, dedup);
+            }
+            // 归档级别很慢，只测小图
+            if ((size_t)img.width * img.height <= 64 * 64) check_lossless(&img, CONTAINER_PNG, PNG_ARCHIVE_LEVEL, 1);
+            free(img.pixels);
+        }
+    }
+    CHECK(dedup_containers > 0, "没有生成任何去重容器，测试图像需要更多重复块");
+
+    for (size_t s = 0; s < sizeof(tile_sizes) / sizeof(tile_sizes[0]); ++s) {
+        for (int pattern = 0; pattern < PATTERN_COUNT; ++pattern) {
+            Image img = make_image(pattern, tile_sizes[s][0], tile_sizes[s][1]);
+            check_tile_container(&img, 1);
+            check_tile_container(&img, 4);
+            free(img.pixels);
+        }
+    }
+
+    printf("%d 项检查，%d 项失败 (去重容器 %d 个)\n", checks, failures, dedup_containers);
+    return failures ? 1 : 0;
+}
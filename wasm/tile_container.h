@@ -0,0 +1,406 @@
+#ifndef TILE_CONTAINER_H
+#define TILE_CONTAINER_H
+
+// =======================================================================
+// ==          分块压缩容器 (可随机读取，供超大图归档)                   ==
+// =======================================================================
+// 整幅图按 32x32 分块 (右侧和底部不满一块的部分也各算一块)，每块单独编码成一个 QOI 流，
+// 按置换表打乱顺序依次存放，前面是偏移表。加密只是按置换表重排各块的压缩数据，
+// 各块互不依赖，可以并行编码；解密或只看一个区域时按偏移表找到需要的块，只解码这些块。
+//   文件头 (32 字节，大端序)
+//     0   "STIL"
+//     4   版本 (1)、编码 (1 = QOI)、块边长 (32)、保留 (0)
+//     8   宽、高、块数 (各 32 位)
+//     20  64 位种子 (与 jpeg_shuffle_make_map 配合生成置换表)
+//     28  保留 (0)
+//   偏移表 (块数 + 1 项，每项 64 位，大端序)
+//     相对数据区起点，第 s 个存储位置的数据在 [offset[s], offset[s + 1]) 内
+//   数据区
+//     第 s 个存储位置存放原图第 map[s] 块的 QOI 流 (完整的 QOI 文件，尺寸与该块相同)
+// 与像素容器不同，这种文件不是图片，只能用本工具打开。
+// 定义 TILE_CONTAINER_THREADS 时编码和区域解码用 pthread 并行 (与 stb_image 的 JPEG 线程相同的做法)。
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef TILE_CONTAINER_THREADS
+#include <pthread.h>
+#endif
+
+#include "qoi_codec.h"
+
+#define TILE_CONTAINER_TILE 32
+#define TILE_CONTAINER_VERSION 1
+#define TILE_CONTAINER_CODEC_QOI 1
+#define TILE_CONTAINER_HEADER_SIZE 32
+#define TILE_CONTAINER_MAX_THREADS 16
+
+// 由 64 位种子生成 count 项置换表 (传入 jpeg_shuffle_make_map，保证与其他容器用同一种打乱)
+typedef void tile_container_map_func(unsigned int* map, int count, unsigned long long seed);
+
+typedef struct {
+    int width, height;
+    int tiles_x, tiles_y, tile_count;
+    unsigned long long seed;
+    size_t data_offset;          // 数据区在文件中的起点 (文件头 + 偏移表)
+    unsigned long long* offsets; // tile_count + 1 项，相对数据区起点
+    unsigned int* map;           // 存储位置 s 存放原图第 map[s] 块
+    unsigned int* slot_of;       // 原图第 t 块的存储位置 (map 的逆)
+} TileContainer;
+
+static inline void tile_container_write64(unsigned char* p, unsigned long long v) {
+    qoi_write32(p, (unsigned int)(v >> 32));
+    qoi_write32(p + 4, (unsigned int)v);
+}
+
+static inline unsigned long long tile_container_read64(const unsigned char* p) {
+    return ((unsigned long long)qoi_read32(p) << 32) | qoi_read32(p + 4);
+}
+
+static inline int tile_container_tiles(int size) {
+    return (size + TILE_CONTAINER_TILE - 1) / TILE_CONTAINER_TILE;
+}
+
+// 原图第 tile 块的位置和尺寸 (边缘的块比 32 小)
+static void tile_container_tile_rect(int width, int height, int tiles_x, int tile,
+                                     int* x, int* y, int* w, int* h) {
+    *x = (tile % tiles_x) * TILE_CONTAINER_TILE;
+    *y = (tile / tiles_x) * TILE_CONTAINER_TILE;
+    *w = width - *x < TILE_CONTAINER_TILE ? width - *x : TILE_CONTAINER_TILE;
+    *h = height - *y < TILE_CONTAINER_TILE ? height - *y : TILE_CONTAINER_TILE;
+}
+
+// --- 并行执行 ---
+
+typedef void (*tile_container_task_func)(void* arg);
+
+#ifdef TILE_CONTAINER_THREADS
+typedef struct {
+    tile_container_task_func func;
+    void* arg;
+} TileContainerThread;
+
+static void* tile_container_thread_entry(void* arg) {
+    TileContainerThread* t = (TileContainerThread*)arg;
+    t->func(t->arg);
+    return NULL;
+}
+#endif
+
+// 对 count 个参数结构依次执行 func，第一个在调用线程上执行。线程启动失败时在本线程补做
+static void tile_container_run_tasks(tile_container_task_func func, void* args, size_t arg_size, int count) {
+#ifdef TILE_CONTAINER_THREADS
+    pthread_t tid[TILE_CONTAINER_MAX_THREADS];
+    TileContainerThread task[TILE_CONTAINER_MAX_THREADS];
+    int started[TILE_CONTAINER_MAX_THREADS];
+    for (int i = 1; i < count; ++i) {
+        task[i].func = func;
+        task[i].arg = (char*)args + i * arg_size;
+        started[i] = pthread_create(&tid[i], NULL, tile_container_thread_entry, &task[i]) == 0;
+        if (!started[i]) func(task[i].arg);
+    }
+    func(args);
+    for (int i = 1; i < count; ++i) {
+        if (started[i]) pthread_join(tid[i], NULL);
+    }
+#else
+    for (int i = 0; i < count; ++i) func((char*)args + i * arg_size);
+#endif
+}
+
+static int tile_container_task_count(int threads, int items) {
+    if (threads > TILE_CONTAINER_MAX_THREADS) threads = TILE_CONTAINER_MAX_THREADS;
+    if (threads > items) threads = items;
+    return threads < 1 ? 1 : threads;
+}
+
+// --- 编码 ---
+
+// 一个线程负责连续的一段存储位置，压缩数据先拼在自己的缓冲区里
+typedef struct {
+    const unsigned char* pixels;
+    int width, height, tiles_x;
+    const unsigned int* map;
+    int first, last;            // 存储位置 [first, last)
+    unsigned long long* sizes;  // 每个存储位置的压缩大小 (与其他线程共用，各写各的范围)
+    unsigned char* data;
+    size_t size, capacity;
+    int failed;
+} TileContainerEncodeTask;
+
+static void tile_container_append(void* context, void* data, int size) {
+    TileContainerEncodeTask* t = (TileContainerEncodeTask*)context;
+    if (t->failed) return;
+    if (t->size + (size_t)size > t->capacity) {
+        size_t capacity = t->capacity ? t->capacity * 2 : 65536;
+        while (capacity < t->size + (size_t)size) capacity *= 2;
+        unsigned char* grown = (unsigned char*)realloc(t->data, capacity);
+        if (!grown) {
+            t->failed = 1;
+            return;
+        }
+        t->data = grown;
+        t->capacity = capacity;
+    }
+    memcpy(t->data + t->size, data, (size_t)size);
+    t->size += (size_t)size;
+}
+
+static void tile_container_encode_task(void* arg) {
+    TileContainerEncodeTask* t = (TileContainerEncodeTask*)arg;
+    for (int s = t->first; s < t->last && !t->failed; ++s) {
+        int x, y, w, h;
+        tile_container_tile_rect(t->width, t->height, t->tiles_x, (int)t->map[s], &x, &y, &w, &h);
+        QoiMemoryRows rows = {t->pixels + ((size_t)y * t->width + x) * 4, (size_t)t->width * 4};
+        const size_t before = t->size;
+        if (!qoi_encode_rows_to_func(tile_container_append, t, w, h, qoi_memory_row, &rows)) t->failed = 1;
+        t->sizes[s] = t->size - before;
+    }
+}
+
+// 把 RGBA 原图编码成分块容器，经 func 依次写出。成功返回 1
+static int tile_container_encode(qoi_write_func* func, void* context, const unsigned char* pixels,
+                                 int width, int height, unsigned long long seed,
+                                 tile_container_map_func* make_map, int threads) {
+    if (width <= 0 || height <= 0) return 0;
+    const int tiles_x = tile_container_tiles(width), tiles_y = tile_container_tiles(height);
+    if ((long long)tiles_x * tiles_y > 0x7fffffff / (int)sizeof(unsigned long long)) return 0;
+    const int tile_count = tiles_x * tiles_y;
+
+    TileContainerEncodeTask tasks[TILE_CONTAINER_MAX_THREADS];
+    const int task_count = tile_container_task_count(threads, tile_count);
+    unsigned int* map = (unsigned int*)malloc(sizeof(unsigned int) * tile_count);
+    unsigned long long* sizes = (unsigned long long*)malloc(sizeof(unsigned long long) * tile_count);
+    int ok = map != NULL && sizes != NULL;
+    memset(tasks, 0, sizeof(tasks));
+
+    if (ok) {
+        make_map(map, tile_count, seed);
+        for (int i = 0; i < task_count; ++i) {
+            TileContainerEncodeTask* t = &tasks[i];
+            t->pixels = pixels;
+            t->width = width;
+            t->height = height;
+            t->tiles_x = tiles_x;
+            t->map = map;
+            t->first = (int)((long long)tile_count * i / task_count);
+            t->last = (int)((long long)tile_count * (i + 1) / task_count);
+            t->sizes = sizes;
+        }
+        tile_container_run_tasks(tile_container_encode_task, tasks, sizeof(tasks[0]), task_count);
+        for (int i = 0; i < task_count; ++i) ok &= !tasks[i].failed;
+    }
+
+    if (ok) {
+        unsigned char stage[4096];
+        memcpy(stage, "STIL", 4);
+        stage[4] = TILE_CONTAINER_VERSION;
+        stage[5] = TILE_CONTAINER_CODEC_QOI;
+        stage[6] = TILE_CONTAINER_TILE;
+        stage[7] = 0;
+        qoi_write32(stage + 8, (unsigned int)width);
+        qoi_write32(stage + 12, (unsigned int)height);
+        qoi_write32(stage + 16, (unsigned int)tile_count);
+        tile_container_write64(stage + 20, seed);
+        qoi_write32(stage + 28, 0);
+        size_t p = TILE_CONTAINER_HEADER_SIZE;
+
+        // 偏移表可能有几 MB (十亿像素约一百万块)，经暂存区分段写出
+        unsigned long long offset = 0;
+        for (int s = 0; s <= tile_count; ++s) {
+            if (p + 8 > sizeof(stage)) {
+                func(context, stage, (int)p);
+                p = 0;
+            }
+            tile_container_write64(stage + p, offset);
+            p += 8;
+            if (s < tile_count) offset += sizes[s];
+        }
+        func(context, stage, (int)p);
+        for (int i = 0; i < task_count; ++i) {
+            if (tasks[i].size > 0) func(context, tasks[i].data, (int)tasks[i].size);
+            free(tasks[i].data);
+            tasks[i].data = NULL;
+        }
+    }
+
+    for (int i = 0; i < task_count; ++i) free(tasks[i].data);
+    free(map);
+    free(sizes);
+    return ok;
+}
+
+// --- 读取 ---
+
+// 只看文件头: 是分块容器时返回文件头加偏移表的总字节数，并给出宽高；否则返回 0
+static size_t tile_container_read_header(const unsigned char* data, size_t size, int* out_width, int* out_height) {
+    if (size < TILE_CONTAINER_HEADER_SIZE || memcmp(data, "STIL", 4) != 0) return 0;
+    if (data[4] != TILE_CONTAINER_VERSION || data[5] != TILE_CONTAINER_CODEC_QOI || data[6] != TILE_CONTAINER_TILE) {
+        return 0;
+    }
+    const unsigned int width = qoi_read32(data + 8), height = qoi_read32(data + 12);
+    const unsigned int tile_count = qoi_read32(data + 16);
+    if (width == 0 || height == 0 || width > 0x7fffffff || height > 0x7fffffff) return 0;
+    if ((unsigned long long)tile_container_tiles((int)width) * tile_container_tiles((int)height) != tile_count) return 0;
+    if (tile_count > 0x7fffffff / sizeof(unsigned long long)) return 0;
+    *out_width = (int)width;
+    *out_height = (int)height;
+    return TILE_CONTAINER_HEADER_SIZE + ((size_t)tile_count + 1) * 8;
+}
+
+static void tile_container_free(TileContainer* c) {
+    if (!c) return;
+    free(c->offsets);
+    free(c->map);
+    free(c->slot_of);
+    free(c);
+}
+
+// 解析文件头和偏移表 (data 至少包含 tile_container_read_header 给出的字节数)，
+// 数据区不需要在内存中。偏移表不单调时返回 NULL
+static TileContainer* tile_container_open(const unsigned char* data, size_t size, tile_container_map_func* make_map) {
+    int width, height;
+    const size_t header_size = tile_container_read_header(data, size, &width, &height);
+    if (header_size == 0 || size < header_size) return NULL;
+
+    TileContainer* c = (TileContainer*)calloc(1, sizeof(TileContainer));
+    if (!c) return NULL;
+    c->width = width;
+    c->height = height;
+    c->tiles_x = tile_container_tiles(width);
+    c->tiles_y = tile_container_tiles(height);
+    c->tile_count = c->tiles_x * c->tiles_y;
+    c->seed = tile_container_read64(data + 20);
+    c->data_offset = header_size;
+    c->offsets = (unsigned long long*)malloc(sizeof(unsigned long long) * ((size_t)c->tile_count + 1));
+    c->map = (unsigned int*)malloc(sizeof(unsigned int) * c->tile_count);
+    c->slot_of = (unsigned int*)malloc(sizeof(unsigned int) * c->tile_count);
+    if (!c->offsets || !c->map || !c->slot_of) {
+        tile_container_free(c);
+        return NULL;
+    }
+
+    const unsigned char* table = data + TILE_CONTAINER_HEADER_SIZE;
+    for (int s = 0; s <= c->tile_count; ++s) {
+        c->offsets[s] = tile_container_read64(table + (size_t)s * 8);
+        // 每块至少是一个空的 QOI 文件
+        if (s == 0 ? c->offsets[0] != 0 : c->offsets[s] < c->offsets[s - 1] + QOI_HEADER_SIZE + QOI_PADDING_SIZE) {
+            tile_container_free(c);
+            return NULL;
+        }
+    }
+    make_map(c->map, c->tile_count, c->seed);
+    for (int s = 0; s < c->tile_count; ++s) c->slot_of[c->map[s]] = (unsigned int)s;
+    return c;
+}
+
+static int tile_container_compare_slots(const void* a, const void* b) {
+    const unsigned int x = *(const unsigned int*)a, y = *(const unsigned int*)b;
+    return x < y ? -1 : x > y;
+}
+
+// 与区域 (x, y, w, h) 相交的块的存储位置，按文件中的顺序 (升序) 写入 slots (至少 tile_count 项)，
+// 返回块数；区域不在图内时返回 0
+static int tile_container_region_slots(const TileContainer* c, int x, int y, int w, int h, unsigned int* slots) {
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || w > c->width - x || h > c->height - y) return 0;
+    const int tx0 = x / TILE_CONTAINER_TILE, tx1 = (x + w - 1) / TILE_CONTAINER_TILE;
+    const int ty0 = y / TILE_CONTAINER_TILE, ty1 = (y + h - 1) / TILE_CONTAINER_TILE;
+    int count = 0;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) slots[count++] = c->slot_of[ty * c->tiles_x + tx];
+    }
+    qsort(slots, (size_t)count, sizeof(unsigned int), tile_container_compare_slots);
+    return count;
+}
+
+// --- 区域解码 ---
+
+typedef struct {
+    const TileContainer* c;
+    const unsigned char* payload;
+    const size_t* positions;     // 第 i 个块在 payload 中的起点，count + 1 项
+    const unsigned int* slots;
+    int first, last;             // slots 的下标范围 [first, last)
+    int x, y, w, h;              // 输出区域
+    unsigned char* out;          // w * h * 4 字节
+    int failed;
+} TileContainerDecodeTask;
+
+static void tile_container_decode_task(void* arg) {
+    TileContainerDecodeTask* t = (TileContainerDecodeTask*)arg;
+    const TileContainer* c = t->c;
+    unsigned char* tile = (unsigned char*)malloc(TILE_CONTAINER_TILE * TILE_CONTAINER_TILE * 4);
+    if (!tile) {
+        t->failed = 1;
+        return;
+    }
+    for (int i = t->first; i < t->last; ++i) {
+        int tx, ty, tw, th, qw, qh;
+        tile_container_tile_rect(c->width, c->height, c->tiles_x, (int)c->map[t->slots[i]], &tx, &ty, &tw, &th);
+        const unsigned char* stream = t->payload + t->positions[i];
+        const size_t size = t->positions[i + 1] - t->positions[i];
+        if (!qoi_read_header(stream, size, &qw, &qh) || qw != tw || qh != th) {
+            t->failed = 1;
+            break;
+        }
+        qoi_decode_pixels(stream, size, tile, (size_t)tw * th);
+
+        // 块与输出区域的交集
+        const int x0 = tx > t->x ? tx : t->x, x1 = tx + tw < t->x + t->w ? tx + tw : t->x + t->w;
+        const int y0 = ty > t->y ? ty : t->y, y1 = ty + th < t->y + t->h ? ty + th : t->y + t->h;
+        for (int y = y0; y < y1; ++y) {
+            memcpy(t->out + ((size_t)(y - t->y) * t->w + (x0 - t->x)) * 4,
+                   tile + ((size_t)(y - ty) * tw + (x0 - tx)) * 4, (size_t)(x1 - x0) * 4);
+        }
+    }
+    free(tile);
+}
+
+// 把区域 (x, y, w, h) 解码到 out (w * h * 4 字节)。slots 是 tile_container_region_slots 的结果，
+// payload 是这些存储位置的数据按同样顺序首尾相接 (调用方只需从文件中读出这几段)。成功返回 1
+static int tile_container_decode_region(const TileContainer* c, const unsigned char* payload, size_t payload_size,
+                                        const unsigned int* slots, int count,
+                                        int x, int y, int w, int h, unsigned char* out, int threads) {
+    if (count <= 0) return 0;
+    size_t* positions = (size_t*)malloc(sizeof(size_t) * ((size_t)count + 1));
+    if (!positions) return 0;
+    positions[0] = 0;
+    for (int i = 0; i < count; ++i) {
+        if (slots[i] >= (unsigned int)c->tile_count) {
+            free(positions);
+            return 0;
+        }
+        positions[i + 1] = positions[i] + (size_t)(c->offsets[slots[i] + 1] - c->offsets[slots[i]]);
+    }
+    if (positions[count] != payload_size) {
+        free(positions);
+        return 0;
+    }
+
+    TileContainerDecodeTask tasks[TILE_CONTAINER_MAX_THREADS];
+    const int task_count = tile_container_task_count(threads, count);
+    for (int i = 0; i < task_count; ++i) {
+        TileContainerDecodeTask* t = &tasks[i];
+        t->c = c;
+        t->payload = payload;
+        t->positions = positions;
+        t->slots = slots;
+        t->first = (int)((long long)count * i / task_count);
+        t->last = (int)((long long)count * (i + 1) / task_count);
+        t->x = x;
+        t->y = y;
+        t->w = w;
+        t->h = h;
+        t->out = out;
+        t->failed = 0;
+    }
+    tile_container_run_tasks(tile_container_decode_task, tasks, sizeof(tasks[0]), task_count);
+
+    int ok = 1;
+    for (int i = 0; i < task_count; ++i) ok &= !tasks[i].failed;
+    free(positions);
+    return ok;
+}
+
+#endif // TILE_CONTAINER_H
@@ -0,0 +1,296 @@
+#ifndef TILE_DEDUP_H
+#define TILE_DEDUP_H
+
+// =======================================================================
+// ==          无损加密容器的分块去重                                   ==
+// =======================================================================
+// 扫描件的空白边距、界面截图里有大量完全相同的 32x32 块。打乱之后它们散布在整幅图里，
+// 超出了 deflate 32KB 的窗口，每一份都要重新编码。去重容器只存每种块一次，另存一张引用表:
+//   第 0 行               元数据行 (标记为 'DEDU'，其余与种子容器相同)
+//   引用表 (table_rows 行) 每项 6 个像素，每个像素是一个 4 位的灰度值 (n * 17)，高位在前。
+//                         第 0 项是不重复块数 U，之后第 i 项是容器第 i 个块位置 (打乱后的顺序) 引用的块编号
+//   块区 (ceil(U / blocks_x) * 32 行)
+//                         不重复的块按第一次出现的顺序逐个排列，所以仍然是打乱后的顺序
+//   右侧条带              原图右侧凑不满一块的 content_height x (width - content_width) 像素，
+//                         按行首尾相接重新折成 width 宽的行
+//   底部条带              原图底部凑不满一块的行，原样
+//   最后一行              magic 行
+// 块区右侧和各区最后一行的空位用引用表的第一个像素填充: 这个颜色已经出现在图里，
+// 不会让调色板多一种颜色，也不会引入透明。
+// 解密时按引用表把块展开回原位 (tile_dedup_expand)。
+// 假定目标平台为小端序 (wasm, x86, ARM)。
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 与 shuffle_rows.h 的 SHUFFLE_BLOCK_SIZE 相同
+#define TILE_DEDUP_BLOCK 32
+// 引用表每项的像素数 (6 个 4 位灰度，最多 2^24 个块)
+#define TILE_DEDUP_ENTRY_PIXELS 6
+
+typedef struct {
+    int blocks_x, block_count;  // 内容区每行的块数、总块数
+    int unique_count;           // 不重复的块数
+    unsigned int* refs;         // 容器第 i 个块位置引用的块编号，block_count 项
+    unsigned int* unique_src;   // 块编号 u 在原图中的块序号，unique_count 项
+    int table_rows;             // 引用表的行数
+    unsigned char* table;       // 引用表的 RGBA 行，table_rows * width * 4 字节
+    int strip_rows;             // 右侧条带折成的行数
+    int container_height;       // 整个容器的高度
+} TileDedup;
+
+static inline unsigned int tile_dedup_rotl(unsigned int v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+// 32x32 RGBA 块的哈希: 每行 128 字节按 16 字节向量逐个混入 4 个 32 位累加器。
+// 只用来分桶，哈希相同的块还要逐字节比较
+static unsigned int tile_dedup_hash(const unsigned char* tile, size_t row_bytes) {
+    unsigned int lanes[4];
+#if defined(__wasm_simd128__)
+    v128_t acc = wasm_i32x4_make((int)0x9E3779B1u, (int)0x85EBCA77u, (int)0xC2B2AE3Du, (int)0x27D4EB2Fu);
+    for (int y = 0; y < TILE_DEDUP_BLOCK; ++y, tile += row_bytes) {
+        for (int k = 0; k < TILE_DEDUP_BLOCK * 4; k += 16) {
+            const v128_t t = wasm_v128_xor(acc, wasm_v128_load(tile + k));
+            acc = wasm_i32x4_add(t, wasm_v128_or(wasm_i32x4_shl(t, 11), wasm_u32x4_shr(t, 21)));
+        }
+    }
+    wasm_v128_store(lanes, acc);
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setr_epi32((int)0x9E3779B1u, (int)0x85EBCA77u, (int)0xC2B2AE3Du, (int)0x27D4EB2Fu);
+    for (int y = 0; y < TILE_DEDUP_BLOCK; ++y, tile += row_bytes) {
+        for (int k = 0; k < TILE_DEDUP_BLOCK * 4; k += 16) {
+            const __m128i t = _mm_xor_si128(acc, _mm_loadu_si128((const __m128i*)(tile + k)));
+            acc = _mm_add_epi32(t, _mm_or_si128(_mm_slli_epi32(t, 11), _mm_srli_epi32(t, 21)));
+        }
+    }
+    _mm_storeu_si128((__m128i*)lanes, acc);
+#else
+    lanes[0] = 0x9E3779B1u;
+    lanes[1] = 0x85EBCA77u;
+    lanes[2] = 0xC2B2AE3Du;
+    lanes[3] = 0x27D4EB2Fu;
+    for (int y = 0; y < TILE_DEDUP_BLOCK; ++y, tile += row_bytes) {
+        for (int k = 0; k < TILE_DEDUP_BLOCK * 4; k += 16) {
+            unsigned int v[4];
+            memcpy(v, tile + k, 16);
+            for (int l = 0; l < 4; ++l) {
+                const unsigned int t = lanes[l] ^ v[l];
+                lanes[l] = t + tile_dedup_rotl(t, 11);
+            }
+        }
+    }
+#endif
+    unsigned int h = lanes[0] ^ tile_dedup_rotl(lanes[1], 8) ^ tile_dedup_rotl(lanes[2], 16) ^ tile_dedup_rotl(lanes[3], 24);
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    return h ^ (h >> 13);
+}
+
+static int tile_dedup_equal(const unsigned char* a, const unsigned char* b, size_t row_bytes) {
+    for (int y = 0; y < TILE_DEDUP_BLOCK; ++y, a += row_bytes, b += row_bytes) {
+        if (memcmp(a, b, TILE_DEDUP_BLOCK * 4) != 0) return 0;
+    }
+    return 1;
+}
+
+// 原图 (RGBA) 中第 block 块左上角的位置
+static inline const unsigned char* tile_dedup_block_ptr(const unsigned char* pixels, int width, int blocks_x,
+                                                        unsigned int block) {
+    return pixels + ((size_t)(block / blocks_x) * TILE_DEDUP_BLOCK * width + (size_t)(block % blocks_x) * TILE_DEDUP_BLOCK) * 4;
+}
+
+static int tile_dedup_table_rows(int width, int block_count) {
+    return (int)(((size_t)(block_count + 1) * TILE_DEDUP_ENTRY_PIXELS + width - 1) / width);
+}
+
+static int tile_dedup_strip_rows(int width, int content_width, int content_height) {
+    return (int)(((size_t)content_height * (width - content_width) + width - 1) / width);
+}
+
+// 去重容器的总高度
+static int tile_dedup_container_height(int table_rows, int unique_count, int blocks_x, int strip_rows,
+                                       int height, int content_height) {
+    const int tile_rows = (unique_count + blocks_x - 1) / blocks_x;
+    return 1 + table_rows + tile_rows * TILE_DEDUP_BLOCK + strip_rows + (height - content_height) + 1;
+}
+
+static void tile_dedup_free(TileDedup* d) {
+    if (!d) return;
+    free(d->refs);
+    free(d->unique_src);
+    free(d->table);
+    free(d);
+}
+
+static void tile_dedup_write_entry(unsigned char* table, size_t index, unsigned int value) {
+    unsigned char* p = table + index * TILE_DEDUP_ENTRY_PIXELS * 4;
+    for (int k = TILE_DEDUP_ENTRY_PIXELS - 1; k >= 0; --k, value >>= 4) {
+        const unsigned char gray = (unsigned char)((value & 15) * 17);
+        p[k * 4] = p[k * 4 + 1] = p[k * 4 + 2] = gray;
+        p[k * 4 + 3] = 255;
+    }
+}
+
+// 按打乱后的顺序找出重复的块。省下的像素不比引用表多时返回 NULL (照片通常没有重复块)，
+// 内存不足或置换表越界时也返回 NULL，调用方改用不去重的容器
+static TileDedup* tile_dedup_build(const unsigned char* pixels, int width, int height,
+                                   int content_width, int content_height, const unsigned int* shuffle_map) {
+    const int blocks_x = content_width / TILE_DEDUP_BLOCK;
+    const int block_count = blocks_x * (content_height / TILE_DEDUP_BLOCK);
+    if (block_count < 2 || content_width > width || content_height > height ||
+        block_count >= 1 << (4 * TILE_DEDUP_ENTRY_PIXELS)) {
+        return NULL;
+    }
+    for (int i = 0; i < block_count; ++i) {
+        if (shuffle_map[i] >= (unsigned int)block_count) return NULL;
+    }
+
+    // 开放寻址哈希表，装载率不超过 1/2。槽里存块编号 + 1，0 表示空槽
+    int hash_bits = 1;
+    while ((1 << hash_bits) < block_count * 2) ++hash_bits;
+    const unsigned int mask = (1u << hash_bits) - 1;
+    TileDedup* d = (TileDedup*)calloc(1, sizeof(TileDedup));
+    unsigned int* slots = (unsigned int*)calloc((size_t)mask + 1, sizeof(unsigned int));
+    unsigned int* hashes = (unsigned int*)malloc(sizeof(unsigned int) * block_count);
+    if (d) {
+        d->refs = (unsigned int*)malloc(sizeof(unsigned int) * block_count);
+        d->unique_src = (unsigned int*)malloc(sizeof(unsigned int) * block_count);
+    }
+    if (!d || !slots || !hashes || !d->refs || !d->unique_src) {
+        free(slots);
+        free(hashes);
+        tile_dedup_free(d);
+        return NULL;
+    }
+
+    const size_t row_bytes = (size_t)width * 4;
+    int unique_count = 0;
+    for (int i = 0; i < block_count; ++i) {
+        const unsigned char* tile = tile_dedup_block_ptr(pixels, width, blocks_x, shuffle_map[i]);
+        const unsigned int h = tile_dedup_hash(tile, row_bytes);
+        unsigned int pos = h & mask;
+        for (;;) {
+            const unsigned int slot = slots[pos];
+            if (slot == 0) {
+                hashes[unique_count] = h;
+                d->unique_src[unique_count] = shuffle_map[i];
+                d->refs[i] = (unsigned int)unique_count;
+                slots[pos] = (unsigned int)++unique_count;
+                break;
+            }
+            const unsigned int u = slot - 1;
+            if (hashes[u] == h &&
+                tile_dedup_equal(tile, tile_dedup_block_ptr(pixels, width, blocks_x, d->unique_src[u]), row_bytes)) {
+                d->refs[i] = u;
+                break;
+            }
+            pos = (pos + 1) & mask;
+        }
+    }
+    free(slots);
+    free(hashes);
+
+    d->blocks_x = blocks_x;
+    d->block_count = block_count;
+    d->unique_count = unique_count;
+    d->table_rows = tile_dedup_table_rows(width, block_count);
+    const size_t saved_pixels = (size_t)(block_count - unique_count) * TILE_DEDUP_BLOCK * TILE_DEDUP_BLOCK;
+    if (saved_pixels <= (size_t)d->table_rows * width) {
+        tile_dedup_free(d);
+        return NULL;
+    }
+
+    const size_t table_pixels = (size_t)d->table_rows * width;
+    d->table = (unsigned char*)malloc(table_pixels * 4);
+    if (!d->table) {
+        tile_dedup_free(d);
+        return NULL;
+    }
+    // 表尾的空位写 0 (与第一项的高位一样是灰度 0)
+    for (size_t p = 0; p < table_pixels; ++p) {
+        d->table[p * 4] = d->table[p * 4 + 1] = d->table[p * 4 + 2] = 0;
+        d->table[p * 4 + 3] = 255;
+    }
+    tile_dedup_write_entry(d->table, 0, (unsigned int)unique_count);
+    for (int i = 0; i < block_count; ++i) tile_dedup_write_entry(d->table, (size_t)i + 1, d->refs[i]);
+
+    d->strip_rows = tile_dedup_strip_rows(width, content_width, content_height);
+    d->container_height = tile_dedup_container_height(d->table_rows, unique_count, blocks_x, d->strip_rows,
+                                                      height, content_height);
+    return d;
+}
+
+// 读引用表的第 index 项 (像素不是 4 位灰度时返回 0xFFFFFFFF)
+static unsigned int tile_dedup_read_entry(const unsigned char* table, size_t index) {
+    const unsigned char* p = table + index * TILE_DEDUP_ENTRY_PIXELS * 4;
+    unsigned int value = 0;
+    for (int k = 0; k < TILE_DEDUP_ENTRY_PIXELS; ++k, p += 4) {
+        if (p[0] % 17 != 0 || p[1] != p[0] || p[2] != p[0] || p[3] != 255) return 0xFFFFFFFFu;
+        value = (value << 4) | (p[0] / 17u);
+    }
+    return value;
+}
+
+// 把去重容器 (container_height 行 RGBA，第 0 行为元数据行) 展开成原图 out (width * height * 4 字节)。
+// 成功返回 1；引用表或容器尺寸与元数据不符时返回 0
+static int tile_dedup_expand(const unsigned char* container, int width, int container_height, int height,
+                             int content_width, int content_height, const unsigned int* shuffle_map,
+                             unsigned char* out) {
+    if (content_width <= 0 || content_height <= 0 || content_width > width || content_height > height ||
+        content_width % TILE_DEDUP_BLOCK != 0 || content_height % TILE_DEDUP_BLOCK != 0) {
+        return 0;
+    }
+    const int blocks_x = content_width / TILE_DEDUP_BLOCK;
+    const int block_count = blocks_x * (content_height / TILE_DEDUP_BLOCK);
+    const int table_rows = tile_dedup_table_rows(width, block_count);
+    const int strip_rows = tile_dedup_strip_rows(width, content_width, content_height);
+    const size_t row_bytes = (size_t)width * 4;
+    if (container_height < 2 + table_rows) return 0;
+
+    const unsigned char* table = container + row_bytes;
+    const unsigned int unique_count = tile_dedup_read_entry(table, 0);
+    if (unique_count == 0 || unique_count > (unsigned int)block_count ||
+        container_height != tile_dedup_container_height(table_rows, (int)unique_count, blocks_x, strip_rows,
+                                                        height, content_height)) {
+        return 0;
+    }
+    for (int i = 0; i < block_count; ++i) {
+        if (shuffle_map[i] >= (unsigned int)block_count) return 0;
+    }
+
+    // 块区: 第 i 个块位置引用的块写回原图中的第 shuffle_map[i] 块
+    const unsigned char* tiles = table + (size_t)table_rows * row_bytes;
+    for (int i = 0; i < block_count; ++i) {
+        const unsigned int u = tile_dedup_read_entry(table, (size_t)i + 1);
+        if (u >= unique_count) return 0;
+        const unsigned char* src = tile_dedup_block_ptr(tiles, width, blocks_x, u);
+        unsigned char* dst = (unsigned char*)tile_dedup_block_ptr(out, width, blocks_x, shuffle_map[i]);
+        for (int y = 0; y < TILE_DEDUP_BLOCK; ++y) {
+            memcpy(dst + (size_t)y * row_bytes, src + (size_t)y * row_bytes, TILE_DEDUP_BLOCK * 4);
+        }
+    }
+
+    // 右侧条带在容器里是连续的像素，按原图每行的条带宽度切开
+    const unsigned char* strip = tiles + (size_t)((unique_count + blocks_x - 1) / blocks_x) * TILE_DEDUP_BLOCK * row_bytes;
+    const size_t strip_bytes = (size_t)(width - content_width) * 4;
+    if (strip_bytes > 0) {
+        for (int y = 0; y < content_height; ++y) {
+            memcpy(out + (size_t)y * row_bytes + (size_t)content_width * 4, strip + (size_t)y * strip_bytes, strip_bytes);
+        }
+    }
+
+    // 底部条带原样
+    const unsigned char* bottom = strip + (size_t)strip_rows * row_bytes;
+    memcpy(out + (size_t)content_height * row_bytes, bottom, (size_t)(height - content_height) * row_bytes);
+    return 1;
+}
+
+#endif // TILE_DEDUP_H